@@ -54,6 +54,42 @@
  *  (cf. irc_set_connect_timeout()) */
 #define DEF_SCTO_US 15000000ul
 
+/** \brief Default delay between parallel connection attempts in microsecs
+ *  (cf. irc_set_connect_stagger()) */
+#define DEF_CSTAGGER_US 250000ul
+
+/** \brief Default time to live of cached server addresses in microsecs
+ *  (cf. irc_set_dnscache()) */
+#define DEF_DNSTTL_US 60000000ul
+
+/** \brief Default time cached server addresses may be used past their TTL
+ *  in microsecs (cf. irc_set_dnscache()) */
+#define DEF_DNSSTALE_US 600000000ul
+
+/** \brief Default send buffer high-water mark in bytes
+ *  (cf. irc_set_sndhiwat()) */
+#define DEF_SNDHIWAT 65536
+
+/** \brief Default flood control cost per line in microsecs
+ *  (cf. irc_set_floodctl()) */
+#define DEF_SQ_LINECOST_US 2000000ul
+
+/** \brief Default flood control cost per byte in microsecs
+ *  (cf. irc_set_floodctl()) */
+#define DEF_SQ_BYTECOST_US 0ul
+
+/** \brief Default flood control burst in microsecs
+ *  (cf. irc_set_floodctl()) */
+#define DEF_SQ_BURST_US 10000000ul
+
+/** \brief Default maximum number of lines in the send queue
+ *  (cf. irc_set_sendq_limits()) */
+#define DEF_SQ_MAXLINES 16384
+
+/** \brief Default maximum number of bytes in the send queue
+ *  (cf. irc_set_sendq_limits()) */
+#define DEF_SQ_MAXBYTES 1048576
+
 /** \brief RFC1459 case mapping as per the 005 ISUPPORT spec.
  *
  * In the RFC1459 case mapping, which is the default, the characters
@@ -92,6 +128,18 @@
 /** \brief Socks5 proxy type (cf. irc_set_proxy()) */
 #define IRCPX_SOCKS5 2
 
+/** \brief Send queue lane for lines that must not wait (cf. irc_sendq()) */
+#define SENDQ_HIGH 0
+
+/** \brief Send queue lane for ordinary commands (cf. irc_sendq()) */
+#define SENDQ_NORMAL 1
+
+/** \brief Send queue lane for bulk messages (cf. irc_sendq()) */
+#define SENDQ_BULK 2
+
+/** \brief Let irc_sendq() pick the lane by looking at the command */
+#define SENDQ_AUTO (-1)
+
 /** \brief Channel mode classes as per the 005 ISUPPORT spec. (A)
  *
  * Channel modes of class A are those that add or remove an entry from a list.
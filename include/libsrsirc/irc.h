@@ -173,8 +173,11 @@ void irc_dispose(irc *ctx);
  *
  * \return true if successfully logged on, false on failure.
  *
+ * This function blocks until done; see irc_connect_start() for a way to
+ * connect without blocking.
+ *
  * \sa irc_set_server(), irc_set_pass(), irc_set_connect_timeout(),
- *     irc_logonconv()
+ *     irc_logonconv(), irc_connect_start()
  */
 bool irc_connect(irc *ctx);
 
@@ -268,10 +271,14 @@ int irc_read(irc *ctx, tokarr *tok, uint64_t to_us);
  *               If the (last or only) line does not end in \\r\\n, it will be
  *               appended.
  *
+ * The line is sent right away, unless autoflush has been turned off
+ * (see irc_set_autoflush()) or we're called from within a message handler,
+ * in which case it is sent along with whatever else is pending a bit later.
+ *
  * \return true on success, false on failure.
  *
  * In the case of failure, an implicit call to irc_reset() is performed.
- * \sa irc_printf(), irc_read(), irc_reset()
+ * \sa irc_printf(), irc_read(), irc_reset(), irc_flush()
  */
 bool irc_write(irc *ctx, const char *line);
 
@@ -280,8 +287,8 @@ bool irc_write(irc *ctx, const char *line);
  * \param ctx   IRC context as obtained by irc_init()
  * \param fmt   A printf-style format string
  *
- * After evaluating the format string and its respective arguments, irc_write()
- * is used to actually send the message.
+ * The message is formatted right into the send buffer; apart from that,
+ * this behaves like irc_write().
  *
  * \return true on success, false on failure.
  *
@@ -0,0 +1,93 @@
+/* irc_cmd.h - convenience functions for commonly client-issued commands
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_IRC_CMD_H
+#define LIBSRSIRC_IRC_CMD_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libsrsirc/defs.h>
+
+/** @file
+ * \defgroup cmdif Command interface provided by irc_cmd.h
+ *
+ * Functions for sending the commands clients send most, taking care of
+ * the protocol's limits so that the caller doesn't have to:
+ *
+ *  - Text that doesn't fit in a single message is split across as many
+ *    as needed.  Splits happen on UTF-8 character boundaries, and leave
+ *    room for the prefix (nick!user\@host) the server puts in front of the
+ *    message when relaying it, so that nothing gets truncated on the way.
+ *  - Messages for several targets are sent with as few lines as the server
+ *    lets us, i.e. with up to as many comma-separated targets per line as
+ *    its 005 TARGMAX (or MAXTARGETS) allows.  Without either, each target
+ *    gets its own line.
+ *  - Channels to join are batched into `JOIN #a,#b,#c` lines.
+ *
+ * All lines produced by a single call go out together, in one write (see
+ * irc_set_autoflush()).  They are not subject to flood control, so
+ * spreading large fan-outs over time is up to the caller (or use the
+ * send queue, see irc_sendq()).
+ *
+ * \addtogroup cmdif
+ *  @{
+ */
+
+/** \brief Send a PRIVMSG, split into several if need be
+ *
+ * \param target   Nick or channel, or a comma-separated list of those
+ * \param text   The message.  Line breaks (CR and/or LF) separate lines
+ *               which are sent as separate messages; empty lines are
+ *               skipped.
+ *
+ * \return true on success, false on failure (a target is malformed, or
+ *         sending failed, in which case an implicit call to irc_reset()
+ *         is performed)
+ */
+bool irc_privmsg(irc *ctx, const char *target, const char *text);
+
+/** \brief Like irc_privmsg(), but send a NOTICE */
+bool irc_notice(irc *ctx, const char *target, const char *text);
+
+/** \brief Send the same PRIVMSG to many targets
+ *
+ * \param targets   Array of nicks and/or channels
+ * \param ntargets   Number of elements in `targets`
+ * \param text   The message, see irc_privmsg()
+ *
+ * \return See irc_privmsg()
+ */
+bool irc_privmsg_many(irc *ctx, const char *const *targets, size_t ntargets,
+    const char *text);
+
+/** \brief Like irc_privmsg_many(), but send NOTICEs */
+bool irc_notice_many(irc *ctx, const char *const *targets, size_t ntargets,
+    const char *text);
+
+/** \brief Join a channel
+ *
+ * \param chan   The channel
+ * \param key   The channel key, or NULL if none
+ *
+ * \return See irc_privmsg()
+ */
+bool irc_join(irc *ctx, const char *chan, const char *key);
+
+/** \brief Join many channels, using as few JOIN lines as possible
+ *
+ * \param chans   Array of channels
+ * \param keys   Array of the respective keys (elements may be NULL for
+ *               channels without key), or NULL if no channel needs a key
+ * \param nchans   Number of elements in `chans` (and `keys`, if given)
+ *
+ * \return See irc_privmsg()
+ */
+bool irc_join_many(irc *ctx, const char *const *chans,
+    const char *const *keys, size_t nchans);
+
+/** @} */
+
+#endif /* LIBSRSIRC_IRC_CMD_H */
@@ -356,11 +356,247 @@ void irc_regcb_mutnick(irc *ctx, fp_mut_nick mn);
  *
  * This setting will take effect not before the next call to irc_connect().
  *
+ * All IRC contexts share a single SSL context.  The SSL session negotiated
+ * with a server is remembered (process-wide, by server hostname and port),
+ * so reconnecting to the same server resumes it rather than performing a
+ * full handshake, provided the server agrees.  irc_iostats() tells how many
+ * handshakes were resumed.
+ *
  * \return true if the request could be fulfilled. *Be sure to check this*,
  *         to avoid accidentally doing plaintext when you meant to use SSL
  */
 bool irc_set_ssl(irc *ctx, bool on);
 
+/** \brief Set the size of the receive buffer
+ *
+ * Incoming data is buffered in a ring buffer of this size (plus some extra
+ * space for a line that wraps around the end) until it has been processed.
+ * The default is 16384 bytes, which is plenty for normal operation.  A larger
+ * buffer can help irc_read_batch() get more messages out of a single read when
+ * there is a lot of input, e.g. during netsplits or when joining channels.
+ *
+ * \param sz   Receive buffer size in bytes.  Must be at least 8703 (the
+ *             maximum length of a line carrying IRCv3 message tags)
+ *
+ * Lines longer than those 8703 bytes (including the CRLF) are dropped,
+ * whatever the size of the buffer.
+ *
+ * This can not be changed while we're connected.
+ *
+ * \return true if the buffer was resized, false on failure (we're online,
+ *         `sz` is too small, or the allocation failed)
+ */
+bool irc_set_rcvbuf_size(irc *ctx, size_t sz);
+
+/** \brief Configure flood control for the send queue
+ *
+ * Most ircds keep a "message timer" per client (cf. RFC 1459, section
+ * 8.10): every line received advances it by some penalty, it is never
+ * behind the current time, and once it is too far ahead, the client is
+ * either throttled or disconnected.  The send queue (see irc_sendq())
+ * keeps its own such timer, and only sends when the server's can't be
+ * too far ahead.
+ *
+ * The defaults model the RFC: two seconds per line, with a ten second
+ * burst (i.e. a handful of lines go out at once, then one every two
+ * seconds).  Networks that also penalize long lines (ircu does so at one
+ * second per 120 bytes or so) can be matched by setting `bytecost_us`.
+ *
+ * \param linecost_us   Penalty per line, in microseconds
+ *                      (default: #DEF_SQ_LINECOST_US)
+ * \param bytecost_us   Additional penalty per byte, in microseconds
+ *                      (default: #DEF_SQ_BYTECOST_US)
+ * \param burst_us   How far ahead of the current time the timer may run
+ *                   (default: #DEF_SQ_BURST_US)
+ *
+ * This setting takes effect immediately.
+ */
+void irc_set_floodctl(irc *ctx, uint64_t linecost_us, uint64_t bytecost_us,
+    uint64_t burst_us);
+
+/** \brief Limit the size of the send queue
+ *
+ * Once either limit is reached, irc_sendq() refuses further lines until
+ * enough have been sent.  Producers that may outpace the server (think
+ * piping a large file through icat) should check irc_sendq_full() and stop
+ * producing for a while, rather than letting the queue grow without bounds.
+ *
+ * \param maxlines   Maximum number of lines, in all lanes together; 0 means
+ *                   no limit (default: #DEF_SQ_MAXLINES)
+ * \param maxbytes   Maximum number of bytes (not counting CRLFs), in all
+ *                   lanes together; 0 means no limit
+ *                   (default: #DEF_SQ_MAXBYTES)
+ *
+ * This setting takes effect immediately, but doesn't drop lines that are
+ * already queued.
+ */
+void irc_set_sendq_limits(irc *ctx, size_t maxlines, size_t maxbytes);
+
+/** \brief Enable or disable sending every line right away
+ *
+ * Outgoing lines go to a per-connection send buffer.  With autoflush on (the
+ * default), irc_write() and irc_printf() send the buffer right away, one
+ * system call per line.  With autoflush off, lines accumulate until
+ * irc_flush() is called, so that e.g. a mass JOIN or a PRIVMSG fan-out costs
+ * a single system call.
+ *
+ * Either way, the send buffer is flushed before we wait for input (e.g. in
+ * irc_read()), and whatever message handlers send while a batch of input
+ * is being processed goes out in one piece once the batch is done.  Should
+ * the high-water mark (see irc_set_sndhiwat()) be reached, the buffer is
+ * flushed regardless.
+ *
+ * \param on   True to send every line right away, false to hold lines back
+ *             until irc_flush()
+ *
+ * This setting takes effect immediately.
+ */
+void irc_set_autoflush(irc *ctx, bool on);
+
+/** \brief Send whatever is in the send buffer
+ *
+ * In the case of failure, an implicit call to irc_reset() is performed.
+ *
+ * With non-blocking writes on (see irc_set_nbwrite()), only as much is
+ * sent as the socket takes right away; the rest stays pending.
+ *
+ * \return true on success (including when there was nothing to send, or
+ *         not everything could be sent yet), false on failure
+ * \sa irc_set_autoflush(), irc_wantwrite()
+ */
+bool irc_flush(irc *ctx);
+
+/** \brief Never block on a full socket when sending
+ *
+ * By default, sending waits until the kernel has taken everything, which
+ * can take arbitrarily long if the ircd (or the network) doesn't keep up.
+ * With non-blocking writes on, whatever the socket can't take right away is
+ * kept in the send buffer, and it is up to the caller to call irc_flush()
+ * again once the socket is writable (see irc_wantwrite(), irc_sockfd()).
+ * The send buffer grows as needed; irc_congested() tells when it has
+ * reached the high-water mark, so that the caller can stop producing.
+ *
+ * Contexts attached to an irc_loop always use non-blocking writes, and
+ * the loop takes care of flushing (see irc_loop_add()).
+ *
+ * \param on   True to never block on writes, false to block
+ *
+ * This setting takes effect immediately.
+ */
+void irc_set_nbwrite(irc *ctx, bool on);
+
+/** \brief Set the send buffer high-water mark
+ *
+ * Once this many bytes are pending, the send buffer is flushed even if
+ * autoflush is off, and irc_congested() starts returning true.
+ *
+ * \param hiwat   High-water mark in bytes, or 0 for the default
+ *                (DEF_SNDHIWAT)
+ *
+ * This setting takes effect immediately.
+ */
+void irc_set_sndhiwat(irc *ctx, size_t hiwat);
+
+/** \brief Tell whether there is output waiting to be sent
+ *
+ * If this is true, irc_flush() should be called once irc_sockfd() is
+ * writable (with non-blocking writes on, that is; otherwise the next read
+ * will flush anyway.)
+ *
+ * \return true if the send buffer is not empty
+ */
+bool irc_wantwrite(irc *ctx);
+
+/** \brief Tell how much output is waiting to be sent
+ * \return Number of bytes in the send buffer
+ */
+size_t irc_pending_output(irc *ctx);
+
+/** \brief Tell whether the send buffer has reached its high-water mark
+ *
+ * This is the backpressure signal for non-blocking writes: while it is
+ * true, the ircd isn't keeping up and it's best to stop sending more.
+ *
+ * \return true if at least as many bytes as set by irc_set_sndhiwat()
+ *         are pending
+ */
+bool irc_congested(irc *ctx);
+
+/** \brief Queue a line to be sent as soon as flood control permits
+ *
+ * Servers disconnect clients that send too much too fast ("Excess Flood").
+ * Lines queued through this function are held back so that this doesn't
+ * happen, while still going out as fast as the server lets us.  How fast
+ * that is is configured by irc_set_floodctl().
+ *
+ * There are three lanes: #SENDQ_HIGH, #SENDQ_NORMAL and #SENDQ_BULK.  A line
+ * is only sent if there is nothing waiting in a higher priority lane, so
+ * e.g. a PONG doesn't have to wait behind a pile of PRIVMSGs.  Within a
+ * lane, lines go out in the order they were queued.
+ *
+ * If the context is attached to an irc_loop, the loop sends queued lines
+ * when they're due, by itself.  Otherwise, call irc_sendq_run() when
+ * irc_sendq_next() says so.  Either way, lines that are due right away are
+ * sent before this function returns.
+ *
+ * The queue is kept across reconnects (but not the flood control state,
+ * since a new server doesn't know about what we sent to the old one).
+ * Lines written with irc_write() or irc_printf() bypass the queue.
+ *
+ * \param line   The line to send (a trailing CRLF is optional)
+ * \param prio   The lane to use, or #SENDQ_AUTO to put PING, PONG and QUIT
+ *               in #SENDQ_HIGH, PRIVMSG and NOTICE in #SENDQ_BULK, and
+ *               everything else in #SENDQ_NORMAL
+ *
+ * \return true on success, false on failure (the queue is full, allocation
+ *         failed, or sending what was due failed, in which case an
+ *         implicit call to irc_reset() is performed)
+ * \sa irc_set_sendq_limits(), irc_sendq_full()
+ */
+bool irc_sendq(irc *ctx, const char *line, int prio);
+
+/** \brief Like irc_sendq(), but printf-style
+ *
+ * Lines must be shorter than 1KiB; longer ones are not queued (and false
+ * is returned) */
+bool irc_sendq_printf(irc *ctx, int prio, const char *fmt, ...);
+
+/** \brief Send whatever flood control permits from the send queue
+ *
+ * Nothing is sent while we're offline, nor while irc_congested() says so.
+ *
+ * \return Number of lines sent, or -1 on failure (in which case an implicit
+ *         call to irc_reset() is performed)
+ * \sa irc_sendq()
+ */
+int irc_sendq_run(irc *ctx);
+
+/** \brief Tell when irc_sendq_run() next has something to do
+ *
+ * \return Microseconds until the next line may be sent, 1 if one may be
+ *         sent right away, or 0 if the send queue is empty
+ * \sa irc_sendq()
+ */
+uint64_t irc_sendq_next(irc *ctx);
+
+/** \brief Tell how many lines are in the send queue (all lanes together) */
+size_t irc_sendq_len(irc *ctx);
+
+/** \brief Tell how many bytes (not counting CRLFs) are in the send queue */
+size_t irc_sendq_bytes(irc *ctx);
+
+/** \brief Tell whether the send queue is (nearly) full
+ *
+ * \return true if the line limit has been reached, or if a line of 1KiB
+ *         (which is what irc_sendq_printf() produces at most) wouldn't fit
+ *         anymore; false otherwise
+ * \sa irc_set_sendq_limits()
+ */
+bool irc_sendq_full(irc *ctx);
+
+/** \brief Drop everything in the send queue */
+void irc_sendq_clear(irc *ctx);
+
 /** \brief Set timeout(s) for irc_connect()
  *
  * Connecting to an IRC server might involve trying a bunch of addresses, since
@@ -397,6 +633,29 @@ bool irc_set_ssl(irc *ctx, bool on);
  */
 void irc_set_connect_timeout(irc *ctx, uint64_t soft, uint64_t hard);
 
+/** \brief Set the delay between parallel connection attempts
+ *
+ * If our server hostname resolved to more than one address, we don't wait
+ * for the first address to fail (or to hit the soft timeout, see
+ * irc_set_connect_timeout()) before trying the next one.  Instead, once
+ * `us` microseconds have passed without the first connection attempt
+ * succeeding, an attempt on the next address is started while the first
+ * one keeps going, and so forth ("Happy Eyeballs", RFC 8305).  Whichever
+ * connects first is used, the others are abandoned.  The addresses are
+ * ordered such that IPv6 and IPv4 alternate.
+ *
+ * An attempt that fails outright makes us start the next one immediately.
+ * Each attempt is still subject to the soft timeout, and the whole thing
+ * to the hard timeout.
+ *
+ * The setting takes effect on the next call to irc_connect() or
+ * irc_connect_start().
+ *
+ * \param us   Delay in microseconds (default: #DEF_CSTAGGER_US), or 0 to
+ *             try one address after the other, as in older versions
+ */
+void irc_set_connect_stagger(irc *ctx, uint64_t us);
+
 /** \brief Set proxy server to use
  *
  * libsrsirc supports redirecting the IRC connection through a proxy server.
@@ -472,11 +731,12 @@ bool irc_set_service_info(irc *ctx, const char *info);
  * When tracking is enabled, the functions in the tracking interface
  * (irc_track.h) are available to query information about channels and users.
  *
- * Note that tracking currently depends on the presence of a 005 ISUPPORT
- * message. If irc_set_track() was used *before* connecting, tracking will
- * be activated as soon as an 005 message (with a CASEMAPPING attribute) is
- * encountered. irc_tracking_enab() can be used to tell whether tracking
- * is actually active.
+ * If irc_set_track() was used *before* connecting, tracking is activated
+ * right when connecting, assuming RFC1459 case mapping.  Should the server
+ * announce a different one (005 CASEMAPPING), what has been tracked so far
+ * is converted, so nothing seen during logon (such as the channels joined
+ * right after) is lost.  irc_tracking_enab() can be used to tell whether
+ * tracking is actually active.
  *
  * \param on   True to enable tracking, false to disable
  *
@@ -545,6 +805,26 @@ const char *irc_get_nick(irc *ctx);
  */
 bool irc_get_ssl(irc *ctx);
 
+/** \brief Tell the size of the receive buffer
+ * \return The receive buffer size in bytes (see irc_set_rcvbuf_size())
+ */
+size_t irc_get_rcvbuf_size(irc *ctx);
+
+/** \brief Tell whether every line is sent right away
+ * \return The value set by irc_set_autoflush()
+ */
+bool irc_get_autoflush(irc *ctx);
+
+/** \brief Tell whether sending never blocks
+ * \return The value set by irc_set_nbwrite()
+ */
+bool irc_get_nbwrite(irc *ctx);
+
+/** \brief Tell the send buffer high-water mark
+ * \return The high-water mark in bytes (see irc_set_sndhiwat())
+ */
+size_t irc_get_sndhiwat(irc *ctx);
+
 /** \brief Tell whether we'll next connect as a service
  * \return The value set by irc_set_service_connect()
  */
@@ -568,11 +848,9 @@ const char *irc_get_service_info(irc *ctx);
 
 /** \brief Tell if channel- and user tracking is active.
  *
- * Tracking currently depends on 005 CASEMAPPING and will not be enabled until
- * such a message is seen (which fortunately tends to be one of the first few
- * messages received).  As soon as 005 CASEMAPPING is seen, this function will
- * start returning true to reflect that, provided that tracking was set to be
- * used by irc_set_track() *before* calling irc_connect().
+ * This returns true from the time of connecting, provided that tracking was
+ * set to be used by irc_set_track() *before* calling irc_connect() (and
+ * we didn't run out of memory).
  * \return True if tracking is enabled and active
  */
 bool irc_tracking_enab(irc *ctx); //tell if tracking is (actually) enabled
@@ -616,6 +894,291 @@ bool irc_get_dumb(irc *ctx);
  */
 bool irc_reg_msghnd(irc *ctx, const char *cmd, uhnd_fn hndfn, bool pre);
 
+/** \brief Only hand out protocol messages with certain commands
+ *
+ * Clients that care about a few commands only (say, PRIVMSG and a handful
+ * of numerics) would otherwise have every message field-split and handed
+ * to them, just to throw most of them away.  With a receive filter,
+ * irc_read() and irc_read_batch() (and thus irc_loop) only return messages
+ * whose command is in `cmds`.  Everything else is dropped right as it is
+ * read, before even being field-split, unless libsrsirc itself (or a
+ * handler registered with irc_reg_msghnd()) has an interest in it.  Such
+ * messages are still processed as usual, they're just not returned.
+ *
+ * Commands are matched exactly (i.e. case-sensitively), as they come from
+ * the server.  The filter does not apply while logging on (see
+ * irc_regcb_conread() for that).  Note that replying to PINGs is up to the
+ * user once we're logged on, so "PING" will usually be among `cmds`.
+ *
+ * \param cmds   Array of commands to return, e.g. "PRIVMSG" or "001", or
+ *               NULL to remove the filter (which is the default)
+ * \param ncmds   Number of elements in `cmds`
+ *
+ * \return true on success, false on failure (a command was empty or longer
+ *         than 31 characters, or memory allocation failed), in which case
+ *         the previous filter remains in effect
+ * \sa irc_iostats()
+ */
+bool irc_set_recv_filter(irc *ctx, const char *const *cmds, size_t ncmds);
+
+/** \brief Start connecting and logging on to IRC, without blocking
+ *
+ * This does what irc_connect() does, but in steps, so that many connection
+ * attempts can be in progress at the same time (or other work can be done
+ * in the meantime).  After this function has returned 0, use
+ * irc_connect_fds() to find out what to wait for, then call
+ * irc_connect_step() and repeat until that doesn't return 0 anymore.
+ *
+ * Usage example:
+ * \code
+ *   int r = irc_connect_start(ctx);
+ *   while (r == 0) {
+ *       int fd;
+ *       bool wantwr;
+ *       uint64_t to_us;
+ *       if (irc_connect_fds(ctx, &fd, 1, &wantwr, &to_us) == 1) {
+ *           // ... poll() `fd` for POLLOUT if `wantwr`, else for POLLIN,
+ *           // for at most `to_us` microseconds (0 meaning no limit)
+ *       }
+ *       r = irc_connect_step(ctx);
+ *   }
+ *   // r is 1 if we're logged on, -1 if it didn't work out
+ * \endcode
+ *
+ * Resolving the server's hostname (if it isn't an IP address to begin with)
+ * is still done synchronously by this function, and so is the SSL handshake
+ * when STARTTLS is used (see irc_set_starttls()).
+ *
+ * \param ctx   IRC context as obtained by irc_init()
+ *
+ * \return 1 if logged on (already), 0 if in progress, -1 on failure.
+ *
+ * \sa irc_connect(), irc_connect_step(), irc_connect_fds()
+ */
+int irc_connect_start(irc *ctx);
+
+/** \brief Continue a connection attempt started by irc_connect_start()
+ *
+ * Does whatever can be done without blocking, then returns.  Call this
+ * whenever one of the fds reported by irc_connect_fds() becomes ready, or
+ * when the time limit reported by irc_connect_fds() has passed (calling it
+ * more often than that does no harm).  Timeouts (see
+ * irc_set_connect_timeout()) are enforced here.
+ *
+ * In the case of failure, an implicit call to irc_reset() is performed.
+ * irc_reset() can also be used to abort a connection attempt in progress.
+ *
+ * \return 1 if logged on, 0 if still in progress, -1 on failure.
+ */
+int irc_connect_step(irc *ctx);
+
+/** \brief Tell what a connection attempt in progress is waiting for
+ *
+ * \param fds   Array which will be filled with the file descriptors that
+ *              are to be waited for
+ * \param fdsz   Number of elements in `fds`
+ * \param wantwr   Will be set to true if the fds are to be waited for to
+ *                become writable, false if readable
+ * \param to_us   Will be set to the time (in microseconds) after which
+ *               irc_connect_step() should be called even if none of the fds
+ *               have become ready; 0 means no limit
+ *
+ * While parallel connection attempts are in progress (see
+ * irc_set_connect_stagger()), there can be up to 8 fds; any of them
+ * becoming ready is reason to call irc_connect_step().
+ *
+ * \return The number of fds stored in `fds`; 0 if no connection attempt is
+ *         in progress.
+ */
+size_t irc_connect_fds(irc *ctx, int *fds, size_t fdsz, bool *wantwr,
+    uint64_t *to_us);
+
+/** \brief Read and process all protocol messages that are readily available
+ *
+ * This is like irc_read(), except that it doesn't stop after the first
+ * message.  After (at most) one round of actually reading from the server,
+ * every complete message that ended up in the receive buffer is field-split
+ * and processed, up to a maximum of `max` messages.  This saves a lot of
+ * overhead when there is a lot of input, e.g. during a netsplit or when
+ * joining big channels.
+ *
+ * Usage example:
+ * \code
+ *   tokarr msgs[32];
+ *
+ *   int r = irc_read_batch(ctx, msgs, 32, 1000000); // 1 second timeout
+ *
+ *   for (int i = 0; i < r; i++)
+ *       if (strcmp(msgs[i][1], "PING") == 0)
+ *           irc_printf(ctx, "PONG %s", msgs[i][2]);
+ * \endcode
+ *
+ * \param ctx   IRC context as obtained by irc_init()
+ * \param toks   Array of (at least) `max` tokarrs, populated as in irc_read()
+ * \param max   Maximum number of messages to read.  Values larger than 64
+ *              are silently capped to 64.
+ * \param to_us   Read timeout in microseconds, as in irc_read()
+ *
+ * \return Number of messages read (>0); 0 on timeout; -1 on failure.
+ *
+ * The data pointed to by the elements of `toks` is valid until the next call
+ * to this function or to irc_read() is made.  Message handlers (see
+ * irc_reg_msghnd()) are called in order for each message, just like with
+ * irc_read(); afterwards, irc_v3tag() and friends refer to the last message.
+ *
+ * In the case of failure, an implicit call to irc_reset() is performed.
+ *
+ * \sa irc_read()
+ */
+int irc_read_batch(irc *ctx, tokarr *toks, size_t max, uint64_t to_us);
+
+/** \brief I/O statistics, as obtained by irc_iostats() */
+struct irc_iostats {
+	uint64_t nmsgs; /**< \brief Protocol messages read */
+	uint64_t nfiltered; /**< \brief Messages dropped unparsed by receive
+	                     *   filters (see irc_set_recv_filter()); these are
+	                     *   not included in `nmsgs` */
+	uint64_t nread; /**< \brief read()-type calls (including SSL_read()) */
+	uint64_t nreadwb; /**< \brief ...of those, how many found nothing */
+	uint64_t nselect; /**< \brief select()/poll()-type calls */
+	uint64_t nwrite; /**< \brief send()-type calls (incl. SSL_write()) */
+	uint64_t nsslhs; /**< \brief Completed SSL handshakes */
+	uint64_t nsslres; /**< \brief ...of those, how many resumed a session */
+};
+
+/** \brief Obtain I/O statistics
+ *
+ * The counters are process-wide, i.e. cover all IRC contexts.  They are
+ * mainly useful to verify that the number of system calls per message
+ * stays low when there is a lot of input (see also irc_read_batch()).
+ *
+ * \param dest   Pointer to a struct irc_iostats to fill in, or NULL
+ * \param reset   If true, reset all counters to zero afterwards
+ */
+void irc_iostats(struct irc_iostats *dest, bool reset);
+
+/** \brief Number of buckets in a struct irc_hist */
+#define IRC_HIST_NBUCKETS 32
+
+/** \brief Latency histogram with logarithmic buckets
+ *
+ * bucket[0] counts what took 0 or 1 ns, bucket[i] (for i > 0) what took
+ * at least 2^i but less than 2^(i+1) ns.  The last bucket also counts
+ * anything longer than that.
+ */
+struct irc_hist {
+	uint64_t count; /**< \brief Number of samples */
+	uint64_t total_ns; /**< \brief Sum of all samples */
+	uint64_t max_ns; /**< \brief Largest sample */
+	uint64_t bucket[IRC_HIST_NBUCKETS]; /**< \brief See above */
+};
+
+/** \brief Dispatch statistics entry, as obtained by irc_stats() */
+struct irc_statent {
+	char cmd[32]; /**< \brief Protocol command, e.g. "PRIVMSG" or "353";
+	               *   "*" for all of those there are no handlers for */
+	char who[16]; /**< \brief What was timed: "" for the processing of the
+	               *   message as a whole, the module ("core", "track",
+	               *   "v3") for libsrsirc's own handlers, or "pre" or
+	               *   "post" for handlers registered with irc_reg_msghnd() */
+	int slot; /**< \brief For "pre" and "post", which of those handlers (0
+	           *   for the first one registered, and so on); else -1 */
+	struct irc_hist hist; /**< \brief Time taken */
+};
+
+/** \brief Turn collecting message dispatch statistics on or off
+ *
+ * When on, every message we process (including those read while logging
+ * on) is counted and timed, per command, and so is every handler it is
+ * dispatched to, be it one of libsrsirc's own or one registered with
+ * irc_reg_msghnd().  This tells which handler is to blame when, say, a
+ * netsplit makes latency spike.  See irc_stats() and irc_dump() for the
+ * results.
+ *
+ * This costs two clock readings per handler call, so it is off by default;
+ * moreover, it is only available if libsrsirc was configured with
+ * --enable-dispstats.  Otherwise, dispatch isn't slowed down at all.
+ *
+ * \param on   true to start collecting, false to stop.  What has been
+ *             collected is kept either way (see irc_stats() for resetting)
+ *
+ * \return true on success, false if turning it on failed (built without
+ *         --enable-dispstats, or memory allocation failed)
+ */
+bool irc_set_stats(irc *ctx, bool on);
+
+/** \brief Obtain message dispatch statistics
+ *
+ * \param dest   Array to put (up to `destsz`) entries in, biggest total
+ *               time first.  May be NULL if `destsz` is 0
+ * \param destsz   Number of elements in `dest`
+ * \param reset   If true, zero all histograms afterwards
+ *
+ * \return The number of entries there are (which may be more than
+ *         `destsz`); 0 if nothing has been collected
+ * \sa irc_set_stats()
+ */
+size_t irc_stats(irc *ctx, struct irc_statent *dest, size_t destsz,
+    bool reset);
+
+/** \brief Configure the cache of resolved server addresses
+ *
+ * Resolving the server hostname is the one part of irc_connect_start() that
+ * blocks, and when a server drops many of our connections at once, they'd
+ * all look up the same name again.  Hence, the addresses are cached
+ * process-wide, keyed by host and port, and shared by all IRC contexts.
+ *
+ * For `ttl_us` microseconds after a lookup, its result is used as is.  For
+ * another `stale_us` microseconds, it is still used, but flagged to be
+ * refreshed in the background ("stale-while-revalidate"): an irc_loop (see
+ * irc_loop_step()) does that when it's otherwise idle; applications with
+ * their own event loop can call irc_dnscache_revalidate().  If the refresh
+ * fails, the stale addresses remain in use until `stale_us` is over, too.
+ * Past that, the next connection attempt waits for the resolver.
+ *
+ * \param ttl_us   Time to live in microseconds (default: #DEF_DNSTTL_US);
+ *                 0 disables (and empties) the cache
+ * \param stale_us   Stale window in microseconds (default:
+ *                   #DEF_DNSSTALE_US); 0 means no stale entries are used
+ */
+void irc_set_dnscache(uint64_t ttl_us, uint64_t stale_us);
+
+/** \brief Empty the cache of resolved server addresses
+ *
+ * Useful if the application knows that the DNS has changed.
+ * \sa irc_set_dnscache()
+ */
+void irc_dnscache_flush(void);
+
+/** \brief Refresh one stale entry of the address cache
+ *
+ * Looks up (at most) one hostname whose cached addresses have been used
+ * after their TTL ran out.  This blocks for as long as the resolver takes,
+ * so call it when there is nothing else to do.
+ *
+ * \return true if something was refreshed (there may be more),
+ *         false if there was nothing to do.
+ * \sa irc_set_dnscache()
+ */
+bool irc_dnscache_revalidate(void);
+
+/** \brief Address cache statistics, as obtained by irc_dnsstats() */
+struct irc_dnsstats {
+	uint64_t nhit; /**< \brief Lookups answered from a fresh entry */
+	uint64_t nstale; /**< \brief Lookups answered from a stale entry */
+	uint64_t nmiss; /**< \brief Lookups that had to wait for the resolver */
+	uint64_t nresolv; /**< \brief Resolver calls, incl. refreshing */
+	uint64_t nfail; /**< \brief ...of those, how many failed */
+};
+
+/** \brief Obtain address cache statistics
+ *
+ * \param dest   Pointer to a struct irc_dnsstats to fill in, or NULL
+ * \param reset   If true, reset all counters to zero afterwards
+ * \sa irc_set_dnscache()
+ */
+void irc_dnsstats(struct irc_dnsstats *dest, bool reset);
+
 /** \brief Tell whether the connection was closed gracefully
  *
  * If we were disconnected, this function can be used to tell whether the
@@ -0,0 +1,180 @@
+/* irc_loop.h - drive many IRC contexts from a single event loop
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_IRC_LOOP_H
+#define LIBSRSIRC_IRC_LOOP_H 1
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libsrsirc/defs.h>
+
+/** @file
+ * \defgroup loopif Event loop interface provided by irc_loop.h
+ *
+ * Instead of calling irc_read() on every IRC context in turn, any number of
+ * (connected) contexts can be attached to an event loop, which waits for
+ * input on all of them at once (using epoll where available) and processes
+ * whatever arrives.  Incoming messages are dispatched to the handlers
+ * registered through irc_reg_msghnd(), and to the loop's message callback,
+ * if any.  Timers can be set up to get called back at a later point in time.
+ *
+ * Usage example:
+ * \code
+ *   static bool
+ *   handle_PING(irc *ctx, tokarr *msg, size_t nargs, bool pre)
+ *   {
+ *       return irc_printf(ctx, "PONG :%s", (*msg)[2]);
+ *   }
+ *
+ *   // ...
+ *   irc_loop *loop = irc_loop_init();
+ *
+ *   for (size_t i = 0; i < nbots; i++) {
+ *       irc_reg_msghnd(bots[i], "PING", handle_PING, true);
+ *       if (irc_connect(bots[i]))
+ *           irc_loop_add(loop, bots[i], NULL);
+ *   }
+ *
+ *   irc_loop_run(loop); // Returns once all bots are disconnected
+ *   irc_loop_dispose(loop);
+ * \endcode
+ *
+ * \addtogroup loopif
+ *  @{
+ */
+
+/** \brief Event loop handle type, as obtained by irc_loop_init() */
+typedef struct irc_loop_s irc_loop;
+
+/** \brief Callback for incoming messages
+ *
+ * Called for every message read on any attached context, after the handlers
+ * registered through irc_reg_msghnd() have been run.
+ *
+ * \param loop   The loop
+ * \param ctx   The context the message was read on
+ * \param msg   The message, see irc_read()
+ * \param tag   The tag given to irc_loop_add() for `ctx`
+ */
+typedef void (*irc_loop_msg_fn)(irc_loop *loop, irc *ctx, tokarr *msg,
+    void *tag);
+
+/** \brief Callback for lost connections
+ *
+ * Called when an attached context is found to be disconnected.  At this
+ * point, the context has already been detached from the loop, so it is okay
+ * to irc_connect() it again and re-attach it, or to irc_dispose() it.
+ *
+ * \param loop   The loop
+ * \param ctx   The context which lost its connection
+ * \param tag   The tag given to irc_loop_add() for `ctx`
+ */
+typedef void (*irc_loop_disc_fn)(irc_loop *loop, irc *ctx, void *tag);
+
+/** \brief Timer callback
+ *
+ * \param loop   The loop
+ * \param ctx   The context the timer was set up for, or NULL
+ * \param tag   The tag given to irc_loop_timer()
+ */
+typedef void (*irc_loop_tmr_fn)(irc_loop *loop, irc *ctx, void *tag);
+
+/** \brief Allocate and initialize a new event loop
+ *
+ * \return A new loop handle, or NULL on failure (allocation failed)
+ */
+irc_loop *irc_loop_init(void);
+
+/** \brief Dispose of an event loop
+ *
+ * Any contexts that are still attached are detached (but not disconnected
+ * nor disposed of), and pending timers are dropped.
+ */
+void irc_loop_dispose(irc_loop *loop);
+
+/** \brief Attach an IRC context to a loop
+ *
+ * The context must be connected (i.e. irc_connect() has succeeded), and may
+ * only be attached to one loop at a time.  Do not call irc_read() on it
+ * while it is attached.  irc_reset() (and hence irc_connect()) as well as
+ * irc_dispose() detach the context automatically, without invoking the
+ * disconnect callback.
+ *
+ * While attached, the context uses non-blocking writes (see
+ * irc_set_nbwrite()); output the socket can't take right away is sent by
+ * the loop once it becomes writable.  The previous setting is restored
+ * upon detaching.
+ *
+ * \param tag   Arbitrary pointer handed back to the callbacks
+ *
+ * \return true on success, false on failure
+ */
+bool irc_loop_add(irc_loop *loop, irc *ctx, void *tag);
+
+/** \brief Detach an IRC context from a loop
+ *
+ * Pending timers for this context are dropped.  This may be called from
+ * within callbacks and message handlers, even for the context being served.
+ *
+ * \return true on success, false if `ctx` wasn't attached to `loop`
+ */
+bool irc_loop_del(irc_loop *loop, irc *ctx);
+
+/** \brief Tell how many contexts are attached to a loop */
+size_t irc_loop_count(irc_loop *loop);
+
+/** \brief Set up a one-shot timer
+ *
+ * \param ctx   Context to associate the timer with (it will be dropped when
+ *              the context is detached), or NULL for a loop-wide timer
+ * \param in_us   Microseconds from now on until the timer fires
+ * \param fn   Function to call when the timer fires
+ * \param tag   Arbitrary pointer handed back to `fn`
+ *
+ * \return true on success, false on failure (`ctx` isn't attached to `loop`,
+ *         or allocation failed)
+ */
+bool irc_loop_timer(irc_loop *loop, irc *ctx, uint64_t in_us,
+    irc_loop_tmr_fn fn, void *tag);
+
+/** \brief Register a callback for incoming messages (NULL to unregister) */
+void irc_loop_regcb_msg(irc_loop *loop, irc_loop_msg_fn cb);
+
+/** \brief Register a callback for lost connections (NULL to unregister) */
+void irc_loop_regcb_disc(irc_loop *loop, irc_loop_disc_fn cb);
+
+/** \brief Wait for and process input and timers, once
+ *
+ * Waits until there is input on at least one attached context, a timer is
+ * due, or `to_us` microseconds have passed, then processes the input and
+ * fires the timers that are due.
+ *
+ * \param to_us   Maximum time to wait; 0 means no limit, 1 means don't wait
+ *
+ * \return Number of contexts served plus number of timers fired, or -1 on
+ *         failure.
+ */
+int irc_loop_step(irc_loop *loop, uint64_t to_us);
+
+/** \brief Run the loop
+ *
+ * Calls irc_loop_step() over and over again until irc_loop_stop() is called,
+ * or until there are neither attached contexts nor timers left.
+ *
+ * \return true if stopped by irc_loop_stop() or when running out of things
+ *         to do; false on failure
+ */
+bool irc_loop_run(irc_loop *loop);
+
+/** \brief Make irc_loop_run() return after the current step
+ *
+ * This is meant to be called from within callbacks or message handlers.
+ */
+void irc_loop_stop(irc_loop *loop);
+
+/** @} */
+
+#endif /* LIBSRSIRC_IRC_LOOP_H */
@@ -0,0 +1,134 @@
+/* irc_msgb.h - build outgoing protocol messages piece by piece
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_IRC_MSGB_H
+#define LIBSRSIRC_IRC_MSGB_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libsrsirc/defs.h>
+
+/** @file
+ * \defgroup msgbif Message builder interface provided by irc_msgb.h
+ *
+ * An alternative to irc_printf() for sending protocol messages.  Instead of
+ * formatting a line into a temporary buffer which is then copied into the
+ * send buffer, the builder appends the parts of a message (IRCv3 client
+ * tags, command, parameters, trailing parameter) right to the send buffer
+ * of the context, without allocating anything.
+ *
+ * Every part is checked as it is added: tag values are escaped as IRCv3
+ * requires, parameters must not contain spaces (nor start with a colon),
+ * nothing may contain CR or LF, and the message (excluding tags) must fit
+ * in the 512 bytes (including CRLF) RFC 1459 allows for.  If a part is
+ * rejected, the builder remembers that, ignores the remaining parts and
+ * irc_msgb_send() drops the message rather than sending something broken.
+ *
+ * Usage example:
+ * \code
+ *   irc_msgb *mb = irc_msgb_start(ctx);
+ *   irc_msgb_tag(mb, "+draft/reply", msgid);
+ *   irc_msgb_cmd(mb, "PRIVMSG");
+ *   irc_msgb_param(mb, "#chan");
+ *   irc_msgb_trail(mb, text);
+ *   if (!irc_msgb_send(mb))
+ *       // text was too long, contained a newline, or we lost the connection
+ * \endcode
+ *
+ * Each context has a single builder; irc_msgb_start() hands out the same
+ * one every time.  Between irc_msgb_start() and irc_msgb_send() (or
+ * irc_msgb_abort()), nothing else must be written to the context (be it by
+ * irc_write(), irc_printf(), irc_flush() or irc_sendq()) and, if it is
+ * attached to an irc_loop, the loop must not be stepped.
+ *
+ * \addtogroup msgbif
+ *  @{
+ */
+
+/** \brief Message builder handle type, as obtained by irc_msgb_start() */
+typedef struct irc_msgb_s irc_msgb;
+
+/** \brief Begin building a message
+ *
+ * If a message was being built already (and neither sent nor aborted), it
+ * is dropped.
+ *
+ * \return The context's message builder, or NULL if we're offline
+ */
+irc_msgb *irc_msgb_start(irc *ctx);
+
+/** \brief Add an IRCv3 client tag
+ *
+ * Tags must be added before the command.  The value is escaped as per the
+ * IRCv3 message-tags specification.  All tags together (including the
+ * leading '@' and the space after them) may not exceed 4094 bytes.
+ *
+ * \param key   Tag name, possibly with the client-only '+' prefix and a
+ *              vendor, e.g. "+example.com/foo"
+ * \param val   Unescaped tag value, or NULL for a tag without value
+ *
+ * \return true on success, false if the tag was rejected (or a previous
+ *         part was)
+ */
+bool irc_msgb_tag(irc_msgb *mb, const char *key, const char *val);
+
+/** \brief Set the command
+ *
+ * \param cmd   A command (letters only) or a three-digit numeric
+ *
+ * \return true on success, false if the command was rejected (or a previous
+ *         part was)
+ */
+bool irc_msgb_cmd(irc_msgb *mb, const char *cmd);
+
+/** \brief Add a (middle) parameter
+ *
+ * There may be up to 15 parameters (including the trailing one).
+ *
+ * \param p   The parameter; must be non-empty, not begin with ':', and not
+ *            contain spaces
+ *
+ * \return true on success, false if the parameter was rejected (or a
+ *         previous part was)
+ */
+bool irc_msgb_param(irc_msgb *mb, const char *p);
+
+/** \brief Add the trailing parameter
+ *
+ * This must be the last part of the message; it is always sent with a
+ * leading colon, so it may be empty and contain spaces.
+ *
+ * \return true on success, false if the parameter was rejected (or a
+ *         previous part was)
+ */
+bool irc_msgb_trail(irc_msgb *mb, const char *t);
+
+/** \brief Like irc_msgb_trail(), but with an explicit length
+ *
+ * \param t   The parameter; need not be '\0'-terminated
+ * \param len   Number of bytes to take from `t`
+ */
+bool irc_msgb_trailn(irc_msgb *mb, const char *t, size_t len);
+
+/** \brief Finish the message and send it
+ *
+ * The message goes to the send buffer like one written with irc_write()
+ * would, i.e. it's sent right away unless autoflush is off (see
+ * irc_set_autoflush()).  If any part was rejected, or no command was set,
+ * nothing is sent.
+ *
+ * \return true on success, false on failure.  Failure to send also performs
+ *         an implicit irc_reset(); if the message was merely rejected,
+ *         the connection is left alone.
+ */
+bool irc_msgb_send(irc_msgb *mb);
+
+/** \brief Drop the message being built */
+void irc_msgb_abort(irc_msgb *mb);
+
+/** @} */
+
+#endif /* LIBSRSIRC_IRC_MSGB_H */
@@ -0,0 +1,129 @@
+/* irc_msgv.h - lazily tokenized view of a protocol message
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_IRC_MSGV_H
+#define LIBSRSIRC_IRC_MSGV_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libsrsirc/defs.h>
+
+/** @file
+ * \defgroup msgvif Lazy message view interface provided by irc_msgv.h
+ *
+ * An alternative to the eagerly tokenized ::tokarr for reading protocol
+ * messages.  Parsing a line into a view only locates the IRCv3 tags, the
+ * prefix and the command; the arguments are split off one by one as they
+ * are asked for.  A client that looks at the command of every message but
+ * at the arguments of only a few (say, a bot that only cares about
+ * PRIVMSGs addressed to it) thus never pays for splitting the rest.
+ *
+ * Like a ::tokarr, the view does not copy anything; it points into the
+ * line it was made from, which it modifies in place (token delimiters are
+ * overwritten with '\0').  The line must stay around for as long as the
+ * view is used.
+ *
+ * Usage example:
+ * \code
+ *   irc_msgv mv;
+ *   while (irc_read_msgv(ctx, &mv, 0) > 0) {
+ *       if (strcmp(irc_msgv_cmd(&mv), "PRIVMSG") != 0)
+ *           continue; // no argument got split
+ *       const char *tgt = irc_msgv_arg(&mv, 0);
+ *       const char *txt = irc_msgv_arg(&mv, 1);
+ *       ...
+ *   }
+ * \endcode
+ *
+ * Code written against ::tokarr can get one out of a view by means of
+ * irc_msgv_tokarr().
+ *
+ * \addtogroup msgvif
+ *  @{
+ */
+
+/** \brief Lazily tokenized message.  The members are private, use the
+ * accessor functions below */
+typedef struct irc_msgv {
+	tokarr tok;   /* prefix, command and the arguments split so far */
+	char *tags;   /* raw IRCv3 tags, or NULL */
+	char *rest;   /* what is left to split, or NULL */
+	size_t nargs; /* number of arguments split so far */
+	bool done;    /* everything split, `tok' is NULL-terminated */
+} irc_msgv;
+
+/** \brief Make a view of a protocol message
+ *
+ * Only the tags, prefix and command are located; nothing else is looked
+ * at yet.
+ *
+ * \param mv    The view to initialize
+ * \param line  A '\0'-terminated protocol message without line delimiter,
+ *              possibly starting with IRCv3 tags.  It is modified in
+ *              place and must outlive the view.
+ *
+ * \return true on success, false if `line' is not a valid message (i.e.
+ *         it is empty, starts with whitespace or lacks a command)
+ */
+bool irc_msgv_parse(irc_msgv *mv, char *line);
+
+/** \brief Get the prefix (sans leading colon) of a message, or NULL */
+const char *irc_msgv_prefix(const irc_msgv *mv);
+
+/** \brief Get the command of a message */
+const char *irc_msgv_cmd(const irc_msgv *mv);
+
+/** \brief Get the raw (i.e. still escaped) IRCv3 tags of a message
+ *
+ * The tags of a message obtained through irc_read_msgv() are not kept in
+ * the view but in the context, see irc_v3tag() and friends.
+ *
+ * \return The tags (without the leading '@'), or NULL if there are none
+ */
+const char *irc_msgv_tags(const irc_msgv *mv);
+
+/** \brief Get the `n'th argument (counting from 0) of a message
+ *
+ * Splits off arguments up to and including the `n'th, if that hasn't
+ * happened yet.  As with ::tokarr, a trailing argument has its leading
+ * colon removed, and there are at most (sizeof (tokarr)/sizeof (char *)
+ * - 2) arguments; the last one holds the remainder of the line should
+ * there be more.
+ *
+ * \return The argument, or NULL if there are fewer than `n'+1 arguments
+ */
+const char *irc_msgv_arg(irc_msgv *mv, size_t n);
+
+/** \brief Get the number of arguments of a message (splitting all of them) */
+size_t irc_msgv_nargs(irc_msgv *mv);
+
+/** \brief Get a message as ::tokarr, splitting all arguments
+ *
+ * \return A pointer to the view's ::tokarr, laid out exactly as what
+ *         irc_read() would have stored.  It is valid as long as the view.
+ */
+tokarr *irc_msgv_tokarr(irc_msgv *mv);
+
+/** \brief Read and process one protocol message, as a lazy view
+ *
+ * Works just like irc_read(), except for how the message is handed out,
+ * and for one thing: messages the library has no handler registered for
+ * (neither internal ones, nor user handlers, see irc_reg_msghnd()) are
+ * not tokenized by it at all.  Consequently, irc_colon_trail() is only
+ * updated for messages which the library needed to tokenize.
+ *
+ * \param mv    The view to initialize.  It points into the receive buffer
+ *              and is only valid until the next read from `ctx'
+ * \param to_us Timeout in microseconds, 0 for none
+ *
+ * \return 1 on success, 0 on timeout, -1 on failure (we're offline then)
+ */
+int irc_read_msgv(irc *ctx, irc_msgv *mv, uint64_t to_us);
+
+/** @} */
+
+#endif /* LIBSRSIRC_IRC_MSGV_H */
@@ -27,9 +27,15 @@
 
 #include <libsrsirc/defs.h>
 
+#include "dnscache.h"
 
-static int tryhost(struct addrlist *ai, const char *laddr, uint16_t lport,
-    char *remaddr, size_t remaddr_sz, uint16_t *peerport, uint64_t to_us);
+
+static int tryhost(struct addrlist *ai, const char *laddr, uint16_t lport);
+static struct addrlist *interleave(struct addrlist *alist);
+static void launch(struct consock *cs);
+static int reap(struct consock *cs);
+static void drop_attempt(struct consock *cs, size_t i);
+static uint64_t min_to(uint64_t a, uint64_t tend);
 
 size_t
 lsi_com_strCchr(const char *str, char c)
@@ -42,48 +48,244 @@ lsi_com_strCchr(const char *str, char c)
 }
 
 
+/* connection attempts are raced as described in RFC 8305 ("Happy Eyeballs"):
+ * the addresses are ordered so that IPv6 and IPv4 alternate, an attempt is
+ * started on the first one, and every `stagger' us (or as soon as an attempt
+ * fails) another one is started while the earlier ones keep going.  whichever
+ * socket connects first wins; the others are closed */
 int
-lsi_com_consocket(const char *host, uint16_t port, const char *laddr,
-    uint16_t lport, char *remaddr, size_t remaddr_sz, uint16_t *peerport,
-    uint64_t softto, uint64_t hardto)
+lsi_com_consocket_start(struct consock *cs, const char *host, uint16_t port,
+    const char *laddr, uint16_t lport, uint64_t softto, uint64_t hardto,
+    uint64_t stagger)
 {
-	uint64_t hardtend = hardto ? lsi_b_tstamp_us() + hardto : 0;
-
-	struct addrlist *alist;
-	int count = lsi_b_mkaddrlist(host, port, &alist);
-	if (count <= 0)
+	cs->tend = hardto ? lsi_b_tstamp_us() + hardto : 0;
+	cs->tnext = 0;
+	cs->stagger = stagger;
+	cs->nact = 0;
+	cs->sck = -1;
+	cs->laddr = laddr;
+	cs->lport = lport;
+
+	int count = lsi_dns_lookup(host, port, &cs->alist);
+	if (count <= 0) {
+		cs->alist = cs->next = NULL;
 		return -1;
+	}
 
 	if (softto && hardto && softto * count < hardto)
 		softto = hardto / count;
+	cs->softto = softto;
 
-	int sck = -1;
-	for (struct addrlist *ai = alist; ai; ai = ai->next) {
-		uint64_t trem = 0;
+	cs->next = cs->alist = interleave(cs->alist);
+	return lsi_com_consocket_step(cs);
+}
 
-		if (lsi_com_check_timeout(hardtend, &trem)) {
+int
+lsi_com_consocket_step(struct consock *cs)
+{
+	for (;;) {
+		if (lsi_com_check_timeout(cs->tend, NULL)) {
 			W("hard timeout");
-			return false;
+			break;
 		}
 
-		if (trem > softto)
-			trem = softto;
+		launch(cs);
+		if (!cs->nact) {
+			W("out of addresses to try");
+			break;
+		}
 
-		sck = tryhost(ai, laddr, lport, remaddr, remaddr_sz, peerport,
-		              trem);
+		int r = reap(cs);
+		if (r != -1)
+			return r;
 
-		if (sck != -1)
-			break;
+		/* something failed; go around to start the next attempt
+		 * right away, unless there are no more addresses */
 	}
 
-	lsi_b_freeaddrlist(alist);
+	lsi_com_consocket_abort(cs);
+	return -1;
+}
 
-	return sck;
+size_t
+lsi_com_consocket_fds(struct consock *cs, int *fds, size_t fdsz,
+    uint64_t *to_us)
+{
+	uint64_t to = min_to(0, cs->tend);
+	for (size_t i = 0; i < cs->nact; i++)
+		to = min_to(to, cs->atends[i]);
+
+	if (cs->next && cs->stagger && cs->nact < COUNTOF(cs->scks))
+		to = min_to(to, cs->tnext);
+
+	*to_us = to;
+
+	size_t n = 0;
+	for (; n < cs->nact && n < fdsz; n++)
+		fds[n] = cs->scks[n];
+
+	return n;
+}
+
+void
+lsi_com_consocket_abort(struct consock *cs)
+{
+	while (cs->nact)
+		drop_attempt(cs, cs->nact - 1);
+
+	lsi_b_freeaddrlist(cs->alist);
+	cs->alist = cs->next = NULL;
+	return;
+}
+
+/* reorder `alist' so that address families alternate, starting with the
+ * family of the first address (getaddrinfo() has already sorted the list
+ * by preference).  returns the new head */
+static struct addrlist *
+interleave(struct addrlist *alist)
+{
+	struct addrlist *heads[2] = { NULL, NULL };
+	struct addrlist **tails[2] = { &heads[0], &heads[1] };
+	bool firstv6 = alist->ipv6;
+
+	while (alist) {
+		struct addrlist *nx = alist->next;
+		int i = alist->ipv6 != firstv6;
+		alist->next = NULL;
+		*tails[i] = alist;
+		tails[i] = &alist->next;
+		alist = nx;
+	}
+
+	struct addrlist *res = NULL, **tail = &res;
+	for (int i = 0; heads[0] || heads[1]; i = !i) {
+		if (!heads[i])
+			continue;
+		*tail = heads[i];
+		tail = &heads[i]->next;
+		heads[i] = heads[i]->next;
+	}
+	*tail = NULL;
+
+	return res;
+}
+
+/* start as many new connection attempts as are due */
+static void
+launch(struct consock *cs)
+{
+	uint64_t now = lsi_b_tstamp_us();
+	while (cs->next && cs->nact < COUNTOF(cs->scks)
+	    && (!cs->nact || (cs->stagger && now >= cs->tnext))) {
+		struct addrlist *ai = cs->next;
+		cs->next = ai->next;
+
+		int sck = tryhost(ai, cs->laddr, cs->lport);
+		if (sck == -1)
+			continue;
+
+		uint64_t trem = 0;
+		lsi_com_check_timeout(cs->tend, &trem);
+		if (!trem || (cs->softto && trem > cs->softto))
+			trem = cs->softto;
+
+		cs->scks[cs->nact] = sck;
+		cs->addrs[cs->nact] = ai;
+		cs->atends[cs->nact] = trem ? now + trem : 0;
+		cs->nact++;
+		cs->tnext = now + cs->stagger;
+	}
+
+	return;
+}
+
+/* see how the attempts in progress are doing.  returns 1 if one of them has
+ * connected (which is then in `cs->sck'), 0 if they're all still pending,
+ * -1 if some have failed (or timed out) */
+static int
+reap(struct consock *cs)
+{
+	int work[COUNTOF(cs->scks)];
+	memcpy(work, cs->scks, cs->nact * sizeof *work);
+
+	bool failed = false;
+	int r = lsi_b_select(work, cs->nact, false, false, 1);
+	if (r == -1) {
+		/* we can't tell which one is at fault, drop them all */
+		while (cs->nact)
+			drop_attempt(cs, cs->nact - 1);
+		return -1;
+	}
+
+	/* go backwards so that drop_attempt() doesn't disturb us */
+	for (size_t i = cs->nact; r > 0 && i-- > 0;) {
+		if (work[i] == -1)
+			continue;
+
+		if (lsi_b_sock_ok(cs->scks[i])) {
+			D("connected to '%s' ('%s')",
+			    cs->addrs[i]->reqname, cs->addrs[i]->addrstr);
+			cs->sck = cs->scks[i];
+			cs->scks[i] = -1;
+			drop_attempt(cs, i);
+			lsi_com_consocket_abort(cs);
+			return 1;
+		}
+
+		W("could not connect to '%s'", cs->addrs[i]->addrstr);
+		drop_attempt(cs, i);
+		failed = true;
+	}
+
+	for (size_t i = cs->nact; i-- > 0;) {
+		if (!lsi_com_check_timeout(cs->atends[i], NULL))
+			continue;
+
+		W("timeout connecting to '%s'", cs->addrs[i]->addrstr);
+		drop_attempt(cs, i);
+		failed = true;
+	}
+
+	if (!failed)
+		return 0;
+
+	cs->tnext = 0;
+	return -1;
+}
+
+/* close attempt `i' (unless its socket has been taken) and forget it */
+static void
+drop_attempt(struct consock *cs, size_t i)
+{
+	if (cs->scks[i] != -1)
+		lsi_b_close(cs->scks[i]);
+
+	cs->nact--;
+	cs->scks[i] = cs->scks[cs->nact];
+	cs->addrs[i] = cs->addrs[cs->nact];
+	cs->atends[i] = cs->atends[cs->nact];
+	return;
+}
+
+/* `a' is a relative timeout (0 = none); return the smaller of that and the
+ * time remaining until the absolute deadline `tend' (0 = none).  a deadline
+ * that has passed already must not end up as 0 (which would mean `none') */
+static uint64_t
+min_to(uint64_t a, uint64_t tend)
+{
+	if (!tend)
+		return a;
+
+	uint64_t trem;
+	if (lsi_com_check_timeout(tend, &trem))
+		trem = 1;
+
+	return !a || trem < a ? trem : a;
 }
 
+/* returns a socket which is connect()ing (or has connected) to `ai', or -1 */
 static int
-tryhost(struct addrlist *ai, const char *laddr, uint16_t lport, char *remaddr,
-    size_t remaddr_sz, uint16_t *peerport, uint64_t to_us)
+tryhost(struct addrlist *ai, const char *laddr, uint16_t lport)
 {
 	D("trying host '%s' ('%s')", ai->reqname, ai->addrstr);
 	int sck = lsi_b_socket(ai->ipv6);
@@ -97,35 +299,12 @@ tryhost(struct addrlist *ai, const char *laddr, uint16_t lport, char *remaddr,
 	if (!lsi_b_blocking(sck, false))
 		W("failed to set socket non-blocking, timeout will not work");
 
-	int r = lsi_b_connect(sck, ai);
-	if (r == 1)
-		return sck;
-	else if (r == -1)
-		goto fail;
-
-	r = lsi_b_select(&sck, 1, true, false, to_us);
-
-	if (r == 1) {
-		//if (!lsi_b_blocking(sck, true))
-		//	W("failed to clear socket non-blocking mode");
-
-		if (lsi_b_sock_ok(sck)) {
-			if (remaddr && remaddr_sz)
-				lsi_b_strNcpy(remaddr, ai->addrstr, remaddr_sz);
-			if (peerport)
-				*peerport = ai->port;
-
-			return sck;
-		} else
-			W("could not connect socket");
-
+	if (lsi_b_connect(sck, ai) == -1) {
+		lsi_b_close(sck);
+		return -1;
 	}
 
-	/* fall-thru */
-fail:
-	if (sck != -1)
-		lsi_b_close(sck);
-	return -1;
+	return sck;
 }
 
 
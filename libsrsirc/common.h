@@ -11,10 +11,32 @@
 #include <stdint.h>
 
 
+struct addrlist;
+
 #define COUNTOF(ARR) (sizeof (ARR) / sizeof (ARR)[0])
 
 #define MIN(A, B) ((A) < (B) ? (A) : (B))
 
+/* maximum number of connection attempts we race against each other */
+#define MAX_CONATTEMPTS 8
+
+/* state of a connection attempt in progress (see lsi_com_consocket_*()) */
+struct consock {
+	struct addrlist *alist; // Addresses to try, in the order we try them
+	struct addrlist *next;  // Next address to start an attempt on
+	int scks[MAX_CONATTEMPTS]; // Sockets connect()ing to...
+	struct addrlist *addrs[MAX_CONATTEMPTS]; // ...these addresses,
+	uint64_t atends[MAX_CONATTEMPTS]; // ...until then (0 if no limit)
+	size_t nact;            // Number of attempts in progress
+	int sck;                // The winner, once there is one
+	const char *laddr;      // Local address to bind to, or NULL
+	uint16_t lport;         // Local port to bind to, or 0
+	uint64_t softto;        // Time each address gets at most (0: no limit)
+	uint64_t stagger;       // Delay between starting attempts (0: don't race)
+	uint64_t tnext;         // When to start the next attempt (absolute)
+	uint64_t tend;          // Overall deadline (absolute), 0 if none
+};
+
 enum hosttypes {
 	HOSTTYPE_IPV4,
 	HOSTTYPE_IPV6,
@@ -26,9 +48,47 @@ size_t lsi_com_strCchr(const char *dst, char c);
 
 bool lsi_com_check_timeout(uint64_t tend, uint64_t *trem);
 
-int lsi_com_consocket(const char *host, uint16_t port, const char *laddr,
-    uint16_t lport, char *remaddr, size_t remaddr_sz, uint16_t *peerport,
-    uint64_t softto, uint64_t hardto);
+/* lsi_com_consocket_start
+ * Resolve `host' and start connecting to the first of its addresses.  As
+ * time goes by (or if that doesn't work out), lsi_com_consocket_step() starts
+ * attempts on the other addresses.
+ *
+ * Params: `cs':     Connection attempt state to initialize
+ *         `host', `port': Where to connect to
+ *         `laddr', `lport': Local address and port to bind to (NULL/0 for
+ *                     "don't care"); `laddr' must remain valid until done
+ *         `softto': Time in us we give each address at most (0 = no limit)
+ *         `hardto': Time in us we give the whole thing (0 = no limit)
+ *         `stagger': Time in us after which we start connecting to the next
+ *                     address while still waiting for the previous one(s),
+ *                     or 0 to try one address after the other
+ *
+ * Returns 1 if connected (right away), 0 if in progress, -1 on failure.
+ *         On success, `cs->sck' is the connected (non-blocking) socket */
+int lsi_com_consocket_start(struct consock *cs, const char *host,
+    uint16_t port, const char *laddr, uint16_t lport, uint64_t softto,
+    uint64_t hardto, uint64_t stagger);
+
+/* lsi_com_consocket_step
+ * Check whether a connection attempt has completed, without blocking.
+ * Handles timeouts and moves on to the next address as needed.
+ *
+ * Returns the same as lsi_com_consocket_start() */
+int lsi_com_consocket_step(struct consock *cs);
+
+/* lsi_com_consocket_fds
+ * Tell what to wait for before calling lsi_com_consocket_step() again
+ *
+ * Params: `fds', `fdsz': Array to store the fds to wait for writability on
+ *         `to_us':  Will be set to how long to wait at most (0 = no limit)
+ *
+ * Returns the number of fds stored in `fds' */
+size_t lsi_com_consocket_fds(struct consock *cs, int *fds, size_t fdsz,
+    uint64_t *to_us);
+
+/* lsi_com_consocket_abort
+ * Abandon a connection attempt in progress, releasing all resources */
+void lsi_com_consocket_abort(struct consock *cs);
 
 bool lsi_com_update_strprop(char **field, const char *val);
 
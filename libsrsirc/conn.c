@@ -16,6 +16,7 @@
 #include <errno.h>
 #include <inttypes.h>
 #include <limits.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -38,6 +39,12 @@
 #define ON 1
 
 
+static bool written(iconn *ctx);
+static uint16_t realport(iconn *ctx);
+static int ssl_step(iconn *ctx);
+static int advance(iconn *ctx, int r);
+
+
 iconn *
 lsi_conn_init(void)
 {
@@ -49,12 +56,15 @@ lsi_conn_init(void)
 		goto fail;
 
 	r->host = NULL;
+	r->rctx.buf = NULL;
 
 	if (!(r->host = STRDUP(DEF_HOST)))
 		goto fail;
 
+	if (!lsi_io_rctx_init(&r->rctx, DEF_RCVBUF_SZ))
+		goto fail;
+
 	errno = preverrno;
-	r->rctx.wptr = r->rctx.eptr = r->rctx.workbuf;
 	r->port = 0;
 	r->phost = NULL;
 	r->pport = 0;
@@ -68,6 +78,14 @@ lsi_conn_init(void)
 	r->sh.shnd = NULL;
 	r->sh.sck = -1;
 	r->sctx = NULL;
+	lsi_io_wctx_init(&r->wctx);
+	r->autoflush = true;
+	r->cork = 0;
+	r->nbwrite = false;
+	r->hiwat = DEF_SNDHIWAT;
+	r->cstate = CST_IDLE;
+	r->sslwantwr = false;
+	r->ctend = 0;
 
 	D("Connection context initialized (%p)", (void *)r);
 
@@ -76,6 +94,7 @@ lsi_conn_init(void)
 fail:
 	EE("failed to initialize iconn handle");
 	if (r) {
+		lsi_io_rctx_dispose(&r->rctx);
 		free(r->host);
 		free(r);
 	}
@@ -88,7 +107,14 @@ lsi_conn_reset(iconn *ctx)
 {
 	D("resetting");
 
-	if (ctx->ssl && ctx->sh.shnd) {
+	if (ctx->cstate == CST_TCP)
+		lsi_com_consocket_abort(&ctx->cs);
+
+	if (ctx->cstate == CST_SSL && ctx->sh.shnd) {
+		D("abandoning ssl handshake");
+		lsi_b_ssl_free(ctx->sh.shnd);
+		ctx->sh.shnd = NULL;
+	} else if (ctx->ssl && ctx->sh.shnd) {
 		D("shutting down ssl");
 		lsi_b_sslfin(ctx->sh.shnd);
 		ctx->sh.shnd = NULL;
@@ -101,7 +127,10 @@ lsi_conn_reset(iconn *ctx)
 
 	ctx->sh.sck = -1;
 	ctx->online = false;
-	ctx->rctx.wptr = ctx->rctx.eptr = ctx->rctx.workbuf;
+	ctx->cstate = CST_IDLE;
+	lsi_io_rctx_reset(&ctx->rctx);
+	lsi_io_wctx_reset(&ctx->wctx);
+	ctx->cork = 0;
 	return;
 }
 
@@ -115,28 +144,28 @@ lsi_conn_dispose(iconn *ctx)
 	free(ctx->host);
 	free(ctx->phost);
 	free(ctx->laddr);
+	lsi_io_rctx_dispose(&ctx->rctx);
+	lsi_io_wctx_dispose(&ctx->wctx);
 
 	D("disposed");
 	free(ctx);
 	return;
 }
 
-bool
-lsi_conn_connect(iconn *ctx, uint64_t softto_us, uint64_t hardto_us)
+int
+lsi_conn_connect_start(iconn *ctx, uint64_t softto_us, uint64_t hardto_us,
+    uint64_t stagger_us)
 {
-	if (ctx->online) {
-		E("Can't connect when already online");
-		return false;
+	if (ctx->online || ctx->cstate != CST_IDLE) {
+		E("Can't connect when already online or connecting");
+		return -1;
 	}
 
-	uint64_t tend = hardto_us ? lsi_b_tstamp_us() + hardto_us : 0;
-
-	uint16_t realport = ctx->port;
-	if (!realport)
-		realport = ctx->ssl ? DEF_PORT_SSL : DEF_PORT_PLAIN;
+	ctx->ctend = hardto_us ? lsi_b_tstamp_us() + hardto_us : 0;
 
+	uint16_t rport = realport(ctx);
 	char *host = ctx->ptype != -1 ? ctx->phost : ctx->host;
-	uint16_t port = ctx->ptype != -1 ? ctx->pport : realport;
+	uint16_t port = ctx->ptype != -1 ? ctx->pport : rport;
 
 	{
 		char ps[64];
@@ -146,150 +175,213 @@ lsi_conn_connect(iconn *ctx, uint64_t softto_us, uint64_t hardto_us)
 			    lsi_px_typestr(ctx->ptype), ctx->phost, ctx->pport);
 
 		I("wanna connect to %s:%"PRIu16"%s, "
-		    "sto: %"PRIu64"us, hto: %"PRIu64"us",
-		    ctx->host, realport, ps, softto_us, hardto_us);
+		    "sto: %"PRIu64"us, hto: %"PRIu64"us, stagger: %"PRIu64"us",
+		    ctx->host, rport, ps, softto_us, hardto_us, stagger_us);
 	}
 
-	char peerhost[256];
-	uint16_t peerport;
+	ctx->cstate = CST_TCP;
+	int r = lsi_com_consocket_start(&ctx->cs, host, port, ctx->laddr,
+	    ctx->lport, softto_us, hardto_us, stagger_us);
 
-	sckhld sh;
-	sh.sck = lsi_com_consocket(host, port, ctx->laddr, ctx->lport, peerhost,
-	    sizeof peerhost, &peerport, softto_us, hardto_us);
-	sh.shnd = NULL;
+	if (r == -1)
+		W("couldn't connect to %s:%"PRIu16"", host, port);
 
-	if (sh.sck < 0) {
-		W("lsi_com_consocket failed for %s:%"PRIu16"", host, port);
-		return false;
+	return advance(ctx, r);
+}
+
+int
+lsi_conn_connect_step(iconn *ctx)
+{
+	switch (ctx->cstate) {
+	case CST_TCP:
+		return advance(ctx, lsi_com_consocket_step(&ctx->cs));
+	case CST_PROXY:
+		return advance(ctx, lsi_px_logon_step(&ctx->px, ctx->sh.sck));
+	case CST_SSL:
+		return advance(ctx, ssl_step(ctx));
 	}
 
-	D("connected socket %d for %s:%"PRIu16"", sh.sck, host, port);
+	E("No connection attempt in progress");
+	return -1;
+}
 
-	ctx->sh = sh; //must be set here for px_logon
+size_t
+lsi_conn_connect_fds(iconn *ctx, int *fds, size_t fdsz, bool *wantwr,
+    uint64_t *to_us)
+{
+	*wantwr = true;
+	if (ctx->cstate == CST_TCP)
+		return lsi_com_consocket_fds(&ctx->cs, fds, fdsz, to_us);
 
-	uint64_t trem = 0;
-	if (ctx->ptype != -1) {
-		if (lsi_com_check_timeout(tend, &trem)) {
-			W("timeout");
-			lsi_b_close(sh.sck);
-			ctx->sh.sck = -1;
-			return false;
-		}
+	if (lsi_com_check_timeout(ctx->ctend, to_us))
+		*to_us = 1;
 
-		if (!lsi_b_blocking(sh.sck, false)) {
-			WE("failed to set nonblocking mode");
-			lsi_b_close(sh.sck);
-			ctx->sh.sck = -1;
-			return false;
-		}
+	if (ctx->cstate == CST_IDLE || !fdsz)
+		return 0;
 
-		bool ok = false;
-		D("logging on to proxy");
-		if (ctx->ptype == IRCPX_HTTP)
-			ok = lsi_px_logon_http(ctx->sh.sck, ctx->host,
-			    realport, trem);
-		else if (ctx->ptype == IRCPX_SOCKS4)
-			ok = lsi_px_logon_socks4(ctx->sh.sck, ctx->host,
-			    realport, trem);
-		else if (ctx->ptype == IRCPX_SOCKS5)
-			ok = lsi_px_logon_socks5(ctx->sh.sck, ctx->host,
-			    realport, trem);
-
-		if (!ok) {
-			W("proxy logon failed");
-			lsi_b_close(sh.sck);
-			ctx->sh.sck = -1;
-			return false;
-		}
-		D("sent proxy logon sequence");
+	*wantwr = ctx->cstate == CST_SSL && ctx->sslwantwr;
+	fds[0] = ctx->sh.sck;
+	return 1;
+}
 
+int
+lsi_conn_read_line(iconn *ctx, char **line, const struct rdfilter *filt,
+    uint64_t to_us)
+{
+	if (!ctx->online) {
+		E("Can't read while offline");
+		return -1;
 	}
 
-	if (ctx->ssl) {
-		D("setting to blocking mode for ssl connect");
+	/* whatever we're waiting for may well be the reply to something
+	 * that's still sitting in our send buffer */
+	if (!lsi_conn_flush(ctx))
+		return -1;
 
-		if (!lsi_b_blocking(sh.sck, true)) {
-			WE("failed to set blocking mode");
-			lsi_b_close(sh.sck);
-			ctx->sh.sck = -1;
-			return false;
-		}
+	int n;
+	if (!(n = lsi_io_read_line(ctx->sh, &ctx->rctx, line, filt, to_us)))
+		return 0; /* timeout */
 
-		if (!(ctx->sh.shnd = lsi_b_sslize(sh.sck, ctx->sctx))) {
-			lsi_b_close(sh.sck);
-			ctx->sh.sck = -1;
-			W("connect bailing out; couldn't initiate ssl");
-			return false;
-		}
+	if (n < 0) {
+		W("lsi_io_read_line %s", n == -1 ? "failed":"EOF");
+		lsi_conn_reset(ctx);
+		ctx->eof = n == -2;
+		return -1;
+	}
 
-		D("setting to nonblocking mode after ssl connect");
+	return 1;
+}
 
-		if (!lsi_b_blocking(sh.sck, false)) {
-			WE("failed to clear blocking mode");
-			lsi_b_close(sh.sck);
-			ctx->sh.sck = -1;
-			return false;
-		}
+int
+lsi_conn_read(iconn *ctx, tokarr *tok, char **tags, size_t *ntags,
+    const struct rdfilter *filt, uint64_t to_us)
+{
+	if (!ctx->online) {
+		E("Can't read while offline");
+		return -1;
 	}
 
-	ctx->online = true;
+	/* whatever we're waiting for may well be the reply to something
+	 * that's still sitting in our send buffer */
+	if (!lsi_conn_flush(ctx))
+		return -1;
 
-	D("%s connection to ircd established", ctx->ptype == -1?"TCP":"proxy");
+	int n;
+	if (!(n = lsi_io_read(ctx->sh, &ctx->rctx, tok,
+	    tags, ntags, filt, to_us)))
+		return 0; /* timeout */
 
-	return true;
+	if (n < 0) {
+		W("lsi_io_read %s", n == -1 ? "failed":"EOF");
+		lsi_conn_reset(ctx);
+		ctx->eof = n == -2;
+		return -1;
+	}
+
+	lsi_conn_upd_colon_trail(ctx, tok);
+
+	D("got a msg ('%s')", (*tok)[1]);
+
+	return 1;
 }
 
 int
-lsi_conn_read(iconn *ctx, tokarr *tok, char **tags, size_t *ntags,
-    uint64_t to_us)
+lsi_conn_read_batch(iconn *ctx, tokarr *toks, char **tagstrs, size_t max,
+    const struct rdfilter *filt, uint64_t to_us)
 {
 	if (!ctx->online) {
 		E("Can't read while offline");
 		return -1;
 	}
 
+	/* whatever we're waiting for may well be the reply to something
+	 * that's still sitting in our send buffer */
+	if (!lsi_conn_flush(ctx))
+		return -1;
+
 	int n;
-	if (!(n = lsi_io_read(ctx->sh, &ctx->rctx, tok,
-	    tags, ntags, to_us)))
+	if (!(n = lsi_io_read_batch(ctx->sh, &ctx->rctx, toks,
+	    tagstrs, max, filt, to_us)))
 		return 0; /* timeout */
 
 	if (n < 0) {
-		W("lsi_io_read %s", n == -1 ? "failed":"EOF");
+		W("lsi_io_read_batch %s", n == -1 ? "failed":"EOF");
 		lsi_conn_reset(ctx);
 		ctx->eof = n == -2;
 		return -1;
 	}
 
+	D("got %d msg(s)", n);
+
+	return n;
+}
+
+/* colon_trail is a property of the message at hand, so batch readers
+ * need to update it themselves as they go through the messages */
+void
+lsi_conn_upd_colon_trail(iconn *ctx, tokarr *tok)
+{
 	size_t last = 2;
 	for (; last < COUNTOF(*tok) && (*tok)[last]; last++);
 
 	if (last > 2)
 		ctx->colon_trail = (*tok)[last-1][-1] == ':';
+	return;
+}
 
-	D("got a msg ('%s', %zu args)", (*tok)[1], last);
+bool
+lsi_conn_write_raw(iconn *ctx, const void *buf, size_t n)
+{
+	if (!ctx->online) {
+		E("Can't write while offline");
+		return false;
+	}
 
-	return 1;
+	if (!lsi_io_append(&ctx->wctx, buf, n)) {
+		lsi_conn_reset(ctx);
+		ctx->eof = false;
+		return false;
+	}
+
+	D("queued: '%.*s'", (int) n, (const char *) buf);
+	return written(ctx);
 }
 
 bool
-lsi_conn_write_raw(iconn *ctx, const void *buf, size_t n)
+lsi_conn_append(iconn *ctx, const void *buf, size_t n)
 {
 	if (!ctx->online) {
 		E("Can't write while offline");
 		return false;
 	}
 
-	if (!lsi_io_write(ctx->sh, buf, n)) {
-		W("failed to write '%.*s'", (int) n, (const char *) buf);
+	if (!lsi_io_append(&ctx->wctx, buf, n)) {
 		lsi_conn_reset(ctx);
 		ctx->eof = false;
 		return false;
 	}
 
-	D("wrote: '%.*s'", (int) n, (const char *) buf);
 	return true;
 }
 
+void
+lsi_conn_truncate(iconn *ctx, size_t n)
+{
+	lsi_io_truncate(&ctx->wctx, n);
+	return;
+}
+
+bool
+lsi_conn_commit(iconn *ctx)
+{
+	if (!ctx->online) {
+		E("Can't write while offline");
+		return false;
+	}
+
+	return written(ctx);
+}
+
 bool
 lsi_conn_write(iconn *ctx, const char *line)
 {
@@ -298,8 +390,149 @@ lsi_conn_write(iconn *ctx, const char *line)
 
 	bool needbr = (len < 2) || strcmp(line + len - 2, crlf) != 0;
 
-	return lsi_conn_write_raw(ctx, line, len)
-	    && lsi_conn_write_raw(ctx, crlf, 2 * needbr);
+	if (!ctx->online) {
+		E("Can't write while offline");
+		return false;
+	}
+
+	if (!lsi_io_append(&ctx->wctx, line, len)
+	    || !lsi_io_append(&ctx->wctx, crlf, 2 * needbr)) {
+		lsi_conn_reset(ctx);
+		ctx->eof = false;
+		return false;
+	}
+
+	D("queued: '%s'", line);
+	return written(ctx);
+}
+
+bool
+lsi_conn_vprintf(iconn *ctx, const char *fmt, va_list vl)
+{
+	if (!ctx->online) {
+		E("Can't write while offline");
+		return false;
+	}
+
+	/* relative to `off', since appending may move the pending data */
+	size_t start = lsi_conn_pending(ctx);
+	if (!lsi_io_vappendf(&ctx->wctx, fmt, vl)) {
+		lsi_conn_reset(ctx);
+		ctx->eof = false;
+		return false;
+	}
+
+	const char *line = ctx->wctx.buf + ctx->wctx.off + start;
+	size_t len = lsi_conn_pending(ctx) - start;
+	bool needbr = len < 2 || line[len-2] != '\r' || line[len-1] != '\n';
+	if (needbr && !lsi_io_append(&ctx->wctx, "\r\n", 2)) {
+		lsi_conn_reset(ctx);
+		ctx->eof = false;
+		return false;
+	}
+
+	D("queued: '%.*s'", (int)len, line);
+	return written(ctx);
+}
+
+bool
+lsi_conn_printf(iconn *ctx, const char *fmt, ...)
+{
+	va_list vl;
+	va_start(vl, fmt);
+	bool r = lsi_conn_vprintf(ctx, fmt, vl);
+	va_end(vl);
+	return r;
+}
+
+bool
+lsi_conn_flush(iconn *ctx)
+{
+	size_t n = lsi_conn_pending(ctx);
+	if (!n)
+		return true;
+
+	if (!ctx->online) {
+		E("Can't write while offline");
+		return false;
+	}
+
+	int r = lsi_io_flush(ctx->sh, &ctx->wctx, !ctx->nbwrite);
+	if (r == -1) {
+		W("failed to flush %zu bytes", n);
+		lsi_conn_reset(ctx);
+		ctx->eof = false;
+		return false;
+	}
+
+	if (r == 0)
+		D("flushed %zu of %zu bytes, socket is full",
+		    n - lsi_conn_pending(ctx), n);
+	else
+		D("flushed %zu bytes", n);
+
+	return true;
+}
+
+size_t
+lsi_conn_pending(iconn *ctx)
+{
+	return ctx->wctx.len - ctx->wctx.off;
+}
+
+void
+lsi_conn_cork(iconn *ctx)
+{
+	ctx->cork++;
+	return;
+}
+
+bool
+lsi_conn_uncork(iconn *ctx)
+{
+	if (ctx->cork && --ctx->cork)
+		return true;
+
+	return !ctx->autoflush || lsi_conn_flush(ctx);
+}
+
+void
+lsi_conn_set_autoflush(iconn *ctx, bool on)
+{
+	ctx->autoflush = on;
+	return;
+}
+
+bool
+lsi_conn_get_autoflush(iconn *ctx)
+{
+	return ctx->autoflush;
+}
+
+void
+lsi_conn_set_nbwrite(iconn *ctx, bool on)
+{
+	ctx->nbwrite = on;
+	return;
+}
+
+bool
+lsi_conn_get_nbwrite(iconn *ctx)
+{
+	return ctx->nbwrite;
+}
+
+void
+lsi_conn_set_sndhiwat(iconn *ctx, size_t hiwat)
+{
+	ctx->hiwat = hiwat;
+	return;
+}
+
+size_t
+lsi_conn_get_sndhiwat(iconn *ctx)
+{
+	return ctx->hiwat;
 }
 
 bool
@@ -409,6 +642,36 @@ lsi_conn_set_ssl(iconn *ctx, bool on)
 	return true;
 }
 
+bool
+lsi_conn_set_rcvbuf_size(iconn *ctx, size_t sz)
+{
+	if (ctx->online) {
+		E("Can't change the receive buffer size while online");
+		return false;
+	}
+
+	if (sz < MAX_LINE_LEN) {
+		E("Receive buffer size %zu too small (need at least %zu)",
+		    sz, (size_t)MAX_LINE_LEN);
+		return false;
+	}
+
+	struct readctx rctx;
+	if (!lsi_io_rctx_init(&rctx, sz))
+		return false;
+
+	lsi_io_rctx_dispose(&ctx->rctx);
+	ctx->rctx = rctx;
+	D("Receive buffer size set to %zu", sz);
+	return true;
+}
+
+size_t
+lsi_conn_get_rcvbuf_size(iconn *ctx)
+{
+	return ctx->rctx.cap;
+}
+
 const char *
 lsi_conn_get_px_host(iconn *ctx)
 {
@@ -445,6 +708,13 @@ lsi_conn_get_ssl(iconn *ctx)
 	return ctx->ssl;
 }
 
+void
+lsi_conn_sslkey(iconn *ctx, char *dest, size_t destsz)
+{
+	snprintf(dest, destsz, "%s:%"PRIu16, ctx->host, realport(ctx));
+	return;
+}
+
 int
 lsi_conn_sockfd(iconn *ctx)
 {
@@ -466,7 +736,94 @@ irc_conn_dump(iconn *ctx)
 	N("eof: %d", ctx->eof);
 	N("colon_trail: %d", ctx->colon_trail);
 	N("ssl: %d", ctx->ssl);
-	N("read buffer: %zu bytes in use", (size_t)(ctx->rctx.eptr - ctx->rctx.wptr));
+	N("read buffer: %zu bytes in use (capacity %zu)",
+	    (size_t)(ctx->rctx.eptr - ctx->rctx.wptr), ctx->rctx.cap);
+	N("send buffer: %zu bytes pending (size %zu, high-water mark %zu)",
+	    lsi_conn_pending(ctx), ctx->wctx.sz, ctx->hiwat);
+	N("autoflush: %d, cork: %u, nbwrite: %d",
+	    ctx->autoflush, ctx->cork, ctx->nbwrite);
 	N("--- end of connection context dump ---");
 	return;
 }
+
+
+/* something was added to the send buffer; send it unless we're told to
+ * hold it back (but don't let it pile up past the high-water mark) */
+static bool
+written(iconn *ctx)
+{
+	if ((ctx->autoflush && !ctx->cork) || lsi_conn_pending(ctx) >= ctx->hiwat)
+		return lsi_conn_flush(ctx);
+
+	return true;
+}
+
+static uint16_t
+realport(iconn *ctx)
+{
+	if (ctx->port)
+		return ctx->port;
+
+	return ctx->ssl ? DEF_PORT_SSL : DEF_PORT_PLAIN;
+}
+
+static int
+ssl_step(iconn *ctx)
+{
+	int r = lsi_b_ssl_handshake(ctx->sh.shnd);
+	ctx->sslwantwr = r == 2;
+	return r == 2 ? 0 : r;
+}
+
+/* `r' is what the last thing we did in the current state returned.  as long
+ * as that says the state is complete (1), go on with the next one */
+static int
+advance(iconn *ctx, int r)
+{
+	while (r == 1) {
+		if (ctx->cstate == CST_TCP) {
+			ctx->sh.sck = ctx->cs.sck;
+			ctx->sh.shnd = NULL;
+			D("connected socket %d", ctx->sh.sck);
+
+			if (ctx->ptype != -1) {
+				D("logging on to proxy");
+				ctx->cstate = CST_PROXY;
+				r = lsi_px_logon_start(&ctx->px, ctx->sh.sck,
+				    ctx->ptype, ctx->host, realport(ctx))
+				    ? lsi_px_logon_step(&ctx->px, ctx->sh.sck)
+				    : -1;
+				continue;
+			}
+		} else if (ctx->cstate == CST_PROXY)
+			D("logged on to proxy");
+
+		if (ctx->ssl && ctx->cstate != CST_SSL) {
+			D("starting ssl handshake");
+			char skey[320];
+			lsi_conn_sslkey(ctx, skey, sizeof skey);
+			ctx->cstate = CST_SSL;
+			ctx->sh.shnd = lsi_b_ssl_start(ctx->sh.sck, ctx->sctx,
+			    skey);
+			r = ctx->sh.shnd ? ssl_step(ctx) : -1;
+			continue;
+		}
+
+		ctx->cstate = CST_IDLE;
+		ctx->online = true;
+		D("%s connection to ircd established",
+		    ctx->ptype == -1 ? "TCP" : "proxy");
+		return 1;
+	}
+
+	if (r == 0) {
+		if (!lsi_com_check_timeout(ctx->ctend, NULL))
+			return 0;
+
+		W("timeout");
+	} else
+		W("connect bailing out (state %d)", ctx->cstate);
+
+	lsi_conn_reset(ctx);
+	return -1;
+}
@@ -6,6 +6,7 @@
 #define LIBSRSIRC_CONN_H 1
 
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
 
@@ -16,11 +17,52 @@
 iconn *lsi_conn_init(void);
 void lsi_conn_reset(iconn *ctx);
 void lsi_conn_dispose(iconn *ctx);
-bool lsi_conn_connect(iconn *ctx, uint64_t softto_us, uint64_t hardto_us);
+
+/* connecting works in steps, so that it can be done without blocking.
+ * both return 1 when connected, 0 when in progress, -1 on failure.  in the
+ * second case, lsi_conn_connect_fds() tells what to wait for before calling
+ * lsi_conn_connect_step() again */
+int lsi_conn_connect_start(iconn *ctx, uint64_t softto_us, uint64_t hardto_us,
+    uint64_t stagger_us);
+int lsi_conn_connect_step(iconn *ctx);
+size_t lsi_conn_connect_fds(iconn *ctx, int *fds, size_t fdsz, bool *wantwr,
+    uint64_t *to_us);
+
+/* lsi_conn_read_line() hands out the raw line (see lsi_io_read_line()) */
+int lsi_conn_read_line(iconn *ctx, char **line, const struct rdfilter *filt,
+    uint64_t to_us);
 int lsi_conn_read(iconn *ctx, tokarr *tok, char **tags, size_t *ntags,
-    uint64_t to_us); // XXX
+    const struct rdfilter *filt, uint64_t to_us); // XXX
+int lsi_conn_read_batch(iconn *ctx, tokarr *toks, char **tagstrs, size_t max,
+    const struct rdfilter *filt, uint64_t to_us);
+/* writing appends to the send buffer, which is flushed right away unless
+ * autoflush is off (see irc_set_autoflush()) or we're corked.  corking nests;
+ * lsi_conn_uncork() flushes once the outermost cork is gone.  all of these
+ * return false (and reset the connection) on failure.  with nbwrite on,
+ * flushing sends only what the socket takes without blocking, the rest
+ * stays pending (see lsi_conn_pending()) until the next flush */
 bool lsi_conn_write_raw(iconn *ctx, const void *buf, size_t n);
+/* for producing a line in several pieces: lsi_conn_append() adds to the send
+ * buffer without considering to flush, lsi_conn_truncate() drops all but the
+ * first `n' pending bytes (i.e. what was appended after lsi_conn_pending()
+ * said `n'), lsi_conn_commit() flushes as if the pieces had been written
+ * with lsi_conn_write_raw() */
+bool lsi_conn_append(iconn *ctx, const void *buf, size_t n);
+void lsi_conn_truncate(iconn *ctx, size_t n);
+bool lsi_conn_commit(iconn *ctx);
 bool lsi_conn_write(iconn *ctx, const char *line);
+bool lsi_conn_printf(iconn *ctx, const char *fmt, ...);
+bool lsi_conn_vprintf(iconn *ctx, const char *fmt, va_list vl);
+bool lsi_conn_flush(iconn *ctx);
+void lsi_conn_cork(iconn *ctx);
+bool lsi_conn_uncork(iconn *ctx);
+void lsi_conn_set_autoflush(iconn *ctx, bool on);
+bool lsi_conn_get_autoflush(iconn *ctx);
+size_t lsi_conn_pending(iconn *ctx);
+void lsi_conn_set_nbwrite(iconn *ctx, bool on);
+bool lsi_conn_get_nbwrite(iconn *ctx);
+void lsi_conn_set_sndhiwat(iconn *ctx, size_t hiwat);
+size_t lsi_conn_get_sndhiwat(iconn *ctx);
 bool lsi_conn_online(iconn *ctx);
 bool lsi_conn_eof(iconn *ctx);
 
@@ -34,9 +76,16 @@ bool lsi_conn_set_px(iconn *ctx, const char *host, uint16_t port, int ptype);
 bool lsi_conn_set_localaddr(iconn *ctx, const char *addr, uint16_t port);
 bool lsi_conn_set_ssl(iconn *ctx, bool on);
 bool lsi_conn_get_ssl(iconn *ctx);
+/* what TLS sessions to `ctx''s server are cached under: "host:port", with
+ * the port we actually connect to (i.e. the default one if none was set).
+ * STARTTLS must call this before turning on `ssl' */
+void lsi_conn_sslkey(iconn *ctx, char *dest, size_t destsz);
+bool lsi_conn_set_rcvbuf_size(iconn *ctx, size_t sz);
+size_t lsi_conn_get_rcvbuf_size(iconn *ctx);
 
 /* TODO: replace these by something less insane */
 bool lsi_conn_colon_trail(iconn *ctx);
+void lsi_conn_upd_colon_trail(iconn *ctx, tokarr *tok);
 int lsi_conn_sockfd(iconn *ctx);
 
 void irc_conn_dump(iconn *ctx);
@@ -0,0 +1,317 @@
+/* dnscache.c - process-wide cache of resolved server addresses
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_DNSCACHE
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "dnscache.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_net.h>
+#include <platform/base_string.h>
+#include <platform/base_time.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/defs.h>
+
+
+/* we don't expect to talk to many different servers; when there are more
+ * entries than this, the least recently used one is dropped */
+#define DNSCACHE_MAXENTS 64
+
+
+struct dnsent {
+	char *host;
+	uint16_t port;
+	struct addrlist *alist; // What the resolver said
+	int count;              // Number of elements in `alist'
+	uint64_t tfetch;        // When we asked the resolver (s_now())
+	uint64_t tused;         // When we last handed this out
+	bool revalidate;        // Has been served stale, wants refreshing
+	struct dnsent *next;
+};
+
+
+static struct dnsent *s_ents;
+static size_t s_nents;
+static size_t s_nrevalidate;
+static uint64_t s_ttl_us = DEF_DNSTTL_US;
+static uint64_t s_stale_us = DEF_DNSSTALE_US;
+static struct dnsstats s_stats;
+static dns_time_fn s_now = lsi_b_tstamp_us;
+
+
+static struct dnsent *find(const char *host, uint16_t port);
+static void store(struct dnsent *e, struct addrlist *alist, int count);
+static struct dnsent *mkent(const char *host, uint16_t port);
+static void unlink_ent(struct dnsent *e);
+static void free_ent(struct dnsent *e);
+static int resolve(const char *host, uint16_t port, struct addrlist **res);
+static struct addrlist *dup_alist(const struct addrlist *al);
+
+
+int
+lsi_dns_lookup(const char *host, uint16_t port, struct addrlist **res)
+{
+	if (!s_ttl_us) {
+		s_stats.nmiss++;
+		return resolve(host, port, res);
+	}
+
+	uint64_t now = s_now();
+	struct dnsent *e = find(host, port);
+	if (e) {
+		uint64_t age = now - e->tfetch;
+		if (age < s_ttl_us + s_stale_us) {
+			struct addrlist *al = dup_alist(e->alist);
+			if (!al)
+				return -1;
+
+			if (age < s_ttl_us) {
+				s_stats.nhit++;
+				D("'%s:%"PRIu16"': hit", host, port);
+			} else {
+				s_stats.nstale++;
+				D("'%s:%"PRIu16"': stale hit", host, port);
+				if (!e->revalidate) {
+					e->revalidate = true;
+					s_nrevalidate++;
+				}
+			}
+
+			e->tused = now;
+			*res = al;
+			return e->count;
+		}
+
+		D("'%s:%"PRIu16"': expired", host, port);
+		unlink_ent(e);
+		free_ent(e);
+	}
+
+	s_stats.nmiss++;
+	struct addrlist *al;
+	int count = resolve(host, port, &al);
+	if (count <= 0)
+		return count;
+
+	struct addrlist *copy = NULL;
+	if (!(e = mkent(host, port)) || !(copy = dup_alist(al))) {
+		free_ent(e);
+		*res = al; // Not caching it is no reason to fail
+		return count;
+	}
+
+	store(e, copy, count);
+	e->next = s_ents;
+	s_ents = e;
+	s_nents++;
+
+	*res = al;
+	return count;
+}
+
+bool
+lsi_dns_revalidate(void)
+{
+	if (!s_nrevalidate)
+		return false;
+
+	struct dnsent *e = s_ents;
+	while (e && !e->revalidate)
+		e = e->next;
+
+	if (!e) {
+		/* can't happen */
+		s_nrevalidate = 0;
+		return false;
+	}
+
+	e->revalidate = false;
+	s_nrevalidate--;
+
+	D("revalidating '%s:%"PRIu16"'", e->host, e->port);
+	struct addrlist *al;
+	int count = resolve(e->host, e->port, &al);
+	if (count <= 0) {
+		W("could not revalidate '%s:%"PRIu16"', keeping stale entry",
+		    e->host, e->port);
+		return true;
+	}
+
+	store(e, al, count);
+	return true;
+}
+
+bool
+lsi_dns_pending(void)
+{
+	return s_nrevalidate;
+}
+
+void
+lsi_dns_config(uint64_t ttl_us, uint64_t stale_us)
+{
+	s_ttl_us = ttl_us;
+	s_stale_us = stale_us;
+	if (!ttl_us)
+		lsi_dns_flush();
+	return;
+}
+
+void
+lsi_dns_flush(void)
+{
+	while (s_ents) {
+		struct dnsent *e = s_ents;
+		s_ents = e->next;
+		free_ent(e);
+	}
+
+	s_nents = s_nrevalidate = 0;
+	return;
+}
+
+void
+lsi_dns_set_clock(dns_time_fn now)
+{
+	s_now = now ? now : lsi_b_tstamp_us;
+	return;
+}
+
+void
+lsi_dns_stats(struct dnsstats *dest, bool reset)
+{
+	if (dest)
+		*dest = s_stats;
+
+	if (reset)
+		memset(&s_stats, 0, sizeof s_stats);
+	return;
+}
+
+
+static struct dnsent *
+find(const char *host, uint16_t port)
+{
+	for (struct dnsent *e = s_ents; e; e = e->next)
+		if (e->port == port && strcmp(e->host, host) == 0)
+			return e;
+
+	return NULL;
+}
+
+/* make `e' hold `alist' (which it takes over), fetched just now */
+static void
+store(struct dnsent *e, struct addrlist *alist, int count)
+{
+	lsi_b_freeaddrlist(e->alist);
+	e->alist = alist;
+	e->count = count;
+	e->tfetch = e->tused = s_now();
+	return;
+}
+
+/* make a new, empty entry, dropping the least recently used one if the
+ * cache is full */
+static struct dnsent *
+mkent(const char *host, uint16_t port)
+{
+	if (s_nents >= DNSCACHE_MAXENTS) {
+		struct dnsent *lru = s_ents;
+		for (struct dnsent *e = s_ents; e; e = e->next)
+			if (e->tused < lru->tused)
+				lru = e;
+
+		D("cache full, dropping '%s:%"PRIu16"'", lru->host, lru->port);
+		unlink_ent(lru);
+		free_ent(lru);
+	}
+
+	struct dnsent *e = MALLOC(sizeof *e);
+	if (!e)
+		return NULL;
+
+	if (!(e->host = STRDUP(host))) {
+		free(e);
+		return NULL;
+	}
+
+	e->port = port;
+	e->alist = NULL;
+	e->count = 0;
+	e->tfetch = e->tused = 0;
+	e->revalidate = false;
+	e->next = NULL;
+	return e;
+}
+
+static void
+unlink_ent(struct dnsent *e)
+{
+	struct dnsent **p = &s_ents;
+	while (*p != e)
+		p = &(*p)->next;
+
+	*p = e->next;
+	s_nents--;
+	if (e->revalidate)
+		s_nrevalidate--;
+	return;
+}
+
+static void
+free_ent(struct dnsent *e)
+{
+	if (!e)
+		return;
+
+	lsi_b_freeaddrlist(e->alist);
+	free(e->host);
+	free(e);
+	return;
+}
+
+static int
+resolve(const char *host, uint16_t port, struct addrlist **res)
+{
+	s_stats.nresolv++;
+	int count = lsi_b_mkaddrlist(host, port, res);
+	if (count <= 0)
+		s_stats.nfail++;
+
+	return count;
+}
+
+static struct addrlist *
+dup_alist(const struct addrlist *al)
+{
+	struct addrlist *head = NULL, **tail = &head;
+	for (; al; al = al->next) {
+		struct addrlist *n = MALLOC(sizeof *n);
+		if (!n) {
+			lsi_b_freeaddrlist(head);
+			return NULL;
+		}
+
+		*n = *al;
+		n->next = NULL;
+		*tail = n;
+		tail = &n->next;
+	}
+
+	return head;
+}
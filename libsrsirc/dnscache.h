@@ -0,0 +1,74 @@
+/* dnscache.h - process-wide cache of resolved server addresses
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_DNSCACHE_H
+#define LIBSRSIRC_DNSCACHE_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <platform/base_net.h>
+
+
+/* counters kept by the cache (see lsi_dns_stats()) */
+struct dnsstats {
+	uint64_t nhit;    // Lookups answered from a fresh entry
+	uint64_t nstale;  // Lookups answered from a stale entry
+	uint64_t nmiss;   // Lookups that had to wait for the resolver
+	uint64_t nresolv; // Calls to the resolver (incl. revalidations)
+	uint64_t nfail;   // ...of which failed
+};
+
+typedef uint64_t (*dns_time_fn)(void);
+
+
+/* lsi_dns_lookup
+ * Resolve `host' like lsi_b_mkaddrlist() does, but consult the cache first.
+ * Fresh entries are returned as they are.  Stale ones (older than the TTL,
+ * but within the stale window) are returned as well, and marked so that
+ * lsi_dns_revalidate() refreshes them.  Anything else is resolved and
+ * (if that worked) put in the cache.
+ *
+ * Params: `host': Hostname (or address) to resolve
+ *         `port': Port to put in the resulting addresses
+ *         `res':  Will point to the resulting list on success.  It is the
+ *                     caller's copy; free it with lsi_b_freeaddrlist()
+ *
+ * Returns the number of addresses, or -1 on failure */
+int lsi_dns_lookup(const char *host, uint16_t port, struct addrlist **res);
+
+/* lsi_dns_revalidate
+ * Refresh (at most) one of the entries that lsi_dns_lookup() served while
+ * stale.  This blocks for as long as the resolver takes.  If the resolver
+ * fails, the stale entry is kept until it falls out of the stale window.
+ *
+ * Returns true if there was something to refresh */
+bool lsi_dns_revalidate(void);
+
+/* lsi_dns_pending
+ * Tell whether there are entries waiting to be revalidated */
+bool lsi_dns_pending(void);
+
+/* lsi_dns_config
+ * Set the cache's time-to-live and stale window, in microseconds.  A TTL of
+ * 0 disables the cache (and flushes it).  Entries are served stale for at
+ * most `stale_us' after their TTL ran out */
+void lsi_dns_config(uint64_t ttl_us, uint64_t stale_us);
+
+/* lsi_dns_flush
+ * Drop all cached entries */
+void lsi_dns_flush(void);
+
+/* lsi_dns_set_clock
+ * Make the cache take the current time (in microseconds) from `now' instead
+ * of lsi_b_tstamp_us(); NULL switches back.  Meant for testing */
+void lsi_dns_set_clock(dns_time_fn now);
+
+/* lsi_dns_stats
+ * Get the counters (if `dest' is non-NULL), optionally reset them */
+void lsi_dns_stats(struct dnsstats *dest, bool reset);
+
+#endif /* LIBSRSIRC_DNSCACHE_H */
@@ -0,0 +1,218 @@
+/* dstat.c - message dispatch statistics (see irc_stats())
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IMSG
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "dstat.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_string.h>
+
+#include <logger/intlog.h>
+
+#include "common.h"
+#include "msg.h"
+#include "skmap.h"
+
+
+/* how many entries irc_dump() shows */
+#define DUMP_MAXENTS 20
+
+/* what messages nobody has a handler for are accounted as, so that a
+ * server (or anyone who can make it relay things to us) can't have us
+ * make up an entry for every made-up command it sends */
+#define OTHER_CMD "*"
+
+
+static unsigned bucket(uint64_t ns);
+static uint64_t quantile(const struct irc_hist *h, double q);
+static struct irc_statent **sorted(irc *ctx, size_t *n);
+static int cmp_total(const void *a, const void *b);
+
+
+bool
+lsi_dstat_enable(irc *ctx, bool on)
+{
+#if WITH_DISPSTATS
+	if (on && !ctx->dstats && !(ctx->dstats = lsi_skmap_init(64, CMAP_ASCII)))
+		return false;
+
+	ctx->dstats_on = on;
+	return true;
+#else
+	if (on)
+		W("not built with --enable-dispstats");
+	return !on;
+#endif
+}
+
+void
+lsi_dstat_add(irc *ctx, const char *cmd, const char *who, int slot,
+    uint64_t ns)
+{
+	if (!lsi_msg_wanted(ctx, cmd, strlen(cmd)))
+		cmd = OTHER_CMD;
+
+	char key[64];
+	snprintf(key, sizeof key, "%s %s %d", cmd, who, slot);
+
+	struct irc_statent *e = lsi_skmap_get(ctx->dstats, key);
+	if (!e) {
+		if (!(e = MALLOC(sizeof *e)))
+			return;
+
+		STRACPY(e->cmd, cmd);
+		STRACPY(e->who, who);
+		e->slot = slot;
+		memset(&e->hist, 0, sizeof e->hist);
+		if (!lsi_skmap_put(ctx->dstats, key, e)) {
+			free(e);
+			return;
+		}
+	}
+
+	struct irc_hist *h = &e->hist;
+	h->count++;
+	h->total_ns += ns;
+	if (ns > h->max_ns)
+		h->max_ns = ns;
+	h->bucket[bucket(ns)]++;
+	return;
+}
+
+size_t
+lsi_dstat_get(irc *ctx, struct irc_statent *dest, size_t destsz, bool reset)
+{
+	size_t n;
+	struct irc_statent **ents = sorted(ctx, &n);
+	if (!ents)
+		return 0;
+
+	for (size_t i = 0; i < n; i++) {
+		if (i < destsz)
+			dest[i] = *ents[i];
+		if (reset)
+			memset(&ents[i]->hist, 0, sizeof ents[i]->hist);
+	}
+
+	free(ents);
+	return n;
+}
+
+void
+lsi_dstat_dump(irc *ctx)
+{
+	if (!ctx->dstats) {
+		N("dispatch stats: none");
+		return;
+	}
+
+	size_t n;
+	struct irc_statent **ents = sorted(ctx, &n);
+	if (!ents)
+		return;
+
+	N("dispatch stats (%s, %zu entries; times in ns, "
+	    "quantiles are upper bounds):", ctx->dstats_on ? "on" : "off", n);
+	for (size_t i = 0; i < n && i < DUMP_MAXENTS; i++) {
+		struct irc_statent *e = ents[i];
+		char who[32];
+		if (e->slot >= 0)
+			snprintf(who, sizeof who, "%s#%d", e->who, e->slot);
+		else
+			STRACPY(who, e->who[0] ? e->who : "(all)");
+
+		N("%-10s %-7s n: %"PRIu64", total: %"PRIu64", avg: %"PRIu64", "
+		    "p50: %"PRIu64", p99: %"PRIu64", max: %"PRIu64,
+		    e->cmd, who, e->hist.count, e->hist.total_ns,
+		    e->hist.count ? e->hist.total_ns / e->hist.count : 0,
+		    quantile(&e->hist, .5), quantile(&e->hist, .99),
+		    e->hist.max_ns);
+	}
+
+	free(ents);
+	return;
+}
+
+void
+lsi_dstat_dispose(irc *ctx)
+{
+	if (!ctx->dstats)
+		return;
+
+	void *e;
+	if (lsi_skmap_first(ctx->dstats, NULL, &e))
+		do free(e); while (lsi_skmap_next(ctx->dstats, NULL, &e));
+
+	lsi_skmap_dispose(ctx->dstats);
+	ctx->dstats = NULL;
+	ctx->dstats_on = false;
+	return;
+}
+
+
+/* bucket 0 takes 0 and 1 ns, bucket i>0 takes [2^i, 2^(i+1)) ns */
+static unsigned
+bucket(uint64_t ns)
+{
+	unsigned b = 0;
+	while (ns >>= 1)
+		b++;
+
+	return b < IRC_HIST_NBUCKETS ? b : IRC_HIST_NBUCKETS - 1;
+}
+
+/* upper bound of the bucket the `q'-quantile falls into */
+static uint64_t
+quantile(const struct irc_hist *h, double q)
+{
+	uint64_t want = (uint64_t)(h->count * q), have = 0;
+	for (unsigned i = 0; i < IRC_HIST_NBUCKETS - 1; i++)
+		if ((have += h->bucket[i]) > want)
+			return (uint64_t)1 << (i + 1);
+
+	return h->max_ns;
+}
+
+/* all entries, biggest total time first; free() the result */
+static struct irc_statent **
+sorted(irc *ctx, size_t *n)
+{
+	*n = ctx->dstats ? lsi_skmap_count(ctx->dstats) : 0;
+	struct irc_statent **ents;
+	if (!*n || !(ents = MALLOC(*n * sizeof *ents)))
+		return NULL;
+
+	size_t i = 0;
+	void *e;
+	if (lsi_skmap_first(ctx->dstats, NULL, &e))
+		do ents[i++] = e; while (i < *n
+		    && lsi_skmap_next(ctx->dstats, NULL, &e));
+
+	qsort(ents, i, sizeof *ents, cmp_total);
+	*n = i;
+	return ents;
+}
+
+static int
+cmp_total(const void *a, const void *b)
+{
+	const struct irc_statent *ea = *(struct irc_statent *const *)a;
+	const struct irc_statent *eb = *(struct irc_statent *const *)b;
+	return ea->hist.total_ns < eb->hist.total_ns ? 1
+	    : ea->hist.total_ns > eb->hist.total_ns ? -1 : 0;
+}
@@ -0,0 +1,70 @@
+/* dstat.h - message dispatch statistics (see irc_stats())
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_DSTAT_H
+#define LIBSRSIRC_DSTAT_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include <libsrsirc/defs.h>
+#include <libsrsirc/irc_ext.h>
+
+#include "intdefs.h"
+
+
+/* time a handler call (or the dispatch of a whole message) if statistics
+ * are on.  without --enable-dispstats, this compiles to nothing at all */
+#if WITH_DISPSTATS
+# define DSTAT_START(CTX) ((CTX)->dstats_on ? lsi_b_tstamp_ns() : 0)
+# define DSTAT_STOP(CTX, T0, CMD, WHO, SLOT) do { \
+	if ((CTX)->dstats_on) \
+		lsi_dstat_add((CTX), (CMD), (WHO), (SLOT), \
+		    lsi_b_tstamp_ns() - (T0)); \
+	} while (0)
+#else
+# define DSTAT_START(CTX) 0
+# define DSTAT_STOP(CTX, T0, CMD, WHO, SLOT) do { \
+	(void)(CTX); (void)(T0); (void)(CMD); (void)(WHO); (void)(SLOT); \
+	} while (0)
+#endif
+
+
+/* lsi_dstat_enable
+ * Turn collecting statistics on or off.  What was collected so far is kept
+ *
+ * Returns false if we're built without --enable-dispstats, or if turning it
+ * on failed (memory allocation) */
+bool lsi_dstat_enable(irc *ctx, bool on);
+
+/* lsi_dstat_add
+ * Account for something that took `ns' nanoseconds
+ *
+ * Params: `cmd':  The command of the message being dispatched
+ *         `who':  "" for the dispatch of the message as a whole, else the
+ *                     handler's module, or "pre"/"post" for user handlers
+ *         `slot': For user handlers, their slot; -1 otherwise
+ *         `ns':   How long it took */
+void lsi_dstat_add(irc *ctx, const char *cmd, const char *who, int slot,
+    uint64_t ns);
+
+/* lsi_dstat_get
+ * Copy (at most `destsz') entries to `dest', see irc_stats() */
+size_t lsi_dstat_get(irc *ctx, struct irc_statent *dest, size_t destsz,
+    bool reset);
+
+/* lsi_dstat_dump
+ * Log a summary, with the most time-consuming entries first */
+void lsi_dstat_dump(irc *ctx);
+
+/* lsi_dstat_dispose
+ * Free everything collected */
+void lsi_dstat_dispose(irc *ctx);
+
+
+#endif /* LIBSRSIRC_DSTAT_H */
@@ -11,10 +11,27 @@
 
 #include <platform/base_net.h>
 
+#include "common.h"
+#include "pool.h"
+#include "px.h"
+#include "sendq.h"
 #include "skmap.h"
 
-/* receive buffer size */
-#define WORKBUF_SZ 4095
+/* default receive buffer size (see irc_set_rcvbuf_size()) */
+#define DEF_RCVBUF_SZ 16384
+
+/* longest line we must be able to handle; IRCv3 allows for 8191 bytes
+ * of message tags on top of the traditional 512 bytes */
+#define MAX_LINE_LEN (8191 + 512)
+
+/* what RFC 1459 allows for a message (excluding IRCv3 tags), incl. CRLF */
+#define MAX_MSG_LEN 512
+
+/* what IRCv3 allows clients to send in tags, incl. the '@' and the space */
+#define MAX_CLTAGS_LEN 4094
+
+/* maximum number of messages handed out by a single irc_read_batch() */
+#define MAX_RDBATCH 64
 
 /* default supported user modes (as per the RFC noone cares about...) */
 #define DEF_UMODES "iswo"
@@ -49,11 +66,52 @@ typedef struct sckhld {
 	SSLTYPE shnd;
 } sckhld;
 
-/* read context structure - holds the receive buffer, primarily*/
+/* read context structure - holds the receive buffer, primarily.
+ * the buffer is used as a ring of `cap' bytes, followed by MAX_LINE_LEN bytes
+ * of mirror space so that a line which wraps around is still contiguous */
 struct readctx {
-	char workbuf[WORKBUF_SZ + 1];
+	char *buf;
+	size_t cap;
 	char *wptr; /* pointer to begin of current valid data */
 	char *eptr; /* pointer to one after end of current valid data */
+	char *sptr; /* scan position; no delimiters between wptr and here */
+	bool bad; /* a batch stopped at a bad line; fail the next read */
+	bool skip; /* dropping an overlong line up to its end */
+};
+
+/* receive filter - decides by the command alone whether a message is worth
+ * tokenizing at all (see irc_set_recv_filter()).  `cmd' is not
+ * '\0'-terminated */
+struct rdfilter {
+	bool (*want)(void *arg, const char *cmd, size_t len);
+	void *arg;
+};
+
+/* write context structure - holds the send buffer, where outgoing lines
+ * accumulate until they are flushed (see lsi_io_flush()) */
+struct writectx {
+	char *buf;
+	size_t sz;  /* allocated size of `buf' */
+	size_t off; /* start of what hasn't been sent yet (after partial writes) */
+	size_t len; /* end of what is waiting to be sent */
+};
+
+
+/* state of the outgoing message builder (see irc_msgb.h); `state' says
+ * what may come next */
+#define MB_IDLE 0   // Nothing; not building a message
+#define MB_TAGS 1   // Tags, or the command
+#define MB_PARAMS 2 // Parameters, or the end of the message
+#define MB_DONE 3   // The end of the message (after the trailing parameter)
+
+struct irc_msgb_s {
+	struct irc_s *ctx;
+	size_t start;     // Where the message begins (relative to pending output)
+	size_t body;      // Where the part after the tags begins (ditto)
+	unsigned ntags;   // Number of tags added
+	unsigned nparams; // Number of parameters added
+	int state;        // MB_*
+	bool err;         // Set once a part was rejected
 };
 
 
@@ -71,6 +129,36 @@ struct umsghnd {
 	uhnd_fn hndfn;
 };
 
+/* handler sets, in the order they are dispatched to */
+#define DS_PRE 0  // User-registered PRE message handlers
+#define DS_SYS 1  // System-registered message handlers
+#define DS_POST 2 // User-registered POST message handlers
+#define DS_NUM 3
+
+/* dispatch index entry - the handlers of all sets registered for a command,
+ * as runs of slot numbers (i.e. indices into msghnds etc.) in `order' */
+struct dispent {
+	char cmd[32];
+	unsigned first[DS_NUM]; // Where the run for each set begins in `order'
+	unsigned cnt[DS_NUM];   // Length of said run
+	bool deliver;           // Passes the receive filter (if there is one)
+};
+
+/* dispatch index - finds the handlers for a command without looking at
+ * the handlers registered for any other command.  rebuilt from scratch
+ * whenever a handler is (un)registered, see msg.c */
+struct dispidx {
+	unsigned num[1000];     // 3-digit numerics: index into `ents' + 1, or 0
+	unsigned *verb;         // Anything else: open-addressed hash, ditto
+	size_t verbsz;          // Size of `verb' (a power of 2), 0 if none yet
+	struct dispent *ents;   // One per command with handlers (or filter entry)
+	size_t nents;           // Number of used elements in `ents'
+	size_t entcap;          // Number of allocated elements in `ents'
+	unsigned *order;        // Slot numbers, grouped by command and set
+	size_t ordcap;          // Number of allocated elements in `order'
+	unsigned gen;           // Bumped on every rebuild
+};
+
 struct v3tag
 {
 	const char *key;
@@ -86,6 +174,12 @@ struct v3cap
 	bool enabled;
 };
 
+/* progress of a connection attempt (see lsi_conn_connect_start()) */
+#define CST_IDLE 0  // Not connecting (but maybe online)
+#define CST_TCP 1   // Waiting for the TCP connect() to complete
+#define CST_PROXY 2 // Logging on to the proxy
+#define CST_SSL 3   // Doing the SSL handshake
+
 /* this is a relict of the former design */
 typedef struct iconn_s iconn;
 struct iconn_s {
@@ -103,9 +197,20 @@ struct iconn_s {
 	bool eof;
 
 	struct readctx rctx;
+	struct writectx wctx;
+	bool autoflush;      // Send every line right away (see irc_set_autoflush())
+	unsigned cork;       // While >0, hold back output regardless
+	bool nbwrite;        // Don't block on a full socket (see irc_set_nbwrite())
+	size_t hiwat;        // Send buffer high-water mark (see irc_set_sndhiwat())
 	bool colon_trail;
 	bool ssl;
 	SSLCTXTYPE sctx;
+
+	int cstate;          // CST_*
+	struct consock cs;   // While CST_TCP
+	struct pxlogon px;   // While CST_PROXY
+	bool sslwantwr;      // While CST_SSL: handshake waits for writability
+	uint64_t ctend;      // Connect deadline (absolute), 0 if none
 };
 
 /* this is our main IRC context context structure (typedef'd as `irc') */
@@ -158,6 +263,7 @@ struct irc_s {
 	char *serv_info;      // Service logon information (service info)
 	uint64_t hcto_us;     // Overall irc_connect() timeout (0=inf)
 	uint64_t scto_us;     // Socket connect() timeout per A/AAAA record (0=inf)
+	uint64_t cstagger_us; // Delay before racing the next A/AAAA record (0=don't)
 	bool tracking;        // Do we want chan/user tracking? by irc_set_track()
 	bool dumb;            // Connect only, leave logon sequence to the user
 
@@ -174,12 +280,22 @@ struct irc_s {
 	size_t uposthnds_cnt;      // Amount of the above
 	struct msghnd *msghnds;    // System-registered message handlers
 	size_t msghnds_cnt;        // Amount of the above
+	struct dispidx disp;       // Index over all of the above, by command
+	char (*rfilt)[32];         // Commands to deliver (irc_set_recv_filter())
+	size_t rfilt_cnt;          // Amount of the above
+	struct rdfilter rdfilt;    // Handed to the I/O layer while `rfilt' is set
+	skmap *dstats;             // Dispatch statistics (see dstat.c), or NULL
+	bool dstats_on;            // Whether to collect them (irc_set_stats())
 
 
 
 	/* These are only used if irc_set_track() was used to enable tracking */
 	skmap *chans;       // The channels we're aware of (or in?)
 	skmap *users;       // The users we're aware of
+	pool *cpool;        // Where the records in `chans'...
+	pool *upool;        // ...`users'...
+	pool *mpool;        // ...and the channels' member maps live
+	arena *strs;        // Their strings (nicks, topics, modes etc.)
 
 
 
@@ -187,7 +303,16 @@ struct irc_s {
 	bool tracking_enab;  // If `tracking`, set once we see 005 CASEMAPPING
 	bool endofnames;     // Helper flag for channel names update
 
+	bool connecting;     // Set from irc_connect_start() until done
+	bool logon_sent;     // ...and we've sent USER/NICK etc.
+	bool logged_on;      // ...and we've seen 004 (or 383)
+	bool sasl_authed;    // ...and SASL authentication is complete
+	uint64_t contend;    // ...and it has to be done by then (0 = no limit)
+
 	struct iconn_s *con; // Connection-specifics (socket, read buffers, ...)
+	sendq *sendq;        // Flood-controlled output (see irc_sendq())
+	struct irc_msgb_s msgb; // Outgoing message builder (see irc_msgb.h)
+	struct loopent *loopent; // Set while attached to an irc_loop
 };
 
 
@@ -14,10 +14,12 @@
 
 #include <ctype.h>
 #include <inttypes.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include <platform/base_misc.h>
 #include <platform/base_net.h>
 #include <platform/base_time.h>
 
@@ -30,19 +32,43 @@
 
 #define ISDELIM(C) ((C) == '\n' || (C) == '\r')
 
+/* vectorized delimiter scanning, where the compiler lets us.  There is no
+ * runtime CPU detection; the AVX2 variant is used if we're built with -mavx2
+ * (or an -march that implies it), SSE2 is baseline on x86_64 anyway */
+#if defined(__GNUC__) && (defined(__SSE2__) || defined(__AVX2__))
+# define SCAN_SSE2 1
+# include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && defined(__AVX2__)
+# define SCAN_AVX2 1
+# include <immintrin.h>
+#endif
+
+
+/* initial size of a send buffer; it grows as needed */
+#define WBUF_INITSZ 1024
+
+
+static uint64_t s_nmsgs; /* messages read, process-wide */
+static uint64_t s_nfilt; /* messages dropped by receive filters, ditto */
+
 
 /* local helpers */
+static char *next_line(struct readctx *rctx, const struct rdfilter *filt);
+static bool filtered(const struct rdfilter *filt, const char *line,
+    const char *end);
 static char *find_delim(struct readctx *rctx);
 static int read_more(sckhld sh, struct readctx *rctx, uint64_t to_us);
+static bool reserve(struct writectx *wctx, size_t n);
 static bool write_str(sckhld sh, const char *str);
 static long read_wrap(sckhld sh, void *buf, size_t sz, uint64_t to_us);
-static long send_wrap(sckhld sh, const void *buf, size_t len);
+static long send_wrap(sckhld sh, const void *buf, size_t len, bool block);
 
 
 /* Documented in io.h */
 int
-lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
-    char **tags, size_t *ntags, uint64_t to_us)
+lsi_io_read_line(sckhld sh, struct readctx *rctx, char **line,
+    const struct rdfilter *filt, uint64_t to_us)
 {
 	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
 	uint64_t tnow, trem = 0;
@@ -51,39 +77,47 @@ lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
 	    tend?"":" no", to_us, rctx->eptr - rctx->wptr,
 	    (int)(rctx->eptr - rctx->wptr), rctx->wptr);
 
+	if (rctx->bad) { /* left over from lsi_io_read_batch() */
+		rctx->bad = false;
+		return -1;
+	}
+
 	while (rctx->wptr < rctx->eptr && ISDELIM(*rctx->wptr))
 		rctx->wptr++; /* skip leading line delimiters */
 	if (rctx->wptr == rctx->eptr) { /* empty buffer, use the opportunity.. */
-		rctx->wptr = rctx->eptr = rctx->workbuf;
+		rctx->wptr = rctx->eptr = rctx->sptr = rctx->buf;
 		V("Opportunistic buffer reset");
 	}
 
-	size_t linelen;
-	char *delim;
 	char *linestart;
-	do {
-		while (!(delim = find_delim(rctx))) {
-			if (tend) {
-				tnow = lsi_b_tstamp_us();
-				trem = tnow >= tend ? 1 : tend - tnow;
-			}
-
-			int r = read_more(sh, rctx, trem);
-			if (r <= 0)
-				return r;
+	while (!(linestart = next_line(rctx, filt))) {
+		if (tend) {
+			tnow = lsi_b_tstamp_us();
+			trem = tnow >= tend ? 1 : tend - tnow;
 		}
 
-		linestart = rctx->wptr;
-		linelen = delim - linestart;
-		rctx->wptr++;
-		V("Delim found, linelen %zu", linelen);
-	} while (linelen == 0);
-	rctx->wptr += linelen;
-
-	*delim = '\0';
+		int r = read_more(sh, rctx, trem);
+		if (r <= 0)
+			return r;
+	}
 
 	I("Read: '%s'", linestart);
 
+	*line = linestart;
+	s_nmsgs++;
+	return 1;
+}
+
+/* Documented in io.h */
+int
+lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
+    char **tags, size_t *ntags, const struct rdfilter *filt, uint64_t to_us)
+{
+	char *linestart;
+	int r = lsi_io_read_line(sh, rctx, &linestart, filt, to_us);
+	if (r <= 0)
+		return r;
+
 	if (linestart[0] == '@') {
 		linestart = lsi_ut_extract_tags(linestart + 1,
 		    tags, ntags);
@@ -95,14 +129,255 @@ lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
 	} else if (ntags)
 		*ntags = 0;
 
-	return lsi_ut_tokenize(linestart, tok) ? 1 : -1;
+	if (!lsi_ut_tokenize(linestart, tok))
+		return -1;
+
+	return 1;
+}
+
+/* Documented in io.h */
+int
+lsi_io_read_batch(sckhld sh, struct readctx *rctx, tokarr *toks,
+    char **tagstrs, size_t max, const struct rdfilter *filt, uint64_t to_us)
+{
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	uint64_t tnow, trem = 0;
+
+	V("Wanna batch-read (max %zu) with%s timeout (%"PRIu64"). "
+	    "%zu bytes in buffer", max, tend?"":" no", to_us,
+	    (size_t)(rctx->eptr - rctx->wptr));
+
+	if (!max)
+		return 0;
+
+	if (rctx->bad) {
+		rctx->bad = false;
+		return -1;
+	}
+
+	while (rctx->wptr < rctx->eptr && ISDELIM(*rctx->wptr))
+		rctx->wptr++; /* skip leading line delimiters */
+	if (rctx->wptr == rctx->eptr) { /* empty buffer, use the opportunity.. */
+		rctx->wptr = rctx->eptr = rctx->sptr = rctx->buf;
+		V("Opportunistic buffer reset");
+	}
+
+	/* only go to the socket if there isn't at least one complete line
+	 * buffered already; after that, take what we've got.  Note that
+	 * we must not call read_more() once we've handed out a line, since
+	 * it might overwrite the buffer contents underneath us */
+	char *line;
+	while (!(line = next_line(rctx, filt))) {
+		if (tend) {
+			tnow = lsi_b_tstamp_us();
+			trem = tnow >= tend ? 1 : tend - tnow;
+		}
+
+		int r = read_more(sh, rctx, trem);
+		if (r <= 0)
+			return r;
+	}
+
+	/* a bad line ends the batch.  if there's good ones before it, those
+	 * are handed out and the failure is reported by the next call */
+	size_t n = 0;
+	do {
+		I("Read: '%s'", line);
+
+		tagstrs[n] = NULL;
+		if (line[0] == '@') {
+			/* leave the tags alone (lsi_ut_extract_tags() will
+			 * split them later on), just skip over them */
+			char *end = strchr(line, ' ');
+			if (!end || !end[1]) {
+				E("protocol error (just tags?)");
+				goto bad;
+			}
+
+			tagstrs[n] = line + 1;
+			line = end + 1;
+		}
+
+		if (!lsi_ut_tokenize(line, &toks[n]))
+			goto bad;
+	} while (++n < max && (line = next_line(rctx, filt)));
+
+	D("Batch of %zu message(s), %zu bytes left in buffer",
+	    n, (size_t)(rctx->eptr - rctx->wptr));
+
+	s_nmsgs += n;
+
+	return (int)n;
+
+bad:
+	if (!n)
+		return -1;
+
+	D("Bad line after %zu message(s), failing next time", n);
+	rctx->bad = true;
+	s_nmsgs += n;
+	return (int)n;
+}
+
+/* Documented in io.h */
+bool
+lsi_io_rctx_init(struct readctx *rctx, size_t cap)
+{
+	if (!(rctx->buf = MALLOC(cap + MAX_LINE_LEN)))
+		return false;
+
+	rctx->cap = cap;
+	lsi_io_rctx_reset(rctx);
+	return true;
+}
+
+/* Documented in io.h */
+void
+lsi_io_rctx_reset(struct readctx *rctx)
+{
+	rctx->wptr = rctx->eptr = rctx->sptr = rctx->buf;
+	rctx->bad = rctx->skip = false;
+	return;
+}
+
+/* Documented in io.h */
+void
+lsi_io_rctx_dispose(struct readctx *rctx)
+{
+	free(rctx->buf);
+	rctx->buf = rctx->wptr = rctx->eptr = rctx->sptr = NULL;
+	rctx->cap = 0;
+	return;
+}
+
+/* Documented in io.h */
+uint64_t
+lsi_io_msgcount(bool reset)
+{
+	uint64_t r = s_nmsgs;
+	if (reset)
+		s_nmsgs = 0;
+	return r;
+}
+
+/* Documented in io.h */
+uint64_t
+lsi_io_filtcount(bool reset)
+{
+	uint64_t r = s_nfilt;
+	if (reset)
+		s_nfilt = 0;
+	return r;
+}
+
+/* Documented in io.h */
+void
+lsi_io_wctx_init(struct writectx *wctx)
+{
+	wctx->buf = NULL;
+	wctx->sz = wctx->off = wctx->len = 0;
+	return;
+}
+
+/* Documented in io.h */
+void
+lsi_io_wctx_reset(struct writectx *wctx)
+{
+	wctx->off = wctx->len = 0;
+	return;
+}
+
+/* Documented in io.h */
+void
+lsi_io_wctx_dispose(struct writectx *wctx)
+{
+	free(wctx->buf);
+	lsi_io_wctx_init(wctx);
+	return;
+}
+
+/* Documented in io.h */
+bool
+lsi_io_append(struct writectx *wctx, const void *buf, size_t n)
+{
+	if (!reserve(wctx, n))
+		return false;
+
+	memcpy(wctx->buf + wctx->len, buf, n);
+	wctx->len += n;
+	return true;
+}
+
+/* Documented in io.h */
+bool
+lsi_io_vappendf(struct writectx *wctx, const char *fmt, va_list vl)
+{
+	/* try with what room there is; if that's not enough, we know
+	 * exactly how much we need the second time around */
+	for (int i = 0; i < 2; i++) {
+		va_list vc;
+		va_copy(vc, vl);
+		size_t room = wctx->sz - wctx->len;
+		int r = vsnprintf(room ? wctx->buf + wctx->len : NULL, room,
+		    fmt, vc);
+		va_end(vc);
+
+		if (r < 0) {
+			EE("vsnprintf");
+			return false;
+		}
+
+		if ((size_t)r < room) {
+			wctx->len += (size_t)r;
+			return true;
+		}
+
+		if (!reserve(wctx, (size_t)r + 1))
+			return false;
+	}
+
+	return false; // Can't happen
+}
+
+/* Documented in io.h */
+void
+lsi_io_truncate(struct writectx *wctx, size_t n)
+{
+	if (n < wctx->len - wctx->off)
+		wctx->len = wctx->off + n;
+
+	return;
+}
+
+/* Documented in io.h */
+int
+lsi_io_flush(sckhld sh, struct writectx *wctx, bool block)
+{
+	if (wctx->off == wctx->len)
+		return 1;
+
+	const char *data = wctx->buf + wctx->off;
+	size_t n = wctx->len - wctx->off;
+	long r = send_wrap(sh, data, n, block);
+	if (r < 0) {
+		W("Failed to write '%.*s'", (int)n, data);
+		return -1;
+	}
+
+	I("Wrote (%ld/%zu bytes): '%.*s'", r, n, (int)r, data);
+	wctx->off += (size_t)r;
+	if (wctx->off < wctx->len)
+		return 0;
+
+	wctx->off = wctx->len = 0;
+	return 1;
 }
 
 /* Documented in io.h */
 bool
 lsi_io_write(sckhld sh, const void *buf, size_t n)
 {
-	long r = send_wrap(sh, buf, n);
+	long r = send_wrap(sh, buf, n, true);
 	bool suc = r >= 0 && (size_t)r == n;
 
 	if (suc)
@@ -113,40 +388,151 @@ lsi_io_write(sckhld sh, const void *buf, size_t n)
 	return suc;
 }
 
-/* return pointer to first line delim in our receive buffer, or NULL if none */
+/* return the next complete, non-empty line in our receive buffer (\0-terminated
+ * and consumed), or NULL if there is none.  lines longer than MAX_LINE_LEN
+ * (with CRLF) are dropped, even if we only get to see the end of them later */
 static char *
-find_delim(struct readctx *rctx)
+next_line(struct readctx *rctx, const struct rdfilter *filt)
+{
+	char *delim;
+	while ((delim = find_delim(rctx))) {
+		char *linestart = rctx->wptr;
+		rctx->wptr = delim + 1;
+		if (rctx->skip) { /* the rest of an overlong line */
+			rctx->skip = false;
+			continue;
+		}
+
+		if (delim - linestart > MAX_LINE_LEN - 2) {
+			W("Dropping overlong line (%zu bytes)",
+			    (size_t)(delim - linestart));
+			continue;
+		}
+
+		if (delim > linestart && !filtered(filt, linestart, delim)) {
+			*delim = '\0';
+			return linestart;
+		}
+	}
+
+	/* if what we've got can't become a line we'd take anymore, there's
+	 * no point in keeping it around */
+	if (rctx->eptr - rctx->wptr > MAX_LINE_LEN - 2) {
+		W("Dropping overlong line (%zu bytes so far)",
+		    (size_t)(rctx->eptr - rctx->wptr));
+		rctx->wptr = rctx->eptr;
+		rctx->skip = true;
+	}
+
+	return NULL;
+}
+
+/* peek at the command of the line [line, end) and ask the receive filter
+ * (if any) whether we want it.  lines we can't make sense of are kept, so
+ * that the tokenizer gets to complain about them */
+static bool
+filtered(const struct rdfilter *filt, const char *line, const char *end)
+{
+	if (!filt)
+		return false;
+
+	const char *cmd = line;
+	if (*cmd == '@' && (cmd = memchr(cmd, ' ', end - cmd)))
+		cmd++; /* skip the tags */
+
+	if (cmd && cmd < end && *cmd == ':' && (cmd = memchr(cmd, ' ', end - cmd)))
+		cmd++; /* skip the prefix */
+
+	if (!cmd || cmd >= end || *cmd == ' ')
+		return false;
+
+	const char *cend = memchr(cmd, ' ', end - cmd);
+	if (!cend)
+		cend = end;
+
+	if (filt->want(filt->arg, cmd, cend - cmd))
+		return false;
+
+	V("Filtered: '%.*s'", (int)(end - line), line);
+	s_nfilt++;
+	return true;
+}
+
+/* Documented in io.h */
+char *
+lsi_io_scan_delim(char *ptr, char *end)
 {
-	*rctx->eptr = '\0'; // for tracing
-	for (char *ptr = rctx->wptr; ptr < rctx->eptr; ptr++)
+#ifdef SCAN_AVX2
+	const __m256i cr32 = _mm256_set1_epi8('\r');
+	const __m256i lf32 = _mm256_set1_epi8('\n');
+	for (; end - ptr >= 32; ptr += 32) {
+		__m256i v = _mm256_loadu_si256((const __m256i *)ptr);
+		unsigned m = (unsigned)_mm256_movemask_epi8(_mm256_or_si256(
+		    _mm256_cmpeq_epi8(v, cr32), _mm256_cmpeq_epi8(v, lf32)));
+		if (m)
+			return ptr + __builtin_ctz(m);
+	}
+#endif
+#ifdef SCAN_SSE2
+	const __m128i cr16 = _mm_set1_epi8('\r');
+	const __m128i lf16 = _mm_set1_epi8('\n');
+	for (; end - ptr >= 16; ptr += 16) {
+		__m128i v = _mm_loadu_si128((const __m128i *)ptr);
+		unsigned m = (unsigned)_mm_movemask_epi8(_mm_or_si128(
+		    _mm_cmpeq_epi8(v, cr16), _mm_cmpeq_epi8(v, lf16)));
+		if (m)
+			return ptr + __builtin_ctz(m);
+	}
+#endif
+	for (; ptr < end; ptr++)
 		if (ISDELIM(*ptr))
 			return ptr;
 	return NULL;
 }
 
+/* return pointer to first line delim in our receive buffer, or NULL if none.
+ * remembers how far we got, so that data which arrives in several pieces
+ * isn't scanned over and over again */
+static char *
+find_delim(struct readctx *rctx)
+{
+	if (rctx->sptr < rctx->wptr)
+		rctx->sptr = rctx->wptr;
+
+	char *delim = lsi_io_scan_delim(rctx->sptr, rctx->eptr);
+	rctx->sptr = delim ? delim : rctx->eptr;
+	return delim;
+}
+
 /* attempt to read more data from the ircd into our read buffer.
  * returns 1 if something was read; 0 on timeout; -1 on failure */
 static int
 read_more(sckhld sh, struct readctx *rctx, uint64_t to_us)
 {
-	/* no sizeof rctx->workbuf here because it's one bigger than WORKBUF_SZ
-	 * and we don't want to fill the last byte with data; it's a dummy */
-	size_t remain = WORKBUF_SZ - (rctx->eptr - rctx->workbuf);
-	if (!remain) { /* no more space left in receive buffer */
-		D("Buffer is full");
-		if (rctx->wptr == rctx->workbuf) { /* completely full */
-			E("input too long");
-			return -1;
-		}
+	char *rend = rctx->buf + rctx->cap; /* end of the ring proper */
+
+	if (rctx->wptr >= rend) {
+		/* everything up to the end of the ring has been consumed, and
+		 * whatever was read beyond it has been mirrored to the front,
+		 * so we can just carry on there */
+		rctx->wptr -= rctx->cap;
+		rctx->eptr -= rctx->cap;
+		rctx->sptr = rctx->sptr >= rend ?
+		    rctx->sptr - rctx->cap : rctx->wptr;
+		V("Wrapped around");
+	}
 
-		/* make additional room by moving data to the beginning */
-		size_t datalen = (size_t)(rctx->eptr - rctx->wptr);
-		memmove(rctx->workbuf, rctx->wptr, datalen);
-		rctx->wptr = rctx->workbuf;
-		rctx->eptr = &rctx->workbuf[datalen];
+	/* we can read up to the end of the mirror space, but not any further
+	 * than what can be mirrored to the front without clobbering data we
+	 * haven't processed yet */
+	char *lim = rend + MAX_LINE_LEN;
+	if (lim > rctx->wptr + rctx->cap)
+		lim = rctx->wptr + rctx->cap;
 
-		remain = WORKBUF_SZ - (rctx->eptr - rctx->workbuf);
-		D("Moved %zu bytes to the front; space: %zu", datalen, remain);
+	size_t remain = (size_t)(lim - rctx->eptr);
+	if (!remain) { /* no more space left in receive buffer */
+		E("input too long");
+		return -1;
 	}
 
 	V("Reading more data (max. %zu bytes, timeout: %"PRIu64, remain, to_us);
@@ -165,18 +551,58 @@ read_more(sckhld sh, struct readctx *rctx, uint64_t to_us)
 
 	V("Got %ld more bytes", n);
 
-	rctx->eptr += n;
+	char *neptr = rctx->eptr + n;
+	if (neptr > rend) { /* mirror what went past the end of the ring */
+		char *from = rctx->eptr > rend ? rctx->eptr : rend;
+		memcpy(rctx->buf + (from - rend), from, (size_t)(neptr - from));
+	}
+
+	rctx->eptr = neptr;
 	return 1;
 }
 
 
+/* make sure there's room for `n' more bytes in the send buffer */
+static bool
+reserve(struct writectx *wctx, size_t n)
+{
+	if (wctx->off == wctx->len)
+		wctx->off = wctx->len = 0;
+
+	if (wctx->sz - wctx->len >= n)
+		return true;
+
+	/* the room taken up by what has been sent already will do? */
+	if (wctx->off && wctx->sz - (wctx->len - wctx->off) >= n) {
+		memmove(wctx->buf, wctx->buf + wctx->off,
+		    wctx->len - wctx->off);
+		wctx->len -= wctx->off;
+		wctx->off = 0;
+		return true;
+	}
+
+	size_t nsz = wctx->sz ? wctx->sz : WBUF_INITSZ;
+	while (nsz - wctx->len < n)
+		nsz *= 2;
+
+	char *nbuf = realloc(wctx->buf, nsz);
+	if (!nbuf) {
+		EE("realloc %zu -> %zu", wctx->sz, nsz);
+		return false;
+	}
+
+	wctx->buf = nbuf;
+	wctx->sz = nsz;
+	return true;
+}
+
 /* write a string to a socket. the underlying write function ensures that
  * everything is sent, well, buffered.
  * returns true on success, false on failure */
 static bool
 write_str(sckhld sh, const char *str)
 {
-	return send_wrap(sh, str, strlen(str)) > 0;
+	return send_wrap(sh, str, strlen(str), true) > 0;
 }
 
 /* wrap around either read() or SSL_read(), depending on whether
@@ -191,9 +617,9 @@ read_wrap(sckhld sh, void *buf, size_t sz, uint64_t to_us)
 
 /* likewise for send()/SSL_write() */
 static long
-send_wrap(sckhld sh, const void *buf, size_t len)
+send_wrap(sckhld sh, const void *buf, size_t len, bool block)
 {
 	if (sh.shnd)
-		return lsi_b_write_ssl(sh.shnd, buf, len);
-	return lsi_b_write(sh.sck, buf, len);
+		return lsi_b_write_ssl(sh.shnd, buf, len, block);
+	return lsi_b_write(sh.sck, buf, len, block);
 }
@@ -6,12 +6,50 @@
 #define LIBSRSIRC_IO_H 1
 
 
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 
 #include <libsrsirc/defs.h>
 #include "intdefs.h"
 
+/* lsi_io_rctx_init
+ * Allocate the receive buffer of a read context and reset it
+ *
+ * Params: `rctx': Read context to initialize
+ *         `cap':  Receive buffer capacity in bytes, should be at least
+ *                     MAX_LINE_LEN, or else long lines can't be read
+ *
+ * Returns true on success, false on failure (allocation failed)
+ */
+bool lsi_io_rctx_init(struct readctx *rctx, size_t cap);
+
+/* lsi_io_rctx_reset
+ * Discard whatever is in a read context's receive buffer */
+void lsi_io_rctx_reset(struct readctx *rctx);
+
+/* lsi_io_rctx_dispose
+ * Free the receive buffer of a read context */
+void lsi_io_rctx_dispose(struct readctx *rctx);
+
+/* lsi_io_read_line
+ * Read one line from the ircd, without tokenizing it.
+ *
+ * Params: `sh':    Structure holding socket and, if enabled, SSL handle
+ *         `rctx':  Read context structure primarily holding the read buffer
+ *         `line':  Points to the '\0'-terminated line (without the line
+ *                      delimiter, possibly starting with IRCv3 tags) on
+ *                      success.  It lives in the receive buffer and stays
+ *                      valid until the next read.
+ *         `filt':  Receive filter, or NULL
+ *         `to_us': Timeout in microseconds (0 = no timeout)
+ *
+ * Returns 1 on success; 0 on timeout; -1 on failure
+ */
+int lsi_io_read_line(sckhld sh, struct readctx *rctx, char **line,
+    const struct rdfilter *filt, uint64_t to_us);
+
 /* lsi_io_read
  * Read one message from the ircd, tokenize and populate `tok' with the results.
  *
@@ -25,12 +63,128 @@
  *                  (*tok)[1] will point to the (mandatory) "command"
  *                  (*tok)[2+n] will point to the n-th "argument", if it
  *                      exists; NULL otherwise (for 0 <= n < sizeof *tok - 2)
+ *         `filt':  Receive filter, or NULL.  Lines it doesn't want are
+ *                      skipped without being tokenized
  *         `to_us': Timeout in microseconds (0 = no timeout)
  *
  * Returns 1 on success; 0 on timeout; -1 on failure
  */
 int lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
-    char **tags, size_t *ntags, uint64_t to_us); // XXX
+    char **tags, size_t *ntags, const struct rdfilter *filt,
+    uint64_t to_us); // XXX
+
+/* lsi_io_read_batch
+ * Like lsi_io_read(), but hand out every complete message that is in the
+ * receive buffer (up to `max'), rather than just one.  The socket is only
+ * read from if there isn't a single complete message buffered yet.
+ *
+ * Params: `sh':      Structure holding socket and, if enabled, SSL handle
+ *         `rctx':    Read context structure primarily holding the read buffer
+ *         `toks':    Array of (at least) `max' result arrays (see lsi_io_read)
+ *         `tagstrs': Array of (at least) `max' pointers, which are set to the
+ *                        raw IRCv3 tags of the respective message (suitable
+ *                        for lsi_ut_extract_tags()), or NULL if it had none
+ *         `max':     Maximum number of messages to hand out
+ *         `filt':    Receive filter, or NULL (see lsi_io_read)
+ *         `to_us':   Timeout in microseconds (0 = no timeout)
+ *
+ * The data pointed to is valid until the next call to either read function.
+ * If a bad line follows some good ones, the good ones are handed out and the
+ * next call to either read function fails.
+ *
+ * Returns number of messages read (>0); 0 on timeout; -1 on failure
+ */
+int lsi_io_read_batch(sckhld sh, struct readctx *rctx, tokarr *toks,
+    char **tagstrs, size_t max, const struct rdfilter *filt, uint64_t to_us);
+
+/* lsi_io_scan_delim
+ * Find the first line delimiter (\r or \n) in a range of memory.  This
+ * uses SSE2/AVX2 where available.  Exposed mainly for benchmarking purposes.
+ *
+ * Params: `ptr': Pointer to the first byte to scan
+ *         `end': Pointer to one after the last byte to scan
+ *
+ * Returns pointer to the first delimiter found, or NULL if there is none
+ */
+char *lsi_io_scan_delim(char *ptr, char *end);
+
+/* lsi_io_msgcount
+ * Tell how many messages have been read so far (process-wide)
+ *
+ * Params: `reset': If true, reset the count to zero afterwards
+ *
+ * Returns the number of messages read
+ */
+uint64_t lsi_io_msgcount(bool reset);
+
+/* lsi_io_filtcount
+ * Tell how many messages have been dropped by receive filters so far
+ * (process-wide).  These don't count towards lsi_io_msgcount()
+ *
+ * Params: `reset': If true, reset the count to zero afterwards
+ *
+ * Returns the number of messages dropped
+ */
+uint64_t lsi_io_filtcount(bool reset);
+
+/* lsi_io_wctx_init
+ * Set up an (empty) write context.  The send buffer is allocated as needed
+ *
+ * Params: `wctx': Write context to initialize */
+void lsi_io_wctx_init(struct writectx *wctx);
+
+/* lsi_io_wctx_reset
+ * Discard whatever is waiting to be sent */
+void lsi_io_wctx_reset(struct writectx *wctx);
+
+/* lsi_io_wctx_dispose
+ * Free the send buffer of a write context */
+void lsi_io_wctx_dispose(struct writectx *wctx);
+
+/* lsi_io_append
+ * Add data to the send buffer, without sending anything
+ *
+ * Params: `wctx': Write context
+ *         `buf':  Data to append
+ *         `n':    Size of the data in bytes
+ *
+ * Returns true on success, false on failure (allocation failed)
+ */
+bool lsi_io_append(struct writectx *wctx, const void *buf, size_t n);
+
+/* lsi_io_vappendf
+ * Like lsi_io_append(), but format the data right into the send buffer
+ *
+ * Params: `wctx': Write context
+ *         `fmt':  printf-style format string
+ *         `vl':   Arguments for `fmt'
+ *
+ * Returns true on success, false on failure (allocation failed)
+ */
+bool lsi_io_vappendf(struct writectx *wctx, const char *fmt, va_list vl);
+
+/* lsi_io_truncate
+ * Drop the data appended last, keeping only the first `n' bytes of what is
+ * waiting to be sent (i.e. of what hasn't been sent yet)
+ *
+ * Params: `wctx': Write context
+ *         `n':    Number of pending bytes to keep */
+void lsi_io_truncate(struct writectx *wctx, size_t n);
+
+/* lsi_io_flush
+ * Send what's in the send buffer to the ircd, using a single write call
+ * (unless the socket can't take it all at once)
+ *
+ * Params: `sh':    Structure holding socket and, if enabled, SSL handle
+ *         `wctx':  Write context
+ *         `block': If false, send only as much as the socket takes right
+ *                      now, and keep the rest for the next call.  If true,
+ *                      wait for the socket until everything is sent.
+ *
+ * Returns 1 if the send buffer is empty now, 0 if there's something left,
+ *         -1 on failure
+ */
+int lsi_io_flush(sckhld sh, struct writectx *wctx, bool block);
 
 /* lsi_io_write
  * Send buffer contents to the ircd
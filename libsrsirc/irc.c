@@ -10,6 +10,8 @@
 
 
 #include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_msgb.h>
 
 #include <inttypes.h>
 #include <stdio.h>
@@ -17,6 +19,7 @@
 #include <string.h>
 
 #include <platform/base_misc.h>
+#include <platform/base_net.h>
 #include <platform/base_string.h>
 #include <platform/base_time.h>
 
@@ -24,9 +27,14 @@
 
 #include "common.h"
 #include "conn.h"
+#include "dnscache.h"
+#include "dstat.h"
+#include "io.h"
 #include "irc_msghnd.h"
 #include "irc_track_int.h"
+#include "loop.h"
 #include "msg.h"
+#include "sendq.h"
 #include "skmap.h"
 #include "v3.h"
 
@@ -36,6 +44,10 @@
 
 static bool send_logon(irc *ctx);
 static void reset_state(irc *ctx);
+static int connected(irc *ctx, int r);
+static int logon_step(irc *ctx);
+static bool handle_batch(irc *ctx, tokarr *toks, char **tagstrs, int r,
+    int *n);
 
 irc *
 irc_init(void)
@@ -58,9 +70,23 @@ irc_init(void)
 
 	r->msghnds = NULL;
 	r->uprehnds = r->uposthnds = NULL;
+	lsi_msg_initidx(r);
+	r->rfilt = NULL;
+	r->rfilt_cnt = 0;
+	r->rdfilt.want = lsi_msg_wanted;
+	r->rdfilt.arg = r;
+	r->dstats = NULL;
+	r->dstats_on = false;
 	r->chans = r->users = NULL;
+	r->cpool = r->upool = r->mpool = NULL;
+	r->strs = NULL;
 	r->m005chantypes = NULL;
 	r->m005attrs = NULL;
+	r->loopent = NULL;
+	r->sendq = NULL;
+	r->msgb.ctx = r;
+	r->msgb.state = MB_IDLE;
+	r->connecting = false;
 
 	lsi_v3_init_caps(r);
 
@@ -93,7 +119,10 @@ irc_init(void)
 		r->v3tags_dec[i][0] = '\0';
 	}
 
-	if (!(r->m005attrs = lsi_skmap_init(256, CMAP_ASCII)))
+	if (!(r->m005attrs = lsi_skmap_init(64, CMAP_ASCII)))
+		goto fail;
+
+	if (!(r->sendq = lsi_sq_init()))
 		goto fail;
 
 	lsi_b_strNcpy(r->m005chantypes, "#&", MAX_005_CHTYP);
@@ -148,6 +177,7 @@ irc_init(void)
 	r->serv_type = DEF_SERV_TYPE;
 	r->scto_us = DEF_SCTO_US;
 	r->hcto_us = DEF_HCTO_US;
+	r->cstagger_us = DEF_CSTAGGER_US;
 	r->dumb = false;
 	r->tracking_enab = r->tracking = false;
 	r->endofnames = false;
@@ -169,6 +199,8 @@ fail:
 		free(r->msghnds);
 		free(r->uprehnds);
 		free(r->uposthnds);
+		lsi_msg_disposeidx(r);
+		free(r->rfilt);
 		free(r->m005chantypes);
 		for (size_t i = 0; i < COUNTOF(r->m005chanmodes); i++)
 			free(r->m005chanmodes[i]);
@@ -177,6 +209,7 @@ fail:
 		for (size_t i = 0; i < COUNTOF(r->v3tags_dec); i++)
 			free(r->v3tags_dec[i]);
 		lsi_skmap_dispose(r->m005attrs);
+		lsi_sq_dispose(r->sendq);
 	}
 
 	if (con)
@@ -188,13 +221,18 @@ fail:
 void
 irc_reset(irc *ctx)
 {
+	lsi_loop_detach(ctx);
+	ctx->connecting = false;
+	irc_msgb_abort(&ctx->msgb);
 	lsi_conn_reset(ctx->con);
+	lsi_sq_reset(ctx->sendq); // the next server will have a fresh clock
 	return;
 }
 
 void
 irc_dispose(irc *ctx)
 {
+	lsi_loop_detach(ctx);
 	lsi_trk_deinit(ctx);
 	lsi_conn_dispose(ctx->con);
 	free(ctx->lasterr);
@@ -210,6 +248,10 @@ irc_dispose(irc *ctx)
 	free(ctx->msghnds);
 	free(ctx->uprehnds);
 	free(ctx->uposthnds);
+	lsi_msg_disposeidx(ctx);
+	free(ctx->rfilt);
+	lsi_dstat_dispose(ctx);
+	lsi_sq_dispose(ctx->sendq);
 
 	for (size_t i = 0; i < COUNTOF(ctx->logonconv); i++)
 		lsi_ut_freearr(ctx->logonconv[i]);
@@ -240,22 +282,58 @@ irc_dispose(irc *ctx)
 bool
 irc_connect(irc *ctx)
 {
-	uint64_t tend = ctx->hcto_us ?
-	    lsi_b_tstamp_us() + ctx->hcto_us : 0;
+	int r = irc_connect_start(ctx);
+	while (r == 0) {
+		int fds[MAX_CONATTEMPTS];
+		bool wantwr;
+		uint64_t to_us;
+		size_t nfds = irc_connect_fds(ctx, fds, COUNTOF(fds), &wantwr,
+		    &to_us);
+		if (nfds && lsi_b_select(fds, nfds, true, !wantwr, to_us) == -1) {
+			irc_reset(ctx);
+			return false;
+		}
+
+		r = irc_connect_step(ctx);
+	}
+
+	return r == 1;
+}
+
+int
+irc_connect_start(irc *ctx)
+{
+	if (ctx->connecting) {
+		E("connection attempt already in progress");
+		return -1;
+	}
+
+	ctx->contend = ctx->hcto_us ? lsi_b_tstamp_us() + ctx->hcto_us : 0;
 
 	lsi_trk_deinit(ctx);
 	ctx->tracking_enab = false;
 
 	lsi_imh_unregall(ctx);
 	if (!lsi_imh_regall(ctx, ctx->dumb))
-		return false;
+		return -1;
 
 	lsi_v3_unregall(ctx);
 	if (!lsi_v3_regall(ctx, ctx->dumb))
-		return false;
+		return -1;
 
 	reset_state(ctx);
 
+	/* we start out assuming RFC1459 case mapping, and switch over if
+	 * 005 CASEMAPPING tells otherwise (see handle_005_CASEMAPPING()) */
+	if (ctx->tracking) {
+		if (!lsi_trk_init(ctx))
+			E("failed to enable tracking");
+		else {
+			ctx->tracking_enab = true;
+			I("tracking enabled");
+		}
+	}
+
 	for (size_t i = 0; i < COUNTOF(ctx->logonconv); i++) {
 		lsi_ut_freearr(ctx->logonconv[i]);
 		ctx->logonconv[i] = NULL;
@@ -266,109 +344,173 @@ irc_connect(irc *ctx)
 		do free(v); while (lsi_skmap_next(ctx->m005attrs, NULL, &v));
 	lsi_skmap_clear(ctx->m005attrs);
 
-	if (!lsi_conn_connect(ctx->con, ctx->scto_us, ctx->hcto_us))
-		return false;
+	ctx->connecting = true;
+	ctx->logon_sent = ctx->logged_on = ctx->sasl_authed = false;
 
-	I("connection established");
-
-	if (ctx->dumb)
-		return true;
+	return connected(ctx,
+	    lsi_conn_connect_start(ctx->con, ctx->scto_us, ctx->hcto_us,
+	    ctx->cstagger_us));
+}
 
-	bool logon_sent = false;
-	if (ctx->starttls_first) {
-		if (!lsi_conn_write(ctx->con, "STARTTLS\r\n"))
-			goto fail;
-	} else {
-		logon_sent = true;
-		if (!send_logon(ctx))
-			goto fail;
-		I("IRC logon sequence sent");
+int
+irc_connect_step(irc *ctx)
+{
+	if (!ctx->connecting) {
+		E("no connection attempt in progress");
+		return -1;
 	}
 
-	STRACPY(ctx->mynick, ctx->nick);
-	tokarr msg;
+	if (!lsi_conn_online(ctx->con))
+		return connected(ctx, lsi_conn_connect_step(ctx->con));
 
-	bool logged_on = false;
-	bool using_sasl = ctx->sasl_mech && ctx->sasl_msg;
-	bool sasl_authed = false;
-	uint64_t trem = 0;
-	int r;
-	do {
-		if (lsi_com_check_timeout(tend, &trem)) {
-			W("timeout waiting for 004");
-			goto fail;
-		}
+	return logon_step(ctx);
+}
 
-		if ((r = lsi_conn_read(ctx->con, &msg, NULL, NULL, trem)) < 0)
-			goto fail;
+size_t
+irc_connect_fds(irc *ctx, int *fds, size_t fdsz, bool *wantwr,
+    uint64_t *to_us)
+{
+	*wantwr = false;
+	*to_us = 0;
+	if (!ctx->connecting)
+		return 0;
 
-		if (r == 0)
-			continue;
+	if (!lsi_conn_online(ctx->con))
+		return lsi_conn_connect_fds(ctx->con, fds, fdsz, wantwr, to_us);
 
-		if (ctx->cb_con_read &&
-		    !ctx->cb_con_read(&msg, ctx->tag_con_read)) {
-			W("logon prohibited by conread");
-			goto fail;
-		}
+	if (lsi_com_check_timeout(ctx->contend, to_us))
+		*to_us = 1;
 
-		size_t ac = 2;
-		while (ac < COUNTOF(msg) && msg[ac])
-			ac++;
+	/* with nbwrite on, some of what we sent to log on (NICK, USER, CAP)
+	 * may still be waiting for the socket to take it */
+	*wantwr = lsi_conn_pending(ctx->con) > 0;
 
-		/* these are the protocol messages we deal with.
-		 * seeing 004 or 383 makes us consider ourselves logged on
-		 * note that we do not wait for 005, but we will later
-		 * parse it as we ran across it. */
-		uint16_t flags = lsi_msg_handle(ctx, &msg, true);
+	if (!fdsz)
+		return 0;
 
-		if (flags & CANT_PROCEED)
-			goto fail;
+	fds[0] = lsi_conn_sockfd(ctx->con);
+	return 1;
+}
 
-		if (flags & LOGON_COMPLETE)
-			logged_on = true;
+int
+irc_read(irc *ctx, tokarr *tok, uint64_t to_us)
+{
+	/* Allow to be called with tok == NULL if we don't need the result */
+	tokarr dummy;
+	if (!tok)
+		tok = &dummy;
 
-		if (flags & SASL_COMPLETE)
-			sasl_authed = true;
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	for (;;) {
+		for (size_t i = 0; i < COUNTOF(ctx->v3tags_dec); i++)
+			ctx->v3tags_dec[i][0] = '\0';
+		ctx->v3ntags = COUNTOF(ctx->v3tags_raw);
 
-		if (flags & STARTTLS_OVER && !logon_sent) {
-			if (!send_logon(ctx))
-				goto fail;
-			logon_sent = true;
+		int r = lsi_conn_read(ctx->con, tok, ctx->v3tags_raw,
+		    &ctx->v3ntags, ctx->rfilt ? &ctx->rdfilt : NULL, to_us);
+
+		if (r == 0)
+			return 0;
+
+		if (r < 0) {
+			irc_reset(ctx);
+			return -1;
 		}
 
-	} while (!logged_on || (using_sasl && !sasl_authed));
+		/* whatever the handlers send goes out in one go afterwards */
+		lsi_conn_cork(ctx->con);
+		uint16_t flags = lsi_msg_handle(ctx, tok, false);
+		if (!lsi_conn_uncork(ctx->con) || flags & CANT_PROCEED) {
+			irc_reset(ctx);
+			return -1;
+		}
 
-	N("logged on to IRC");
-	return true;
+		/* with a receive filter, messages which only got through
+		 * because we handle them ourselves aren't for the user */
+		if (lsi_msg_deliver(ctx, (*tok)[1]))
+			return 1;
 
-fail:
-	irc_reset(ctx);
-	return false;
+		if (tend) {
+			uint64_t tnow = lsi_b_tstamp_us();
+			to_us = tnow >= tend ? 1 : tend - tnow;
+		}
+	}
 }
 
 int
-irc_read(irc *ctx, tokarr *tok, uint64_t to_us)
+irc_read_batch(irc *ctx, tokarr *toks, size_t max, uint64_t to_us)
 {
-	/* Allow to be called with tok == NULL if we don't need the result */
-	tokarr dummy;
-	if (!tok)
-		tok = &dummy;
+	char *tagstrs[MAX_RDBATCH];
+	if (max > COUNTOF(tagstrs))
+		max = COUNTOF(tagstrs);
 
-	for (size_t i = 0; i < COUNTOF(ctx->v3tags_dec); i++)
-		ctx->v3tags_dec[i][0] = '\0';
-	ctx->v3ntags = COUNTOF(ctx->v3tags_raw);
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	int n = 0;
+	do {
+		int r = lsi_conn_read_batch(ctx->con, toks, tagstrs, max,
+		    ctx->rfilt ? &ctx->rdfilt : NULL, to_us);
+
+		if (r == 0)
+			return 0;
 
-	int r = lsi_conn_read(ctx->con, tok, ctx->v3tags_raw, &ctx->v3ntags, to_us);
+		if (r < 0) {
+			irc_reset(ctx);
+			return -1;
+		}
 
-	if (r == 0)
-		return 0;
+		if (!handle_batch(ctx, toks, tagstrs, r, &n))
+			return -1;
+
+		if (tend) {
+			uint64_t tnow = lsi_b_tstamp_us();
+			to_us = tnow >= tend ? 1 : tend - tnow;
+		}
+	} while (!n);
 
-	if (r < 0 || lsi_msg_handle(ctx, tok, false) & CANT_PROCEED) {
+	return n;
+}
+
+/* process the `r' messages we just read into `toks'.  the ones that are to
+ * be handed out to the user are moved to the front, and counted in `*n'.
+ * returns false if we had to irc_reset() */
+static bool
+handle_batch(irc *ctx, tokarr *toks, char **tagstrs, int r, int *n)
+{
+	/* whatever the handlers send goes out in one go afterwards */
+	lsi_conn_cork(ctx->con);
+	for (int i = 0; i < r; i++) {
+		for (size_t j = 0; j < COUNTOF(ctx->v3tags_dec); j++)
+			ctx->v3tags_dec[j][0] = '\0';
+
+		ctx->v3ntags = COUNTOF(ctx->v3tags_raw);
+		if (tagstrs[i])
+			lsi_ut_extract_tags(tagstrs[i],
+			    ctx->v3tags_raw, &ctx->v3ntags);
+		else
+			ctx->v3ntags = 0;
+
+		lsi_conn_upd_colon_trail(ctx->con, &toks[i]);
+
+		if (lsi_msg_handle(ctx, &toks[i], false) & CANT_PROCEED) {
+			irc_reset(ctx);
+			return false;
+		}
+
+		/* see irc_read() */
+		if (!lsi_msg_deliver(ctx, toks[i][1]))
+			continue;
+
+		if (*n != i)
+			memcpy(toks[*n], toks[i], sizeof toks[i]);
+		(*n)++;
+	}
+
+	if (!lsi_conn_uncork(ctx->con)) {
 		irc_reset(ctx);
-		return -1;
+		return false;
 	}
 
-	return 1;
+	return true;
 }
 
 bool
@@ -384,6 +526,8 @@ irc_write(irc *ctx, const char *line)
 
 	if (!r)
 		irc_reset(ctx);
+	else
+		lsi_loop_update(ctx);
 
 	return r;
 }
@@ -391,71 +535,175 @@ irc_write(irc *ctx, const char *line)
 bool
 irc_printf(irc *ctx, const char *fmt, ...)
 {
-	char buf[1024];
-
 	va_list vl;
 	va_start(vl, fmt);
-	vsnprintf(buf, sizeof buf, fmt, vl);
+	bool r = lsi_conn_vprintf(ctx->con, fmt, vl);
 	va_end(vl);
 
-	return irc_write(ctx, buf);
+	if (!r)
+		irc_reset(ctx);
+	else
+		lsi_loop_update(ctx);
+
+	return r;
 }
 
+bool
+irc_flush(irc *ctx)
+{
+	bool r = lsi_conn_flush(ctx->con);
 
-static bool
-send_logon(irc *ctx)
+	if (!r)
+		irc_reset(ctx);
+	else
+		lsi_loop_update(ctx);
+
+	return r;
+}
+
+bool
+irc_wantwrite(irc *ctx)
 {
-	if (!lsi_conn_online(ctx->con))
+	return lsi_conn_pending(ctx->con) > 0;
+}
+
+size_t
+irc_pending_output(irc *ctx)
+{
+	return lsi_conn_pending(ctx->con);
+}
+
+bool
+irc_congested(irc *ctx)
+{
+	return lsi_conn_pending(ctx->con) >= lsi_conn_get_sndhiwat(ctx->con);
+}
+
+bool
+irc_sendq(irc *ctx, const char *line, int prio)
+{
+	if (!lsi_sq_add(ctx->sendq, line, prio)) {
+		E("failed to queue '%s'", line);
 		return false;
-	char aBuf[512];
-	char *pBuf = aBuf;
-	aBuf[0] = '\0';
-	size_t rem = sizeof aBuf;
-	int r;
-
-	/* XXX use strNcat? STRACAT? invent STRAPRINTF?  this clearly sucks */
-	if (lsi_v3_want_caps(ctx)) {
-		r = snprintf(pBuf, rem, "CAP LS 302\r\n");
-		if (r > (int)rem)
-			r = rem;
-
-		rem -= r;
-		pBuf += r;
 	}
 
-	if (!rem)
+	return irc_sendq_run(ctx) != -1;
+}
+
+bool
+irc_sendq_printf(irc *ctx, int prio, const char *fmt, ...)
+{
+	char buf[SENDQ_PRINTF_MAX];
+	va_list vl;
+	va_start(vl, fmt);
+	int r = vsnprintf(buf, sizeof buf, fmt, vl);
+	va_end(vl);
+
+	if (r < 0 || (size_t)r >= sizeof buf) {
+		E("not queueing overlong line '%.32s...'", buf);
 		return false;
+	}
 
-	if (ctx->pass && strlen(ctx->pass) > 0) {
-		r = snprintf(pBuf, rem, "PASS :%s\r\n", ctx->pass);
-		if (r > (int)rem)
-			r = rem;
+	return irc_sendq(ctx, buf, prio);
+}
+
+int
+irc_sendq_run(irc *ctx)
+{
+	if (!lsi_conn_online(ctx->con))
+		return 0;
+
+	/* whatever is due goes out in one piece */
+	int n = 0;
+	const char *line;
+	lsi_conn_cork(ctx->con);
+	while (!irc_congested(ctx)
+	    && (line = lsi_sq_peek(ctx->sendq, NULL))) {
+		if (!lsi_conn_write(ctx->con, line)) {
+			irc_reset(ctx);
+			return -1;
+		}
 
-		rem -= r;
-		pBuf += r;
+		lsi_sq_pop(ctx->sendq);
+		n++;
 	}
 
-	if (!rem)
+	if (!lsi_conn_uncork(ctx->con)) {
+		irc_reset(ctx);
+		return -1;
+	}
+
+	if (n)
+		D("sent %d line(s) from the send queue, %zu left",
+		    n, lsi_sq_count(ctx->sendq));
+
+	lsi_loop_update(ctx);
+	return n;
+}
+
+uint64_t
+irc_sendq_next(irc *ctx)
+{
+	return lsi_sq_next(ctx->sendq);
+}
+
+size_t
+irc_sendq_len(irc *ctx)
+{
+	return lsi_sq_count(ctx->sendq);
+}
+
+size_t
+irc_sendq_bytes(irc *ctx)
+{
+	return lsi_sq_bytes(ctx->sendq);
+}
+
+bool
+irc_sendq_full(irc *ctx)
+{
+	return lsi_sq_full(ctx->sendq, SENDQ_PRINTF_MAX);
+}
+
+void
+irc_sendq_clear(irc *ctx)
+{
+	lsi_sq_clear(ctx->sendq);
+	return;
+}
+
+
+static bool
+send_logon(irc *ctx)
+{
+	if (!lsi_conn_online(ctx->con))
 		return false;
 
-	if (ctx->service) {
-		r = snprintf(pBuf, rem, "SERVICE %s 0 %s %ld 0 :%s\r\n",
-		    ctx->nick, ctx->serv_dist, ctx->serv_type,
-		    ctx->serv_info);
-	} else {
-		r = snprintf(pBuf, rem, "NICK %s\r\nUSER %s %u * :%s\r\n",
-		    ctx->nick, ctx->uname, ctx->conflags, ctx->fname);
-	}
+	/* the whole sequence goes out in one piece */
+	iconn *con = ctx->con;
+	lsi_conn_cork(con);
 
-	if (r > (int)rem) {
-		r = rem;
+	if (lsi_v3_want_caps(ctx) && !lsi_conn_printf(con, "CAP LS 302"))
 		return false;
-	}
 
-	rem -= r;
-	pBuf += r;
+	if (ctx->pass && strlen(ctx->pass) > 0
+	    && !lsi_conn_printf(con, "PASS :%s", ctx->pass))
+		return false;
+
+	if (ctx->service) {
+		if (!lsi_conn_printf(con, "SERVICE %s 0 %s %ld 0 :%s",
+		    ctx->nick, ctx->serv_dist, ctx->serv_type,
+		    ctx->serv_info))
+			return false;
+	} else if (!lsi_conn_printf(con, "NICK %s", ctx->nick)
+	    || !lsi_conn_printf(con, "USER %s %u * :%s",
+	    ctx->uname, ctx->conflags, ctx->fname))
+		return false;
 
-	return irc_write(ctx, aBuf);
+	/* we're about to wait for the reply, so autoflush or not, this
+	 * has to go out now */
+	lsi_conn_uncork(con);
+	return lsi_conn_flush(con);
 }
 
 void
@@ -479,11 +727,87 @@ irc_reg_msghnd(irc *ctx, const char *cmd, uhnd_fn hndfn, bool pre)
 	return lsi_msg_reguhnd(ctx, cmd, hndfn, pre);
 }
 
+bool
+irc_set_stats(irc *ctx, bool on)
+{
+	return lsi_dstat_enable(ctx, on);
+}
+
+size_t
+irc_stats(irc *ctx, struct irc_statent *dest, size_t destsz, bool reset)
+{
+	return lsi_dstat_get(ctx, dest, destsz, reset);
+}
+
+bool
+irc_set_recv_filter(irc *ctx, const char *const *cmds, size_t ncmds)
+{
+	return lsi_msg_setfilter(ctx, cmds, ncmds);
+}
+
+void
+irc_iostats(struct irc_iostats *dest, bool reset)
+{
+	struct iostats st;
+	lsi_b_iostats(&st, reset);
+	uint64_t nmsgs = lsi_io_msgcount(reset);
+	uint64_t nfilt = lsi_io_filtcount(reset);
+
+	if (dest) {
+		dest->nmsgs = nmsgs;
+		dest->nfiltered = nfilt;
+		dest->nread = st.nread;
+		dest->nreadwb = st.nreadwb;
+		dest->nselect = st.nselect;
+		dest->nwrite = st.nwrite;
+		dest->nsslhs = st.nsslhs;
+		dest->nsslres = st.nsslres;
+	}
+	return;
+}
+
+void
+irc_set_dnscache(uint64_t ttl_us, uint64_t stale_us)
+{
+	lsi_dns_config(ttl_us, stale_us);
+	return;
+}
+
+void
+irc_dnscache_flush(void)
+{
+	lsi_dns_flush();
+	return;
+}
+
+bool
+irc_dnscache_revalidate(void)
+{
+	return lsi_dns_revalidate();
+}
+
+void
+irc_dnsstats(struct irc_dnsstats *dest, bool reset)
+{
+	struct dnsstats st;
+	lsi_dns_stats(&st, reset);
+
+	if (dest) {
+		dest->nhit = st.nhit;
+		dest->nstale = st.nstale;
+		dest->nmiss = st.nmiss;
+		dest->nresolv = st.nresolv;
+		dest->nfail = st.nfail;
+	}
+	return;
+}
+
 void
 irc_dump(irc *ctx)
 {
 	N("--- IRC context %p dump---", (void *)ctx);
 	irc_conn_dump(ctx->con);
+	lsi_sq_dump(ctx->sendq);
 	N("mynick: '%s'", ctx->mynick);
 	N("myhost: '%s'", ctx->myhost);
 	N("service: %d", ctx->service);
@@ -494,6 +818,7 @@ irc_dump(irc *ctx)
 	N("lasterr: '%s'", ctx->lasterr);
 	N("hcto_us: %"PRIu64, ctx->hcto_us);
 	N("scto_us: %"PRIu64, ctx->scto_us);
+	N("cstagger_us: %"PRIu64, ctx->cstagger_us);
 	N("restricted: %d", ctx->restricted);
 	N("banned: %d", ctx->banned);
 	N("banmsg: '%s'", ctx->banmsg);
@@ -539,6 +864,7 @@ irc_dump(irc *ctx)
 	//struct iconn_s *con
 	if (ctx->tracking_enab)
 		lsi_trk_dump(ctx, true);
+	lsi_dstat_dump(ctx);
 	N("--- end of IRC context dump ---");
 	return;
 }
@@ -569,3 +895,99 @@ reset_state(irc *ctx)
 	ctx->v3ntags = 0;
 	return;
 }
+
+/* `r' is what the connection layer said about the connection attempt.
+ * once it's through, kick off the IRC logon */
+static int
+connected(irc *ctx, int r)
+{
+	if (r != 1) {
+		if (r == -1)
+			ctx->connecting = false;
+		return r;
+	}
+
+	I("connection established");
+
+	if (ctx->dumb) {
+		ctx->connecting = false;
+		return 1;
+	}
+
+	if (ctx->starttls_first) {
+		if (!lsi_conn_write(ctx->con, "STARTTLS\r\n"))
+			goto fail;
+	} else {
+		ctx->logon_sent = true;
+		if (!send_logon(ctx))
+			goto fail;
+		I("IRC logon sequence sent");
+	}
+
+	STRACPY(ctx->mynick, ctx->nick);
+	return logon_step(ctx);
+
+fail:
+	irc_reset(ctx);
+	return -1;
+}
+
+/* process the logon conversation as far as it has come.  returns 1 once we
+ * are logged on, 0 if we have to wait for more, -1 on failure */
+static int
+logon_step(irc *ctx)
+{
+	bool using_sasl = ctx->sasl_mech && ctx->sasl_msg;
+	tokarr msg;
+	for (;;) {
+		if (lsi_com_check_timeout(ctx->contend, NULL)) {
+			W("timeout waiting for 004");
+			goto fail;
+		}
+
+		int r = lsi_conn_read(ctx->con, &msg, NULL, NULL, NULL, 1);
+		if (r < 0)
+			goto fail;
+
+		if (r == 0)
+			return 0;
+
+		if (ctx->cb_con_read &&
+		    !ctx->cb_con_read(&msg, ctx->tag_con_read)) {
+			W("logon prohibited by conread");
+			goto fail;
+		}
+
+		/* these are the protocol messages we deal with.
+		 * seeing 004 or 383 makes us consider ourselves logged on
+		 * note that we do not wait for 005, but we will later
+		 * parse it as we ran across it. */
+		uint16_t flags = lsi_msg_handle(ctx, &msg, true);
+
+		if (flags & CANT_PROCEED)
+			goto fail;
+
+		if (flags & LOGON_COMPLETE)
+			ctx->logged_on = true;
+
+		if (flags & SASL_COMPLETE)
+			ctx->sasl_authed = true;
+
+		if (flags & STARTTLS_OVER && !ctx->logon_sent) {
+			if (!send_logon(ctx))
+				goto fail;
+			ctx->logon_sent = true;
+		}
+
+		if (ctx->logged_on && (!using_sasl || ctx->sasl_authed))
+			break;
+	}
+
+	ctx->connecting = false;
+	N("logged on to IRC");
+	return 1;
+
+fail:
+	irc_reset(ctx);
+	return -1;
+}
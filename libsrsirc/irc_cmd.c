@@ -0,0 +1,409 @@
+/* irc_cmd.c - convenience functions for commonly client-issued commands
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IRC
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include <libsrsirc/irc_cmd.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_string.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_msgb.h>
+#include <libsrsirc/irc_track.h>
+
+#include "common.h"
+#include "conn.h"
+#include "intdefs.h"
+#include "loop.h"
+
+
+/* what we assume for the user and host part of our prefix if the server
+ * doesn't tell (through 005 USERLEN/HOSTLEN) and we don't know ourselves */
+#define DEF_USERLEN 9
+#define DEF_HOSTLEN 63
+
+
+/* the targets of a message, either an array or a comma-separated list */
+struct targets {
+	const char *const *arr; // The array, or NULL if it's a list
+	size_t n;               // Number of elements in `arr'
+	size_t i;               // Next element of `arr'
+	const char *list;       // What's left of the list, if it's one
+};
+
+
+static bool msg_many(irc *ctx, const char *cmd, struct targets *tg,
+    const char *text);
+static bool send_text(irc *ctx, const char *cmd, const char *tlist,
+    size_t tlen, size_t longest, const char *text);
+static const char *next_target(struct targets *tg, size_t *len);
+static bool valid_arg(const char *s, size_t len);
+static size_t utf8_cut(const char *s, size_t max);
+static size_t targmax(irc *ctx, const char *cmd, bool legacy);
+static size_t attr_num(irc *ctx, const char *name, size_t def);
+static size_t prefix_len(irc *ctx);
+static bool done(irc *ctx, bool ok);
+
+
+bool
+irc_privmsg(irc *ctx, const char *target, const char *text)
+{
+	struct targets tg = { NULL, 0, 0, target };
+	return msg_many(ctx, "PRIVMSG", &tg, text);
+}
+
+bool
+irc_notice(irc *ctx, const char *target, const char *text)
+{
+	struct targets tg = { NULL, 0, 0, target };
+	return msg_many(ctx, "NOTICE", &tg, text);
+}
+
+bool
+irc_privmsg_many(irc *ctx, const char *const *targets, size_t ntargets,
+    const char *text)
+{
+	struct targets tg = { targets, ntargets, 0, NULL };
+	return msg_many(ctx, "PRIVMSG", &tg, text);
+}
+
+bool
+irc_notice_many(irc *ctx, const char *const *targets, size_t ntargets,
+    const char *text)
+{
+	struct targets tg = { targets, ntargets, 0, NULL };
+	return msg_many(ctx, "NOTICE", &tg, text);
+}
+
+bool
+irc_join(irc *ctx, const char *chan, const char *key)
+{
+	return irc_join_many(ctx, &chan, key ? &key : NULL, 1);
+}
+
+bool
+irc_join_many(irc *ctx, const char *const *chans,
+    const char *const *keys, size_t nchans)
+{
+	if (!lsi_conn_online(ctx->con))
+		return false;
+
+	/* room for the channel and key lists in "JOIN <chans> <keys>\r\n"
+	 * (the space between the lists is accounted for below) */
+	size_t avail = MAX_MSG_LEN - 2 - 5;
+	size_t maxt = targmax(ctx, "JOIN", false);
+	char cl[MAX_MSG_LEN];
+	char kl[MAX_MSG_LEN];
+	size_t clen = 0, klen = 0, cnt = 0;
+	bool ok = true;
+
+	lsi_conn_cork(ctx->con);
+
+	/* keys are matched up with channels by position, so the channels
+	 * that have a key go first */
+	for (int pass = 0; pass < 2 && lsi_conn_online(ctx->con); pass++) {
+		for (size_t i = 0; i < nchans; i++) {
+			const char *key = keys && keys[i] && *keys[i]
+			    ? keys[i] : NULL;
+			if ((key == NULL) != (pass == 1))
+				continue;
+
+			size_t l = strlen(chans[i]);
+			size_t kl0 = key ? strlen(key) : 0;
+			if (!valid_arg(chans[i], l) || (key && !valid_arg(key, kl0))
+			    || l + kl0 + 1 > avail) {
+				W("not joining bad channel '%s'", chans[i]);
+				ok = false;
+				continue;
+			}
+
+			size_t nclen = clen + !!cnt + l;
+			size_t nklen = klen + (key ? !!klen + kl0 : 0);
+			if (cnt && (cnt == maxt
+			    || nclen + (nklen ? nklen + 1 : 0) > avail)) {
+				irc_msgb *mb = irc_msgb_start(ctx);
+				irc_msgb_cmd(mb, "JOIN");
+				irc_msgb_param(mb, cl);
+				if (klen)
+					irc_msgb_param(mb, kl);
+				if (!irc_msgb_send(mb)) {
+					ok = false;
+					if (!lsi_conn_online(ctx->con))
+						return done(ctx, false);
+				}
+
+				clen = klen = cnt = 0;
+				nclen = l;
+				nklen = kl0;
+			}
+
+			if (cnt)
+				cl[clen++] = ',';
+			memcpy(cl + clen, chans[i], l);
+			cl[clen = nclen] = '\0';
+
+			if (key) {
+				if (klen)
+					kl[klen++] = ',';
+				memcpy(kl + klen, key, kl0);
+				kl[klen = nklen] = '\0';
+			}
+
+			cnt++;
+		}
+	}
+
+	if (cnt) {
+		irc_msgb *mb = irc_msgb_start(ctx);
+		irc_msgb_cmd(mb, "JOIN");
+		irc_msgb_param(mb, cl);
+		if (klen)
+			irc_msgb_param(mb, kl);
+		if (!irc_msgb_send(mb)) {
+			ok = false;
+			if (!lsi_conn_online(ctx->con))
+				return done(ctx, false);
+		}
+	}
+
+	return done(ctx, ok);
+}
+
+
+/* send `text' to all targets in `tg', with as many targets per line as the
+ * server lets us, as long as that leaves enough room for the text */
+static bool
+msg_many(irc *ctx, const char *cmd, struct targets *tg, const char *text)
+{
+	if (!lsi_conn_online(ctx->con))
+		return false;
+
+	/* room for the target list and the text in "CMD <targets> :<text>" */
+	size_t avail = MAX_MSG_LEN - 2 - strlen(cmd) - 3;
+	size_t maxt = targmax(ctx, cmd, true);
+
+	/* if the text is short enough, we want it in a single line for all
+	 * targets in a batch.  otherwise, it'll be split anyway, so let the
+	 * targets have up to half of the line */
+	size_t textlen = strlen(text);
+	size_t want = textlen < avail / 2 ? textlen : avail / 2;
+
+	char tl[MAX_MSG_LEN];
+	size_t tlen = 0, cnt = 0, longest = 0;
+	bool ok = true;
+	const char *t;
+	size_t l;
+
+	lsi_conn_cork(ctx->con);
+	while ((t = next_target(tg, &l))) {
+		if (!valid_arg(t, l) || l + want > avail) {
+			W("not sending to bad target '%.*s'", (int)l, t);
+			ok = false;
+			continue;
+		}
+
+		if (cnt && (cnt == maxt || tlen + 1 + l + want > avail)) {
+			if (!send_text(ctx, cmd, tl, tlen, longest, text)) {
+				ok = false;
+				if (!lsi_conn_online(ctx->con))
+					return done(ctx, false);
+			}
+
+			tlen = cnt = longest = 0;
+		}
+
+		if (cnt)
+			tl[tlen++] = ',';
+		memcpy(tl + tlen, t, l);
+		tlen += l;
+		tl[tlen] = '\0';
+		if (l > longest)
+			longest = l;
+		cnt++;
+	}
+
+	if (cnt && !send_text(ctx, cmd, tl, tlen, longest, text)) {
+		ok = false;
+		if (!lsi_conn_online(ctx->con))
+			return done(ctx, false);
+	}
+
+	return done(ctx, ok);
+}
+
+/* send `text' to the targets in `tlist' (of which the longest is `longest'
+ * bytes), in as many messages as it takes, each line of it separately */
+static bool
+send_text(irc *ctx, const char *cmd, const char *tlist, size_t tlen,
+    size_t longest, const char *text)
+{
+	/* the line we send must fit, and so must what the server relays
+	 * to each target (which is prefixed by our nick!user@host) */
+	size_t fixed = strlen(cmd) + 3 + 2;
+	size_t room = MAX_MSG_LEN - fixed - tlen;
+	size_t relay = prefix_len(ctx) + fixed + longest;
+	if (relay < MAX_MSG_LEN && MAX_MSG_LEN - relay < room)
+		room = MAX_MSG_LEN - relay;
+	else if (relay >= MAX_MSG_LEN)
+		room = 0;
+
+	if (room < 4) { // Not even room for a single UTF-8 character
+		W("no room for the text (targets: '%s')", tlist);
+		return false;
+	}
+
+	while (*text) {
+		const char *ln = text;
+		size_t n = strcspn(text, "\r\n");
+		text += n;
+		text += strspn(text, "\r\n");
+
+		while (n) {
+			size_t c = n <= room ? n : utf8_cut(ln, room);
+			irc_msgb *mb = irc_msgb_start(ctx);
+			irc_msgb_cmd(mb, cmd);
+			irc_msgb_param(mb, tlist);
+			irc_msgb_trailn(mb, ln, c);
+			if (!irc_msgb_send(mb))
+				return false;
+
+			ln += c;
+			n -= c;
+		}
+	}
+
+	return true;
+}
+
+/* the next target, or NULL if there are no more */
+static const char *
+next_target(struct targets *tg, size_t *len)
+{
+	if (tg->arr) {
+		if (tg->i == tg->n)
+			return NULL;
+
+		*len = strlen(tg->arr[tg->i]);
+		return tg->arr[tg->i++];
+	}
+
+	while (*tg->list == ',')
+		tg->list++;
+
+	if (!*tg->list)
+		return NULL;
+
+	const char *t = tg->list;
+	*len = strcspn(t, ",");
+	tg->list += *len;
+	return t;
+}
+
+/* tell whether `s' can be (part of) a comma-separated parameter */
+static bool
+valid_arg(const char *s, size_t len)
+{
+	if (!len || *s == ':')
+		return false;
+
+	for (size_t i = 0; i < len; i++)
+		if (s[i] == ' ' || s[i] == ',' || s[i] == '\r' || s[i] == '\n'
+		    || s[i] == '\0')
+			return false;
+
+	return true;
+}
+
+/* how many bytes of `s' (which is longer than `max') to take such that no
+ * UTF-8 sequence is cut in half.  if `s' isn't UTF-8, that's just `max' */
+static size_t
+utf8_cut(const char *s, size_t max)
+{
+	size_t c = max;
+	while (c > 0 && max - c < 4 && ((unsigned char)s[c] & 0xc0) == 0x80)
+		c--;
+
+	return c > 0 && max - c < 4 ? c : max;
+}
+
+/* the maximum number of targets per `cmd', as per 005 TARGMAX or, if
+ * `legacy', MAXTARGETS.  lacking both, that is 1 if `legacy' (i.e. for
+ * PRIVMSG and NOTICE), and no limit otherwise */
+static size_t
+targmax(irc *ctx, const char *cmd, bool legacy)
+{
+	size_t cl = strlen(cmd);
+	const char *v = lsi_skmap_get(ctx->m005attrs, "TARGMAX");
+	while (v && *v) {
+		if (lsi_b_strncasecmp(v, cmd, cl) == 0 && v[cl] == ':') {
+			/* no number means no limit */
+			unsigned long n = strtoul(v + cl + 1, NULL, 10);
+			return n ? (size_t)n : SIZE_MAX;
+		}
+
+		if ((v = strchr(v, ',')))
+			v++;
+	}
+
+	if (!legacy)
+		return SIZE_MAX;
+
+	return attr_num(ctx, "MAXTARGETS", 1);
+}
+
+/* the numeric value of 005 attribute `name', or `def' if there's none */
+static size_t
+attr_num(irc *ctx, const char *name, size_t def)
+{
+	const char *v = lsi_skmap_get(ctx->m005attrs, name);
+	unsigned long n = v ? strtoul(v, NULL, 10) : 0;
+	return n ? (size_t)n : def;
+}
+
+/* the length of the prefix (":nick!user@host ") that the server puts in
+ * front of our messages when it relays them */
+static size_t
+prefix_len(irc *ctx)
+{
+	size_t ul = 0, hl = 0;
+	userrep u;
+	if (irc_tracking_enab(ctx) && irc_user(ctx, &u, ctx->mynick)) {
+		ul = u.uname ? strlen(u.uname) : 0;
+		hl = u.host ? strlen(u.host) : 0;
+	}
+
+	if (!ul)
+		ul = attr_num(ctx, "USERLEN", DEF_USERLEN) + 1; // Maybe a ~
+	if (!hl)
+		hl = attr_num(ctx, "HOSTLEN", DEF_HOSTLEN);
+
+	return 1 + strlen(ctx->mynick) + 1 + ul + 1 + hl + 1;
+}
+
+/* send what we produced, all at once */
+static bool
+done(irc *ctx, bool ok)
+{
+	if (!lsi_conn_uncork(ctx->con)) {
+		irc_reset(ctx);
+		return false;
+	}
+
+	lsi_loop_update(ctx);
+	return ok;
+}
@@ -21,6 +21,7 @@
 #include "common.h"
 #include "conn.h"
 #include "msg.h"
+#include "sendq.h"
 #include "skmap.h"
 #include "v3.h"
 
@@ -236,6 +237,30 @@ irc_get_dumb(irc *ctx)
 	return ctx->dumb;
 }
 
+size_t
+irc_get_rcvbuf_size(irc *ctx)
+{
+	return lsi_conn_get_rcvbuf_size(ctx->con);
+}
+
+bool
+irc_get_autoflush(irc *ctx)
+{
+	return lsi_conn_get_autoflush(ctx->con);
+}
+
+bool
+irc_get_nbwrite(irc *ctx)
+{
+	return lsi_conn_get_nbwrite(ctx->con);
+}
+
+size_t
+irc_get_sndhiwat(irc *ctx)
+{
+	return lsi_conn_get_sndhiwat(ctx->con);
+}
+
 
 /* Setters - set library parameters (none of these takes effect before the
  * next call to irc_connect() is done */
@@ -379,6 +404,28 @@ irc_set_connect_timeout(irc *ctx, uint64_t soft, uint64_t hard)
 	return;
 }
 
+void
+irc_set_connect_stagger(irc *ctx, uint64_t us)
+{
+	ctx->cstagger_us = us;
+	return;
+}
+
+void
+irc_set_floodctl(irc *ctx, uint64_t linecost_us, uint64_t bytecost_us,
+    uint64_t burst_us)
+{
+	lsi_sq_config(ctx->sendq, linecost_us, bytecost_us, burst_us);
+	return;
+}
+
+void
+irc_set_sendq_limits(irc *ctx, size_t maxlines, size_t maxbytes)
+{
+	lsi_sq_limit(ctx->sendq, maxlines, maxbytes);
+	return;
+}
+
 bool
 irc_set_ssl(irc *ctx, bool on)
 {
@@ -393,6 +440,33 @@ irc_set_ssl(irc *ctx, bool on)
 	return lsi_conn_set_ssl(ctx->con, on);
 }
 
+bool
+irc_set_rcvbuf_size(irc *ctx, size_t sz)
+{
+	return lsi_conn_set_rcvbuf_size(ctx->con, sz);
+}
+
+void
+irc_set_autoflush(irc *ctx, bool on)
+{
+	lsi_conn_set_autoflush(ctx->con, on);
+	return;
+}
+
+void
+irc_set_nbwrite(irc *ctx, bool on)
+{
+	lsi_conn_set_nbwrite(ctx->con, on);
+	return;
+}
+
+void
+irc_set_sndhiwat(irc *ctx, size_t hiwat)
+{
+	lsi_conn_set_sndhiwat(ctx->con, hiwat ? hiwat : DEF_SNDHIWAT);
+	return;
+}
+
 void
 irc_set_dumb(irc *ctx, bool dumbmode)
 {
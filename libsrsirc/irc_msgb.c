@@ -0,0 +1,261 @@
+/* irc_msgb.c - build outgoing protocol messages piece by piece
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IRC
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include <libsrsirc/irc_msgb.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc.h>
+
+#include "common.h"
+#include "conn.h"
+#include "intdefs.h"
+#include "loop.h"
+
+
+/* RFC 1459 allows for 15 parameters */
+#define MAX_PARAMS 15
+
+
+static bool reject(irc_msgb *mb, const char *what);
+static bool put(irc_msgb *mb, const void *buf, size_t n);
+static bool put_escaped(irc_msgb *mb, const char *val);
+static bool fits(irc_msgb *mb);
+
+
+irc_msgb *
+irc_msgb_start(irc *ctx)
+{
+	irc_msgb *mb = &ctx->msgb;
+	if (mb->state != MB_IDLE) {
+		W("dropping unfinished message");
+		irc_msgb_abort(mb);
+	}
+
+	if (!lsi_conn_online(ctx->con)) {
+		E("Can't build a message while offline");
+		return NULL;
+	}
+
+	mb->ctx = ctx;
+	mb->start = mb->body = lsi_conn_pending(ctx->con);
+	mb->ntags = mb->nparams = 0;
+	mb->state = MB_TAGS;
+	mb->err = false;
+	return mb;
+}
+
+bool
+irc_msgb_tag(irc_msgb *mb, const char *key, const char *val)
+{
+	if (mb->err)
+		return false;
+
+	if (mb->state != MB_TAGS)
+		return reject(mb, "tag after the command");
+
+	/* client-only prefix, optional vendor (a hostname), then the name */
+	const char *k = key + (*key == '+');
+	size_t klen = strlen(key);
+	if (!*k || strspn(k, "abcdefghijklmnopqrstuvwxyz"
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789-./") != strlen(k))
+		return reject(mb, "bad tag name");
+
+	if (!put(mb, mb->ntags ? ";" : "@", 1) || !put(mb, key, klen))
+		return false;
+
+	if (val && *val && (!put(mb, "=", 1) || !put_escaped(mb, val)))
+		return false;
+
+	mb->ntags++;
+	if (lsi_conn_pending(mb->ctx->con) - mb->start + 1 > MAX_CLTAGS_LEN)
+		return reject(mb, "tags too long");
+
+	return true;
+}
+
+bool
+irc_msgb_cmd(irc_msgb *mb, const char *cmd)
+{
+	if (mb->err)
+		return false;
+
+	if (mb->state != MB_TAGS)
+		return reject(mb, "command set twice");
+
+	size_t len = strlen(cmd);
+	bool numeric = len == 3 && strspn(cmd, "0123456789") == 3;
+	if (!numeric && (!len || strspn(cmd, "abcdefghijklmnopqrstuvwxyz"
+	    "ABCDEFGHIJKLMNOPQRSTUVWXYZ") != len))
+		return reject(mb, "bad command");
+
+	if (mb->ntags && !put(mb, " ", 1))
+		return false;
+
+	mb->body = lsi_conn_pending(mb->ctx->con);
+	mb->state = MB_PARAMS;
+	return put(mb, cmd, len) && fits(mb);
+}
+
+bool
+irc_msgb_param(irc_msgb *mb, const char *p)
+{
+	if (mb->err)
+		return false;
+
+	if (mb->state != MB_PARAMS)
+		return reject(mb, mb->state == MB_TAGS
+		    ? "parameter before the command"
+		    : "parameter after the trailing one");
+
+	size_t len = strlen(p);
+	if (!len || *p == ':' || strcspn(p, " \r\n") != len)
+		return reject(mb, "bad parameter");
+
+	if (++mb->nparams > MAX_PARAMS)
+		return reject(mb, "too many parameters");
+
+	return put(mb, " ", 1) && put(mb, p, len) && fits(mb);
+}
+
+bool
+irc_msgb_trail(irc_msgb *mb, const char *t)
+{
+	return irc_msgb_trailn(mb, t, strlen(t));
+}
+
+bool
+irc_msgb_trailn(irc_msgb *mb, const char *t, size_t len)
+{
+	if (mb->err)
+		return false;
+
+	if (mb->state != MB_PARAMS)
+		return reject(mb, mb->state == MB_TAGS
+		    ? "parameter before the command"
+		    : "parameter after the trailing one");
+
+	if (memchr(t, '\r', len) || memchr(t, '\n', len) || memchr(t, '\0', len))
+		return reject(mb, "bad trailing parameter");
+
+	if (++mb->nparams > MAX_PARAMS)
+		return reject(mb, "too many parameters");
+
+	mb->state = MB_DONE;
+	return put(mb, " :", 2) && put(mb, t, len) && fits(mb);
+}
+
+bool
+irc_msgb_send(irc_msgb *mb)
+{
+	if (mb->state == MB_IDLE) {
+		E("No message being built");
+		return false;
+	}
+
+	if (!mb->err && mb->state == MB_TAGS)
+		reject(mb, "no command");
+
+	irc *ctx = mb->ctx;
+	if (mb->err || !put(mb, "\r\n", 2)) {
+		irc_msgb_abort(mb);
+		if (!lsi_conn_online(ctx->con))
+			irc_reset(ctx); // we ran out of memory
+		return false;
+	}
+
+	mb->state = MB_IDLE;
+	if (!lsi_conn_commit(ctx->con)) {
+		irc_reset(ctx);
+		return false;
+	}
+
+	lsi_loop_update(ctx);
+	return true;
+}
+
+void
+irc_msgb_abort(irc_msgb *mb)
+{
+	if (mb->state == MB_IDLE)
+		return;
+
+	/* if we went offline meanwhile, there's nothing left to drop */
+	lsi_conn_truncate(mb->ctx->con, mb->start);
+	mb->state = MB_IDLE;
+	return;
+}
+
+
+/* mark the message as broken, so that it won't be sent */
+static bool
+reject(irc_msgb *mb, const char *what)
+{
+	W("not sending message: %s", what);
+	mb->err = true;
+	return false;
+}
+
+/* append to the send buffer */
+static bool
+put(irc_msgb *mb, const void *buf, size_t n)
+{
+	if (!lsi_conn_append(mb->ctx->con, buf, n)) {
+		mb->err = true;
+		return false;
+	}
+
+	return true;
+}
+
+/* append a tag value, escaped as per IRCv3 message-tags.  unproblematic
+ * stretches are appended in one go */
+static bool
+put_escaped(irc_msgb *mb, const char *val)
+{
+	while (*val) {
+		size_t n = strcspn(val, "; \\\r\n");
+		if (n && !put(mb, val, n))
+			return false;
+
+		val += n;
+		if (!*val)
+			break;
+
+		const char *esc;
+		switch (*val++) {
+		case ';': esc = "\\:"; break;
+		case ' ': esc = "\\s"; break;
+		case '\\': esc = "\\\\"; break;
+		case '\r': esc = "\\r"; break;
+		default: esc = "\\n"; break;
+		}
+
+		if (!put(mb, esc, 2))
+			return false;
+	}
+
+	return true;
+}
+
+/* make sure the message (excluding tags), with its CRLF, is within limits */
+static bool
+fits(irc_msgb *mb)
+{
+	if (lsi_conn_pending(mb->ctx->con) - mb->body + 2 > MAX_MSG_LEN)
+		return reject(mb, "message too long");
+
+	return true;
+}
@@ -25,9 +25,11 @@
 #include "conn.h"
 #include "irc_track_int.h"
 #include "msg.h"
+#include "ucbase.h"
 #include "v3.h"
 
 #include <libsrsirc/defs.h>
+#include <libsrsirc/irc_msgb.h>
 #include <libsrsirc/util.h>
 
 
@@ -121,11 +123,11 @@ handle_PING(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (nargs < 3)
 		return PROTO_ERR;
 
-	char buf[256];
-	snprintf(buf, sizeof buf, "PONG :%s\r\n", (*msg)[2]);
 	D("Replying to a logon-time PING (%s)", (*msg)[2]);
 
-	return lsi_conn_write(ctx->con, buf) ? 0 : IO_ERR;
+	irc_msgb *mb = irc_msgb_start(ctx);
+	return mb && irc_msgb_cmd(mb, "PONG") && irc_msgb_trail(mb, (*msg)[2])
+	    && irc_msgb_send(mb) ? 0 : IO_ERR;
 }
 
 /* This handles 432, 433, 436 and 437 all of which signal us that
@@ -286,16 +288,27 @@ handle_MODE(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 static uint16_t
 handle_005_CASEMAPPING(irc *ctx, const char *val)
 {
+	int cm;
 	if (lsi_b_strcasecmp(val, "ascii") == 0)
-		ctx->casemap = CMAP_ASCII;
+		cm = CMAP_ASCII;
 	else if (lsi_b_strcasecmp(val, "strict-rfc1459") == 0)
-		ctx->casemap = CMAP_STRICT_RFC1459;
+		cm = CMAP_STRICT_RFC1459;
 	else {
 		if (lsi_b_strcasecmp(val, "rfc1459") != 0)
 			W("unknown 005 casemapping: '%s'", val);
-		ctx->casemap = CMAP_RFC1459;
+		cm = CMAP_RFC1459;
+	}
+
+	/* tracking started out with what we assumed; whatever it has seen
+	 * so far needs to be rehashed if we assumed wrong */
+	if (cm != ctx->casemap && ctx->tracking_enab
+	    && !lsi_ucb_set_casemap(ctx, cm)) {
+		E("failed to switch casemap, disabling tracking");
+		lsi_trk_deinit(ctx);
+		ctx->tracking_enab = false;
 	}
 
+	ctx->casemap = cm;
 	return 0;
 }
 
@@ -358,7 +371,6 @@ static uint16_t
 handle_005(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 {
 	uint16_t ret = 0;
-	bool have_casemap = false;
 	D("handing a 005 with %zu args", nargs);
 
 	/* last arg is "are supported by this server" or equivalent */
@@ -380,10 +392,9 @@ handle_005(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 		if (!val || !lsi_skmap_put(ctx->m005attrs, nam, val))
 			E("Out of memory, m005attrs will be incomplete");
 
-		if (lsi_b_strcasecmp(nam, "CASEMAPPING") == 0) {
+		if (lsi_b_strcasecmp(nam, "CASEMAPPING") == 0)
 			ret |= handle_005_CASEMAPPING(ctx, val);
-			have_casemap = true;
-		} else if (lsi_b_strcasecmp(nam, "PREFIX") == 0)
+		else if (lsi_b_strcasecmp(nam, "PREFIX") == 0)
 			ret |= handle_005_PREFIX(ctx, val);
 		else if (lsi_b_strcasecmp(nam, "CHANMODES") == 0)
 			ret |= handle_005_CHANMODES(ctx, val);
@@ -397,18 +408,6 @@ handle_005(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			return ret;
 	}
 
-	if (have_casemap && ctx->tracking && !ctx->tracking_enab) {
-		/* Now that we know the casemapping used by the server, we
-		 * can enable tracking if it was originally (before connecting)
-		 * asked for */
-		if (!lsi_trk_init(ctx))
-			E("failed to enable tracking");
-		else {
-			ctx->tracking_enab = true;
-			I("tracking enabled");
-		}
-	}
-
 	return ret;
 }
 
@@ -0,0 +1,238 @@
+/* irc_msgv.c - lazily tokenized view of a protocol message
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IRC
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include <libsrsirc/irc_msgv.h>
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <platform/base_time.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/util.h>
+
+#include "common.h"
+#include "conn.h"
+#include "intdefs.h"
+#include "msg.h"
+
+
+static char *next_tok(char *buf);
+static bool parse(irc_msgv *mv, char *line);
+static bool split_one(irc_msgv *mv);
+static void split_all(irc_msgv *mv);
+
+
+bool
+irc_msgv_parse(irc_msgv *mv, char *line)
+{
+	char *tags = NULL;
+	if (*line == '@') {
+		tags = line + 1;
+		if (!(line = next_tok(line))) {
+			E("protocol error (just tags?)");
+			return false;
+		}
+	}
+
+	if (!parse(mv, line))
+		return false;
+
+	mv->tags = tags;
+	return true;
+}
+
+const char *
+irc_msgv_prefix(const irc_msgv *mv)
+{
+	return mv->tok[0];
+}
+
+const char *
+irc_msgv_cmd(const irc_msgv *mv)
+{
+	return mv->tok[1];
+}
+
+const char *
+irc_msgv_tags(const irc_msgv *mv)
+{
+	return mv->tags;
+}
+
+const char *
+irc_msgv_arg(irc_msgv *mv, size_t n)
+{
+	while (mv->nargs <= n && split_one(mv))
+		;
+
+	return n < mv->nargs ? mv->tok[2 + n] : NULL;
+}
+
+size_t
+irc_msgv_nargs(irc_msgv *mv)
+{
+	split_all(mv);
+	return mv->nargs;
+}
+
+tokarr *
+irc_msgv_tokarr(irc_msgv *mv)
+{
+	split_all(mv);
+	return &mv->tok;
+}
+
+int
+irc_read_msgv(irc *ctx, irc_msgv *mv, uint64_t to_us)
+{
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	for (;;) {
+		for (size_t i = 0; i < COUNTOF(ctx->v3tags_dec); i++)
+			ctx->v3tags_dec[i][0] = '\0';
+		ctx->v3ntags = 0;
+
+		char *line;
+		int r = lsi_conn_read_line(ctx->con, &line,
+		    ctx->rfilt ? &ctx->rdfilt : NULL, to_us);
+
+		if (r == 0)
+			return 0;
+
+		if (r < 0) {
+			irc_reset(ctx);
+			return -1;
+		}
+
+		if (*line == '@') {
+			ctx->v3ntags = COUNTOF(ctx->v3tags_raw);
+			line = lsi_ut_extract_tags(line + 1, ctx->v3tags_raw,
+			    &ctx->v3ntags);
+			if (!line || !*line) {
+				E("protocol error (just tags?)");
+				irc_reset(ctx);
+				return -1;
+			}
+		}
+
+		if (!parse(mv, line)) {
+			irc_reset(ctx);
+			return -1;
+		}
+
+		/* only tokenize what somebody registered a handler for */
+		if (lsi_msg_needs(ctx, mv->tok[1])) {
+			tokarr *tok = irc_msgv_tokarr(mv);
+			lsi_conn_upd_colon_trail(ctx->con, tok);
+
+			lsi_conn_cork(ctx->con);
+			uint16_t flags = lsi_msg_handle(ctx, tok, false);
+			if (!lsi_conn_uncork(ctx->con) || flags & CANT_PROCEED) {
+				irc_reset(ctx);
+				return -1;
+			}
+		}
+
+		if (lsi_msg_deliver(ctx, mv->tok[1]))
+			return 1;
+
+		if (tend) {
+			uint64_t tnow = lsi_b_tstamp_us();
+			to_us = tnow >= tend ? 1 : tend - tnow;
+		}
+	}
+}
+
+
+/* lsi_com_next_tok(buf, ' '), but letting strchr() do the scanning; that
+ * is vectorized in any libc worth its salt, and a prefix easily spans
+ * a few dozen bytes */
+static char *
+next_tok(char *buf)
+{
+	if (!(buf = strchr(buf, ' ')))
+		return NULL; /* there's no next token */
+
+	while (*buf == ' ') /* walk over token delimiter, zero it out */
+		*buf++ = '\0';
+
+	return *buf ? buf : NULL;
+}
+
+/* locate prefix and command of a tag-less `line' and set up `mv' for
+ * splitting the arguments.  this is lsi_ut_tokenize() minus the loop */
+static bool
+parse(irc_msgv *mv, char *line)
+{
+	mv->tok[0] = NULL;
+	if (*line == ':') { /* message has a prefix */
+		mv->tok[0] = line + 1; /* disregard the colon */
+		if (!(line = next_tok(line))) {
+			E("protocol error (no more tokens after prefix)");
+			return false;
+		}
+	} else if (*line == ' ') { /* this would lead to parsing issues */
+		E("protocol error (leading whitespace)");
+		return false;
+	} else if (!*line) {
+		E("protocol error (empty line)");
+		return false;
+	}
+
+	mv->tok[1] = line; /* command */
+	mv->tags = NULL;
+	mv->rest = next_tok(line);
+	mv->nargs = 0;
+	mv->done = false;
+	return true;
+}
+
+/* split off the next argument, if any.  the last slot of a tokarr is never
+ * cut off at a space, just like lsi_ut_tokenize() does it */
+static bool
+split_one(irc_msgv *mv)
+{
+	char *arg = mv->rest;
+	if (!arg)
+		return false;
+
+	size_t slot = 2 + mv->nargs++;
+	if (*arg == ':') { /* `trailing' arg */
+		mv->tok[slot] = arg + 1; /* disregard the colon */
+		mv->rest = NULL;
+		return true;
+	}
+
+	mv->tok[slot] = arg;
+	mv->rest = slot + 1 < COUNTOF(mv->tok) ? next_tok(arg)
+	    : NULL;
+	return true;
+}
+
+static void
+split_all(irc_msgv *mv)
+{
+	if (mv->done)
+		return;
+
+	while (split_one(mv))
+		;
+
+	for (size_t i = 2 + mv->nargs; i < COUNTOF(mv->tok); i++)
+		mv->tok[i] = NULL;
+
+	mv->done = true;
+	return;
+}
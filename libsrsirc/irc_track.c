@@ -148,7 +148,7 @@ h_352(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			W("username for '%s' changed from '%s' to '%s'!",
 			    u->nick, u->uname, (*msg)[4]);
 
-		lsi_com_update_strprop(&u->uname, (*msg)[4]);
+		lsi_ucb_update_strprop(ctx, &u->uname, (*msg)[4]);
 	}
 
 	if (!u->host || lsi_ut_istrcmp(u->host, (*msg)[5], ctx->casemap) != 0) {
@@ -156,7 +156,7 @@ h_352(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			W("host for '%s' changed from '%s' to '%s'!",
 			    u->nick, u->host, (*msg)[5]);
 
-		lsi_com_update_strprop(&u->host, (*msg)[5]);
+		lsi_ucb_update_strprop(ctx, &u->host, (*msg)[5]);
 	}
 
 	const char *fname = strchr((*msg)[9], ' ');
@@ -168,7 +168,7 @@ h_352(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			W("fullname for '%s' changed from '%s' to '%s'!",
 			    u->nick, u->fname, fname+1);
 
-		lsi_com_update_strprop(&u->fname, fname+1);
+		lsi_ucb_update_strprop(ctx, &u->fname, fname+1);
 	}
 
 	return 0;
@@ -189,8 +189,7 @@ h_332(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 		W("we don't know channel '%s'!", (*msg)[3]);
 		return 0;
 	}
-	free(c->topic);
-	if (!(c->topic = STRDUP((*msg)[4])))
+	if (!lsi_ucb_update_strprop(ctx, &c->topic, (*msg)[4]))
 		return ALLOC_ERR;
 
 	return 0;
@@ -207,8 +206,7 @@ h_333(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 		W("we don't know channel '%s'!", (*msg)[3]);
 		return 0;
 	}
-	free(c->topicnick);
-	if (!(c->topicnick = STRDUP((*msg)[4])))
+	if (!lsi_ucb_update_strprop(ctx, &c->topicnick, (*msg)[4]))
 		return ALLOC_ERR;
 
 	c->tstopic = (uint64_t)strtoull((*msg)[5], NULL, 10);
@@ -391,11 +389,8 @@ h_TOPIC(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 		W("we don't know channel '%s'!", (*msg)[2]);
 		return 0;
 	}
-	free(c->topic);
-	free(c->topicnick);
-	c->topicnick = NULL;
-	if (!(c->topic = STRDUP((*msg)[3]))
-	    || !(c->topicnick = STRDUP(nick)))
+	if (!lsi_ucb_update_strprop(ctx, &c->topic, (*msg)[3])
+	    || !lsi_ucb_update_strprop(ctx, &c->topicnick, nick))
 		return ALLOC_ERR;
 
 	return 0;
@@ -466,9 +461,12 @@ h_MODE(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 static uint16_t
 h_PRIVMSG(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 {
-	if (!(*msg)[0] || nargs < 4)
+	if (nargs < 4)
 		return PROTO_ERR;
 
+	if (!(*msg)[0]) /* from the server, e.g. NOTICE AUTH during logon */
+		return 0;
+
 	char nick[MAX_NICK_LEN];
 	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
 
@@ -481,9 +479,12 @@ h_PRIVMSG(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 static uint16_t
 h_NOTICE(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 {
-	if (!(*msg)[0] || nargs < 4)
+	if (nargs < 4)
 		return PROTO_ERR;
 
+	if (!(*msg)[0]) /* from the server, e.g. NOTICE AUTH during logon */
+		return 0;
+
 	char nick[MAX_NICK_LEN];
 	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
 
@@ -559,7 +560,7 @@ h_311(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			W("username for '%s' changed from '%s' to '%s'!",
 			    u->nick, u->uname, (*msg)[4]);
 
-		lsi_com_update_strprop(&u->uname, (*msg)[4]);
+		lsi_ucb_update_strprop(ctx, &u->uname, (*msg)[4]);
 	}
 
 	if (!u->host || lsi_ut_istrcmp(u->host, (*msg)[5], ctx->casemap) != 0) {
@@ -567,7 +568,7 @@ h_311(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			W("host for '%s' changed from '%s' to '%s'!",
 			    u->nick, u->host, (*msg)[5]);
 
-		lsi_com_update_strprop(&u->host, (*msg)[5]);
+		lsi_ucb_update_strprop(ctx, &u->host, (*msg)[5]);
 	}
 
 	if (!u->fname || lsi_ut_istrcmp(u->fname, (*msg)[7], ctx->casemap) != 0) {
@@ -575,7 +576,7 @@ h_311(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			W("fullname for '%s' changed from '%s' to '%s'!",
 			    u->nick, u->fname, (*msg)[7]);
 
-		lsi_com_update_strprop(&u->fname, (*msg)[7]);
+		lsi_ucb_update_strprop(ctx, &u->fname, (*msg)[7]);
 	}
 
 	return 0;
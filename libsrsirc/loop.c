@@ -0,0 +1,614 @@
+/* loop.c - drive many IRC contexts from a single event loop
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_LOOP
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include <libsrsirc/irc_loop.h>
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_net.h>
+#include <platform/base_time.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+
+#include "common.h"
+#include "conn.h"
+#include "dnscache.h"
+#include "intdefs.h"
+#include "loop.h"
+#include "sendq.h"
+
+
+/* how many readiness notifications to fetch per wait */
+#define LOOP_MAXEVENTS 256
+
+/* how many irc_read_batch() calls a context gets per step before we move on
+ * to the others (it is served again in the next step, without waiting) */
+#define LOOP_MAXROUNDS 8
+
+
+struct loopent {
+	irc *ctx;
+	irc_loop *loop;
+	int fd;
+	void *tag;
+	size_t ntimers;  // Number of pending timers associated with `ctx`
+	uint64_t served; // Step number we last served this in
+	bool dead;       // Detached, to be freed at the end of the step
+	bool pending;    // Has been cut off at LOOP_MAXROUNDS
+	bool wantwr;     // Watching for writability (output is pending)
+	bool sqarmed;    // Has a timer pending for its send queue
+	bool prevnb;     // What irc_get_nbwrite() said before we attached
+	struct loopent *prev, *next; // List of live entries
+	struct loopent *nextpend;    // Pending list
+	struct loopent *nextdead;    // Dead list
+};
+
+struct ltimer {
+	uint64_t at;  // Absolute time (lsi_b_tstamp_us()) to fire at
+	uint64_t seq; // Tie breaker, so that timers due at once fire in order
+	struct loopent *ent; // NULL for loop-wide timers
+	irc_loop_tmr_fn fn;
+	void *tag;
+};
+
+struct irc_loop_s {
+	evset *es;
+	struct loopent *ents;    // All attached contexts
+	size_t nents;
+	struct loopent *pending; // Contexts to serve again without waiting
+	struct loopent *dead;    // Detached, but possibly still referenced
+
+	struct ltimer *tmrs;     // Binary min-heap on (at, seq)
+	size_t ntmrs;
+	size_t tmrsz;
+	uint64_t tmrseq;
+
+	uint64_t step;
+	bool stop;
+
+	irc_loop_msg_fn cb_msg;
+	irc_loop_disc_fn cb_disc;
+
+	void *ready[LOOP_MAXEVENTS];
+	tokarr toks[MAX_RDBATCH];
+};
+
+
+static void detach(struct loopent *ent);
+static void sweep(irc_loop *loop);
+static bool serve(irc_loop *loop, struct loopent *ent);
+static bool tmr_less(const struct ltimer *a, const struct ltimer *b);
+static void tmr_siftup(irc_loop *loop, size_t i);
+static void tmr_siftdown(irc_loop *loop, size_t i);
+static void tmr_drop(irc_loop *loop, struct loopent *ent);
+static int tmr_fire(irc_loop *loop);
+static void sq_fire(irc_loop *loop, irc *ctx, void *tag);
+
+
+irc_loop *
+irc_loop_init(void)
+{
+	irc_loop *l = MALLOC(sizeof *l);
+	if (!l)
+		return NULL;
+
+	if (!(l->es = lsi_b_evset_init())) {
+		free(l);
+		return NULL;
+	}
+
+	l->ents = l->pending = l->dead = NULL;
+	l->nents = 0;
+	l->tmrs = NULL;
+	l->ntmrs = l->tmrsz = 0;
+	l->tmrseq = l->step = 0;
+	l->stop = false;
+	l->cb_msg = NULL;
+	l->cb_disc = NULL;
+
+	D("(%p) initialized", (void *)l);
+	return l;
+}
+
+void
+irc_loop_dispose(irc_loop *loop)
+{
+	if (!loop)
+		return;
+
+	while (loop->ents)
+		detach(loop->ents);
+
+	sweep(loop);
+	lsi_b_evset_dispose(loop->es);
+	free(loop->tmrs);
+	D("(%p) disposed", (void *)loop);
+	free(loop);
+	return;
+}
+
+bool
+irc_loop_add(irc_loop *loop, irc *ctx, void *tag)
+{
+	if (ctx->loopent) {
+		E("(%p) context %p is already attached to a loop",
+		    (void *)loop, (void *)ctx);
+		return false;
+	}
+
+	int fd = irc_sockfd(ctx);
+	if (!irc_online(ctx) || fd < 0) {
+		E("(%p) context %p is not connected",
+		    (void *)loop, (void *)ctx);
+		return false;
+	}
+
+	struct loopent *ent = MALLOC(sizeof *ent);
+	if (!ent)
+		return false;
+
+	if (!lsi_b_evset_add(loop->es, fd, ent)) {
+		free(ent);
+		return false;
+	}
+
+	ent->ctx = ctx;
+	ent->loop = loop;
+	ent->fd = fd;
+	ent->tag = tag;
+	ent->ntimers = 0;
+	ent->served = 0;
+	ent->dead = false;
+	ent->wantwr = false;
+	ent->sqarmed = false;
+	ent->prevnb = irc_get_nbwrite(ctx);
+	ent->nextdead = NULL;
+	ent->prev = NULL;
+	ent->next = loop->ents;
+	if (loop->ents)
+		loop->ents->prev = ent;
+	loop->ents = ent;
+	loop->nents++;
+	ctx->loopent = ent;
+
+	/* a full socket must not hold up the other contexts */
+	irc_set_nbwrite(ctx, true);
+	lsi_loop_update(ctx);
+
+	/* irc_connect() may have read ahead past the logon sequence, so
+	 * don't rely on the fd becoming readable before looking */
+	ent->pending = true;
+	ent->nextpend = loop->pending;
+	loop->pending = ent;
+
+	D("(%p) attached context %p (fd %d, now %zu)",
+	    (void *)loop, (void *)ctx, fd, loop->nents);
+	return true;
+}
+
+bool
+irc_loop_del(irc_loop *loop, irc *ctx)
+{
+	struct loopent *ent = ctx->loopent;
+	if (!ent || ent->loop != loop) {
+		W("(%p) context %p is not attached", (void *)loop, (void *)ctx);
+		return false;
+	}
+
+	detach(ent);
+	return true;
+}
+
+size_t
+irc_loop_count(irc_loop *loop)
+{
+	return loop->nents;
+}
+
+bool
+irc_loop_timer(irc_loop *loop, irc *ctx, uint64_t in_us,
+    irc_loop_tmr_fn fn, void *tag)
+{
+	struct loopent *ent = NULL;
+	if (ctx) {
+		ent = ctx->loopent;
+		if (!ent || ent->loop != loop) {
+			E("(%p) context %p is not attached",
+			    (void *)loop, (void *)ctx);
+			return false;
+		}
+	}
+
+	if (loop->ntmrs == loop->tmrsz) {
+		size_t nsz = loop->tmrsz ? loop->tmrsz * 2 : 16;
+		struct ltimer *n = realloc(loop->tmrs, nsz * sizeof *n);
+		if (!n) {
+			EE("realloc");
+			return false;
+		}
+		loop->tmrs = n;
+		loop->tmrsz = nsz;
+	}
+
+	struct ltimer *t = &loop->tmrs[loop->ntmrs];
+	t->at = lsi_b_tstamp_us() + in_us;
+	t->seq = loop->tmrseq++;
+	t->ent = ent;
+	t->fn = fn;
+	t->tag = tag;
+	tmr_siftup(loop, loop->ntmrs++);
+
+	if (ent)
+		ent->ntimers++;
+
+	V("(%p) timer in %"PRIu64"us (now %zu)",
+	    (void *)loop, in_us, loop->ntmrs);
+	return true;
+}
+
+void
+irc_loop_regcb_msg(irc_loop *loop, irc_loop_msg_fn cb)
+{
+	loop->cb_msg = cb;
+	return;
+}
+
+void
+irc_loop_regcb_disc(irc_loop *loop, irc_loop_disc_fn cb)
+{
+	loop->cb_disc = cb;
+	return;
+}
+
+int
+irc_loop_step(irc_loop *loop, uint64_t to_us)
+{
+	uint64_t step = ++loop->step;
+
+	/* don't sleep past the next timer, nor at all if there's stuff
+	 * left over from the previous step */
+	if (loop->pending)
+		to_us = 1;
+	else if (loop->ntmrs) {
+		uint64_t now = lsi_b_tstamp_us();
+		uint64_t at = loop->tmrs[0].at;
+		uint64_t tto = at > now ? at - now : 1;
+		if (tto < 2)
+			tto = 1; // 0 would mean `forever'
+		if (!to_us || tto < to_us)
+			to_us = tto;
+	}
+
+	int n = lsi_b_evset_wait(loop->es, loop->ready, COUNTOF(loop->ready),
+	    to_us);
+	if (n < 0)
+		return -1;
+
+	int count = 0;
+
+	/* contexts left over from the previous step go first.  grab the
+	 * list as a whole, serve() may start a new one */
+	struct loopent *pend = loop->pending;
+	loop->pending = NULL;
+	while (pend) {
+		struct loopent *ent = pend;
+		pend = ent->nextpend;
+		ent->nextpend = NULL;
+		ent->pending = false;
+		if (ent->dead)
+			continue;
+
+		ent->served = step;
+		count++;
+		serve(loop, ent);
+	}
+
+	for (int i = 0; i < n; i++) {
+		struct loopent *ent = loop->ready[i];
+		if (ent->dead || ent->served == step)
+			continue;
+
+		ent->served = step;
+		count++;
+		serve(loop, ent);
+	}
+
+	count += tmr_fire(loop);
+	sweep(loop);
+
+	/* if we were idle, use the time to refresh a cached server address
+	 * that has been handed out stale (see irc_set_dnscache()) */
+	if (!count && lsi_dns_pending())
+		lsi_dns_revalidate();
+
+	return count;
+}
+
+bool
+irc_loop_run(irc_loop *loop)
+{
+	loop->stop = false;
+	while (!loop->stop && (loop->nents || loop->ntmrs))
+		if (irc_loop_step(loop, 0) == -1)
+			return false;
+
+	D("(%p) %s", (void *)loop, loop->stop ? "stopped" : "out of work");
+	return true;
+}
+
+void
+irc_loop_stop(irc_loop *loop)
+{
+	loop->stop = true;
+	return;
+}
+
+void
+lsi_loop_detach(irc *ctx)
+{
+	if (ctx->loopent)
+		detach(ctx->loopent);
+	return;
+}
+
+void
+lsi_loop_update(irc *ctx)
+{
+	struct loopent *ent = ctx->loopent;
+	if (!ent || ent->dead)
+		return;
+
+	bool want = lsi_conn_pending(ctx->con) > 0;
+	if (want != ent->wantwr) {
+		if (lsi_b_evset_mod(ent->loop->es, ent->fd, ent, want))
+			ent->wantwr = want;
+
+		V("(%p) context %p %s write interest", (void *)ent->loop,
+		    (void *)ctx, want ? "gained" : "lost");
+	}
+
+	/* wake up when the send queue may release its next line.  while
+	 * we're congested, the queue holds off anyway; we'll be back here
+	 * once the socket has taken what's pending */
+	uint64_t in_us;
+	if (!ent->sqarmed && !irc_congested(ctx)
+	    && (in_us = lsi_sq_next(ctx->sendq))
+	    && irc_loop_timer(ent->loop, ctx, in_us, sq_fire, NULL))
+		ent->sqarmed = true;
+
+	return;
+}
+
+
+/* send what's pending and read and dispatch whatever is there on `ent',
+ * without blocking.  returns false if the context got detached in the
+ * process */
+static bool
+serve(irc_loop *loop, struct loopent *ent)
+{
+	irc *ctx = ent->ctx;
+	for (size_t round = 0; round < LOOP_MAXROUNDS; round++) {
+		/* this flushes the send buffer (as far as the socket lets us)
+		 * before looking for input */
+		int r = irc_read_batch(ctx, loop->toks, COUNTOF(loop->toks), 1);
+		if (r == 0) {
+			lsi_loop_update(ctx);
+			return true;
+		}
+
+		if (r < 0) {
+			/* irc_read_batch() has done irc_reset(), which in
+			 * turn has detached us */
+			D("(%p) context %p disconnected",
+			    (void *)loop, (void *)ctx);
+			if (!ent->dead)
+				detach(ent);
+			if (loop->cb_disc)
+				loop->cb_disc(loop, ctx, ent->tag);
+			return false;
+		}
+
+		for (int i = 0; i < r; i++) {
+			if (ent->dead)
+				return false;
+
+			if (loop->cb_msg)
+				loop->cb_msg(loop, ctx, &loop->toks[i],
+				    ent->tag);
+		}
+
+		if (ent->dead)
+			return false;
+	}
+
+	lsi_loop_update(ctx);
+
+	/* there may be more; don't let this one starve the others */
+	if (!ent->pending) {
+		ent->pending = true;
+		ent->nextpend = loop->pending;
+		loop->pending = ent;
+	}
+
+	return true;
+}
+
+/* take `ent' out of the loop.  it is not freed right away, as we might be
+ * in the middle of a step that still has pointers to it */
+static void
+detach(struct loopent *ent)
+{
+	irc_loop *loop = ent->loop;
+	if (ent->dead)
+		return;
+
+	lsi_b_evset_del(loop->es, ent->fd);
+	tmr_drop(loop, ent);
+	irc_set_nbwrite(ent->ctx, ent->prevnb);
+
+	if (ent->prev)
+		ent->prev->next = ent->next;
+	else
+		loop->ents = ent->next;
+	if (ent->next)
+		ent->next->prev = ent->prev;
+	loop->nents--;
+
+	/* unhook from the pending list, if it's on it.  if it isn't found
+	 * there, irc_loop_step() is currently walking it, and will skip us */
+	if (ent->pending) {
+		struct loopent **p = &loop->pending;
+		while (*p && *p != ent)
+			p = &(*p)->nextpend;
+		if (*p) {
+			*p = ent->nextpend;
+			ent->pending = false;
+		}
+	}
+
+	ent->ctx->loopent = NULL;
+	ent->dead = true;
+	ent->nextdead = loop->dead;
+	loop->dead = ent;
+
+	D("(%p) detached context %p (now %zu)",
+	    (void *)loop, (void *)ent->ctx, loop->nents);
+	return;
+}
+
+static void
+sweep(irc_loop *loop)
+{
+	while (loop->dead) {
+		struct loopent *ent = loop->dead;
+		loop->dead = ent->nextdead;
+		free(ent);
+	}
+	return;
+}
+
+static bool
+tmr_less(const struct ltimer *a, const struct ltimer *b)
+{
+	return a->at < b->at || (a->at == b->at && a->seq < b->seq);
+}
+
+static void
+tmr_siftup(irc_loop *loop, size_t i)
+{
+	struct ltimer t = loop->tmrs[i];
+	while (i > 0) {
+		size_t p = (i - 1) / 2;
+		if (!tmr_less(&t, &loop->tmrs[p]))
+			break;
+		loop->tmrs[i] = loop->tmrs[p];
+		i = p;
+	}
+	loop->tmrs[i] = t;
+	return;
+}
+
+static void
+tmr_siftdown(irc_loop *loop, size_t i)
+{
+	struct ltimer t = loop->tmrs[i];
+	size_t n = loop->ntmrs;
+	for (;;) {
+		size_t c = 2 * i + 1;
+		if (c >= n)
+			break;
+		if (c + 1 < n && tmr_less(&loop->tmrs[c + 1], &loop->tmrs[c]))
+			c++;
+		if (!tmr_less(&loop->tmrs[c], &t))
+			break;
+		loop->tmrs[i] = loop->tmrs[c];
+		i = c;
+	}
+	loop->tmrs[i] = t;
+	return;
+}
+
+/* remove all timers associated with `ent', then restore the heap property.
+ * this is O(number of timers), but only needed if `ent' has any */
+static void
+tmr_drop(irc_loop *loop, struct loopent *ent)
+{
+	if (!ent->ntimers)
+		return;
+
+	size_t j = 0;
+	for (size_t i = 0; i < loop->ntmrs; i++)
+		if (loop->tmrs[i].ent != ent)
+			loop->tmrs[j++] = loop->tmrs[i];
+
+	V("(%p) dropped %zu timer(s)", (void *)loop, loop->ntmrs - j);
+	loop->ntmrs = j;
+	ent->ntimers = 0;
+
+	for (size_t i = loop->ntmrs / 2; i-- > 0;)
+		tmr_siftdown(loop, i);
+	return;
+}
+
+/* a context's send queue is due */
+static void
+sq_fire(irc_loop *loop, irc *ctx, void *tag)
+{
+	struct loopent *ent = ctx->loopent;
+	ent->sqarmed = false;
+
+	/* this re-arms us if there's more */
+	if (irc_sendq_run(ctx) == -1) {
+		/* irc_reset() has detached us, but `ent' is still around */
+		D("(%p) context %p disconnected", (void *)loop, (void *)ctx);
+		if (loop->cb_disc)
+			loop->cb_disc(loop, ctx, ent->tag);
+	}
+
+	return;
+}
+
+/* fire all timers that are due.  returns how many were fired */
+static int
+tmr_fire(irc_loop *loop)
+{
+	if (!loop->ntmrs)
+		return 0;
+
+	/* timers set up by the callbacks wait for the next step, even if
+	 * they are due right away */
+	int count = 0;
+	uint64_t now = lsi_b_tstamp_us();
+	uint64_t seqlim = loop->tmrseq;
+	while (loop->ntmrs && loop->tmrs[0].at <= now
+	    && loop->tmrs[0].seq < seqlim) {
+		struct ltimer t = loop->tmrs[0];
+		loop->tmrs[0] = loop->tmrs[--loop->ntmrs];
+		if (loop->ntmrs)
+			tmr_siftdown(loop, 0);
+
+		if (t.ent)
+			t.ent->ntimers--;
+
+		count++;
+		t.fn(loop, t.ent ? t.ent->ctx : NULL, t.tag);
+	}
+
+	return count;
+}
@@ -0,0 +1,28 @@
+/* loop.h - event loop internal interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_LOOP_H
+#define LIBSRSIRC_LOOP_H 1
+
+
+#include <libsrsirc/defs.h>
+#include "intdefs.h"
+
+/* lsi_loop_detach
+ * Detach an IRC context from whatever irc_loop it is attached to, if any.
+ * Called whenever the context's connection goes away (irc_reset()) and
+ * when it is disposed of, so loops never hold on to stale contexts.
+ *
+ * Params: `ctx': The IRC context */
+void lsi_loop_detach(irc *ctx);
+
+/* lsi_loop_update
+ * Make the loop `ctx' is attached to (if any) watch its socket for
+ * writability if, and only if, there's output pending.  Called whenever
+ * the send buffer may have changed outside of the loop's own doing.
+ *
+ * Params: `ctx': The IRC context */
+void lsi_loop_update(irc *ctx);
+
+#endif /* LIBSRSIRC_LOOP_H */
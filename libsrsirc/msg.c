@@ -12,6 +12,7 @@
 #include "msg.h"
 
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,11 +25,58 @@
 
 #include "common.h"
 #include "conn.h"
+#include "dstat.h"
 
 #include <libsrsirc/defs.h>
 #include <libsrsirc/util.h>
 
 
+/* a walk over the handlers of one set for the current message's command */
+struct dispwalk {
+	const struct dispent *ent; // NULL if the command has no handlers
+	unsigned gen;              // Generation of the index `ent' belongs to
+	unsigned pos;              // Next position in the run
+	size_t slot;               // Slot of the handler last returned
+	bool started;              // Whether we returned any handler yet
+};
+
+
+static const char *slotcmd(irc *ctx, int set, size_t slot);
+static size_t nslots(irc *ctx, int set);
+static int numeric(const char *cmd);
+static uint32_t hash(const char *cmd);
+static unsigned *bucket(struct dispidx *di, const char *cmd);
+static const struct dispent *lookup(struct dispidx *di, const char *cmd);
+static struct dispent *enter(struct dispidx *di, const char *cmd);
+static bool grow(struct dispidx *di, size_t nhnds);
+static bool rebuild(irc *ctx);
+static bool next_hnd(irc *ctx, const char *cmd, int set, struct dispwalk *w);
+static uint16_t dispatch(irc *ctx, tokarr *msg, bool logon);
+
+
+void
+lsi_msg_initidx(irc *ctx)
+{
+	struct dispidx *di = &ctx->disp;
+	memset(di->num, 0, sizeof di->num);
+	di->verb = NULL;
+	di->ents = NULL;
+	di->order = NULL;
+	di->verbsz = di->nents = di->entcap = di->ordcap = 0;
+	di->gen = 0;
+	return;
+}
+
+void
+lsi_msg_disposeidx(irc *ctx)
+{
+	free(ctx->disp.verb);
+	free(ctx->disp.ents);
+	free(ctx->disp.order);
+	lsi_msg_initidx(ctx);
+	return;
+}
+
 bool
 lsi_msg_reghnd(irc *ctx, const char *cmd, hnd_fn hndfn, const char *module)
 {
@@ -57,6 +105,11 @@ lsi_msg_reghnd(irc *ctx, const char *cmd, hnd_fn hndfn, const char *module)
 	ctx->msghnds[i].module = module;
 	ctx->msghnds[i].hndfn = hndfn;
 	STRACPY(ctx->msghnds[i].cmd, cmd);
+	if (!rebuild(ctx)) {
+		ctx->msghnds[i].cmd[0] = '\0';
+		return false;
+	}
+
 	return true;
 }
 
@@ -96,9 +149,84 @@ lsi_msg_reguhnd(irc *ctx, const char *cmd, uhnd_fn hndfn, bool pre)
 
 	harr[i].hndfn = hndfn;
 	STRACPY(harr[i].cmd, cmd);
+	if (!rebuild(ctx)) {
+		harr[i].cmd[0] = '\0';
+		return false;
+	}
+
+	return true;
+}
+
+bool
+lsi_msg_setfilter(irc *ctx, const char *const *cmds, size_t ncmds)
+{
+	char (*nf)[32] = NULL;
+	if (cmds) {
+		if (!(nf = MALLOC((ncmds + 1) * sizeof *nf)))
+			return false;
+
+		for (size_t i = 0; i < ncmds; i++) {
+			if (!cmds[i][0] || strlen(cmds[i]) >= sizeof *nf) {
+				E("bad command '%s' in receive filter", cmds[i]);
+				free(nf);
+				return false;
+			}
+
+			STRACPY(nf[i], cmds[i]);
+		}
+	}
+
+	char (*of)[32] = ctx->rfilt;
+	size_t ocnt = ctx->rfilt_cnt;
+	ctx->rfilt = nf;
+	ctx->rfilt_cnt = cmds ? ncmds : 0;
+	if (!rebuild(ctx)) {
+		ctx->rfilt = of;
+		ctx->rfilt_cnt = ocnt;
+		free(nf);
+		return false;
+	}
+
+	free(of);
 	return true;
 }
 
+bool
+lsi_msg_wanted(void *ctx, const char *cmd, size_t len)
+{
+	char buf[32];
+	if (len >= sizeof buf)
+		return false; // nothing by that name can be in the index
+
+	memcpy(buf, cmd, len);
+	buf[len] = '\0';
+	return lookup(&((irc *)ctx)->disp, buf);
+}
+
+bool
+lsi_msg_deliver(irc *ctx, const char *cmd)
+{
+	if (!ctx->rfilt)
+		return true;
+
+	const struct dispent *ent = lookup(&ctx->disp, cmd);
+	return ent && ent->deliver;
+}
+
+bool
+lsi_msg_needs(irc *ctx, const char *cmd)
+{
+	const struct dispent *ent = lookup(&ctx->disp, cmd);
+	if (!ent)
+		return false;
+
+	for (size_t i = 0; i < DS_NUM; i++)
+		if (ent->cnt[i])
+			return true;
+
+	return false;
+}
+
 void
 lsi_msg_unregall(irc *ctx, const char *module)
 {
@@ -107,24 +235,26 @@ lsi_msg_unregall(irc *ctx, const char *module)
 		if (ctx->msghnds[i].cmd[0]
 		    && strcmp(ctx->msghnds[i].module, module) == 0)
 			ctx->msghnds[i].cmd[0] = '\0';
+
+	rebuild(ctx); // can't fail, we only got fewer handlers
 	return;
 }
 
 static bool
-dispatch_uhnd(irc *ctx, tokarr *msg, size_t ac, bool pre)
+dispatch_uhnd(irc *ctx, tokarr *msg, size_t ac, struct dispwalk *from, bool pre)
 {
-	size_t hcnt = pre ? ctx->uprehnds_cnt : ctx->uposthnds_cnt;
-	struct umsghnd *harr = pre ? ctx->uprehnds : ctx->uposthnds;
+	int set = pre ? DS_PRE : DS_POST;
+	struct dispwalk w = { .ent = from->ent, .gen = from->gen };
 
-	for (size_t i = 0; i < hcnt; i++) {
-		if (!harr[i].cmd[0])
-			continue;
-
-		if (strcmp((*msg)[1], harr[i].cmd) != 0)
-			continue;
+	while (next_hnd(ctx, (*msg)[1], set, &w)) {
+		struct umsghnd *h = pre ? &ctx->uprehnds[w.slot]
+		    : &ctx->uposthnds[w.slot];
 
 		D("dispatch a %s-'%s'", pre?"pre":"post", (*msg)[1]);
-		if (!harr[i].hndfn(ctx, msg, ac, pre))
+		uint64_t t0 = DSTAT_START(ctx);
+		bool ok = h->hndfn(ctx, msg, ac, pre);
+		DSTAT_STOP(ctx, t0, (*msg)[1], pre ? "pre" : "post", (int)w.slot);
+		if (!ok)
 			return false;
 	}
 
@@ -133,32 +263,43 @@ dispatch_uhnd(irc *ctx, tokarr *msg, size_t ac, bool pre)
 
 uint16_t
 lsi_msg_handle(irc *ctx, tokarr *msg, bool logon)
+{
+	uint64_t t0 = DSTAT_START(ctx);
+	uint16_t res = dispatch(ctx, msg, logon);
+	DSTAT_STOP(ctx, t0, (*msg)[1], "", -1);
+	return res;
+}
+
+static uint16_t
+dispatch(irc *ctx, tokarr *msg, bool logon)
 {
 	uint16_t res = 0;
-	size_t i = 0;
 	size_t ac = 2;
 	while (ac < COUNTOF(*msg) && (*msg)[ac])
 		ac++;
 
-	if (!logon && !dispatch_uhnd(ctx, msg, ac, true)) {
+	/* commands nobody registered a handler for end here (most do) */
+	struct dispwalk w = { .gen = ctx->disp.gen };
+	if (!(w.ent = lookup(&ctx->disp, (*msg)[1])))
+		return 0;
+
+	if (!logon && !dispatch_uhnd(ctx, msg, ac, &w, true)) {
 		res |= USER_ERR;
 		goto fail;
 	}
 
-	for (;i < ctx->msghnds_cnt; i++) {
-		if (!ctx->msghnds[i].cmd[0])
-			continue;
-
-		if (strcmp((*msg)[1], ctx->msghnds[i].cmd) != 0)
-			continue;
-
-		D("dispatch a '%s' to '%s'", (*msg)[1], ctx->msghnds[i].module);
-		res |= ctx->msghnds[i].hndfn(ctx, msg, ac, logon);
+	while (next_hnd(ctx, (*msg)[1], DS_SYS, &w)) {
+		struct msghnd *h = &ctx->msghnds[w.slot];
+		D("dispatch a '%s' to '%s'", (*msg)[1], h->module);
+		const char *mod = h->module; // `h' may move while we're in there
+		uint64_t t0 = DSTAT_START(ctx);
+		res |= h->hndfn(ctx, msg, ac, logon);
+		DSTAT_STOP(ctx, t0, (*msg)[1], mod, -1);
 		if (res & CANT_PROCEED)
 			goto fail;
 	}
 
-	if (!logon && !dispatch_uhnd(ctx, msg, ac, false)) {
+	if (!logon && !dispatch_uhnd(ctx, msg, ac, &w, false)) {
 		res |= USER_ERR;
 		goto fail;
 	}
@@ -193,3 +334,218 @@ fail:;
 
 	return res;
 }
+
+
+/* the command of the handler in slot `slot' of set `set', "" if unused */
+static const char *
+slotcmd(irc *ctx, int set, size_t slot)
+{
+	switch (set) {
+	case DS_PRE: return ctx->uprehnds[slot].cmd;
+	case DS_SYS: return ctx->msghnds[slot].cmd;
+	default: return ctx->uposthnds[slot].cmd;
+	}
+}
+
+static size_t
+nslots(irc *ctx, int set)
+{
+	switch (set) {
+	case DS_PRE: return ctx->uprehnds_cnt;
+	case DS_SYS: return ctx->msghnds_cnt;
+	default: return ctx->uposthnds_cnt;
+	}
+}
+
+/* the value of a 3-digit numeric, -1 if `cmd' isn't one */
+static int
+numeric(const char *cmd)
+{
+	if (!isdigit((unsigned char)cmd[0]) || !isdigit((unsigned char)cmd[1])
+	    || !isdigit((unsigned char)cmd[2]) || cmd[3])
+		return -1;
+
+	return (cmd[0] - '0') * 100 + (cmd[1] - '0') * 10 + (cmd[2] - '0');
+}
+
+/* FNV-1a */
+static uint32_t
+hash(const char *cmd)
+{
+	uint32_t h = 2166136261u;
+	while (*cmd)
+		h = (h ^ (unsigned char)*cmd++) * 16777619u;
+
+	return h;
+}
+
+/* where `cmd' is (or would go) in the index; NULL if there's no verb table */
+static unsigned *
+bucket(struct dispidx *di, const char *cmd)
+{
+	int n = numeric(cmd);
+	if (n >= 0)
+		return &di->num[n];
+
+	if (!di->verbsz)
+		return NULL;
+
+	size_t mask = di->verbsz - 1;
+	size_t i = hash(cmd) & mask;
+	while (di->verb[i] && strcmp(di->ents[di->verb[i] - 1].cmd, cmd) != 0)
+		i = (i + 1) & mask;
+
+	return &di->verb[i];
+}
+
+static const struct dispent *
+lookup(struct dispidx *di, const char *cmd)
+{
+	unsigned *b = bucket(di, cmd);
+	return b && *b ? &di->ents[*b - 1] : NULL;
+}
+
+/* the entry for `cmd', which is created if there is none yet.  there must
+ * be room for it (see grow()) */
+static struct dispent *
+enter(struct dispidx *di, const char *cmd)
+{
+	unsigned *b = bucket(di, cmd);
+	if (!*b) {
+		struct dispent *e = &di->ents[di->nents++];
+		STRACPY(e->cmd, cmd);
+		memset(e->cnt, 0, sizeof e->cnt);
+		e->deliver = false;
+		*b = di->nents;
+	}
+
+	return &di->ents[*b - 1];
+}
+
+/* make room for indexing `nhnds' handlers.  the verb table is kept at most
+ * half full so that probe sequences stay short.  we never shrink, so that
+ * rebuilding after unregistering handlers can't fail.  nothing is replaced
+ * unless everything could be allocated */
+static bool
+grow(struct dispidx *di, size_t nhnds)
+{
+	size_t vsz = di->verbsz ? di->verbsz : 16;
+	while (vsz < nhnds * 2)
+		vsz *= 2;
+
+	unsigned *nv = NULL, *no = NULL;
+	struct dispent *ne = NULL;
+	if ((vsz > di->verbsz && !(nv = MALLOC(vsz * sizeof *nv)))
+	    || (nhnds > di->entcap && !(ne = MALLOC(nhnds * sizeof *ne)))
+	    || (nhnds > di->ordcap && !(no = MALLOC(nhnds * sizeof *no)))) {
+		free(nv);
+		free(ne);
+		return false;
+	}
+
+	if (nv) {
+		free(di->verb);
+		di->verb = nv;
+		di->verbsz = vsz;
+	}
+
+	if (ne) {
+		free(di->ents);
+		di->ents = ne;
+		di->entcap = nhnds;
+	}
+
+	if (no) {
+		free(di->order);
+		di->order = no;
+		di->ordcap = nhnds;
+	}
+
+	return true;
+}
+
+/* index all registered handlers.  first we count the handlers per command
+ * and set, then hand out the runs in `order', then fill them in slot order,
+ * which is the order in which handlers are dispatched to.  commands in the
+ * receive filter get an entry too, handlers or not.  if we fail to
+ * allocate, the index is left as it was */
+static bool
+rebuild(irc *ctx)
+{
+	struct dispidx *di = &ctx->disp;
+	size_t nhnds = 0;
+	for (int set = 0; set < DS_NUM; set++)
+		for (size_t i = 0; i < nslots(ctx, set); i++)
+			if (slotcmd(ctx, set, i)[0])
+				nhnds++;
+
+	if (!grow(di, nhnds + ctx->rfilt_cnt)) {
+		E("failed to rebuild the dispatch index");
+		return false;
+	}
+
+	memset(di->num, 0, sizeof di->num);
+	memset(di->verb, 0, di->verbsz * sizeof *di->verb);
+	di->nents = 0;
+
+	for (int set = 0; set < DS_NUM; set++) {
+		for (size_t i = 0; i < nslots(ctx, set); i++) {
+			const char *cmd = slotcmd(ctx, set, i);
+			if (cmd[0])
+				enter(di, cmd)->cnt[set]++;
+		}
+	}
+
+	for (size_t i = 0; i < ctx->rfilt_cnt; i++)
+		enter(di, ctx->rfilt[i])->deliver = true;
+
+	unsigned off = 0;
+	for (size_t j = 0; j < di->nents; j++) {
+		for (int set = 0; set < DS_NUM; set++) {
+			di->ents[j].first[set] = off;
+			off += di->ents[j].cnt[set];
+			di->ents[j].cnt[set] = 0;
+		}
+	}
+
+	for (int set = 0; set < DS_NUM; set++) {
+		for (size_t i = 0; i < nslots(ctx, set); i++) {
+			const char *cmd = slotcmd(ctx, set, i);
+			if (!cmd[0])
+				continue;
+
+			struct dispent *e = &di->ents[*bucket(di, cmd) - 1];
+			di->order[e->first[set] + e->cnt[set]++] = i;
+		}
+	}
+
+	di->gen++;
+	D("dispatch index: %zu handlers for %zu commands (gen %u)",
+	    nhnds, di->nents, di->gen);
+	return true;
+}
+
+/* step `w' to the next handler of set `set' for `cmd', returning false if
+ * there is none.  handlers may (un)register handlers while we dispatch; if
+ * the index was rebuilt meanwhile, we look `cmd' up again and carry on after
+ * the slot we were at, just like a scan over the slots would */
+static bool
+next_hnd(irc *ctx, const char *cmd, int set, struct dispwalk *w)
+{
+	struct dispidx *di = &ctx->disp;
+	if (w->gen != di->gen) {
+		w->gen = di->gen;
+		w->ent = lookup(di, cmd);
+		w->pos = 0;
+		while (w->started && w->ent && w->pos < w->ent->cnt[set]
+		    && di->order[w->ent->first[set] + w->pos] <= w->slot)
+			w->pos++;
+	}
+
+	if (!w->ent || w->pos == w->ent->cnt[set])
+		return false;
+
+	w->slot = di->order[w->ent->first[set] + w->pos++];
+	w->started = true;
+	return true;
+}
@@ -28,11 +28,31 @@
 #define MORE_CAPS      (1<<11) // multiline reply to CAP LS
 #define STARTTLS_OVER  (1<<12) // early starttls finished (or failed)
 
+/* set up and tear down the dispatch index (see struct dispidx) */
+void lsi_msg_initidx(irc *ctx);
+void lsi_msg_disposeidx(irc *ctx);
+
 bool lsi_msg_reghnd(irc *ctx, const char *cmd, hnd_fn hndfn, const char *module);
 void lsi_msg_unregall(irc *ctx, const char *module);
 
 bool lsi_msg_reguhnd(irc *ctx, const char *cmd, uhnd_fn hndfn, bool pre);
 
+/* set the receive filter (see irc_set_recv_filter()); `cmds' NULL for none */
+bool lsi_msg_setfilter(irc *ctx, const char *const *cmds, size_t ncmds);
+
+/* whether a message with command `cmd' (`len' bytes, need not be
+ * '\0'-terminated) is of any interest, i.e. either passes the receive
+ * filter or has handlers.  `ctx' is the irc context; this is suitable as
+ * a struct rdfilter's `want' function */
+bool lsi_msg_wanted(void *ctx, const char *cmd, size_t len);
+
+/* whether any handler (internal or user) is registered for `cmd', i.e.
+ * whether a message with that command needs to be tokenized at all */
+bool lsi_msg_needs(irc *ctx, const char *cmd);
+
+/* whether a message with command `cmd' is to be handed out to the user */
+bool lsi_msg_deliver(irc *ctx, const char *cmd);
+
 
 /* returns the bitwise OR of one or more of the above
  * bitmasks, or 0 for nothing special */
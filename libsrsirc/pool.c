@@ -0,0 +1,425 @@
+/* pool.c - slab pools and a small-object arena
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_POOL
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "pool.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+
+#include <logger/intlog.h>
+
+#include "common.h"
+
+
+/* what the objects we hand out might need to be aligned to */
+union align {
+	void *p;
+	uint64_t u;
+	double d;
+};
+
+#define ALIGN_UP(N) \
+    (((N) + sizeof (union align) - 1) / sizeof (union align) \
+    * sizeof (union align))
+
+/* the arena's size classes, and about how big their chunks are */
+#define NCLASSES 4
+#define MIN_CLASS 16
+#define ARENA_CHUNKSZ 4096
+
+
+struct chunk {
+	struct chunk *next;
+	union align data[];
+};
+
+struct pool {
+	size_t objsz;
+	size_t perchunk;
+	struct chunk *chunks; // newest first; we carve from the head
+	char *cur;            // next never-used object in `chunks'
+	size_t left;          // how many never-used objects remain there
+	void *freelist;       // handed-back objects, linked through their
+	                      // first bytes
+	size_t nchunks;
+	size_t nlive;
+	size_t nfree;
+};
+
+/* allocations too big for any size class */
+struct bigblk {
+	struct bigblk *next, *prev;
+	size_t sz;
+	union align data[];
+};
+
+/* where a chunk of one of the arena's pools begins, and which pool it is */
+struct clschunk {
+	const char *base;
+	size_t cls;
+};
+
+struct arena {
+	pool *cls[NCLASSES];
+	struct clschunk *chunks; // all chunks of the above, sorted by `base'
+	size_t nchunks;
+	size_t chunkcap;
+	struct bigblk *big;
+	size_t nbig;
+	size_t bigbytes;
+};
+
+
+static size_t class_of(size_t sz);
+static bool reserve_chunk(arena *a);
+static void add_chunk(arena *a, const char *base, size_t cls);
+static size_t chunk_class(arena *a, const void *ptr);
+
+
+pool *
+lsi_pool_init(size_t objsz, size_t perchunk)
+{
+	pool *p = MALLOC(sizeof *p);
+	if (!p)
+		return NULL;
+
+	if (objsz < sizeof (void *))
+		objsz = sizeof (void *);
+
+	p->objsz = ALIGN_UP(objsz);
+	p->perchunk = perchunk ? perchunk : 1;
+	p->chunks = NULL;
+	p->cur = NULL;
+	p->left = 0;
+	p->freelist = NULL;
+	p->nchunks = p->nlive = p->nfree = 0;
+	return p;
+}
+
+void *
+lsi_pool_get(pool *p)
+{
+	void *obj;
+	if ((obj = p->freelist)) {
+		memcpy(&p->freelist, obj, sizeof p->freelist);
+		p->nfree--;
+	} else {
+		if (!p->left) {
+			struct chunk *c = MALLOC(sizeof *c
+			    + p->perchunk * p->objsz);
+			if (!c)
+				return NULL;
+
+			c->next = p->chunks;
+			p->chunks = c;
+			p->cur = (char *)c->data;
+			p->left = p->perchunk;
+			p->nchunks++;
+		}
+
+		obj = p->cur;
+		p->cur += p->objsz;
+		p->left--;
+	}
+
+	p->nlive++;
+	return obj;
+}
+
+void
+lsi_pool_put(pool *p, void *obj)
+{
+	if (!obj)
+		return;
+
+	memcpy(obj, &p->freelist, sizeof p->freelist);
+	p->freelist = obj;
+	p->nlive--;
+	p->nfree++;
+	return;
+}
+
+void
+lsi_pool_clear(pool *p)
+{
+	while (p->chunks) {
+		struct chunk *c = p->chunks;
+		p->chunks = c->next;
+		free(c);
+	}
+
+	p->cur = NULL;
+	p->left = 0;
+	p->freelist = NULL;
+	p->nchunks = p->nlive = p->nfree = 0;
+	return;
+}
+
+void
+lsi_pool_dispose(pool *p)
+{
+	if (!p)
+		return;
+
+	lsi_pool_clear(p);
+	free(p);
+	return;
+}
+
+void
+lsi_pool_stat(pool *p, size_t *nchunks, size_t *nlive, size_t *nfree,
+    size_t *nbytes)
+{
+	*nchunks = p->nchunks;
+	*nlive = p->nlive;
+	*nfree = p->nfree;
+	*nbytes = p->nchunks * (sizeof (struct chunk) + p->perchunk * p->objsz);
+	return;
+}
+
+void
+lsi_pool_dumpstat(pool *p, const char *dbgname)
+{
+	size_t nchunks, nlive, nfree, nbytes;
+	lsi_pool_stat(p, &nchunks, &nlive, &nfree, &nbytes);
+
+	A("pool '%s' stat: objsz: %zu, chunks: %zu (%zu bytes), live: %zu, "
+	    "free: %zu, unused: %zu", dbgname, p->objsz, nchunks, nbytes,
+	    nlive, nfree, p->left);
+	return;
+}
+
+
+arena *
+lsi_arena_init(void)
+{
+	arena *a = MALLOC(sizeof *a);
+	if (!a)
+		return NULL;
+
+	for (size_t i = 0; i < NCLASSES; i++)
+		a->cls[i] = NULL;
+	a->chunks = NULL;
+	a->nchunks = a->chunkcap = 0;
+	a->big = NULL;
+	a->nbig = a->bigbytes = 0;
+
+	for (size_t i = 0; i < NCLASSES; i++) {
+		size_t sz = (size_t)MIN_CLASS << i;
+		if (!(a->cls[i] = lsi_pool_init(sz, ARENA_CHUNKSZ / sz))) {
+			lsi_arena_dispose(a);
+			return NULL;
+		}
+	}
+
+	return a;
+}
+
+void *
+lsi_arena_alloc(arena *a, size_t sz)
+{
+	size_t cls = class_of(sz);
+	if (cls < NCLASSES) {
+		/* make sure we'll be able to note down a new chunk, if the
+		 * pool needs one */
+		if (!reserve_chunk(a))
+			return NULL;
+
+		pool *p = a->cls[cls];
+		struct chunk *c = p->chunks;
+		void *obj = lsi_pool_get(p);
+		if (obj && p->chunks != c)
+			add_chunk(a, (char *)p->chunks->data, cls);
+
+		return obj;
+	}
+
+	struct bigblk *b = MALLOC(sizeof *b + sz);
+	if (!b)
+		return NULL;
+
+	b->sz = sz;
+	b->prev = NULL;
+	if ((b->next = a->big))
+		b->next->prev = b;
+	a->big = b;
+	a->nbig++;
+	a->bigbytes += sz;
+	return b->data;
+}
+
+void
+lsi_arena_free(arena *a, void *ptr)
+{
+	if (!ptr)
+		return;
+
+	size_t cls = chunk_class(a, ptr);
+	if (cls < NCLASSES) {
+		lsi_pool_put(a->cls[cls], ptr);
+		return;
+	}
+
+	struct bigblk *b = (struct bigblk *)((char *)ptr
+	    - offsetof(struct bigblk, data));
+	if (b->next)
+		b->next->prev = b->prev;
+	if (b->prev)
+		b->prev->next = b->next;
+	else
+		a->big = b->next;
+
+	a->nbig--;
+	a->bigbytes -= b->sz;
+	free(b);
+	return;
+}
+
+char *
+lsi_arena_strdup(arena *a, const char *s)
+{
+	size_t len = strlen(s);
+	char *r = lsi_arena_alloc(a, len + 1);
+	if (r)
+		memcpy(r, s, len + 1);
+	return r;
+}
+
+void
+lsi_arena_strfree(arena *a, char *s)
+{
+	lsi_arena_free(a, s);
+	return;
+}
+
+void
+lsi_arena_clear(arena *a)
+{
+	for (size_t i = 0; i < NCLASSES; i++)
+		if (a->cls[i])
+			lsi_pool_clear(a->cls[i]);
+
+	a->nchunks = 0;
+	while (a->big) {
+		struct bigblk *b = a->big;
+		a->big = b->next;
+		free(b);
+	}
+
+	a->nbig = a->bigbytes = 0;
+	return;
+}
+
+void
+lsi_arena_dispose(arena *a)
+{
+	if (!a)
+		return;
+
+	lsi_arena_clear(a);
+	for (size_t i = 0; i < NCLASSES; i++)
+		lsi_pool_dispose(a->cls[i]);
+	free(a->chunks);
+	free(a);
+	return;
+}
+
+void
+lsi_arena_dumpstat(arena *a, const char *dbgname)
+{
+	char name[64];
+	for (size_t i = 0; i < NCLASSES; i++) {
+		snprintf(name, sizeof name, "%s/%zu", dbgname,
+		    (size_t)MIN_CLASS << i);
+		lsi_pool_dumpstat(a->cls[i], name);
+	}
+
+	A("arena '%s' stat: large blocks: %zu (%zu bytes)",
+	    dbgname, a->nbig, a->bigbytes);
+	return;
+}
+
+
+/* index of the smallest size class `sz' fits in, or NCLASSES if none */
+static size_t
+class_of(size_t sz)
+{
+	size_t i = 0;
+	for (size_t csz = MIN_CLASS; i < NCLASSES && csz < sz; csz <<= 1)
+		i++;
+	return i;
+}
+
+/* make room for one more entry in `a->chunks' */
+static bool
+reserve_chunk(arena *a)
+{
+	if (a->nchunks < a->chunkcap)
+		return true;
+
+	size_t ncap = a->chunkcap ? a->chunkcap * 2 : 16;
+	struct clschunk *n = MALLOC(ncap * sizeof *n);
+	if (!n)
+		return false;
+
+	if (a->nchunks)
+		memcpy(n, a->chunks, a->nchunks * sizeof *n);
+	free(a->chunks);
+	a->chunks = n;
+	a->chunkcap = ncap;
+	return true;
+}
+
+/* note that the chunk at `base' belongs to size class `cls'; there must
+ * be room for it (see reserve_chunk()) */
+static void
+add_chunk(arena *a, const char *base, size_t cls)
+{
+	/* new chunks tend to be at higher addresses, so look from the end */
+	size_t i = a->nchunks;
+	while (i > 0 && a->chunks[i - 1].base > base) {
+		a->chunks[i] = a->chunks[i - 1];
+		i--;
+	}
+
+	a->chunks[i].base = base;
+	a->chunks[i].cls = cls;
+	a->nchunks++;
+	return;
+}
+
+/* the size class of the chunk `ptr' was handed out from, or NCLASSES if
+ * it isn't in any (i.e. it's a large block) */
+static size_t
+chunk_class(arena *a, const void *ptr)
+{
+	const char *p = ptr;
+	size_t lo = 0, hi = a->nchunks;
+	while (lo < hi) { /* find the last chunk starting at or before `p' */
+		size_t mid = lo + (hi - lo) / 2;
+		if (a->chunks[mid].base <= p)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (!lo)
+		return NCLASSES;
+
+	const struct clschunk *c = &a->chunks[lo - 1];
+	pool *pl = a->cls[c->cls];
+	return p < c->base + pl->perchunk * pl->objsz ? c->cls : NCLASSES;
+}
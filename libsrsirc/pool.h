@@ -0,0 +1,49 @@
+/* pool.h - slab pools and a small-object arena, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_POOL_H
+#define LIBSRSIRC_POOL_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+
+typedef struct pool pool;
+typedef struct arena arena;
+
+
+/* a pool hands out objects of `objsz' bytes, carved out of chunks of
+ * `perchunk' objects each.  objects handed back are reused, chunks are only
+ * released (all at once) by lsi_pool_clear() and lsi_pool_dispose() --
+ * which also means anything still handed out is gone, then */
+pool *lsi_pool_init(size_t objsz, size_t perchunk);
+void *lsi_pool_get(pool *p);
+void lsi_pool_put(pool *p, void *obj);
+void lsi_pool_clear(pool *p);
+void lsi_pool_dispose(pool *p);
+
+/* `nfree' counts objects that were handed back and not reused yet,
+ * `nbytes' is what the chunks take up */
+void lsi_pool_stat(pool *p, size_t *nchunks, size_t *nlive, size_t *nfree,
+    size_t *nbytes);
+void lsi_pool_dumpstat(pool *p, const char *dbgname);
+
+
+/* an arena serves variably sized small allocations (mostly strings) from
+ * a handful of pools of size classes; larger ones are malloc'd but still
+ * accounted for, so that lsi_arena_clear() releases everything.  the arena
+ * keeps track of which pool each of its chunks belongs to, so freeing needs
+ * nothing but the pointer (and strings may be changed in place) */
+arena *lsi_arena_init(void);
+void *lsi_arena_alloc(arena *a, size_t sz);
+void lsi_arena_free(arena *a, void *ptr);
+char *lsi_arena_strdup(arena *a, const char *s);
+void lsi_arena_strfree(arena *a, char *s);
+void lsi_arena_clear(arena *a);
+void lsi_arena_dispose(arena *a);
+void lsi_arena_dumpstat(arena *a, const char *dbgname);
+
+
+#endif /* LIBSRSIRC_POOL_H */
@@ -12,6 +12,7 @@
 #include "px.h"
 
 #include <ctype.h>
+#include <errno.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -37,73 +38,158 @@
 #define DBGSPEC "(%d,%s,%"PRIu16")"
 
 
+/* phases of a SOCKS5 logon */
+#define S5_GREET 0   // Waiting for the reply to our greeting
+#define S5_CONN 1    // Waiting for the head of the reply to our CONNECT
+#define S5_DNSLEN 2  // Waiting for the length of the bound hostname
+#define S5_ADDR 3    // Waiting for the bound address and port
+
+
+static bool send_req(struct pxlogon *px, int sck, const void *buf, size_t len);
+static bool start_http(struct pxlogon *px, int sck);
+static bool start_socks4(struct pxlogon *px, int sck);
+static bool start_socks5(struct pxlogon *px, int sck);
+static bool send_socks5_conn(struct pxlogon *px, int sck);
+static int phase_http(struct pxlogon *px, int sck);
+static int phase_socks4(struct pxlogon *px, int sck);
+static int phase_socks5(struct pxlogon *px, int sck);
+
+
 bool
-lsi_px_logon_http(int sck, const char *host, uint16_t port, uint64_t to_us)
+lsi_px_logon_start(struct pxlogon *px, int sck, int type, const char *host,
+    uint16_t port)
 {
-	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
-	uint64_t tnow, trem = 0;
-	char buf[256];
-	snprintf(buf, sizeof buf, "CONNECT %s:%d HTTP/1.0\r\nHost: %s:%d"
-	    "\r\n\r\n", host, port, host, port);
+	px->type = type;
+	px->host = host;
+	px->port = port;
+	px->phase = 0;
+	px->have = 0;
+
+	switch (type) {
+	case IRCPX_HTTP:
+		return start_http(px, sck);
+	case IRCPX_SOCKS4:
+		return start_socks4(px, sck);
+	case IRCPX_SOCKS5:
+		return start_socks5(px, sck);
+	}
+
+	E("illegal proxy type %d", type);
+	return false;
+}
+
+/* read as much of the proxy's response as is there, without blocking.
+ * whenever as many bytes as the current phase wants have arrived, the
+ * protocol-specific phase_*() function looks at them and either declares
+ * the logon done (1) or failed (-1), or sets up the next phase (0) */
+int
+lsi_px_logon_step(struct pxlogon *px, int sck)
+{
+	for (;;) {
+		while (px->have < px->want) {
+			errno = 0;
+			long n = lsi_b_read(sck, px->buf + px->have,
+			    px->want - px->have, 1);
+			if (n == 0)
+				return 0;
+
+			if (n < 0) {
+				if (n == -2)
+					W(DBGSPEC" unexpected EOF",
+					    sck, px->host, px->port);
+				else
+					WE(DBGSPEC" read failed",
+					    sck, px->host, px->port);
+				return -1;
+			}
+
+			px->have += (size_t)n;
+		}
 
+		int r = px->type == IRCPX_HTTP ? phase_http(px, sck)
+		    : px->type == IRCPX_SOCKS4 ? phase_socks4(px, sck)
+		    : phase_socks5(px, sck);
+
+		if (r != 0)
+			return r;
+	}
+}
+
+
+static bool
+send_req(struct pxlogon *px, int sck, const void *buf, size_t len)
+{
 	errno = 0;
-	long n = lsi_b_write(sck, buf, strlen(buf));
+	long n = lsi_b_write(sck, buf, len, true);
 	if (n <= -1) {
-		WE(DBGSPEC" write() failed", sck, host, port);
+		WE(DBGSPEC" write() failed", sck, px->host, px->port);
 		return false;
-	} else if ((size_t)n < strlen(buf)) {
+	} else if ((size_t)n < len) {
 		W(DBGSPEC" didn't send everything (%ld/%zu)",
-		    sck, host, port, n, strlen(buf));
+		    sck, px->host, px->port, n, len);
 		return false;
 	}
 
-	memset(buf, 0, sizeof buf);
+	return true;
+}
+
+static bool
+start_http(struct pxlogon *px, int sck)
+{
+	char buf[600];
+	snprintf(buf, sizeof buf, "CONNECT %s:%d HTTP/1.0\r\nHost: %s:%d"
+	    "\r\n\r\n", px->host, px->port, px->host, px->port);
+
+	if (!send_req(px, sck, buf, strlen(buf)))
+		return false;
 
 	D(DBGSPEC" wrote HTTP CONNECT, reading response",
-	    sck, host, port);
-	size_t c = 0;
-	while (c < sizeof buf && (c < 4 || buf[c-4] != '\r' ||
-	    buf[c-3] != '\n' || buf[c-2] != '\r' || buf[c-1] != '\n')) {
-		errno = 0;
-		if (tend) {
-			tnow = lsi_b_tstamp_us();
-			trem = tnow >= tend ? 1 : tend - tnow;
-		}
-		n = lsi_b_read(sck, &buf[c], 1, trem);
-		if (n <= 0) {
-			if (n == 0)
-				W(DBGSPEC" timeout hit", sck, host, port);
-			else if (n == -2)
-				W(DBGSPEC" unexpected EOF", sck, host, port);
-			else WE(DBGSPEC" read failed",
-				    sck, host, port);
-			return false;
+	    sck, px->host, px->port);
+
+	/* the ircd may start talking right after the header, so we must
+	 * not read past it; hence one byte at a time */
+	px->want = 1;
+	return true;
+}
+
+static int
+phase_http(struct pxlogon *px, int sck)
+{
+	size_t c = px->have;
+	unsigned char *b = px->buf;
+	if (c < 4 || b[c-4] != '\r' || b[c-3] != '\n'
+	    || b[c-2] != '\r' || b[c-1] != '\n') {
+		if (c == sizeof px->buf - 1) {
+			W(DBGSPEC" response too long", sck, px->host, px->port);
+			return -1;
 		}
-		c++;
+
+		px->want++;
+		return 0;
 	}
 
-	char *sp = strchr(buf, ' ');
+	b[c] = '\0';
+	char *sp = strchr((char *)b, ' ');
 	if (!sp) {
-		W(DBGSPEC" parse error 1 (buf: '%s')", sck, host, port, buf);
-		return false;
+		W(DBGSPEC" parse error 1 (buf: '%s')",
+		    sck, px->host, px->port, (char *)b);
+		return -1;
 	}
 
 	D(DBGSPEC" http response: '%.3s' (should be '200')",
-	    sck, host, port, sp+1);
-	return strncmp(sp+1, "200", 3) == 0;
+	    sck, px->host, px->port, sp+1);
+	return strncmp(sp+1, "200", 3) == 0 ? 1 : -1;
 }
 
 /* SOCKS4 doesntsupport ipv6 */
-bool
-lsi_px_logon_socks4(int sck, const char *host, uint16_t port, uint64_t to_us)
+static bool
+start_socks4(struct pxlogon *px, int sck)
 {
-	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
-	uint64_t tnow, trem = 0;
 	unsigned char logon[14];
-	uint16_t nport = lsi_b_htons(port);
+	uint16_t nport = lsi_b_htons(px->port);
 
 	/*FIXME this doesntwork if host is not an ipv4 addr but dns*/
-	uint32_t ip = lsi_b_inet_addr(host);
+	uint32_t ip = lsi_b_inet_addr(px->host);
 	char name[6];
 	for (size_t i = 0; i < sizeof name - 1; i++)
 		name[i] = rand() % 26 + 'a';
@@ -119,122 +205,60 @@ lsi_px_logon_socks4(int sck, const char *host, uint16_t port, uint64_t to_us)
 	memcpy(logon+c, name, strlen(name) + 1);
 	c += strlen(name) + 1;
 
-	errno = 0;
-	long n = lsi_b_write(sck, logon, c);
-	if (n <= -1) {
-		WE(DBGSPEC" write() failed", sck, host, port);
+	if (!send_req(px, sck, logon, c))
 		return false;
-	} else if ((size_t)n < c) {
-		W(DBGSPEC" didn't send everything (%ld/%zu)",
-		    sck, host, port, n, c);
-		return false;
-	}
 
 	D(DBGSPEC" wrote SOCKS4 logon sequence, reading response",
-	    sck, host, port);
-	char resp[8];
-	c = 0;
-	while (c < 8) {
-		if (tend) {
-			tnow = lsi_b_tstamp_us();
-			trem = tnow >= tend ? 1 : tend - tnow;
-		}
-		errno = 0;
-		n = lsi_b_read(sck, &resp+c, 8-c, trem);
-		if (n <= 0) {
-			if (n == 0)
-				W(DBGSPEC" timeout hit", sck, host, port);
-			else if (n == -2)
-			      W(DBGSPEC" unexpected EOF", sck, host, port);
-			else
-				WE(DBGSPEC" read failed", sck, host, port);
-			return false;
-		}
-		c += n;
-	}
-	D(DBGSPEC" socks4 response: %"PRIu8" %"PRIu8" (should be: 0x00 0x5a)",
-	    sck, host, port, resp[0], resp[1]);
-	return resp[0] == 0 && resp[1] == 0x5a;
+	    sck, px->host, px->port);
+	px->want = 8;
+	return true;
 }
 
-bool
-lsi_px_logon_socks5(int sck, const char *host, uint16_t port, uint64_t to_us)
+static int
+phase_socks4(struct pxlogon *px, int sck)
 {
-	// This is horrible.  sanitize!
-	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
-	uint64_t tnow, trem = 0;
-	unsigned char logon[14];
+	unsigned char *resp = px->buf;
+	D(DBGSPEC" socks4 response: %"PRIu8" %"PRIu8" (should be: 0x00 0x5a)",
+	    sck, px->host, px->port, resp[0], resp[1]);
+	return resp[0] == 0 && resp[1] == 0x5a ? 1 : -1;
+}
 
-	if (!port) {
-		W(DBGSPEC" srsly what?!", sck, host, port);
+static bool
+start_socks5(struct pxlogon *px, int sck)
+{
+	if (!px->port) {
+		W(DBGSPEC" srsly what?!", sck, px->host, px->port);
 		return false;
 	}
 
-	uint16_t nport = lsi_b_htons(port);
-	size_t c = 0;
-	logon[c++] = 5;
-
-	logon[c++] = 1;
-	logon[c++] = 0;
-
-	errno = 0;
-	long n = lsi_b_write(sck, logon, c);
-	if (n <= -1) {
-		WE(DBGSPEC" write() failed", sck, host, port);
+	unsigned char logon[3] = { 5, 1, 0 };
+	if (!send_req(px, sck, logon, sizeof logon))
 		return false;
-	} else if ((size_t)n < c) {
-		W(DBGSPEC" didn't send everything (%ld/%zu)",
-		    sck, host, port, n, c);
-		return false;
-	}
 
 	D(DBGSPEC" wrote SOCKS5 logon sequence 1, reading response",
-	    sck, host, port);
-	char resp[128];
-	c = 0;
-	while (c < 2) {
-		errno = 0;
-		if (tend) {
-			tnow = lsi_b_tstamp_us();
-			trem = tnow >= tend ? 1 : tend - tnow;
-		}
-		n = lsi_b_read(sck, &resp+c, 2-c, trem);
-		if (n <= 0) {
-			if (n == 0)
-				W(DBGSPEC" timeout 1 hit", sck, host, port);
-			else if (n == -2)
-				W(DBGSPEC" unexpected EOF", sck, host, port);
-			else
-				WE(DBGSPEC" read failed", sck, host, port);
-			return false;
-		}
-		c += n;
-	}
-
-	if (resp[0] != 5) {
-		W(DBGSPEC" unexpected response %"PRIu8" %"PRIu8" (no socks5?)",
-		    sck, host, port, resp[0], resp[1]);
-		return false;
-	}
-	if (resp[1] != 0) {
-		W(DBGSPEC" socks5 denied (%"PRIu8" %"PRIu8")",
-		    sck, host, port, resp[0], resp[1]);
-		return false;
-	}
-	D(DBGSPEC" socks5 let us in", sck, host, port);
+	    sck, px->host, px->port);
+	px->phase = S5_GREET;
+	px->want = 2;
+	return true;
+}
 
-	c = 0;
-	unsigned char conbuf[128];
+static bool
+send_socks5_conn(struct pxlogon *px, int sck)
+{
+	const char *host = px->host;
+	uint16_t port = px->port;
+	uint16_t nport = lsi_b_htons(port);
+	unsigned char conbuf[300];
+	size_t c = 0;
 	conbuf[c++] = 5;
 	conbuf[c++] = 1;
 	conbuf[c++] = 0;
-	int type = lsi_com_guess_hosttype(host);
-	switch (type) {
+	switch (lsi_com_guess_hosttype(host)) {
 	case HOST_IPV4:
 		conbuf[c++] = 1;
 		if (!lsi_b_inet4_addr(&conbuf[c], 4, host))
 			return false;
-		c += 16;
+		c += 4;
 		break;
 	case HOST_IPV6:
 		conbuf[c++] = 4;
@@ -243,6 +267,10 @@ lsi_px_logon_socks5(int sck, const char *host, uint16_t port, uint64_t to_us)
 		c += 16;
 		break;
 	case HOST_DNS:
+		if (strlen(host) > 255) {
+			W(DBGSPEC" hostname too long", sck, host, port);
+			return false;
+		}
 		conbuf[c++] = 3;
 		conbuf[c++] = (uint8_t)strlen(host);
 		memcpy(conbuf+c, host, strlen(host));
@@ -250,94 +278,85 @@ lsi_px_logon_socks5(int sck, const char *host, uint16_t port, uint64_t to_us)
 	}
 	memcpy(conbuf+c, &nport, 2); c += 2;
 
-	errno = 0;
-	n = lsi_b_write(sck, conbuf, c);
-	if (n <= -1) {
-		WE(DBGSPEC" write() failed",
-		    sck, host, port);
+	if (!send_req(px, sck, conbuf, c))
 		return false;
-	} else if ((size_t)n < c) {
-		W(DBGSPEC" didn't send everything (%ld/%zu)",
-		    sck, host, port, n, c);
-		return false;
-	}
+
 	D(DBGSPEC" wrote SOCKS5 logon sequence 2, reading response",
 	    sck, host, port);
+	return true;
+}
 
-	size_t l = 4;
-	c = 0;
-	while (c < l) {
-		errno = 0;
-		if (tend) {
-			tnow = lsi_b_tstamp_us();
-			trem = tnow >= tend ? 1 : tend - tnow;
+static int
+phase_socks5(struct pxlogon *px, int sck)
+{
+	unsigned char *resp = px->buf;
+	const char *host = px->host;
+	uint16_t port = px->port;
+
+	switch (px->phase) {
+	case S5_GREET:
+		if (resp[0] != 5) {
+			W(DBGSPEC" unexpected response %"PRIu8" %"PRIu8
+			    " (no socks5?)", sck, host, port, resp[0], resp[1]);
+			return -1;
 		}
-		n = lsi_b_read(sck, resp + c, l - c, trem);
-		if (n <= 0) {
-			if (n == 0)
-				W(DBGSPEC" timeout 2 hit", sck, host, port);
-			else if (n == -2)
-				W(DBGSPEC" unexpected EOF", sck, host, port);
-			else
-				WE(DBGSPEC" read failed", sck, host, port);
-			return false;
+		if (resp[1] != 0) {
+			W(DBGSPEC" socks5 denied (%"PRIu8" %"PRIu8")",
+			    sck, host, port, resp[0], resp[1]);
+			return -1;
+		}
+		D(DBGSPEC" socks5 let us in", sck, host, port);
+
+		if (!send_socks5_conn(px, sck))
+			return -1;
+
+		px->phase = S5_CONN;
+		px->have = 0;
+		px->want = 4;
+		return 0;
+
+	case S5_CONN:
+		if (resp[0] != 5 || resp[1] != 0) {
+			W(DBGSPEC" socks5 deny/err %"PRIu8" %"PRIu8" %"PRIu8
+			    " %"PRIu8"", sck, host, port,
+			    resp[0], resp[1], resp[2], resp[3]);
+			return -1;
 		}
-		c += n;
-	}
 
-	if (resp[0] != 5 || resp[1] != 0) {
-		W(DBGSPEC" socks5 deny/err %"PRIu8" %"PRIu8" %"PRIu8" %"PRIu8"",
-		    sck, host, port, resp[0], resp[1], resp[2], resp[3]);
-		return false;
-	}
+		/* not that we'd care about the address the proxy bound,
+		 * but we must make sure to read the correct amount of
+		 * bytes */
+		px->phase = S5_ADDR;
+		px->have = 0;
+		switch (resp[3]) {
+		case 1: //ipv4
+			px->want = 4 + 2;
+			break;
+		case 4: //ipv6
+			px->want = 16 + 2;
+			break;
+		case 3: //dns
+			px->phase = S5_DNSLEN;
+			px->want = 1;
+			break;
+		default:
+			W(DBGSPEC" socks returned illegal addrtype %d",
+			    sck, host, port, resp[3]);
+			return -1;
+		}
+		return 0;
 
-	bool dns = false;
-	switch (resp[3]) {
-	case 1: //ipv4
-		l = 4;
-		break;
-	case 4: //ipv6
-		l = 16;
-		break;
-	case 3: //dns
-		dns = true;
-		l = 1; //length
-		break;
-	default:
-		W(DBGSPEC" socks returned illegal addrtype %d",
-		    sck, host, port, resp[3]);
-		return false;
-	}
+	case S5_DNSLEN:
+		px->phase = S5_ADDR;
+		px->want = 1 + resp[0] + 2;
+		return 0;
 
-	c = 0;
-	l += 2; //port
-	while (c < l) {
-		errno = 0;
-		/* read the very first byte seperately */
-		if (tend) {
-			tnow = lsi_b_tstamp_us();
-			trem = tnow >= tend ? 1 : tend - tnow;
-		}
-		n = lsi_b_read(sck, resp + c, c ? l - c : 1, trem);
-		if (n <= 0) {
-			if (n == 0)
-				W(DBGSPEC" timeout 2 hit", sck, host, port);
-			else if (n == 0)
-				W(DBGSPEC" unexpected EOF", sck, host, port);
-			else
-				WE(DBGSPEC" read failed", sck, host, port);
-			return false;
-		}
-		if (!c && dns)
-			l += (uint8_t)resp[c];
-		c += n;
+	case S5_ADDR:
+		D(DBGSPEC" socks5 success (apparently)", sck, host, port);
+		return 1;
 	}
 
-	/* not that we'd care about what we just have read but we want to
-	 * make sure to read the correct amount of characters */
-
-	D(DBGSPEC" socks5 success (apparently)", sck, host, port);
-	return true;
+	return -1;
 }
 
 int
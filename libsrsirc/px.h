@@ -7,17 +7,44 @@
 
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
-bool lsi_px_logon_http(int sck, const char *host, uint16_t port,
-    uint64_t to_us);
-
-bool lsi_px_logon_socks4(int sck, const char *host, uint16_t port,
-    uint64_t to_us);
-
-bool lsi_px_logon_socks5(int sck, const char *host, uint16_t port,
-    uint64_t to_us);
+/* state of a proxy logon in progress */
+struct pxlogon {
+	int type;          // IRCPX_*
+	int phase;         // Protocol-specific
+	const char *host;  // Where we want the proxy to connect us to
+	uint16_t port;
+	unsigned char buf[512]; // Response (of the current phase) so far
+	size_t have;       // Bytes in `buf'
+	size_t want;       // Bytes we need before we can look at `buf'
+};
+
+/* lsi_px_logon_start
+ * Send the initial request of a proxy logon
+ *
+ * Params: `px':   Proxy logon state to initialize
+ *         `sck':  Socket connected to the proxy
+ *         `type': Proxy type (IRCPX_*)
+ *         `host': Host we want the proxy to connect us to.  Must remain
+ *                     valid until the logon is complete.
+ *         `port': Port we want the proxy to connect us to
+ *
+ * Returns true on success, false on failure */
+bool lsi_px_logon_start(struct pxlogon *px, int sck, int type,
+    const char *host, uint16_t port);
+
+/* lsi_px_logon_step
+ * Process whatever the proxy has sent so far, without blocking
+ *
+ * Params: `px':  Proxy logon state, as set up by lsi_px_logon_start()
+ *         `sck': Socket connected to the proxy
+ *
+ * Returns 1 if the logon is complete, 0 if we have to wait for the socket
+ *         to become readable, -1 on failure */
+int lsi_px_logon_step(struct pxlogon *px, int sck);
 
 int lsi_px_typenum(const char *typestr);
 const char *lsi_px_typestr(int typenum);
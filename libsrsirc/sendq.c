@@ -0,0 +1,457 @@
+/* sendq.c - flood-controlled send queue with priority lanes
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_SENDQ
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "sendq.h"
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_string.h>
+#include <platform/base_time.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/defs.h>
+
+#include "common.h"
+
+
+#define NUM_LANES (SENDQ_BULK + 1)
+
+/* lines are kept in a byte ring per lane, each preceded by its length (a
+ * size_t).  entries are padded to a multiple of the header size, so a
+ * header never straddles the end of the ring.  when a line doesn't fit
+ * between the last entry and the end of the ring, WRAPMARK (unless there's
+ * no room for even that) tells the reader to continue at the beginning */
+#define HDRSZ (sizeof (size_t))
+#define WRAPMARK ((size_t)-1)
+
+/* initial ring size per lane; rings grow (by doubling) as needed, within
+ * the limits set by lsi_sq_limit() */
+#define RING_INITSZ 4096
+
+
+struct sqlane {
+	char *buf;    // The ring
+	size_t cap;   // Size of `buf'
+	size_t rd;    // Offset of the oldest entry
+	size_t wr;    // Offset the next entry goes to
+	size_t used;  // Bytes taken by entries (excl. padding at the end)
+	size_t count; // Number of entries
+};
+
+struct sendq {
+	struct sqlane lanes[NUM_LANES];
+	size_t nlines;     // Lines queued in all lanes together
+	size_t nbytes;     // ...and their size (excl. CRLF)
+	size_t maxlines;   // Limits for the above (0 = none)
+	size_t maxbytes;
+	size_t peaklines;  // Highest `nlines' seen
+	size_t peakbytes;  // Highest `nbytes' seen
+	uint64_t nreject;  // Lines refused because we were full
+	uint64_t clock;    // Penalty clock (lsi_b_tstamp_us() based)
+	uint64_t linecost; // What a line costs, in us
+	uint64_t bytecost; // ...plus this much per byte
+	uint64_t burst;    // How far the clock may be ahead of us
+	sq_time_fn now;    // Where the current time comes from
+	int peeked;        // Lane of the last lsi_sq_peek()'d line, or -1
+};
+
+
+static struct sqlane *first_lane(sendq *sq);
+static uint64_t cost(sendq *sq, size_t len);
+static size_t entsz(size_t len);
+static char *ring_put(struct sqlane *ln, size_t len);
+static bool ring_grow(struct sqlane *ln, size_t need);
+
+
+sendq *
+lsi_sq_init(void)
+{
+	sendq *sq = MALLOC(sizeof *sq);
+	if (!sq)
+		return NULL;
+
+	for (size_t i = 0; i < COUNTOF(sq->lanes); i++) {
+		sq->lanes[i].buf = NULL;
+		sq->lanes[i].cap = sq->lanes[i].used = 0;
+		sq->lanes[i].count = sq->lanes[i].rd = sq->lanes[i].wr = 0;
+	}
+
+	/* the normal lane is used most (and by icat exclusively) */
+	if (!ring_grow(&sq->lanes[SENDQ_NORMAL], 0)) {
+		free(sq);
+		return NULL;
+	}
+
+	sq->nlines = sq->nbytes = 0;
+	sq->maxlines = DEF_SQ_MAXLINES;
+	sq->maxbytes = DEF_SQ_MAXBYTES;
+	sq->peaklines = sq->peakbytes = 0;
+	sq->nreject = 0;
+	sq->clock = 0;
+	sq->linecost = DEF_SQ_LINECOST_US;
+	sq->bytecost = DEF_SQ_BYTECOST_US;
+	sq->burst = DEF_SQ_BURST_US;
+	sq->now = lsi_b_tstamp_us;
+	lsi_sq_clear(sq);
+
+	D("(%p) initialized", (void *)sq);
+	return sq;
+}
+
+void
+lsi_sq_dispose(sendq *sq)
+{
+	if (!sq)
+		return;
+
+	for (size_t i = 0; i < COUNTOF(sq->lanes); i++)
+		free(sq->lanes[i].buf);
+
+	D("(%p) disposed", (void *)sq);
+	free(sq);
+	return;
+}
+
+bool
+lsi_sq_add(sendq *sq, const char *line, int prio)
+{
+	if (prio < 0 || prio >= NUM_LANES)
+		prio = lsi_sq_classify(line);
+
+	size_t len = strlen(line);
+	while (len && (line[len-1] == '\r' || line[len-1] == '\n'))
+		len--;
+
+	if (lsi_sq_full(sq, len)) {
+		W("(%p) send queue full (%zu lines, %zu bytes)",
+		    (void *)sq, sq->nlines, sq->nbytes);
+		sq->nreject++;
+		return false;
+	}
+
+	struct sqlane *ln = &sq->lanes[prio];
+	char *dst = ring_put(ln, len);
+	if (!dst) {
+		EE("(%p) failed to make room in lane %d", (void *)sq, prio);
+		return false;
+	}
+
+	memcpy(dst, line, len);
+	dst[len] = '\0';
+
+	sq->nlines++;
+	sq->nbytes += len;
+	if (sq->nlines > sq->peaklines)
+		sq->peaklines = sq->nlines;
+	if (sq->nbytes > sq->peakbytes)
+		sq->peakbytes = sq->nbytes;
+
+	V("(%p) queued (lane %d, now %zu): '%s'",
+	    (void *)sq, prio, ln->count, dst);
+	return true;
+}
+
+int
+lsi_sq_classify(const char *line)
+{
+	/* skip the IRCv3 tags and the prefix, if any */
+	if (*line == '@' && (line = strchr(line, ' ')))
+		while (*line == ' ')
+			line++;
+
+	if (line && *line == ':' && (line = strchr(line, ' ')))
+		while (*line == ' ')
+			line++;
+
+	if (!line)
+		return SENDQ_NORMAL;
+
+	size_t n = strcspn(line, " \r\n");
+	if (n == 4 && (lsi_b_strncasecmp(line, "PING", 4) == 0
+	    || lsi_b_strncasecmp(line, "PONG", 4) == 0
+	    || lsi_b_strncasecmp(line, "QUIT", 4) == 0))
+		return SENDQ_HIGH;
+
+	if ((n == 7 && lsi_b_strncasecmp(line, "PRIVMSG", 7) == 0)
+	    || (n == 6 && lsi_b_strncasecmp(line, "NOTICE", 6) == 0))
+		return SENDQ_BULK;
+
+	return SENDQ_NORMAL;
+}
+
+const char *
+lsi_sq_peek(sendq *sq, size_t *len)
+{
+	struct sqlane *ln = first_lane(sq);
+	if (!ln)
+		return NULL;
+
+	uint64_t now = sq->now();
+	if (sq->clock > now + sq->burst)
+		return NULL;
+
+	sq->peeked = (int)(ln - sq->lanes);
+	if (len)
+		memcpy(len, ln->buf + ln->rd, HDRSZ);
+
+	return ln->buf + ln->rd + HDRSZ;
+}
+
+void
+lsi_sq_pop(sendq *sq)
+{
+	if (sq->peeked == -1)
+		return;
+
+	struct sqlane *ln = &sq->lanes[sq->peeked];
+	sq->peeked = -1;
+
+	size_t len;
+	memcpy(&len, ln->buf + ln->rd, HDRSZ);
+
+	uint64_t now = sq->now();
+	if (sq->clock < now)
+		sq->clock = now;
+	sq->clock += cost(sq, len);
+
+	sq->nlines--;
+	sq->nbytes -= len;
+	ln->used -= entsz(len);
+	ln->rd += entsz(len);
+
+	if (!--ln->count) {
+		ln->rd = ln->wr = 0;
+		return;
+	}
+
+	/* follow the writer if it wrapped around here */
+	size_t hdr = WRAPMARK;
+	if (ln->rd < ln->cap)
+		memcpy(&hdr, ln->buf + ln->rd, HDRSZ);
+	if (hdr == WRAPMARK)
+		ln->rd = 0;
+
+	return;
+}
+
+uint64_t
+lsi_sq_next(sendq *sq)
+{
+	if (!first_lane(sq))
+		return 0;
+
+	uint64_t now = sq->now();
+	if (sq->clock <= now + sq->burst)
+		return 1;
+
+	return sq->clock - sq->burst - now;
+}
+
+size_t
+lsi_sq_count(sendq *sq)
+{
+	return sq->nlines;
+}
+
+size_t
+lsi_sq_bytes(sendq *sq)
+{
+	return sq->nbytes;
+}
+
+bool
+lsi_sq_full(sendq *sq, size_t len)
+{
+	return (sq->maxlines && sq->nlines >= sq->maxlines)
+	    || (sq->maxbytes && sq->nbytes + len > sq->maxbytes);
+}
+
+void
+lsi_sq_clear(sendq *sq)
+{
+	/* the rings are kept; they're bounded by the limits anyway */
+	for (size_t i = 0; i < COUNTOF(sq->lanes); i++) {
+		sq->lanes[i].rd = sq->lanes[i].wr = 0;
+		sq->lanes[i].used = sq->lanes[i].count = 0;
+	}
+
+	sq->nlines = sq->nbytes = 0;
+	sq->peeked = -1;
+	return;
+}
+
+void
+lsi_sq_reset(sendq *sq)
+{
+	sq->clock = 0;
+	return;
+}
+
+void
+lsi_sq_config(sendq *sq, uint64_t linecost, uint64_t bytecost,
+    uint64_t burst)
+{
+	sq->linecost = linecost;
+	sq->bytecost = bytecost;
+	sq->burst = burst;
+	return;
+}
+
+void
+lsi_sq_set_clock(sendq *sq, sq_time_fn now)
+{
+	sq->now = now ? now : lsi_b_tstamp_us;
+	return;
+}
+
+void
+lsi_sq_limit(sendq *sq, size_t maxlines, size_t maxbytes)
+{
+	sq->maxlines = maxlines;
+	sq->maxbytes = maxbytes;
+	return;
+}
+
+void
+lsi_sq_dump(sendq *sq)
+{
+	uint64_t now = sq->now();
+	N("--- send queue %p dump ---", (void *)sq);
+	N("linecost: %"PRIu64"us, bytecost: %"PRIu64"us, burst: %"PRIu64"us",
+	    sq->linecost, sq->bytecost, sq->burst);
+	N("clock: %"PRIu64"us ahead", sq->clock > now ? sq->clock - now : 0);
+	N("queued: %zu lines, %zu bytes (limits: %zu lines, %zu bytes)",
+	    sq->nlines, sq->nbytes, sq->maxlines, sq->maxbytes);
+	N("peak: %zu lines, %zu bytes; rejected: %"PRIu64" lines",
+	    sq->peaklines, sq->peakbytes, sq->nreject);
+	for (size_t i = 0; i < COUNTOF(sq->lanes); i++) {
+		struct sqlane *ln = &sq->lanes[i];
+		N("lane %zu: %zu lines, ring %zu/%zu bytes (rd: %zu, wr: %zu)",
+		    i, ln->count, ln->used, ln->cap, ln->rd, ln->wr);
+	}
+	N("--- end of send queue dump ---");
+	return;
+}
+
+
+/* the highest priority lane that has something in it, or NULL */
+static struct sqlane *
+first_lane(sendq *sq)
+{
+	for (size_t i = 0; i < COUNTOF(sq->lanes); i++)
+		if (sq->lanes[i].count)
+			return &sq->lanes[i];
+
+	return NULL;
+}
+
+/* what sending a line of `len' bytes (excluding CRLF) costs */
+static uint64_t
+cost(sendq *sq, size_t len)
+{
+	return sq->linecost + sq->bytecost * (len + 2);
+}
+
+/* how much room a line of `len' bytes takes in the ring, i.e. the header
+ * plus the line plus its NUL, padded to a multiple of the header size */
+static size_t
+entsz(size_t len)
+{
+	return HDRSZ + (len + 1 + HDRSZ - 1) / HDRSZ * HDRSZ;
+}
+
+/* append an entry for a line of `len' bytes to the lane's ring (growing
+ * it if necessary), returning where the line is to be copied to */
+static char *
+ring_put(struct sqlane *ln, size_t len)
+{
+	size_t need = entsz(len);
+
+	for (;;) {
+		if (ln->count && ln->wr < ln->rd) {
+			/* wrapped; the gap between writer and reader is it */
+			if (ln->rd - ln->wr >= need)
+				break;
+		} else if (!ln->count || ln->wr > ln->rd) {
+			if (ln->cap - ln->wr >= need)
+				break;
+
+			/* no room left at the end, try the beginning */
+			if (ln->count && ln->rd >= need) {
+				if (ln->cap - ln->wr >= HDRSZ) {
+					size_t mark = WRAPMARK;
+					memcpy(ln->buf + ln->wr, &mark, HDRSZ);
+				}
+				ln->wr = 0;
+				break;
+			}
+		} /* else writer caught up with the reader, i.e. we're full */
+
+		if (!ring_grow(ln, need))
+			return NULL;
+	}
+
+	char *ent = ln->buf + ln->wr;
+	memcpy(ent, &len, HDRSZ);
+	ln->wr += need;
+	ln->used += need;
+	ln->count++;
+	return ent + HDRSZ;
+}
+
+/* enlarge the lane's ring such that at least `need' more bytes fit after
+ * the entries it holds.  the entries are moved to the beginning of the new
+ * ring, in order, so it isn't wrapped afterwards */
+static bool
+ring_grow(struct sqlane *ln, size_t need)
+{
+	size_t ncap = ln->cap ? ln->cap * 2 : RING_INITSZ;
+	while (ncap < ln->used + need)
+		ncap *= 2;
+
+	char *nbuf = MALLOC(ncap);
+	if (!nbuf)
+		return false;
+
+	size_t off = 0;
+	size_t rd = ln->rd;
+	for (size_t i = 0; i < ln->count; i++) {
+		size_t len;
+		memcpy(&len, ln->buf + rd, HDRSZ);
+		if (len == WRAPMARK) {
+			rd = 0;
+			memcpy(&len, ln->buf, HDRSZ);
+		}
+
+		memcpy(nbuf + off, ln->buf + rd, entsz(len));
+		off += entsz(len);
+		rd += entsz(len);
+		if (rd == ln->cap)
+			rd = 0;
+	}
+
+	D("lane ring grown from %zu to %zu bytes (%zu entries)",
+	    ln->cap, ncap, ln->count);
+
+	free(ln->buf);
+	ln->buf = nbuf;
+	ln->cap = ncap;
+	ln->rd = 0;
+	ln->wr = off;
+	return true;
+}
@@ -0,0 +1,134 @@
+/* sendq.h - flood-controlled send queue with priority lanes
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_SENDQ_H
+#define LIBSRSIRC_SENDQ_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* the send queue holds outgoing lines until the server's flood protection
+ * lets us send them.  the latter is modelled after the "message timer" most
+ * ircds implement (RFC 1459, 8.10): every line sent advances a penalty clock
+ * by a fixed cost (plus, optionally, a per-byte cost), the clock is never
+ * behind the current time, and lines may only be sent while the clock is at
+ * most `burst' ahead of the current time.  lines are taken from the highest
+ * priority lane (SENDQ_HIGH) that has any.
+ *
+ * each lane keeps its lines in a ring buffer, so queueing and dequeueing
+ * are O(1) and don't allocate (except when a ring needs to grow).  the
+ * number of lines and bytes queued is capped (see lsi_sq_limit()), which
+ * also bounds the memory the rings take */
+typedef struct sendq sendq;
+typedef uint64_t (*sq_time_fn)(void);
+
+/* size of the buffer irc_sendq_printf() formats into (including the '\0');
+ * irc_sendq_full() leaves room for a line of that length */
+#define SENDQ_PRINTF_MAX 1024
+
+
+/* lsi_sq_init
+ * Allocate and initialize an empty send queue, with the default costs
+ *
+ * Returns the new queue, or NULL on failure (allocation failed) */
+sendq *lsi_sq_init(void);
+
+/* lsi_sq_dispose
+ * Free a send queue and whatever is still queued in it */
+void lsi_sq_dispose(sendq *sq);
+
+/* lsi_sq_add
+ * Append a line to one of the lanes
+ *
+ * Params: `sq':   The send queue
+ *         `line': The line to queue; a trailing CRLF (if any) is dropped
+ *         `prio': SENDQ_HIGH, SENDQ_NORMAL or SENDQ_BULK; SENDQ_AUTO picks
+ *                     one by looking at the command (see lsi_sq_classify())
+ *
+ * Returns true on success, false on failure (queue full, see lsi_sq_full(),
+ *         or allocation failed) */
+bool lsi_sq_add(sendq *sq, const char *line, int prio);
+
+/* lsi_sq_classify
+ * Tell which lane a line belongs in if queued with SENDQ_AUTO: PING, PONG
+ * and QUIT (which keep or end the connection) go to SENDQ_HIGH, PRIVMSG and
+ * NOTICE to SENDQ_BULK, everything else to SENDQ_NORMAL */
+int lsi_sq_classify(const char *line);
+
+/* lsi_sq_peek
+ * Get the line that is to be sent next, if the penalty clock allows it
+ *
+ * Params: `sq':  The send queue
+ *         `len': If non-NULL, the length of the line is stored here
+ *
+ * Returns pointer to the line (valid until the next lsi_sq_pop() or
+ *         lsi_sq_clear()), or NULL if the queue is empty or it isn't time
+ *         yet */
+const char *lsi_sq_peek(sendq *sq, size_t *len);
+
+/* lsi_sq_pop
+ * Drop the line returned by the last lsi_sq_peek() (which has been sent)
+ * and charge its cost to the penalty clock */
+void lsi_sq_pop(sendq *sq);
+
+/* lsi_sq_next
+ * Tell how long it is until the next line may be sent
+ *
+ * Returns microseconds to wait; 1 if a line may be sent right away,
+ *         0 if the queue is empty */
+uint64_t lsi_sq_next(sendq *sq);
+
+/* lsi_sq_count
+ * Tell how many lines are queued (in all lanes together) */
+size_t lsi_sq_count(sendq *sq);
+
+/* lsi_sq_bytes
+ * Tell how many bytes (excluding CRLFs) are queued (in all lanes together) */
+size_t lsi_sq_bytes(sendq *sq);
+
+/* lsi_sq_full
+ * Tell whether the queue is too full to take a line of `len' bytes (not
+ * counting the CRLF), as per the limits set by lsi_sq_limit() */
+bool lsi_sq_full(sendq *sq, size_t len);
+
+/* lsi_sq_clear
+ * Drop all queued lines */
+void lsi_sq_clear(sendq *sq);
+
+/* lsi_sq_reset
+ * Rewind the penalty clock, i.e. grant a full burst again.  Meant to be
+ * called when we get a new connection, since the server has a fresh clock */
+void lsi_sq_reset(sendq *sq);
+
+/* lsi_sq_config
+ * Set the costs charged to the penalty clock
+ *
+ * Params: `sq':        The send queue
+ *         `linecost':  Cost per line in microseconds
+ *         `bytecost':  Additional cost per byte in microseconds
+ *         `burst':     How far (in microseconds) the penalty clock may run
+ *                          ahead of the current time */
+void lsi_sq_config(sendq *sq, uint64_t linecost, uint64_t bytecost,
+    uint64_t burst);
+
+/* lsi_sq_set_clock
+ * Make the queue take the current time (in microseconds) from `now'
+ * instead of lsi_b_tstamp_us(); NULL switches back.  Meant for testing */
+void lsi_sq_set_clock(sendq *sq, sq_time_fn now);
+
+/* lsi_sq_limit
+ * Set the maximum number of lines and bytes (excl. CRLFs) that may be queued
+ * (in all lanes together); 0 means no limit.  Lines already queued are
+ * kept even if they exceed the new limits */
+void lsi_sq_limit(sendq *sq, size_t maxlines, size_t maxbytes);
+
+/* lsi_sq_dump
+ * Log the state of the queue (including peak usage and the number of lines
+ * rejected because it was full), for debugging */
+void lsi_sq_dump(sendq *sq);
+
+#endif /* LIBSRSIRC_SENDQ_H */
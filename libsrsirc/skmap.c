@@ -22,82 +22,88 @@
 
 #include <logger/intlog.h>
 
-#include "bucklist.h"
 #include "cmap.h"
 #include "common.h"
 
 
+/* open addressing with linear probing, robin hood style: an element being
+ * inserted takes the place of any it has probed further than, and deleting
+ * shifts the rest of the probe sequence back by one (no tombstones).  this
+ * keeps probe sequences short and lookups for absent keys cheap, even near
+ * the maximum load factor of MAXLOAD_NUM/MAXLOAD_DEN */
+#define MAXLOAD_NUM 4
+#define MAXLOAD_DEN 5
+#define MIN_CAP 8
+
+#define NOSLOT SIZE_MAX
+
+
+struct skslot {
+	char *key; /* NULL if the slot is free */
+	void *val;
+	size_t hash;
+};
+
 struct skmap {
-	bucklist **buck;
-	size_t bsz;
+	struct skslot *slot; /* NULL until the first put */
+	size_t cap; /* number of slots, 0 or a power of 2 */
 	size_t count;
+	size_t initsz;
 
 	bool iterating;
-	size_t bit;
-	size_t listiter;
-
-	skmap_hash_fn hfn;
+	size_t bit; /* next slot to look at */
+	size_t bleft; /* number of slots not looked at yet */
+	size_t bcur; /* slot last handed out */
 
 	const uint8_t *cmap;
+	uint64_t seed[2]; /* hash key, different for every map */
 };
 
 
-static size_t strhash_small(const char *s, const uint8_t *cmap);
-static size_t strhash_mid(const char *s, const uint8_t *cmap);
+static size_t strhash(const char *s, const uint8_t *cmap,
+    const uint64_t *seed);
+static bool keyeq(const char *k1, const char *k2, const uint8_t *cmap);
+static size_t dist(skmap *h, size_t i);
+static size_t find(skmap *h, const char *key, size_t hash);
+static void insert(skmap *h, char *key, void *val, size_t hash);
+static void remove_at(skmap *h, size_t i);
+static bool grow(skmap *h);
+static bool iter_scan(skmap *h, char **key, void **val);
 
 
 skmap *
-lsi_skmap_init(size_t bsz, int cmap)
+lsi_skmap_init(size_t initsz, int cmap)
 {
 	skmap *h = MALLOC(sizeof *h);
 	if (!h)
 		return NULL;
 
-	h->bsz = bsz;
+	h->slot = NULL;
+	h->cap = 0;
 	h->count = 0;
+	h->initsz = initsz;
 	h->iterating = false;
 	h->cmap = g_cmap[cmap];
-	h->hfn = bsz <= 256 ? strhash_small : strhash_mid;
-
-	h->buck = MALLOC(h->bsz * sizeof *h->buck);
-	if (!h->buck)
-		goto fail;
-
-	for (size_t i = 0; i < h->bsz; i++)
-		h->buck[i] = NULL;
+	lsi_b_randbytes(h->seed, sizeof h->seed);
 
 	return h;
-
-fail:
-	if (h)
-		free(h->buck);
-	free(h);
-
-	return NULL;
 }
 
 void
 lsi_skmap_clear(skmap *h)
 {
-	char *k;
-
 	if (!h)
 		return;
 
-	for (size_t i = 0; i < h->bsz; i++) {
-		if (!h->buck[i])
-			continue;
-
-		if (lsi_bucklist_first(h->buck[i], &k, NULL))
-			do {
-				free(k);
-			} while (lsi_bucklist_next(h->buck[i], &k, NULL));
-
-		lsi_bucklist_dispose(h->buck[i]);
-		h->buck[i] = NULL;
-	}
+	for (size_t i = 0; i < h->cap; i++)
+		free(h->slot[i].key);
 
+	/* start over small, a map that was huge once needn't stay that way */
+	free(h->slot);
+	h->slot = NULL;
+	h->cap = 0;
 	h->count = 0;
+	h->iterating = false;
 	return;
 }
 
@@ -109,7 +115,6 @@ lsi_skmap_dispose(skmap *h)
 
 	lsi_skmap_clear(h);
 
-	free(h->buck);
 	free(h);
 	return;
 }
@@ -120,41 +125,23 @@ lsi_skmap_put(skmap *h, const char *key, void *elem)
 	if (!h || !key || !elem)
 		return false;
 
-	bool allocated = false;
-	size_t ind = h->hfn(key, h->cmap) % h->bsz;
-	char *kd = NULL;
-
-	bucklist *kl = h->buck[ind];
-	if (!kl) {
-		allocated = true;
-		if (!(kl = h->buck[ind] = lsi_bucklist_init(h->cmap)))
-			goto fail;
+	size_t hash = strhash(key, h->cmap, h->seed);
+	size_t i = find(h, key, hash);
+	if (i != NOSLOT) {
+		h->slot[i].val = elem;
+		return true;
 	}
 
-	void *e = lsi_bucklist_find(kl, key, NULL);
-	if (!e) {
-		kd = STRDUP(key);
-		if (!kd)
-			goto fail;
-
-		if (!lsi_bucklist_insert(kl, 0, kd, elem))
-			goto fail;
+	if ((h->count + 1) * MAXLOAD_DEN > h->cap * MAXLOAD_NUM && !grow(h))
+		return false;
 
-		h->count++;
-	} else
-		lsi_bucklist_replace(kl, key, elem);
+	char *kd = STRDUP(key);
+	if (!kd)
+		return false;
 
+	insert(h, kd, elem, hash);
+	h->count++;
 	return true;
-
-fail:
-	if (allocated) {
-		lsi_bucklist_dispose(kl);
-		h->buck[ind] = NULL;
-	}
-
-	free(kd);
-
-	return false;
 }
 
 void *
@@ -163,13 +150,8 @@ lsi_skmap_get(skmap *h, const char *key)
 	if (!h)
 		return NULL;
 
-	size_t ind = h->hfn(key, h->cmap) % h->bsz;
-
-	bucklist *kl = h->buck[ind];
-	if (!kl)
-		return NULL;
-
-	return lsi_bucklist_find(kl, key, NULL);
+	size_t i = find(h, key, strhash(key, h->cmap, h->seed));
+	return i == NOSLOT ? NULL : h->slot[i].val;
 }
 
 void *
@@ -178,23 +160,69 @@ lsi_skmap_del(skmap *h, const char *key)
 	if (!h)
 		return NULL;
 
-	size_t ind = h->hfn(key, h->cmap) % h->bsz;
-
-	bucklist *kl = h->buck[ind];
-	if (!kl)
+	size_t i = find(h, key, strhash(key, h->cmap, h->seed));
+	if (i == NOSLOT)
 		return NULL;
 
-	char *okey;
-	void *e = lsi_bucklist_remove(kl, key, &okey);
-
-	if (!e)
-		return NULL;
-
-	free(okey);
+	void *e = h->slot[i].val;
+	free(h->slot[i].key);
+	remove_at(h, i);
 	h->count--;
 	return e;
 }
 
+size_t
+lsi_skmap_hash(skmap *h, const char *key)
+{
+	return strhash(key, h->cmap, h->seed);
+}
+
+bool
+lsi_skmap_rehash(skmap *h, int cmap, skmap_merge_fn mergefn, void *arg)
+{
+	if (!h)
+		return false;
+
+	h->iterating = false;
+	if (h->cmap == g_cmap[cmap])
+		return true;
+
+	struct skslot *nslot = NULL;
+	if (h->cap && !(nslot = MALLOC(h->cap * sizeof *nslot)))
+		return false;
+
+	for (size_t i = 0; i < h->cap; i++)
+		nslot[i].key = NULL;
+
+	/* nothing can fail from here on */
+	struct skslot *oslot = h->slot;
+	h->slot = nslot;
+	h->cmap = g_cmap[cmap];
+
+	for (size_t i = 0; i < h->cap; i++) {
+		struct skslot *s = &oslot[i];
+		if (!s->key)
+			continue;
+
+		size_t hash = strhash(s->key, h->cmap, h->seed);
+		size_t j = find(h, s->key, hash);
+		if (j == NOSLOT) {
+			insert(h, s->key, s->val, hash);
+			continue;
+		}
+
+		/* two keys that used to differ are the same now */
+		D("'%s' and '%s' collide, merging", h->slot[j].key, s->key);
+		free(s->key);
+		h->count--;
+		if (mergefn)
+			mergefn(arg, h->slot[j].val, s->val);
+	}
+
+	free(oslot);
+	return true;
+}
+
 size_t
 lsi_skmap_count(skmap *h)
 {
@@ -210,21 +238,23 @@ lsi_skmap_first(skmap *h, char **key, void **val)
 	if (!h)
 		return false;
 
-	h->bit = 0;
-	while (h->bit < h->bsz &&
-	    (!h->buck[h->bit] || lsi_bucklist_isempty(h->buck[h->bit])))
-		h->bit++;
-
-	if (h->bit == h->bsz) {
-		if (key) *key = NULL;
-		if (val) *val = NULL;
-
-		return h->iterating = false;
+	/* start right after a free slot; no probe sequence wraps around past
+	 * it, so deleting the current element (which pulls the remainder of
+	 * its probe sequence back by one) can't move anything from the part
+	 * we haven't seen yet to the part we have.  there always is a free
+	 * slot, unless the map is empty */
+	h->bleft = 0;
+	if (h->count) {
+		size_t i = 0;
+		while (h->slot[i].key)
+			i++;
+
+		h->bit = (i + 1) & (h->cap - 1);
+		h->bleft = h->cap;
 	}
 
-	lsi_bucklist_first(h->buck[h->bit], key, val);
-
-	return h->iterating = true;
+	h->iterating = true;
+	return iter_scan(h, key, val);
 }
 
 bool
@@ -233,31 +263,22 @@ lsi_skmap_next(skmap *h, char **key, void **val)
 	if (!h || !h->iterating)
 		return false;
 
-	if (lsi_bucklist_next(h->buck[h->bit], key, val))
-		return true;
-
-	do {
-		h->bit++;
-	} while (h->bit < h->bsz &&
-	    (!h->buck[h->bit] || lsi_bucklist_isempty(h->buck[h->bit])));
-
-	if (h->bit == h->bsz) {
-		if (key) *key = NULL;
-		if (val) *val = NULL;
-
-		return h->iterating = false;
-	}
-
-	lsi_bucklist_first(h->buck[h->bit], key, val);
-
-	return true;
+	return iter_scan(h, key, val);
 }
 
 void
 lsi_skmap_del_iter(skmap *h)
 {
-	if (h && h->iterating)
-		lsi_bucklist_del_iter(h->buck[h->bit]);
+	if (!h || !h->iterating || !h->slot[h->bcur].key)
+		return;
+
+	free(h->slot[h->bcur].key);
+	remove_at(h, h->bcur);
+	h->count--;
+
+	/* what used to follow may have moved into the current slot */
+	h->bit = h->bcur;
+	h->bleft++;
 	return;
 }
 
@@ -265,25 +286,21 @@ void
 lsi_skmap_dump(skmap *h, skmap_op_fn valop)
 {
 	#define M(...) fprintf(stderr, __VA_ARGS__)
-	M("===hashmap dump (count: %zu)===\n", h->count);
-	if (!h)
+	if (!h) {
 		M("nullpointer...\n");
+		return;
+	}
 
-	for (size_t i = 0; i < h->bsz; i++) {
-		if (h->buck[i] && lsi_bucklist_count(h->buck[i])) {
-			fprintf(stderr, "[%zu]: ", i);
-			bucklist *kl = h->buck[i];
-			char *key;
-			void *val;
-			if (lsi_bucklist_first(kl, &key, &val))
-				do {
-					fprintf(stderr, "'%s' --> ", key);
-					if (valop)
-						valop(val);
-					fputs(", ", stderr);
-				} while (lsi_bucklist_next(kl, &key, &val));
-			fputc('\n', stderr);
-		}
+	M("===hashmap dump (count: %zu, slots: %zu)===\n", h->count, h->cap);
+
+	for (size_t i = 0; i < h->cap; i++) {
+		if (!h->slot[i].key)
+			continue;
+
+		M("[%zu] (+%zu): '%s' --> ", i, dist(h, i), h->slot[i].key);
+		if (valop)
+			valop(h->slot[i].val);
+		fputc('\n', stderr);
 	}
 	M("===end of hashmap dump===\n");
 	#undef M
@@ -291,103 +308,230 @@ lsi_skmap_dump(skmap *h, skmap_op_fn valop)
 }
 
 void
-lsi_skmap_stat(skmap *h, size_t *nbuck, size_t *nbuckused, size_t *nitems,
-    double *loadfac, double *avglistlen, size_t *maxlistlen)
+lsi_skmap_stat(skmap *h, size_t *nslots, size_t *nused, size_t *nitems,
+    double *loadfac, double *avgprobe, size_t *maxprobe)
 {
 	size_t used = 0;
-	size_t usedlen = 0;
-	size_t empty = 0;
+	size_t probesum = 0;
 	size_t maxlen = 0;
-	for (size_t i = 0; i < h->bsz; i++) {
-		if (h->buck[i]) {
-			size_t c = lsi_bucklist_count(h->buck[i]);
-			if (c > maxlen)
-				maxlen = c;
-			if (c > 0) {
-				used++;
-				usedlen += c;
-			} else
-				empty++;
-		}
+	for (size_t i = 0; i < h->cap; i++) {
+		if (!h->slot[i].key)
+			continue;
+
+		size_t c = dist(h, i) + 1;
+		if (c > maxlen)
+			maxlen = c;
+		used++;
+		probesum += c;
 	}
 
-	*nbuck = h->bsz;
-	*nbuckused = used;
+	*nslots = h->cap;
+	*nused = used;
 	*nitems = h->count;
-	*loadfac = (double)h->count / h->bsz;
-	if (used)
-		*avglistlen = (double)usedlen / used;
-	else
-		*avglistlen = 0;
-	*maxlistlen = maxlen;
+	*loadfac = h->cap ? (double)h->count / h->cap : 0;
+	*avgprobe = used ? (double)probesum / used : 0;
+	*maxprobe = maxlen;
 	return;
 }
 
 void
 lsi_skmap_dumpstat(skmap *h, const char *dbgname)
 {
-	size_t nbuck;
-	size_t nbuckused;
+	size_t nslots;
+	size_t nused;
 	size_t nitems;
 	double loadfac;
-	double avglistlen;
-	size_t maxlistlen;
+	double avgprobe;
+	size_t maxprobe;
 
-	lsi_skmap_stat(h, &nbuck, &nbuckused, &nitems, &loadfac, &avglistlen,
-	    &maxlistlen);
+	lsi_skmap_stat(h, &nslots, &nused, &nitems, &loadfac, &avgprobe,
+	    &maxprobe);
 
-	A("hashmap '%s' stat: bucksz: %zu, buckused: %zu (%f%%), items: %zu, "
-	    "loadfac: %f, avg listlen: %f, max listlen: %zu",
-	    dbgname, nbuck, nbuckused, 100.0*nbuckused/nbuck, nitems,
-	    loadfac, avglistlen, maxlistlen);
+	A("hashmap '%s' stat: slots: %zu, items: %zu, loadfac: %f, "
+	    "avg probe len: %f, max probe len: %zu",
+	    dbgname, nslots, nitems, loadfac, avgprobe, maxprobe);
 	return;
 }
 
 
+#define ROTL(X, B) (((X) << (B)) | ((X) >> (64 - (B))))
+#define SIPROUND(V0, V1, V2, V3) do { \
+	V0 += V1; V1 = ROTL(V1, 13); V1 ^= V0; V0 = ROTL(V0, 32); \
+	V2 += V3; V3 = ROTL(V3, 16); V3 ^= V2; \
+	V0 += V3; V3 = ROTL(V3, 21); V3 ^= V0; \
+	V2 += V1; V1 = ROTL(V1, 17); V1 ^= V2; V2 = ROTL(V2, 32); \
+	} while (0)
+
+/* SipHash-1-3 of the case-mapped key, keyed with the map's random seed.
+ * nicks and channel names are chosen by others, so we can't have anyone
+ * come up with a bunch of them that all end up in the same probe sequence
+ * (which anyone could, with an unkeyed hash and a power-of-2 table).  the
+ * case mapping is done as the key is read, 8 bytes at a time */
 static size_t
-strhash_small(const char *s, const uint8_t *cmap)
+strhash(const char *s, const uint8_t *cmap, const uint64_t *seed)
 {
-	uint8_t res = 0xaa;
-	uint8_t cur;
-	unsigned shift = 0;
+	uint64_t v0 = seed[0] ^ 0x736f6d6570736575u;
+	uint64_t v1 = seed[1] ^ 0x646f72616e646f6du;
+	uint64_t v2 = seed[0] ^ 0x6c7967656e657261u;
+	uint64_t v3 = seed[1] ^ 0x7465646279746573u;
+	uint64_t len = 0;
+
+	for (;;) {
+		uint64_t m = 0;
+		unsigned i = 0;
+		uint8_t cur;
+		while (i < 8 && (cur = cmap[(uint8_t)s[i]]))
+			m |= (uint64_t)cur << (8 * i++);
+
+		len += i;
+		if (i < 8) { /* last block, with the length on top */
+			m |= len << 56;
+			v3 ^= m;
+			SIPROUND(v0, v1, v2, v3);
+			v0 ^= m;
+			break;
+		}
+
+		v3 ^= m;
+		SIPROUND(v0, v1, v2, v3);
+		v0 ^= m;
+		s += 8;
+	}
 
-	while ((cur = cmap[(uint8_t)*s++]))
-		res ^= (cur << (++shift % 3));
+	v2 ^= 0xff;
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
+	SIPROUND(v0, v1, v2, v3);
 
-	return res;
+	return (size_t)(v0 ^ v1 ^ v2 ^ v3);
+}
+
+static bool
+keyeq(const char *k1, const char *k2, const uint8_t *cmap)
+{
+	unsigned char c1, c2;
+	while ((c1 = cmap[(unsigned char)*k1]) & /* avoid short circuit */
+	    (c2 = cmap[(unsigned char)*k2])) {
+		if (c1 != c2)
+			return false;
+
+		k1++; k2++;
+	}
+
+	return c1 == c2;
+}
+
+/* how far the element in slot `i' is from where it wanted to be */
+static size_t
+dist(skmap *h, size_t i)
+{
+	return (i - (h->slot[i].hash & (h->cap - 1))) & (h->cap - 1);
 }
 
 static size_t
-strhash_mid(const char *s, const uint8_t *cmap)
+find(skmap *h, const char *key, size_t hash)
 {
-	uint8_t res[2] = { 0xaa, 0xaa };
-	uint8_t cur;
-	unsigned shift = 0;
-	bool first = true;
+	if (!h->cap)
+		return NOSLOT;
+
+	size_t mask = h->cap - 1;
+	for (size_t i = hash & mask, d = 0;; i = (i + 1) & mask, d++) {
+		struct skslot *s = &h->slot[i];
+		/* had it been there, it'd have displaced whatever is here */
+		if (!s->key || dist(h, i) < d)
+			return NOSLOT;
+
+		if (s->hash == hash && keyeq(s->key, key, h->cmap))
+			return i;
+	}
+}
+
+/* `key' must not be in the map yet, and there must be room for it */
+static void
+insert(skmap *h, char *key, void *val, size_t hash)
+{
+	struct skslot cur = { key, val, hash };
+	size_t mask = h->cap - 1;
+	for (size_t i = hash & mask, d = 0;; i = (i + 1) & mask, d++) {
+		struct skslot *s = &h->slot[i];
+		if (!s->key) {
+			*s = cur;
+			return;
+		}
+
+		size_t sd = dist(h, i);
+		if (sd < d) { /* take from the rich */
+			struct skslot tmp = *s;
+			*s = cur;
+			cur = tmp;
+			d = sd;
+		}
+	}
+}
 
-	while ((cur = cmap[(uint8_t)*s++]))
-		res[first = !first] ^= cur << (++shift % 3);
+static void
+remove_at(skmap *h, size_t i)
+{
+	size_t mask = h->cap - 1;
+	size_t j = (i + 1) & mask;
+	while (h->slot[j].key && dist(h, j) > 0) {
+		h->slot[i] = h->slot[j];
+		i = j;
+		j = (j + 1) & mask;
+	}
 
-	return (res[0] << 8) | res[1];
+	h->slot[i].key = NULL;
+	return;
 }
 
-/*void skmap_test(void) {
+static bool
+grow(skmap *h)
+{
+	size_t ncap = h->cap * 2;
+	if (!ncap) {
+		ncap = MIN_CAP;
+		while (h->initsz * MAXLOAD_DEN > ncap * MAXLOAD_NUM)
+			ncap *= 2;
+	}
+
+	struct skslot *nslot = MALLOC(ncap * sizeof *nslot);
+	if (!nslot)
+		return false;
 
-	char *line = NULL;
-	size_t linesize = 0;
-	ssize_t linelen;
+	for (size_t i = 0; i < ncap; i++)
+		nslot[i].key = NULL;
 
-	while ((linelen = getline(&line, &linesize, stdin)) != -1) {
-		char *s = strchr(line, '\n');
-		*s = 0;
-		size_t shs = strhash_small(line, g_cmap[0]);
-		size_t shm = strhash_mid(line, g_cmap[0]);
-		size_t shm4 = strhash_mid(line, g_cmap[0]) % 8192;
+	struct skslot *oslot = h->slot;
+	size_t ocap = h->cap;
+	h->slot = nslot;
+	h->cap = ncap;
 
-		printf("'%s' %zu %zu %zu\n", line, shs, shm, shm4);
+	for (size_t i = 0; i < ocap; i++)
+		if (oslot[i].key)
+			insert(h, oslot[i].key, oslot[i].val, oslot[i].hash);
+
+	free(oslot);
+	D("grew from %zu to %zu slots (%zu items)", ocap, ncap, h->count);
+	return true;
+}
+
+static bool
+iter_scan(skmap *h, char **key, void **val)
+{
+	while (h->bleft) {
+		size_t i = h->bit;
+		h->bit = (h->bit + 1) & (h->cap - 1);
+		h->bleft--;
+		if (h->slot[i].key) {
+			h->bcur = i;
+			if (key) *key = h->slot[i].key;
+			if (val) *val = h->slot[i].val;
+			return true;
+		}
 	}
 
-	if (ferror(stdin))
-		perror("getline");
+	if (key) *key = NULL;
+	if (val) *val = NULL;
 
-} */
+	return h->iterating = false;
+}
@@ -15,10 +15,13 @@ typedef size_t (*skmap_hash_fn)(const char *elem, const uint8_t *cmap);
 typedef void (*skmap_op_fn)(const void *elem);
 typedef void *(*skmap_keydup_fn)(const char *key);
 typedef bool (*skmap_eq_fn)(const void *elem1, const void *elem2);
+typedef void (*skmap_merge_fn)(void *arg, void *kept, void *dropped);
 typedef struct skmap skmap;
 
 
-skmap *lsi_skmap_init(size_t bucketsz, int cmap);
+/* `initsz' is the number of items expected; the map grows as needed,
+ * but starting off at the right size saves the rehashing */
+skmap *lsi_skmap_init(size_t initsz, int cmap);
 void lsi_skmap_clear(skmap *m);
 void lsi_skmap_dispose(skmap *m);
 bool lsi_skmap_put(skmap *m, const char *key, void *elem);
@@ -26,13 +29,26 @@ void *lsi_skmap_get(skmap *m, const char *key);
 void *lsi_skmap_del(skmap *m, const char *key);
 size_t lsi_skmap_count(skmap *m);
 
+/* switch `m' over to case mapping `cmap', in place.  keys that become
+ * equal are merged: one survives, and `mergefn' (unless NULL) is called
+ * with the surviving and the dropped value, the latter of which is no
+ * longer in the map.  returns false if we're out of memory, in which case
+ * the map is left unchanged */
+bool lsi_skmap_rehash(skmap *m, int cmap, skmap_merge_fn mergefn, void *arg);
+
+/* the hash of `key' as seen by `m' (keyed per map, see skmap.c) */
+size_t lsi_skmap_hash(skmap *m, const char *key);
+
+/* while iterating, the map must not be modified other than by replacing
+ * values or by lsi_skmap_del_iter(), which deletes the current item */
 bool lsi_skmap_first(skmap *m, char **key, void **val);
 bool lsi_skmap_next(skmap *m, char **key, void **val);
 void lsi_skmap_del_iter(skmap *h);
 
 void lsi_skmap_dump(skmap *m, skmap_op_fn valop);
-void lsi_skmap_stat(skmap *h, size_t *nbuck, size_t *nbuckused, size_t *nitems,
-    double *loadfac, double *avglistlen, size_t *maxlistlen);
+/* probe lengths count the slots looked at to find an item, i.e. 1 is best */
+void lsi_skmap_stat(skmap *h, size_t *nslots, size_t *nused, size_t *nitems,
+    double *loadfac, double *avgprobe, size_t *maxprobe);
 void lsi_skmap_dumpstat(skmap *m, const char *dbgname);
 //void skmap_test(void);
 
@@ -28,24 +28,51 @@
 
 
 static int compare_modepfx(irc *ctx, char c1, char c2);
+static void touch_user_int(irc *ctx, user *u, const char *ident);
+static void free_user(irc *ctx, user *u);
+static void free_chan(irc *ctx, chan *c);
+static void link_memb(user *u, memb *m);
+static void unlink_memb(memb *m);
+static void merge_user(void *arg, void *kept, void *dropped);
+static void merge_memb(void *arg, void *kept, void *dropped);
+static void merge_chan(void *arg, void *kept, void *dropped);
 
 
 bool
 lsi_ucb_init(irc *ctx)
 {
-	if (!(ctx->chans = lsi_skmap_init(256, ctx->casemap)))
-		return false;
+	if (!(ctx->chans = lsi_skmap_init(64, ctx->casemap)))
+		goto fail;
+
+	if (!(ctx->users = lsi_skmap_init(1024, ctx->casemap)))
+		goto fail;
+
+	/* records and their strings come in bulk (think NAMES replies and
+	 * netjoins), so we keep them in slabs rather than malloc'ing each.
+	 * everything is released at once by lsi_ucb_clear() */
+	if (!(ctx->cpool = lsi_pool_init(sizeof (chan), 64)))
+		goto fail;
+
+	if (!(ctx->upool = lsi_pool_init(sizeof (user), 256)))
+		goto fail;
+
+	if (!(ctx->mpool = lsi_pool_init(sizeof (memb), 512)))
+		goto fail;
 
-	if (!(ctx->users = lsi_skmap_init(4096, ctx->casemap)))
-		return lsi_skmap_dispose(ctx->chans), false;
+	if (!(ctx->strs = lsi_arena_init()))
+		goto fail;
 
 	return true;
+
+fail:
+	lsi_ucb_deinit(ctx);
+	return false;
 }
 
 chan *
 lsi_ucb_add_chan(irc *ctx, const char *name)
 {
-	chan *c = MALLOC(sizeof *c);
+	chan *c = lsi_pool_get(ctx->cpool);
 	if (!c)
 		goto fail;
 
@@ -53,15 +80,17 @@ lsi_ucb_add_chan(irc *ctx, const char *name)
 	c->topic = c->topicnick = NULL;
 	c->tscreate = c->tstopic = 0;
 	c->desync = false;
+	c->memb = NULL;
 	c->modes = NULL;
 	c->tag = NULL;
 	c->freetag = false;
 
-	if (!(c->memb = lsi_skmap_init(256, ctx->casemap)))
+	if (!(c->memb = lsi_skmap_init(8, ctx->casemap)))
 		goto fail;
 
 	c->modes_sz = 16; //grows
-	if (!(c->modes = MALLOC(c->modes_sz * sizeof *c->modes)))
+	if (!(c->modes = lsi_arena_alloc(ctx->strs,
+	    c->modes_sz * sizeof *c->modes)))
 		goto fail;
 
 	for (size_t i = 0; i < c->modes_sz; i++)
@@ -75,15 +104,9 @@ lsi_ucb_add_chan(irc *ctx, const char *name)
 	return c;
 
 fail:
-	if (c) {
-		if (c->modes)
-			free(c->modes[0]);
+	if (c)
+		free_chan(ctx, c);
 
-		free(c->modes);
-		lsi_skmap_dispose(c->memb);
-	}
-
-	free(c);
 	return NULL;
 }
 
@@ -99,34 +122,21 @@ lsi_ucb_drop_chan(irc *ctx, chan *c)
 	if (lsi_skmap_first(c->memb, NULL, &e)) {
 		do {
 			memb *m = e;
+			unlink_memb(m);
 			if (--m->u->nchans == 0) {
 				if (!lsi_skmap_del(ctx->users, m->u->nick))
 					W("user '%s' not in umap", m->u->nick);
 				D("implicitly dropped user '%s'", m->u->nick);
-				free(m->u->nick);
-				free(m->u->uname);
-				free(m->u->host);
-				free(m->u->fname);
-				if (m->u->freetag)
-					free(m->u->tag);
-				free(m->u);
+				free_user(ctx, m->u);
 			}
-			free(m);
+			lsi_pool_put(ctx->mpool, m);
 		} while (lsi_skmap_next(c->memb, NULL, &e));
 		lsi_skmap_clear(c->memb);
 	}
-	lsi_skmap_dispose(c->memb);
 
 	D("dropped channel '%s'", c->name);
 
-	free(c->topic);
-	free(c->topicnick);
-	for (size_t i = 0; i < c->modes_sz; i++)
-		free(c->modes[i]);
-	free(c->modes);
-	if (c->freetag)
-		free(c->tag);
-	free(c);
+	free_chan(ctx, c);
 	return true;
 }
 
@@ -163,12 +173,23 @@ lsi_ucb_num_memb(irc *ctx, chan *c)
 bool
 lsi_ucb_add_memb(irc *ctx, chan *c, user *u, const char *mpfxstr)
 {
-	memb *m = lsi_ucb_alloc_memb(ctx, u, mpfxstr);
-	if (!m || !lsi_skmap_put(c->memb, u->nick, m)) {
-		free(m);
+	memb *m = lsi_skmap_get(c->memb, u->nick);
+	if (m && m->u == u) { /* e.g. NAMES while we already know them */
+		STRACPY(m->modepfx, mpfxstr);
+		return true;
+	}
+
+	if (m) /* someone that used to have the nick?  can't really be */
+		lsi_ucb_drop_memb(ctx, c, m->u, false, false);
+
+	if (!(m = lsi_ucb_alloc_memb(ctx, u, mpfxstr))
+	    || !lsi_skmap_put(c->memb, u->nick, m)) {
+		lsi_pool_put(ctx->mpool, m);
 		return false;
 	}
 
+	m->c = c;
+	link_memb(u, m);
 	u->nchans++;
 	D("added member '%s' to chan '%s'", u->nick, c->name);
 	return true;
@@ -180,22 +201,17 @@ lsi_ucb_drop_memb(irc *ctx, chan *c, user *u, bool purge, bool complain)
 	memb *m = lsi_skmap_del(c->memb, u->nick);
 	if (m) {
 		D("dropped '%s' from '%s'", m->u->nick, c->name);
+		unlink_memb(m);
 		if (--m->u->nchans == 0 && purge) {
 			if (!lsi_skmap_del(ctx->users, m->u->nick))
 				W("user '%s' not in user map", m->u->nick);
 			D("implicitly dropped user '%s'", m->u->nick);
-			free(m->u->nick);
-			free(m->u->uname);
-			free(m->u->host);
-			free(m->u->fname);
-			if (m->u->freetag)
-				free(m->u->tag);
-			free(m->u);
+			free_user(ctx, m->u);
 		}
 	} else if (complain)
 		W("no such member '%s' in channel '%s'", u->nick, c->name);
 
-	free(m);
+	lsi_pool_put(ctx->mpool, m);
 	return m;
 }
 
@@ -208,19 +224,14 @@ lsi_ucb_clear_memb(irc *ctx, chan *c)
 
 	do {
 		memb *m = e;
+		unlink_memb(m);
 		if (--m->u->nchans== 0) {
 			if (!lsi_skmap_del(ctx->users, m->u->nick))
 				W("user '%s' not in user map", m->u->nick);
 			D("implicitly dropped user '%s'", m->u->nick);
-			free(m->u->nick);
-			free(m->u->uname);
-			free(m->u->host);
-			free(m->u->fname);
-			if (m->u->freetag)
-				free(m->u->tag);
-			free(m->u);
+			free_user(ctx, m->u);
 		}
-		free(m);
+		lsi_pool_put(ctx->mpool, m);
 	} while (lsi_skmap_next(c->memb, NULL, &e));
 	lsi_skmap_clear(c->memb);
 	D("cleared members of channel '%s'", c->name);
@@ -230,18 +241,16 @@ lsi_ucb_clear_memb(irc *ctx, chan *c)
 memb *
 lsi_ucb_alloc_memb(irc *ctx, user *u, const char *mpfxstr)
 {
-	memb *m = MALLOC(sizeof *m);
+	memb *m = lsi_pool_get(ctx->mpool);
 	if (!m)
-		goto fail;
+		return NULL;
 
 	m->u = u;
+	m->c = NULL;
+	m->unext = m->uprev = NULL;
 	STRACPY(m->modepfx, mpfxstr);
 
 	return m;
-
-fail:
-	free(m);
-	return NULL;
 }
 
 bool
@@ -304,7 +313,7 @@ void
 lsi_ucb_clear_chanmodes(irc *ctx, chan *c)
 {
 	for (size_t i = 0; i < c->modes_sz; i++)
-		free(c->modes[i]), c->modes[i] = NULL;
+		lsi_arena_strfree(ctx->strs, c->modes[i]), c->modes[i] = NULL;
 	return;
 }
 
@@ -318,7 +327,8 @@ lsi_ucb_add_chanmode(irc *ctx, chan *c, const char *modestr)
 
 	if (ind == c->modes_sz) {
 		size_t nsz = c->modes_sz * 2;
-		char **nmodes = MALLOC(nsz * sizeof *nmodes);
+		char **nmodes = lsi_arena_alloc(ctx->strs,
+		    nsz * sizeof *nmodes);
 		if (!nmodes)
 			return false;
 
@@ -329,12 +339,12 @@ lsi_ucb_add_chanmode(irc *ctx, chan *c, const char *modestr)
 		for (; i < nsz; i++)
 			nmodes[i] = NULL;
 
-		free(c->modes);
+		lsi_arena_free(ctx->strs, c->modes);
 		c->modes = nmodes;
 		c->modes_sz = nsz;
 	}
 
-	return (c->modes[ind] = STRDUP(modestr));
+	return (c->modes[ind] = lsi_arena_strdup(ctx->strs, modestr));
 }
 
 bool
@@ -370,7 +380,7 @@ lsi_ucb_drop_chanmode(irc *ctx, chan *c, const char *modestr)
 		if (c->modes[last])
 			break;
 
-	free(c->modes[i]);
+	lsi_arena_strfree(ctx->strs, c->modes[i]);
 	if (last == i)
 		c->modes[i] = NULL;
 	else {
@@ -381,21 +391,17 @@ lsi_ucb_drop_chanmode(irc *ctx, chan *c, const char *modestr)
 	return true;
 }
 
-void
-lsi_ucb_touch_user_int(user *u, const char *ident)
+bool
+lsi_ucb_update_strprop(irc *ctx, char **field, const char *val)
 {
-	if (!u->uname && strchr(ident, '!')) {
-		char unam[MAX_UNAME_LEN];
-		lsi_ut_ident2uname(unam, sizeof unam, ident);
-		u->uname = STRDUP(unam); //pointless to check
-	}
+	char *n = NULL;
+	if (val && !(n = lsi_arena_strdup(ctx->strs, val)))
+		return false;
 
-	if (!u->host && strchr(ident, '@')) {
-		char host[MAX_HOST_LEN];
-		lsi_ut_ident2host(host, sizeof host, ident);
-		u->host = STRDUP(host); //pointless to check
-	}
-	return;
+	lsi_arena_strfree(ctx->strs, *field);
+	*field = n;
+
+	return true;
 }
 
 user *
@@ -403,7 +409,7 @@ lsi_ucb_touch_user(irc *ctx, const char *ident, bool complain)
 {
 	user *u = lsi_ucb_get_user(ctx, ident, complain);
 	if (u)
-		lsi_ucb_touch_user_int(u, ident);
+		touch_user_int(ctx, u, ident);
 	return u;
 }
 
@@ -414,35 +420,32 @@ lsi_ucb_add_user(irc *ctx, const char *ident) //ident may be a nick, or nick!una
 	char nick[MAX_NICK_LEN];
 	lsi_ut_ident2nick(nick, sizeof nick, ident);
 
-	user *u = MALLOC(sizeof *u);
+	user *u = lsi_pool_get(ctx->upool);
 	if (!u)
 		goto fail;
 
-	u->uname = u->host = u->fname = NULL;
+	u->nick = u->uname = u->host = u->fname = NULL;
 	u->nchans = 0;
+	u->memb = NULL;
 	u->tag = NULL;
 	u->freetag = false;
 
-	if (!(u->nick = STRDUP(nick)))
+	if (!(u->nick = lsi_arena_strdup(ctx->strs, nick)))
 		goto fail;
 
 	if (!lsi_skmap_put(ctx->users, nick, u))
 		goto fail;
 
-	lsi_ucb_touch_user_int(u, ident);
+	touch_user_int(ctx, u, ident);
 
 	D("added user '%s' ('%s@%s')", u->nick, u->uname, u->host);
 
 	return u;
 
 fail:
-	if (u) {
-		free(u->nick);
-		free(u->uname);
-		free(u->host);
-	}
+	if (u)
+		free_user(ctx, u);
 
-	free(u);
 	return NULL;
 }
 
@@ -454,24 +457,19 @@ lsi_ucb_drop_user(irc *ctx, user *u)
 		return false;
 	}
 
-	void *e;
-	if (lsi_skmap_first(ctx->chans, NULL, &e))
-		do {
-			lsi_ucb_drop_memb(ctx, e, u, false, false);
-		} while (lsi_skmap_next(ctx->chans, NULL, &e));
-	else
+	if (!u->memb)
 		W("dropping dangling user '%s'", u->nick);
 
-	D("dropped user '%s'", u->nick);
+	while (u->memb) {
+		memb *m = u->memb;
+		u->memb = m->unext;
+		lsi_skmap_del(m->c->memb, u->nick);
+		lsi_pool_put(ctx->mpool, m);
+	}
 
-	free(u->nick);
-	free(u->uname);
-	free(u->host);
-	free(u->fname);
-	if (u->freetag)
-		free(u->tag);
-	free(u);
+	D("dropped user '%s'", u->nick);
 
+	free_user(ctx, u);
 	return true;
 }
 
@@ -481,46 +479,51 @@ lsi_ucb_deinit(irc *ctx)
 	lsi_ucb_clear(ctx);
 	lsi_skmap_dispose(ctx->chans);
 	lsi_skmap_dispose(ctx->users);
+	lsi_pool_dispose(ctx->cpool);
+	lsi_pool_dispose(ctx->upool);
+	lsi_pool_dispose(ctx->mpool);
+	lsi_arena_dispose(ctx->strs);
 	ctx->chans = ctx->users = NULL;
+	ctx->cpool = ctx->upool = ctx->mpool = NULL;
+	ctx->strs = NULL;
 	return;
 }
 
+/* records and strings all live in the pools, so there's no need to free
+ * them one by one; only what was malloc'd elsewhere needs attention */
 void
 lsi_ucb_clear(irc *ctx)
 {
 	void *e;
 	if (ctx->chans) {
-		if (!lsi_skmap_first(ctx->chans, NULL, &e))
-			return;
-
-		do {
-			chan *c = e;
-			lsi_ucb_clear_memb(ctx, c);
-			lsi_skmap_dispose(c->memb);
-			free(c->topicnick);
-			free(c->topic);
-			for (size_t i = 0; i < c->modes_sz; i++)
-				free(c->modes[i]);
-			free(c->modes);
-			free(c);
-		} while (lsi_skmap_next(ctx->chans, NULL, &e));
+		if (lsi_skmap_first(ctx->chans, NULL, &e))
+			do {
+				chan *c = e;
+				lsi_skmap_dispose(c->memb);
+				if (c->freetag)
+					free(c->tag);
+			} while (lsi_skmap_next(ctx->chans, NULL, &e));
 		lsi_skmap_clear(ctx->chans);
 	}
 
 	if (ctx->users) {
-		if (!lsi_skmap_first(ctx->users, NULL, &e))
-			return;
-
-		do {
-			user *u = e;
-			free(u->nick);
-			free(u->uname);
-			free(u->host);
-			free(u->fname);
-			free(u);
-		} while (lsi_skmap_next(ctx->users, NULL, &e));
+		if (lsi_skmap_first(ctx->users, NULL, &e))
+			do {
+				user *u = e;
+				if (u->freetag)
+					free(u->tag);
+			} while (lsi_skmap_next(ctx->users, NULL, &e));
 		lsi_skmap_clear(ctx->users);
 	}
+
+	if (ctx->cpool)
+		lsi_pool_clear(ctx->cpool);
+	if (ctx->upool)
+		lsi_pool_clear(ctx->upool);
+	if (ctx->mpool)
+		lsi_pool_clear(ctx->mpool);
+	if (ctx->strs)
+		lsi_arena_clear(ctx->strs);
 	return;
 }
 
@@ -529,6 +532,10 @@ lsi_ucb_dump(irc *ctx, bool full)
 {
 	lsi_skmap_dumpstat(ctx->chans, "channels");
 	lsi_skmap_dumpstat(ctx->users, "global users");
+	lsi_pool_dumpstat(ctx->cpool, "channels");
+	lsi_pool_dumpstat(ctx->upool, "users");
+	lsi_pool_dumpstat(ctx->mpool, "members");
+	lsi_arena_dumpstat(ctx->strs, "strings");
 
 	char *key;
 	void *e1, *e2;
@@ -620,9 +627,9 @@ lsi_ucb_rename_user(irc *ctx, const char *ident, const char *newnick, bool *allo
 		lsi_b_strNcpy(u->nick, newnick, strlen(u->nick) + 1);
 		return true;
 	} else {
-		if (!(nn = STRDUP(newnick)))
+		if (!(nn = lsi_arena_strdup(ctx->strs, newnick)))
 			return false; //oh shit.
-		free(u->nick);
+		lsi_arena_strfree(ctx->strs, u->nick);
 		u->nick = nn;
 	}
 
@@ -634,23 +641,57 @@ lsi_ucb_rename_user(irc *ctx, const char *ident, const char *newnick, bool *allo
 
 	lsi_skmap_del(ctx->users, ident);
 
+	for (memb *m = u->memb; m; m = m->unext) {
+		if (!lsi_skmap_put(m->c->memb, newnick, m)) {
+			if (allocerr)
+				*allocerr = true;
+			return false;
+		}
+
+		lsi_skmap_del(m->c->memb, ident);
+	}
+
+	return true;
+}
+
+bool
+lsi_ucb_set_casemap(irc *ctx, int cmap)
+{
+	/* users first; whoever got merged into someone else is still
+	 * referenced by their memberships, which we point to the survivor
+	 * before the member maps are rehashed in turn */
+	if (!lsi_skmap_rehash(ctx->users, cmap, merge_user, ctx))
+		return false;
+
 	void *e;
 	if (lsi_skmap_first(ctx->chans, NULL, &e))
 		do {
 			chan *c = e;
-			memb *m = lsi_skmap_get(c->memb, ident);
-			if (!m)
-				continue;
-
-			if (!lsi_skmap_put(c->memb, newnick, m)) {
-				if (allocerr)
-					*allocerr = true;
+			void *e2;
+			if (lsi_skmap_first(c->memb, NULL, &e2))
+				do {
+					memb *m = e2;
+					user *u = lsi_skmap_get(ctx->users,
+					    m->u->nick);
+					if (!u || u == m->u)
+						continue;
+
+					unlink_memb(m);
+					u->nchans++;
+					if (--m->u->nchans == 0)
+						free_user(ctx, m->u);
+					m->u = u;
+					link_memb(u, m);
+				} while (lsi_skmap_next(c->memb, NULL, &e2));
+
+			if (!lsi_skmap_rehash(c->memb, cmap, merge_memb, ctx))
 				return false;
-			}
-
-			lsi_skmap_del(c->memb, ident);
 		} while (lsi_skmap_next(ctx->chans, NULL, &e));
 
+	if (!lsi_skmap_rehash(ctx->chans, cmap, merge_chan, ctx))
+		return false;
+
+	D("switched to casemap %s", lsi_ut_casemap_nam(cmap));
 	return true;
 }
 
@@ -728,3 +769,146 @@ lsi_ucb_tag_user(user *u, void *tag, bool autofree)
 	u->freetag = autofree;
 	return;
 }
+
+static void
+touch_user_int(irc *ctx, user *u, const char *ident)
+{
+	if (!u->uname && strchr(ident, '!')) {
+		char unam[MAX_UNAME_LEN];
+		lsi_ut_ident2uname(unam, sizeof unam, ident);
+		u->uname = lsi_arena_strdup(ctx->strs, unam); //pointless to check
+	}
+
+	if (!u->host && strchr(ident, '@')) {
+		char host[MAX_HOST_LEN];
+		lsi_ut_ident2host(host, sizeof host, ident);
+		u->host = lsi_arena_strdup(ctx->strs, host); //pointless to check
+	}
+	return;
+}
+
+static void
+free_user(irc *ctx, user *u)
+{
+	lsi_arena_strfree(ctx->strs, u->nick);
+	lsi_arena_strfree(ctx->strs, u->uname);
+	lsi_arena_strfree(ctx->strs, u->host);
+	lsi_arena_strfree(ctx->strs, u->fname);
+	if (u->freetag)
+		free(u->tag);
+	lsi_pool_put(ctx->upool, u);
+	return;
+}
+
+/* the members must be gone already */
+static void
+free_chan(irc *ctx, chan *c)
+{
+	lsi_skmap_dispose(c->memb);
+	lsi_arena_strfree(ctx->strs, c->topic);
+	lsi_arena_strfree(ctx->strs, c->topicnick);
+	if (c->modes) {
+		for (size_t i = 0; i < c->modes_sz; i++)
+			lsi_arena_strfree(ctx->strs, c->modes[i]);
+		lsi_arena_free(ctx->strs, c->modes);
+	}
+	if (c->freetag)
+		free(c->tag);
+	lsi_pool_put(ctx->cpool, c);
+	return;
+}
+
+/* the two are one and the same under the new case mapping; users that are
+ * in channels are freed once the last membership is moved over */
+static void
+merge_user(void *arg, void *kept, void *dropped)
+{
+	irc *ctx = arg;
+	user *u = kept, *o = dropped;
+	D("merging user '%s' into '%s'", o->nick, u->nick);
+	if (!u->uname && o->uname) {
+		u->uname = o->uname;
+		o->uname = NULL;
+	}
+	if (!u->host && o->host) {
+		u->host = o->host;
+		o->host = NULL;
+	}
+	if (!u->fname && o->fname) {
+		u->fname = o->fname;
+		o->fname = NULL;
+	}
+
+	if (!o->nchans)
+		free_user(ctx, o);
+	return;
+}
+
+/* by now, both refer to the same user */
+static void
+merge_memb(void *arg, void *kept, void *dropped)
+{
+	irc *ctx = arg;
+	memb *m = kept, *o = dropped;
+	if (!m->modepfx[0])
+		STRACPY(m->modepfx, o->modepfx);
+
+	unlink_memb(o);
+	m->u->nchans--;
+	lsi_pool_put(ctx->mpool, o);
+	return;
+}
+
+static void
+merge_chan(void *arg, void *kept, void *dropped)
+{
+	irc *ctx = arg;
+	chan *c = kept, *o = dropped;
+	D("merging channel '%s' into '%s'", o->name, c->name);
+
+	void *e;
+	if (lsi_skmap_first(o->memb, NULL, &e))
+		do {
+			memb *m = e;
+			memb *km = lsi_skmap_get(c->memb, m->u->nick);
+			if (km)
+				merge_memb(ctx, km, m);
+			else if (!lsi_skmap_put(c->memb, m->u->nick, m)) {
+				E("out of memory, lost '%s' from '%s'",
+				    m->u->nick, c->name);
+				unlink_memb(m);
+				m->u->nchans--;
+				lsi_pool_put(ctx->mpool, m);
+				c->desync = true;
+			} else
+				m->c = c;
+		} while (lsi_skmap_next(o->memb, NULL, &e));
+
+	lsi_skmap_clear(o->memb);
+	free_chan(ctx, o);
+	return;
+}
+
+static void
+link_memb(user *u, memb *m)
+{
+	m->uprev = NULL;
+	if ((m->unext = u->memb))
+		m->unext->uprev = m;
+	u->memb = m;
+	return;
+}
+
+static void
+unlink_memb(memb *m)
+{
+	if (m->unext)
+		m->unext->uprev = m->uprev;
+	if (m->uprev)
+		m->uprev->unext = m->unext;
+	else if (m->u->memb == m)
+		m->u->memb = m->unext;
+
+	m->unext = m->uprev = NULL;
+	return;
+}
@@ -33,6 +33,8 @@ struct chan {
 
 struct member {
 	user *u;
+	chan *c;
+	memb *unext, *uprev; //the other memberships of `u'
 	char modepfx[MAX_MODEPFX];
 };
 
@@ -42,6 +44,7 @@ struct user {
 	char *host;
 	char *fname;
 	size_t nchans;
+	memb *memb; //list of this user's memberships, linked by unext/uprev
 	bool dangling; //debug
 	void *tag;
 	bool freetag;
@@ -51,6 +54,14 @@ bool   lsi_ucb_init(irc *ctx);
 void   lsi_ucb_deinit(irc *ctx);
 void   lsi_ucb_clear(irc *ctx);
 void   lsi_ucb_dump(irc *ctx, bool full);
+/* switch all maps to a different case mapping, merging users, members and
+ * channels that are the same under the new one.  on failure (out of
+ * memory), the maps are left in an inconsistent state; lsi_ucb_deinit() */
+bool   lsi_ucb_set_casemap(irc *ctx, int cmap);
+
+/* the strings in users and channels live in ctx->strs; this is
+ * lsi_com_update_strprop() for them */
+bool   lsi_ucb_update_strprop(irc *ctx, char **field, const char *val);
 
 user  *lsi_ucb_add_user(irc *ctx, const char *ident);
 bool   lsi_ucb_drop_user(irc *ctx, user *u);
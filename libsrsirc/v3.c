@@ -10,6 +10,7 @@
 
 #include "v3.h"
 
+#include <inttypes.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -433,17 +434,29 @@ handle_670(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 
 	struct sckhld *sh = &ctx->con->sh;
 
+	/* anything still in plain text must go out before the handshake,
+	 * all of it, even if we're otherwise not to block on writes */
+	bool nb = lsi_conn_get_nbwrite(ctx->con);
+	lsi_conn_set_nbwrite(ctx->con, false);
+	bool suc = lsi_conn_flush(ctx->con);
+	lsi_conn_set_nbwrite(ctx->con, nb);
+	if (!suc)
+		return IO_ERR;
+
 	if (!lsi_b_blocking(sh->sck, true)) {
 		EE("failed to set blocking mode");
 		return IO_ERR;
 	}
 
-	if (!(ctx->con->sctx = lsi_b_mksslctx())) {
+	if (!ctx->con->sctx && !(ctx->con->sctx = lsi_b_mksslctx())) {
 		E("could not create ssl context, ssl not enabled!");
 		return IO_ERR;
 	}
 
-	if (!(sh->shnd = lsi_b_sslize(sh->sck, ctx->con->sctx))) {
+	char skey[320];
+	lsi_conn_sslkey(ctx->con, skey, sizeof skey);
+
+	if (!(sh->shnd = lsi_b_sslize(sh->sck, ctx->con->sctx, skey))) {
 		E("connect bailing out; couldn't initiate ssl");
 		return IO_ERR;
 	}
@@ -58,6 +58,10 @@ const char *modnames[NUM_MODS] = {
 	[MOD_ICATUSER] = "icat/user",
 	[MOD_ICATMISC] = "icat/misc",
 	[MOD_IWAT] = "iwat",
+	[MOD_LOOP] = "libsrsirc/loop",
+	[MOD_DNSCACHE] = "libsrsirc/dnscache",
+	[MOD_SENDQ] = "libsrsirc/sendq",
+	[MOD_POOL] = "libsrsirc/pool",
 	[MOD_UNKNOWN] = "(??" "?)"
 };
 
@@ -37,8 +37,12 @@
 #define MOD_ICATUSER 20
 #define MOD_ICATMISC 21
 #define MOD_IWAT 22
-#define MOD_UNKNOWN 23
-#define NUM_MODS 24 /* when adding modules, don't forget intlog.c's `modnames' */
+#define MOD_LOOP 23
+#define MOD_DNSCACHE 24
+#define MOD_SENDQ 25
+#define MOD_POOL 26
+#define MOD_UNKNOWN 27
+#define NUM_MODS 28 /* when adding modules, don't forget intlog.c's `modnames' */
 
 /* our two higher-than-debug custom loglevels */
 #define LOG_TRACE (LOG_VIVI+1)
@@ -13,10 +13,15 @@
 
 #include <inttypes.h>
 #include <signal.h>
+#include <stdio.h>
+#include <time.h>
 
 #if HAVE_UNISTD_H
 # include <unistd.h>
 #endif
+#if HAVE_SYS_RANDOM_H
+# include <sys/random.h>
+#endif
 
 #include <platform/base_misc.h>
 
@@ -97,3 +102,42 @@ lsi_b_malloc(size_t sz, const char *file, int line, const char *func)
 		EE("malloc in %s() at %s:%d", func, file, line);
 	return r;
 }
+
+bool
+lsi_b_randbytes(void *buf, size_t n)
+{
+	unsigned char *p = buf;
+	size_t done = 0;
+#if HAVE_GETENTROPY
+	while (done < n) { /* it hands out at most 256 bytes at a time */
+		size_t c = n - done > 256 ? 256 : n - done;
+		if (getentropy(p + done, c) != 0)
+			break;
+		done += c;
+	}
+#endif
+	if (done < n) {
+		FILE *f = fopen("/dev/urandom", "rb");
+		if (f) {
+			done += fread(p + done, 1, n - done, f);
+			fclose(f);
+		}
+	}
+
+	if (done == n)
+		return true;
+
+	W("No entropy source, making do with time and addresses");
+	static uint64_t ctr;
+	uint64_t x = (uint64_t)time(NULL) ^ (uint64_t)(uintptr_t)buf
+	    ^ (uint64_t)(uintptr_t)&ctr ^ (++ctr << 32) ^ (uint64_t)clock();
+#if HAVE_UNISTD_H
+	x ^= (uint64_t)getpid() << 16;
+#endif
+	for (; done < n; done++) {
+		x ^= x >> 33; x *= 0xff51afd7ed558ccdu; x ^= x >> 33;
+		p[done] = (unsigned char)x;
+	}
+
+	return false;
+}
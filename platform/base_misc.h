@@ -6,6 +6,7 @@
 #define LIBSRSIRC_BASE_MISC_H 1
 
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -19,4 +20,9 @@ int lsi_b_optind(void);
 void lsi_b_regsig(int sig, void (*sigfn)(int));
 void *lsi_b_malloc(size_t sz, const char *file, int line, const char *func);
 
+/* fill `buf' with `n' unpredictable bytes (for seeding, not for crypto).
+ * returns false if no proper entropy source was available, in which case
+ * `buf' still gets filled, but with something weaker */
+bool lsi_b_randbytes(void *buf, size_t n);
+
 #endif /* LIBSRSIRC_BASE_MISC_H */
@@ -13,7 +13,9 @@
 
 #include <ctype.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #if HAVE_ARPA_INET_H
@@ -32,6 +34,14 @@
 # include <netinet/in.h>
 #endif
 
+#if HAVE_POLL_H
+# include <poll.h>
+#endif
+
+#if HAVE_SYS_EPOLL_H
+# include <sys/epoll.h>
+#endif
+
 #if HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif
@@ -63,6 +73,30 @@
 #endif
 
 static bool s_sslinit;
+static struct iostats s_iostats;
+
+/* there is only one kind of SSL context we use, so all connections share
+ * one, which lives as long as anybody holds a reference to it */
+static SSLCTXTYPE s_sslctx;
+static size_t s_sslctx_refs;
+
+#ifdef WITH_SSL
+/* how many servers we remember SSL sessions for */
+# define SSLSESS_MAX 32
+
+/* sessions we may resume, by server (see lsi_b_ssl_start()) */
+static struct sslsess {
+	char *key;
+	SSL_SESSION *sess;
+	uint64_t tused;
+} s_sslsess[SSLSESS_MAX];
+#endif
+
+#if HAVE_POLL
+static int s_selbackend = SELB_POLL;
+#else
+static int s_selbackend = SELB_SELECT;
+#endif
 
 #if HAVE_LIBWS2_32
 static WSADATA wsa;
@@ -80,6 +114,27 @@ static void addrstr_from_sockaddr(char *addr, size_t addrsz, uint16_t *port,
 # endif
 #endif
 static void sslinit(void);
+#ifdef WITH_SSL
+static int sslsess_new(SSL *shnd, SSL_SESSION *sess);
+static struct sslsess *sslsess_find(const char *key, bool create);
+#endif
+static int select_select(int *fds, size_t nfds, bool noresult, bool rdbl,
+    uint64_t to_us);
+#if HAVE_POLL
+static int select_poll(int *fds, size_t nfds, bool noresult, bool rdbl,
+    uint64_t to_us);
+#endif
+#if HAVE_EPOLL_CREATE1
+static int select_epoll(int *fds, size_t nfds, bool noresult, bool rdbl,
+    uint64_t to_us);
+#endif
+static int select_tout_ms(uint64_t tend, bool dopoll, bool *expired);
+
+#if !HAVE_EPOLL_CREATE1
+/* how long lsi_b_evset_wait() waits for readability at a time while some
+ * fds wait for writability (see there) */
+# define EVSET_WRPOLL_US 10000
+#endif
 
 #if HAVE_LIBWS2_32
 static bool
@@ -250,6 +305,242 @@ lsi_b_close(int sck)
 
 int
 lsi_b_select(int *fds, size_t nfds, bool noresult, bool rdbl, uint64_t to_us)
+{
+	switch (s_selbackend) {
+#if HAVE_EPOLL_CREATE1
+	case SELB_EPOLL:
+		return select_epoll(fds, nfds, noresult, rdbl, to_us);
+#endif
+#if HAVE_POLL
+	case SELB_POLL:
+		return select_poll(fds, nfds, noresult, rdbl, to_us);
+#endif
+	default:
+		return select_select(fds, nfds, noresult, rdbl, to_us);
+	}
+}
+
+bool
+lsi_b_set_selbackend(int backend)
+{
+	switch (backend) {
+	case SELB_SELECT:
+#if HAVE_SELECT || HAVE_LIBWS2_32
+		break;
+#else
+		return false;
+#endif
+	case SELB_POLL:
+#if HAVE_POLL
+		break;
+#else
+		return false;
+#endif
+	case SELB_EPOLL:
+#if HAVE_EPOLL_CREATE1
+		break;
+#else
+		return false;
+#endif
+	default:
+		return false;
+	}
+
+	D("Using select backend %d", backend);
+	s_selbackend = backend;
+	return true;
+}
+
+int
+lsi_b_get_selbackend(void)
+{
+	return s_selbackend;
+}
+
+/* compute the timeout in milliseconds for a poll()/epoll_wait() from the
+ * absolute end time `tend' (0 means none).  sets *expired if it's over */
+static int
+select_tout_ms(uint64_t tend, bool dopoll, bool *expired)
+{
+	*expired = false;
+	if (dopoll)
+		return 0;
+
+	if (!tend)
+		return -1;
+
+	uint64_t now = lsi_b_tstamp_us();
+	if (now >= tend) {
+		*expired = true;
+		return 0;
+	}
+
+	uint64_t trem_ms = (tend - now + 999) / 1000; /* round up */
+	return trem_ms > INT_MAX ? INT_MAX : (int)trem_ms;
+}
+
+#if HAVE_POLL
+static int
+select_poll(int *fds, size_t nfds, bool noresult, bool rdbl, uint64_t to_us)
+{
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	bool dopoll = to_us == 1;
+
+	struct pollfd pfdbuf[16];
+	struct pollfd *pfds = pfdbuf;
+	if (nfds > sizeof pfdbuf / sizeof *pfdbuf
+	    && !(pfds = MALLOC(nfds * sizeof *pfds)))
+		return -1;
+
+	for (size_t i = 0; i < nfds; i++) {
+		pfds[i].fd = fds[i];
+		pfds[i].events = rdbl ? POLLIN : POLLOUT;
+		pfds[i].revents = 0;
+	}
+
+	int ret;
+	for (;;) {
+		bool expired;
+		int tout = select_tout_ms(tend, dopoll, &expired);
+		if (expired) {
+			ret = 0;
+			break;
+		}
+
+		V("poll()ing %zu fd(s) for %sability%s (to: %dms)",
+		    nfds, rdbl?"read":"writ", dopoll ? " (poll)" : "", tout);
+
+		s_iostats.nselect++;
+		int r = poll(pfds, (nfds_t)nfds, tout);
+
+		if (r < 0) {
+			int e = errno;
+			EE("poll() %zu fd(s) for %c", nfds, rdbl?'r':'w');
+			ret = e == EINTR ? 0 : -1;
+			break;
+		}
+
+		if (r >= 1) {
+			if (!noresult)
+				for (size_t i = 0; i < nfds; i++)
+					if (!pfds[i].revents)
+						fds[i] = -1;
+
+			V("Polled (%d)!", r);
+			ret = r;
+			break;
+		}
+
+		if (dopoll) {
+			ret = 0;
+			break;
+		}
+
+		V("Nothing polled");
+	}
+
+	if (pfds != pfdbuf)
+		free(pfds);
+
+	return ret;
+}
+#endif
+
+#if HAVE_EPOLL_CREATE1
+/* this sets up a new epoll instance every time, which only pays off for
+ * large numbers of fds; for anything else, poll() is the better choice */
+static int
+select_epoll(int *fds, size_t nfds, bool noresult, bool rdbl, uint64_t to_us)
+{
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	bool dopoll = to_us == 1;
+
+	if (nfds > INT_MAX) {
+		E("Too many fds (%zu)", nfds);
+		return -1;
+	}
+
+	struct epoll_event evbuf[16];
+	struct epoll_event *evs = evbuf;
+	if (nfds > sizeof evbuf / sizeof *evbuf
+	    && !(evs = MALLOC(nfds * sizeof *evs)))
+		return -1;
+
+	int ret = -1;
+	int epfd = epoll_create1(EPOLL_CLOEXEC);
+	if (epfd == -1) {
+		EE("epoll_create1()");
+		goto out;
+	}
+
+	for (size_t i = 0; i < nfds; i++) {
+		struct epoll_event ev;
+		ev.events = rdbl ? EPOLLIN : EPOLLOUT;
+		ev.data.u64 = i;
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, fds[i], &ev) == -1
+		    && errno != EEXIST) {
+			EE("epoll_ctl() (fd %d)", fds[i]);
+			goto out;
+		}
+	}
+
+	for (;;) {
+		bool expired;
+		int tout = select_tout_ms(tend, dopoll, &expired);
+		if (expired) {
+			ret = 0;
+			break;
+		}
+
+		V("epoll_wait()ing %zu fd(s) for %sability%s (to: %dms)",
+		    nfds, rdbl?"read":"writ", dopoll ? " (poll)" : "", tout);
+
+		s_iostats.nselect++;
+		int r = epoll_wait(epfd, evs, (int)nfds, tout);
+
+		if (r < 0) {
+			int e = errno;
+			EE("epoll_wait() %zu fd(s) for %c", nfds, rdbl?'r':'w');
+			ret = e == EINTR ? 0 : -1;
+			break;
+		}
+
+		if (r >= 1) {
+			if (!noresult) {
+				/* flip the ready ones (fd >= 0 becomes < 0),
+				 * then flip them back and -1 the rest */
+				for (int i = 0; i < r; i++)
+					fds[evs[i].data.u64] =
+					    ~fds[evs[i].data.u64];
+				for (size_t i = 0; i < nfds; i++)
+					fds[i] = fds[i] < 0 ? ~fds[i] : -1;
+			}
+
+			V("epolled (%d)!", r);
+			ret = r;
+			break;
+		}
+
+		if (dopoll) {
+			ret = 0;
+			break;
+		}
+
+		V("Nothing epolled");
+	}
+
+out:
+	if (epfd != -1)
+		close(epfd);
+	if (evs != evbuf)
+		free(evs);
+
+	return ret;
+}
+#endif
+
+static int
+select_select(int *fds, size_t nfds, bool noresult, bool rdbl, uint64_t to_us)
 {
 	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
 	bool dopoll = to_us == 1; //mhhh.
@@ -259,6 +550,17 @@ lsi_b_select(int *fds, size_t nfds, bool noresult, bool rdbl, uint64_t to_us)
 	char dbgstr[32] = {0};
 	char dbgtmp[10] = {0};
 
+# if ! HAVE_LIBWS2_32
+	/* FD_SET()ing these would write past the end of the fd_set */
+	for (size_t i = 0; i < nfds; i++) {
+		if (fds[i] >= FD_SETSIZE) {
+			E("fd %d exceeds FD_SETSIZE (%d), can't select() it",
+			    fds[i], FD_SETSIZE);
+			return -1;
+		}
+	}
+# endif
+
 	for (;;) {
 		fd_set fdset;
 		FD_ZERO(&fdset);
@@ -286,6 +588,7 @@ lsi_b_select(int *fds, size_t nfds, bool noresult, bool rdbl, uint64_t to_us)
 		V("select()ing fd(s)%s for %sability%s (to: %"PRIu64"us)",
 		    dbgstr, rdbl?"read":"writ", dopoll ? " (poll)" : "", trem);
 
+		s_iostats.nselect++;
 		int r = select(maxfd+1, rdbl ? &fdset : NULL,
 		    rdbl ? NULL : &fdset, NULL,
 		    (tend || dopoll) ? &tout : NULL);
@@ -388,47 +691,86 @@ lsi_b_sock_ok(int sck)
 }
 
 
-/* returns: >0 on success, 0 on timeout, -1 on failure, -2 on EOF */
+/* returns: >0 on success, 0 on timeout, -1 on failure, -2 on EOF.
+ * the socket is expected to be in non-blocking mode.  we try to read first
+ * and only wait for readability if there was nothing to read, which saves
+ * a select() per read when there is a lot of input */
 long
 lsi_b_read(int sck, void *buf, size_t sz, uint64_t to_us)
 {
 	V("read()ing from sck %d (bufsz: %zu)", sck, sz);
-	int s;
 	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	uint64_t tnow, trem = 0;
 
-	do
-	    s = lsi_b_select(&sck, 1, true, true, to_us);
-	while (s == 0 && (!tend || lsi_b_tstamp_us() < tend));
-
-	if (s <= 0)
-		return s;
-
+	for (;;) {
+		s_iostats.nread++;
 #if HAVE_LIBWS2_32
-	int r = recv(sck, buf, sz, 0);
-	if (r == SOCKET_ERROR) {
-
+		int r = recv(sck, buf, sz, 0);
+		if (r == SOCKET_ERROR) {
+			bool wb = WSAGetLastError() == WSAEWOULDBLOCK;
+			bool intr = WSAGetLastError() == WSAEINTR;
 #elif HAVE_READ
-	ssize_t r = read(sck, buf, sz);
-	if (r < 0) {
+		ssize_t r = read(sck, buf, sz);
+		if (r < 0) {
+			bool wb =
+# if HAVE_EWOULDBLOCK
+			    errno == EWOULDBLOCK ||
+# endif
+# if HAVE_EAGAIN
+			    errno == EAGAIN ||
+# endif
+			    false;
+			bool intr = errno == EINTR;
 #else
 # error "We need something like read()"
 #endif
+			if (intr)
+				continue;
 
-		EE("read/recv() from sck %d (bufsz: %zu)", sck, sz);
-	} else if (r > LONG_MAX) {
-		W("read too long, capping return value");
-		r = LONG_MAX;
-	} else if (r == 0) {
-		W("read: EOF");
-	} else
-		V("Read %zu bytes", (size_t)r);
+			if (!wb) {
+				EE("read/recv() from sck %d (bufsz: %zu)",
+				    sck, sz);
+				return -1;
+			}
+
+			s_iostats.nreadwb++;
+			if (to_us == 1) { /* just polling */
+				V("Nothing to read");
+				return 0;
+			}
+
+			if (tend) {
+				tnow = lsi_b_tstamp_us();
+				if (tnow >= tend)
+					return 0;
+				trem = tend - tnow;
+			}
+
+			int s = lsi_b_select(&sck, 1, true, true, trem);
+			if (s < 0)
+				return -1;
+
+			continue;
+		}
 
-	return r == 0 ? -2L : (long)r;
+		if (r > LONG_MAX) {
+			W("read too long, capping return value");
+			r = LONG_MAX;
+		} else if (r == 0) {
+			W("read: EOF");
+		} else
+			V("Read %zu bytes", (size_t)r);
+
+		return r == 0 ? -2L : (long)r;
+	}
 }
 
 
+/* if `block' is false, give up as soon as the socket can't take any more
+ * and return how much has been sent up to then (possibly 0); otherwise wait
+ * for the socket to become writable again, until everything is sent */
 long
-lsi_b_write(int sck, const void *buf, size_t len)
+lsi_b_write(int sck, const void *buf, size_t len, bool block)
 {
 #if HAVE_SEND || HAVE_LIBWS2_32
 	int flags = 0;
@@ -439,22 +781,14 @@ lsi_b_write(int sck, const void *buf, size_t len)
 	V("send()ing %zu bytes over sck %d", len, sck);
 	while (bc < len) {
 
-		/* XXX FIXME we can get stuck here.  should query socket
-		 * state or select for read/except, i guess. taking it
-		 * out for now... */
-		// int s;
-		// while ((s = lsi_b_select(&sck, 1, true, false, 10000)) == 0)
-		//	;
-		//
-		//if (s == -1)
-		//	return -1;
-
 # if HAVE_LIBWS2_32
+		s_iostats.nwrite++;
 		int r = send(sck, (const unsigned char *)buf + bc, (int)(len - bc), flags);
 		if (r == SOCKET_ERROR) {
 			bool wb = WSAGetLastError() == WSAEWOULDBLOCK
 			       || WSAGetLastError() == WSAEINPROGRESS;
 # else
+		s_iostats.nwrite++;
 		ssize_t r = send(sck, (const unsigned char *)buf + bc, len - bc, flags);
 		if (r == -1) {
 			bool wb =
@@ -467,8 +801,15 @@ lsi_b_write(int sck, const void *buf, size_t len)
 			    false;
 # endif
 
+			if (wb && !block) {
+				V("send() would block, %zu/%zu sent", bc, len);
+				break;
+			}
+
 			if (wb) {
-				V("send() would block...");
+				V("send() would block, waiting");
+				if (lsi_b_select(&sck, 1, true, false, 0) == -1)
+					return -1;
 				continue;
 			}
 
@@ -505,6 +846,7 @@ lsi_b_read_ssl(SSLTYPE ssl, void *buf, size_t sz, uint64_t to_us)
 	int r;
 	do {
 		V("SSL_read()ing from ssl socket %p (bufsz: %zu)", (void *)ssl, sz);
+		s_iostats.nread++;
 		r = SSL_read(ssl, buf, sz);
 		if (r < 0) {
 			int errc = SSL_get_error(ssl, r);
@@ -514,6 +856,7 @@ lsi_b_read_ssl(SSLTYPE ssl, void *buf, size_t sz, uint64_t to_us)
 				bool rdbl = errc == SSL_ERROR_WANT_READ;
 				D("SSL WANT %s", rdbl ? "READ" : "WRITE");
 				int sck = SSL_get_fd(ssl);
+				s_iostats.nreadwb++;
 
 				if (tend) {
 					tnow = lsi_b_tstamp_us();
@@ -558,13 +901,16 @@ lsi_b_read_ssl(SSLTYPE ssl, void *buf, size_t sz, uint64_t to_us)
 }
 
 
+/* as lsi_b_write().  if we return early, the next call must be made with
+ * the same data (SSL_write() insists), although it may have moved */
 long
-lsi_b_write_ssl(SSLTYPE ssl, const void *buf, size_t len)
+lsi_b_write_ssl(SSLTYPE ssl, const void *buf, size_t len, bool block)
 {
 #ifdef WITH_SSL
 	size_t bc = 0;
 	while (bc < len) {
 		V("send()ing %zu bytes over ssl socket %p", len, (void *)ssl);
+		s_iostats.nwrite++;
 		int r = SSL_write(ssl, (const unsigned char *)buf + bc, len - bc);
 
 		if (r <= 0) {
@@ -573,8 +919,10 @@ lsi_b_write_ssl(SSLTYPE ssl, const void *buf, size_t len)
 			    || errc == SSL_ERROR_WANT_WRITE) {
 				bool rdbl = errc == SSL_ERROR_WANT_READ;
 				D("SSL WANT %s", rdbl ? "READ" : "WRITE");
-				int sck = SSL_get_fd(ssl);
+				if (!block)
+					break;
 
+				int sck = SSL_get_fd(ssl);
 				r = lsi_b_select(&sck, 1, true, rdbl, 0);
 				if (r <= 0)
 					return -1;
@@ -607,6 +955,299 @@ lsi_b_write_ssl(SSLTYPE ssl, const void *buf, size_t len)
 }
 
 
+/* persistent set of fds to wait for readability (and optionally, for
+ * writability) on.  with epoll, the cost of waiting depends on the number
+ * of ready fds, not the size of the set */
+struct evset {
+#if HAVE_EPOLL_CREATE1
+	int epfd;
+	struct epoll_event *evs;
+	size_t evsz;
+#else
+	int *fds;
+	int *work;
+	void **udata;
+	bool *wr;      // Also wait for writability of fds[i]?
+	size_t nwr;    // Number of true elements in `wr'
+	int *wwork;    // Scratch space for the fds in question...
+	size_t *widx;  // ...and their indices in `fds'
+#endif
+	size_t nfds;
+	size_t fdsz;
+};
+
+evset *
+lsi_b_evset_init(void)
+{
+	evset *es = MALLOC(sizeof *es);
+	if (!es)
+		return NULL;
+
+	es->nfds = es->fdsz = 0;
+#if HAVE_EPOLL_CREATE1
+	es->evs = NULL;
+	es->evsz = 0;
+	if ((es->epfd = epoll_create1(EPOLL_CLOEXEC)) == -1) {
+		EE("epoll_create1()");
+		free(es);
+		return NULL;
+	}
+#else
+	es->fds = es->work = es->wwork = NULL;
+	es->udata = NULL;
+	es->wr = NULL;
+	es->widx = NULL;
+	es->nwr = 0;
+#endif
+	return es;
+}
+
+void
+lsi_b_evset_dispose(evset *es)
+{
+	if (!es)
+		return;
+#if HAVE_EPOLL_CREATE1
+	close(es->epfd);
+	free(es->evs);
+#else
+	free(es->fds);
+	free(es->work);
+	free(es->udata);
+	free(es->wr);
+	free(es->wwork);
+	free(es->widx);
+#endif
+	free(es);
+	return;
+}
+
+bool
+lsi_b_evset_add(evset *es, int fd, void *udata)
+{
+#if HAVE_EPOLL_CREATE1
+	struct epoll_event ev;
+	ev.events = EPOLLIN;
+	ev.data.ptr = udata;
+	if (epoll_ctl(es->epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+		EE("epoll_ctl() (add fd %d)", fd);
+		return false;
+	}
+#else
+	if (es->nfds == es->fdsz) {
+		size_t nsz = es->fdsz ? es->fdsz * 2 : 16;
+		int *nfds = realloc(es->fds, nsz * sizeof *nfds);
+		if (nfds)
+			es->fds = nfds;
+		int *nwork = realloc(es->work, nsz * sizeof *nwork);
+		if (nwork)
+			es->work = nwork;
+		void **nud = realloc(es->udata, nsz * sizeof *nud);
+		if (nud)
+			es->udata = nud;
+		bool *nwr = realloc(es->wr, nsz * sizeof *nwr);
+		if (nwr)
+			es->wr = nwr;
+		int *nwwork = realloc(es->wwork, nsz * sizeof *nwwork);
+		if (nwwork)
+			es->wwork = nwwork;
+		size_t *nwidx = realloc(es->widx, nsz * sizeof *nwidx);
+		if (nwidx)
+			es->widx = nwidx;
+
+		if (!nfds || !nwork || !nud || !nwr || !nwwork || !nwidx) {
+			EE("realloc");
+			return false;
+		}
+		es->fdsz = nsz;
+	}
+
+	es->fds[es->nfds] = fd;
+	es->udata[es->nfds] = udata;
+	es->wr[es->nfds] = false;
+#endif
+	es->nfds++;
+	V("Added fd %d (now %zu)", fd, es->nfds);
+	return true;
+}
+
+bool
+lsi_b_evset_del(evset *es, int fd)
+{
+#if HAVE_EPOLL_CREATE1
+	/* closing an fd removes it from the epoll set on its own, so this
+	 * may legitimately fail if it has been closed already */
+	if (epoll_ctl(es->epfd, EPOLL_CTL_DEL, fd, NULL) == -1)
+		DE("epoll_ctl() (del fd %d)", fd);
+#else
+	size_t i = 0;
+	while (i < es->nfds && es->fds[i] != fd)
+		i++;
+
+	if (i == es->nfds) {
+		W("fd %d not in set", fd);
+		return false;
+	}
+
+	if (es->wr[i])
+		es->nwr--;
+
+	es->fds[i] = es->fds[es->nfds - 1];
+	es->udata[i] = es->udata[es->nfds - 1];
+	es->wr[i] = es->wr[es->nfds - 1];
+#endif
+	es->nfds--;
+	V("Removed fd %d (now %zu)", fd, es->nfds);
+	return true;
+}
+
+/* set whether `fd' (which must be in the set already) is to be waited for
+ * to become writable, in addition to readable */
+bool
+lsi_b_evset_mod(evset *es, int fd, void *udata, bool wr)
+{
+#if HAVE_EPOLL_CREATE1
+	struct epoll_event ev;
+	ev.events = EPOLLIN | (wr ? EPOLLOUT : 0);
+	ev.data.ptr = udata;
+	if (epoll_ctl(es->epfd, EPOLL_CTL_MOD, fd, &ev) == -1) {
+		EE("epoll_ctl() (mod fd %d)", fd);
+		return false;
+	}
+#else
+	size_t i = 0;
+	while (i < es->nfds && es->fds[i] != fd)
+		i++;
+
+	if (i == es->nfds) {
+		W("fd %d not in set", fd);
+		return false;
+	}
+
+	if (es->wr[i] != wr)
+		es->nwr += wr ? 1 : -1;
+
+	es->wr[i] = wr;
+	es->udata[i] = udata;
+#endif
+	V("fd %d: %swaiting for writability", fd, wr ? "" : "not ");
+	return true;
+}
+
+/* wait for (at most `readysz') fds to become readable (or writable, if so
+ * requested by lsi_b_evset_mod()); their udata pointers are put in `ready'.
+ * timeout semantics are as with lsi_b_select(), except that the fallback
+ * implementation may time out early while some fds wait for writability.
+ * returns number of ready fds, 0 on timeout, -1 on failure */
+int
+lsi_b_evset_wait(evset *es, void **ready, size_t readysz, uint64_t to_us)
+{
+	if (!readysz)
+		return 0;
+
+#if HAVE_EPOLL_CREATE1
+	if (readysz > INT_MAX)
+		readysz = INT_MAX;
+
+	if (es->evsz < readysz) {
+		struct epoll_event *nevs = realloc(es->evs,
+		    readysz * sizeof *nevs);
+		if (!nevs) {
+			EE("realloc");
+			return -1;
+		}
+		es->evs = nevs;
+		es->evsz = readysz;
+	}
+
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	bool expired;
+	int tout = select_tout_ms(tend, to_us == 1, &expired);
+
+	V("epoll_wait()ing %zu fd(s) (to: %dms)", es->nfds, tout);
+	s_iostats.nselect++;
+	int r = epoll_wait(es->epfd, es->evs, (int)readysz, tout);
+	if (r < 0) {
+		int e = errno;
+		EE("epoll_wait()");
+		return e == EINTR ? 0 : -1;
+	}
+
+	for (int i = 0; i < r; i++)
+		ready[i] = es->evs[i].data.ptr;
+
+	return r;
+#else
+	if (!es->nfds) {
+		/* nothing to wait for but the timeout */
+		if (to_us > 1)
+			lsi_b_usleep(to_us);
+		return 0;
+	}
+
+	/* lsi_b_select() can't wait for readability of some fds and for
+	 * writability of others at once.  so look (without waiting) which of
+	 * the latter are writable first; if none is, wait for readability,
+	 * but not for long, so we'll soon look again */
+	int nwrbl = 0;
+	size_t nw = 0;
+	if (es->nwr) {
+		for (size_t i = 0; i < es->nfds; i++)
+			if (es->wr[i]) {
+				es->wwork[nw] = es->fds[i];
+				es->widx[nw++] = i;
+			}
+
+		if ((nwrbl = lsi_b_select(es->wwork, nw, false, false, 1)) < 0)
+			return -1;
+
+		if (nwrbl)
+			to_us = 1;
+		else if (!to_us || to_us > EVSET_WRPOLL_US)
+			to_us = EVSET_WRPOLL_US;
+	}
+
+	memcpy(es->work, es->fds, es->nfds * sizeof *es->work);
+	int r = lsi_b_select(es->work, es->nfds, false, true, to_us);
+	if (r < 0)
+		return -1;
+
+	if (!nwrbl && !r)
+		return 0;
+
+	if (!r)
+		for (size_t i = 0; i < es->nfds; i++)
+			es->work[i] = -1;
+
+	for (size_t i = 0; i < nw && nwrbl; i++)
+		if (es->wwork[i] != -1)
+			es->work[es->widx[i]] = es->fds[es->widx[i]];
+
+	size_t c = 0;
+	for (size_t i = 0; i < es->nfds && c < readysz; i++)
+		if (es->work[i] != -1)
+			ready[c++] = es->udata[i];
+
+	return (int)c;
+#endif
+}
+
+
+void
+lsi_b_iostats(struct iostats *dest, bool reset)
+{
+	if (dest)
+		*dest = s_iostats;
+
+	if (reset) {
+		s_iostats.nread = s_iostats.nreadwb = 0;
+		s_iostats.nselect = s_iostats.nwrite = 0;
+		s_iostats.nsslhs = s_iostats.nsslres = 0;
+	}
+	return;
+}
+
+
 int
 lsi_b_mkaddrlist(const char *host, uint16_t port, struct addrlist **res)
 {
@@ -769,12 +1410,34 @@ lsi_b_mksslctx(void)
 	if (!s_sslinit)
 		sslinit();
 
+	if (s_sslctx) {
+		s_sslctx_refs++;
+		return s_sslctx;
+	}
+
 	SSLCTXTYPE sslctx = NULL;
 #ifdef WITH_SSL
 	sslctx = SSL_CTX_new(SSLv23_client_method());
-	if (!sslctx)
+	if (!sslctx) {
 		E("SSL_CTX_new failed");
+		return NULL;
+	}
 	SSL_CTX_set_mode(sslctx, SSL_MODE_AUTO_RETRY); /*XXX blocking IO only*/
+
+	/* a write that couldn't complete is retried from our send buffer,
+	 * which may have been realloc()ed in the meantime */
+	SSL_CTX_set_mode(sslctx, SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER
+	    | SSL_MODE_ENABLE_PARTIAL_WRITE);
+
+	/* OpenSSL's own cache is keyed by session ID, which is of no use to
+	 * a client; we keep the sessions ourselves, by server */
+	SSL_CTX_set_session_cache_mode(sslctx,
+	    SSL_SESS_CACHE_CLIENT | SSL_SESS_CACHE_NO_INTERNAL_STORE);
+	SSL_CTX_sess_set_new_cb(sslctx, sslsess_new);
+
+	s_sslctx = sslctx;
+	s_sslctx_refs = 1;
+	D("created shared SSL context");
 #else
 	E("no ssl support compiled in");
 #endif
@@ -786,6 +1449,16 @@ void
 lsi_b_freesslctx(SSLCTXTYPE sslctx)
 {
 #ifdef WITH_SSL
+	if (sslctx == s_sslctx && --s_sslctx_refs)
+		return;
+
+	if (sslctx == s_sslctx) {
+		D("last reference gone, freeing shared SSL context");
+		s_sslctx = NULL;
+	}
+
+	/* sessions made with this context remain in s_sslsess; they can be
+	 * resumed through whatever context we make next */
 	SSL_CTX_free(sslctx);
 #else
 	E("no ssl support compiled in");
@@ -795,47 +1468,119 @@ lsi_b_freesslctx(SSLCTXTYPE sslctx)
 
 
 SSLTYPE
-lsi_b_sslize(int sck, SSLCTXTYPE sslctx)
+lsi_b_sslize(int sck, SSLCTXTYPE sslctx, const char *sesskey)
 {
-	SSLTYPE shnd = NULL;
-#ifdef WITH_SSL
-	bool fail = !(shnd = SSL_new(sslctx));
-	fail = fail || !SSL_set_fd(shnd, sck);
-	if (!fail) {
-		D("calling SSL_connect()");
-		int r = SSL_connect(shnd);
-		if (r != 1) {
-			int rr = SSL_get_error(shnd, r);
-			if (rr == SSL_ERROR_SYSCALL)
-				EE("SSL_connect() failed");
-			else
-				E("SSL_connect() failed, error code %d", rr);
-		} else
-			D("SSL_connect: %d", r);
-		fail = fail || (r != 1);
+	SSLTYPE shnd = lsi_b_ssl_start(sck, sslctx, sesskey);
+	if (!shnd)
+		return NULL;
+
+	int r;
+	while ((r = lsi_b_ssl_handshake(shnd)) == 0 || r == 2)
+		if (lsi_b_select(&sck, 1, true, r == 0, 0) == -1)
+			break;
+
+	if (r != 1) {
+		lsi_b_ssl_free(shnd);
+		return NULL;
 	}
 
-	if (fail) {
+	return shnd;
+}
+
+/* `sesskey' (may be NULL) identifies the server, so that the session can be
+ * resumed the next time we connect to it */
+SSLTYPE
+lsi_b_ssl_start(int sck, SSLCTXTYPE sslctx, const char *sesskey)
+{
+	SSLTYPE shnd = NULL;
+#ifdef WITH_SSL
+	if (!(shnd = SSL_new(sslctx)) || !SSL_set_fd(shnd, sck)) {
+		E("failed to set up SSL for sck %d", sck);
 		ERR_print_errors_fp(stderr);
-		if (shnd) {
+		if (shnd)
 			SSL_free(shnd);
-			shnd = NULL;
-		}
-		return false;
+		return NULL;
 	}
 
+	if (!sesskey)
+		return shnd;
+
+	/* sslsess_new() needs to know which server a new session is for;
+	 * that may be well after the handshake (TLS 1.3 session tickets) */
+	char *key = STRDUP(sesskey);
+	if (!key)
+		return shnd; // We'll do without resumption
+
+	SSL_set_app_data(shnd, key);
+
+	struct sslsess *s = sslsess_find(key, false);
+	if (s && s->sess) {
+		D("trying to resume session for '%s'", key);
+		SSL_set_session(shnd, s->sess);
+		s->tused = lsi_b_tstamp_us();
+	}
 #else
 	E("no ssl support compiled in");
 #endif
 	return shnd;
 }
 
+/* returns 1 when done, 0 or 2 when we have to wait for the socket to become
+ * readable or writable (respectively) before calling again, -1 on failure */
+int
+lsi_b_ssl_handshake(SSLTYPE shnd)
+{
+#ifdef WITH_SSL
+	D("calling SSL_connect()");
+	int r = SSL_connect(shnd);
+	if (r == 1) {
+		s_iostats.nsslhs++;
+		if (SSL_session_reused(shnd))
+			s_iostats.nsslres++;
+
+		D("SSL_connect: %d (%s)", r,
+		    SSL_session_reused(shnd) ? "resumed" : "full handshake");
+		return 1;
+	}
+
+	int rr = SSL_get_error(shnd, r);
+	if (rr == SSL_ERROR_WANT_READ || rr == SSL_ERROR_WANT_WRITE) {
+		D("SSL WANT %s", rr == SSL_ERROR_WANT_READ ? "READ" : "WRITE");
+		return rr == SSL_ERROR_WANT_READ ? 0 : 2;
+	}
+
+	if (rr == SSL_ERROR_SYSCALL)
+		EE("SSL_connect() failed");
+	else
+		E("SSL_connect() failed, error code %d", rr);
+	ERR_print_errors_fp(stderr);
+#else
+	E("no ssl support compiled in");
+#endif
+	return -1;
+}
+
+/* for sessions which never completed the handshake, or which we don't want
+ * to shut down cleanly */
+void
+lsi_b_ssl_free(SSLTYPE shnd)
+{
+#ifdef WITH_SSL
+	free(SSL_get_app_data(shnd));
+	SSL_free(shnd);
+#else
+	E("no ssl support compiled in");
+#endif
+	return;
+}
+
 
 void
 lsi_b_sslfin(SSLTYPE shnd)
 {
 #ifdef WITH_SSL
 	SSL_shutdown(shnd);
+	free(SSL_get_app_data(shnd));
 	SSL_free(shnd);
 #else
 	E("no ssl support compiled in");
@@ -845,6 +1590,60 @@ lsi_b_sslfin(SSLTYPE shnd)
 }
 
 
+#ifdef WITH_SSL
+/* OpenSSL calls this whenever the server gave us a session we could resume
+ * later.  returning 1 means we keep the reference to `sess' */
+static int
+sslsess_new(SSL *shnd, SSL_SESSION *sess)
+{
+	const char *key = SSL_get_app_data(shnd);
+	struct sslsess *s;
+	if (!key || !(s = sslsess_find(key, true)))
+		return 0;
+
+	D("got session for '%s'", key);
+	if (s->sess)
+		SSL_SESSION_free(s->sess);
+
+	s->sess = sess;
+	s->tused = lsi_b_tstamp_us();
+	return 1;
+}
+
+/* find the session cache slot for `key'.  if there is none and `create' is
+ * true, make one (recycling the least recently used slot if need be) */
+static struct sslsess *
+sslsess_find(const char *key, bool create)
+{
+	struct sslsess *lru = &s_sslsess[0];
+	for (size_t i = 0; i < SSLSESS_MAX; i++) {
+		struct sslsess *s = &s_sslsess[i];
+		if (s->key && strcmp(s->key, key) == 0)
+			return s;
+
+		if (!s->key || (lru->key && s->tused < lru->tused))
+			lru = s;
+	}
+
+	if (!create)
+		return NULL;
+
+	char *k = STRDUP(key);
+	if (!k)
+		return NULL;
+
+	free(lru->key);
+	if (lru->sess)
+		SSL_SESSION_free(lru->sess);
+
+	lru->key = k;
+	lru->sess = NULL;
+	lru->tused = 0;
+	return lru;
+}
+#endif
+
+
 uint16_t
 lsi_b_htons(uint16_t h)
 {
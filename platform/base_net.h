@@ -26,6 +26,26 @@ struct addrlist {
 };
 
 
+/* backends for lsi_b_select() (see lsi_b_set_selbackend()) */
+#define SELB_SELECT 0
+#define SELB_POLL 1
+#define SELB_EPOLL 2
+
+/* process-wide I/O syscall counters (see lsi_b_iostats()) */
+struct iostats {
+	uint64_t nread; /* read()/recv()/SSL_read() calls */
+	uint64_t nreadwb; /* ...of which found nothing to read */
+	uint64_t nselect; /* select()/poll()/epoll_wait() calls */
+	uint64_t nwrite; /* send()/SSL_write() calls */
+	uint64_t nsslhs; /* completed SSL handshakes */
+	uint64_t nsslres; /* ...of which resumed a previous session */
+};
+
+
+/* persistent set of fds to wait on (see lsi_b_evset_*()) */
+typedef struct evset evset;
+
+
 #ifdef WITH_SSL
 typedef SSL *SSLTYPE;
 typedef SSL_CTX *SSLCTXTYPE;
@@ -41,16 +61,27 @@ bool lsi_b_bind(int sck, const char *addr, uint16_t port, bool ipv6);
 int lsi_b_close(int sck);
 int lsi_b_select(int *fds, size_t nfds, bool noresult, bool rdbl,
     uint64_t to_us);
+bool lsi_b_set_selbackend(int backend);
+int lsi_b_get_selbackend(void);
 
 bool lsi_b_blocking(int sck, bool blocking);
 bool lsi_b_sock_ok(int sck);
 
 long lsi_b_read(int sck, void *buf, size_t sz, uint64_t to_us);
-long lsi_b_write(int sck, const void *buf, size_t len);
+long lsi_b_write(int sck, const void *buf, size_t len, bool block);
 
 bool lsi_b_have_ssl(void);
 long lsi_b_read_ssl(SSLTYPE ssl, void *buf, size_t sz, uint64_t to_us);
-long lsi_b_write_ssl(SSLTYPE ssl, const void *buf, size_t len);
+long lsi_b_write_ssl(SSLTYPE ssl, const void *buf, size_t len, bool block);
+
+evset *lsi_b_evset_init(void);
+void lsi_b_evset_dispose(evset *es);
+bool lsi_b_evset_add(evset *es, int fd, void *udata);
+bool lsi_b_evset_del(evset *es, int fd);
+bool lsi_b_evset_mod(evset *es, int fd, void *udata, bool wr);
+int lsi_b_evset_wait(evset *es, void **ready, size_t readysz, uint64_t to_us);
+
+void lsi_b_iostats(struct iostats *dest, bool reset);
 
 int lsi_b_mkaddrlist(const char *host, uint16_t port, struct addrlist **res);
 void lsi_b_freeaddrlist(struct addrlist *al);
@@ -58,7 +89,10 @@ void lsi_b_freeaddrlist(struct addrlist *al);
 SSLCTXTYPE lsi_b_mksslctx(void);
 void lsi_b_freesslctx(SSLCTXTYPE sslctx);
 
-SSLTYPE lsi_b_sslize(int sck, SSLCTXTYPE sslctx);
+SSLTYPE lsi_b_sslize(int sck, SSLCTXTYPE sslctx, const char *sesskey);
+SSLTYPE lsi_b_ssl_start(int sck, SSLCTXTYPE sslctx, const char *sesskey);
+int lsi_b_ssl_handshake(SSLTYPE shnd);
+void lsi_b_ssl_free(SSLTYPE shnd);
 void lsi_b_sslfin(SSLTYPE shnd);
 
 uint16_t lsi_b_htons(uint16_t h);
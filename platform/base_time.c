@@ -18,6 +18,9 @@
 #if HAVE_SYS_TIME_H
 # include <sys/time.h>
 #endif
+#if HAVE_CLOCK_GETTIME
+# include <time.h>
+#endif
 
 #include <logger/intlog.h>
 
@@ -42,6 +45,22 @@ lsi_b_tstamp_us(void)
 #endif
 }
 
+uint64_t
+lsi_b_tstamp_ns(void)
+{
+#if HAVE_CLOCK_GETTIME && defined(CLOCK_MONOTONIC)
+	struct timespec t;
+	if (clock_gettime(CLOCK_MONOTONIC, &t) != 0) {
+		EE("clock_gettime");
+		return 0;
+	}
+
+	return (uint64_t)t.tv_sec * 1000000000u + (uint64_t)t.tv_nsec;
+#else
+	return lsi_b_tstamp_us() * 1000u;
+#endif
+}
+
 #if HAVE_GETTIMEOFDAY
 static void
 com_tconv(struct timeval *tv, uint64_t *ts, bool tv_to_ts)
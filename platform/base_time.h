@@ -8,5 +8,9 @@
 
 uint64_t lsi_b_tstamp_us(void);
 
+/* monotonic, in nanoseconds, from an arbitrary starting point; meant for
+ * measuring short intervals */
+uint64_t lsi_b_tstamp_ns(void);
+
 
 #endif /* LIBSRSIRC_BASE_TIME_H */
@@ -0,0 +1,23 @@
+#!/bin/sh
+
+# Run all benchmarks in unittests/ (bench_*), passing along any arguments
+# (i.e. `scripts/runbench.sh bench_iodelim` runs just that one)
+
+set -e
+
+cd unittests
+for f in bench_*; do
+	if [ ! -x "$f" -o ! -f "$f" ]; then
+		continue
+	fi
+
+	if [ $# -gt 0 ]; then
+		case " $* " in
+			*" $f "*) ;;
+			*) continue ;;
+		esac
+	fi
+
+	echo "=== $f ==="
+	./${f}
+done
@@ -97,7 +97,12 @@ icat_core_run(void)
 			}
 		}
 
-		if (!ignoreuser) {
+		/* don't take more from the user than we can queue; they'll
+		 * have to wait (i.e. block on writing to us) until the
+		 * server has taken some of it off the send queue */
+		bool holduser = ignoreuser || icat_serv_sendq_full();
+
+		if (!holduser) {
 			if (icat_user_canread()) {
 				size_t olen = icat_user_readline(ln, sizeof ln);
 				I("From user: '%s'", ln);
@@ -165,7 +170,7 @@ icat_core_run(void)
 			size_t fdc = 1;
 			int fds[2];
 			fds[0] = icat_serv_fd();
-			if (!ignoreuser) {
+			if (!holduser) {
 				fds[1] = icat_user_fd();
 				fdc++;
 			}
@@ -263,8 +268,10 @@ handle_usermsg(char *lnbuf)
 static void
 dump_info(void)
 {
-	fprintf(stderr, "icat: %sline; read %uln wrote %uln\n",
-	    icat_serv_online()?"on":"off", s_readcnt, s_writecnt);
+	fprintf(stderr, "icat: %sline; read %uln wrote %uln; "
+	    "sendq %zuln/%zub\n", icat_serv_online()?"on":"off",
+	    s_readcnt, s_writecnt, icat_serv_sendq_len(),
+	    icat_serv_sendq_bytes());
 	icat_serv_dump();
 	return;
 }
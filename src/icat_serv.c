@@ -30,17 +30,11 @@
 #include "icat_serv.h"
 
 
-struct outline_s {
-	char *line;
-	struct outline_s *next;
-};
-
-
 static irc *s_irc;
 static bool s_on;
-static struct outline_s *s_outQ;
+static size_t s_unsent;    // What irc_sendq_len() said last time we looked
+static size_t s_quitafter; // While >0, this many lines go out before QUIT
 static uint64_t s_nexthb;
-static uint64_t s_nextsend;
 static uint64_t s_quitat;
 static int s_casemap = CMAP_RFC1459;
 static bool s_gotpong;
@@ -49,7 +43,7 @@ static bool s_gotpong;
 static bool handle_PING(irc *irchnd, tokarr *tok, size_t nargs, bool pre);
 static bool handle_PONG(irc *irchnd, tokarr *tok, size_t nargs, bool pre);
 static bool handle_005(irc *irchnd, tokarr *tok, size_t nargs, bool pre);
-static int process_sendq(void);
+static void account_sent(void);
 static bool do_heartbeat(void);
 static bool to_srv(const char *line);
 static bool tryconnect(struct srvlist_s *s);
@@ -70,6 +64,9 @@ icat_serv_init(void)
 	irc_set_fname(s_irc, g_sett.fname);
 	irc_set_conflags(s_irc, g_sett.conflags);
 	irc_set_connect_timeout(s_irc, g_sett.cto_soft_us, g_sett.cto_hard_us);
+	/* `freelines' lines (but at least one) may go out at once */
+	irc_set_floodctl(s_irc, g_sett.linedelay, 0,
+	    (g_sett.freelines ? g_sett.freelines - 1 : 0) * g_sett.linedelay);
 	if (g_sett.pxtype != -1)
 		irc_set_px(s_irc, g_sett.pxhost, g_sett.pxport, g_sett.pxtype);
 	if (g_sett.pass[0])
@@ -147,11 +144,13 @@ icat_serv_operate(void)
 		return s_on = true; //return here so we can determine logon fail
 	}
 
-	if (process_sendq() == -1) {
-		E("process_sendq() failed");
-		return false;
+	if (irc_sendq_run(s_irc) == -1) {
+		E("irc_sendq_run() failed");
+		return s_on = false;
 	}
 
+	account_sent();
+
 	if (!do_heartbeat()) {
 		E("do_heartbeat() failed");
 		return false;
@@ -200,24 +199,18 @@ icat_serv_printf(const char *fmt, ...)
 	int r = vsnprintf(buf, sizeof buf, fmt, l);
 	va_end(l);
 
-	struct outline_s *ptr = s_outQ;
-
-	if (!ptr) {
-		if (!(ptr = s_outQ = MALLOC(sizeof *s_outQ)))
-			CE("malloc failed");
-	} else {
-		while (ptr->next)
-			ptr = ptr->next;
-		if (!(ptr->next = MALLOC(sizeof *ptr->next)))
-			CE("malloc failed");
-		ptr = ptr->next;
+	/* a single lane, as lines must go out in the order we got them */
+	D("Queueing line '%s'", buf);
+	if (!irc_sendq(s_irc, buf, SENDQ_NORMAL)) {
+		E("irc_sendq() failed on '%s'", buf);
+		return r;
 	}
 
-	ptr->next = NULL;
-	if (!(ptr->line = STRDUP(buf)))
-		CE("strdup failed");
+	s_unsent++;
+	if (!s_quitafter && lsi_b_strncasecmp(buf, "QUIT", 4) == 0)
+		s_quitafter = s_unsent;
 
-	D("Queued line '%s'", buf);
+	account_sent();
 	return r;
 }
 
@@ -248,12 +241,34 @@ icat_serv_attention_at(void)
 	if (g_sett.hbeat_us)
 		attat = s_nexthb;
 
-	if (s_outQ && (!attat || s_nextsend < attat))
-		attat = s_nextsend;
+	uint64_t in_us = irc_sendq_next(s_irc);
+	if (in_us) {
+		uint64_t sendat = lsi_b_tstamp_us() + in_us;
+		if (!attat || sendat < attat)
+			attat = sendat;
+	}
 
 	return attat;
 }
 
+bool
+icat_serv_sendq_full(void)
+{
+	return irc_sendq_full(s_irc);
+}
+
+size_t
+icat_serv_sendq_len(void)
+{
+	return irc_sendq_len(s_irc);
+}
+
+size_t
+icat_serv_sendq_bytes(void)
+{
+	return irc_sendq_bytes(s_irc);
+}
+
 void
 icat_serv_dump(void)
 {
@@ -291,36 +306,28 @@ handle_005(irc *irchnd, tokarr *tok, size_t nargs, bool pre)
 	return true;
 }
 
-static int
-process_sendq(void)
+/* see what the send queue got rid of since we last looked, in order to
+ * notice when our QUIT has been sent */
+static void
+account_sent(void)
 {
-	if (!s_outQ)
-		return 0;
-
-	if (g_sett.freelines > 0 || s_nextsend <= lsi_b_tstamp_us()) {
-		D("SendQ time");
-		struct outline_s *ptr = s_outQ;
-		if (!to_srv(ptr->line)) {
-			s_on = false;
-			return -1;
-		}
-		s_outQ = s_outQ->next;
-		if (lsi_b_strncasecmp(ptr->line, "QUIT", 4) == 0) {
-			I("QUIT seen, forcing d/c in %"PRIu64" seconds",
-			    g_sett.waitquit_us / 1000000u);
-			s_quitat = lsi_b_tstamp_us();
-		}
+	size_t left = irc_sendq_len(s_irc);
+	size_t sent = s_unsent - left;
+	s_unsent = left;
 
-		free(ptr->line);
-		free(ptr);
-		if (g_sett.freelines)
-			g_sett.freelines--;
-		s_nextsend = lsi_b_tstamp_us() + g_sett.linedelay;
+	if (!s_quitafter)
+		return;
 
-		return 1;
+	if (sent < s_quitafter) {
+		s_quitafter -= sent;
+		return;
 	}
 
-	return 0;
+	s_quitafter = 0;
+	I("QUIT sent, forcing d/c in %"PRIu64" seconds",
+	    g_sett.waitquit_us / 1000000u);
+	s_quitat = lsi_b_tstamp_us();
+	return;
 }
 
 static bool
@@ -8,6 +8,7 @@
 
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include <libsrsirc/defs.h>
@@ -27,6 +28,9 @@ bool icat_serv_online(void);
 int icat_serv_casemap(void);
 uint64_t icat_serv_sentquit(void);
 uint64_t icat_serv_attention_at(void);
+bool icat_serv_sendq_full(void);
+size_t icat_serv_sendq_len(void);
+size_t icat_serv_sendq_bytes(void);
 
 void icat_serv_dump(void);
 
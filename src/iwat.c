@@ -27,6 +27,7 @@
 #include <logger/intlog.h>
 
 #include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_msgb.h>
 #include <libsrsirc/irc_track.h>
 #include <libsrsirc/util.h>
 
@@ -59,6 +60,7 @@ static bool g_dumpplx = 0;
 
 
 
+static bool isend(const char *cmd, const char *param, const char *trail);
 static bool tryconnect(void);
 static void process_args(int *argc, char ***argv, struct settings_s *sett);
 static void init(int *argc, char ***argv, struct settings_s *sett);
@@ -79,6 +81,22 @@ iprintf(const char *fmt, ...)
 	return !irc_write(g_irc, buf) ? -1 : r;
 }
 
+/* send "cmd [param] :trail", straight into the send buffer (a part that
+ * would produce a malformed line makes the whole thing fail) */
+static bool
+isend(const char *cmd, const char *param, const char *trail)
+{
+	irc_msgb *mb = irc_msgb_start(g_irc);
+	if (!mb)
+		return false;
+
+	irc_msgb_cmd(mb, cmd);
+	if (param)
+		irc_msgb_param(mb, param);
+	irc_msgb_trail(mb, trail);
+	return irc_msgb_send(mb);
+}
+
 static bool
 tryconnect(void)
 {
@@ -377,12 +395,12 @@ main(int argc, char **argv)
 			continue;
 
 		if (strcmp(tok[1], "PING") == 0)
-			iprintf("PONG :%s\r\n", tok[2]);
+			isend("PONG", NULL, tok[2]);
 		else if (strcmp(tok[1], "PRIVMSG") == 0) {
 			if (strncmp(tok[3], "ECHO ", 5) == 0) {
 				char nick[64];
 				lsi_ut_ident2nick(nick, sizeof nick, tok[0]);
-				iprintf("PRIVMSG %s :%s\r\n", nick, tok[3]+5);
+				isend("PRIVMSG", nick, tok[3]+5);
 			} else if (strncmp(tok[3], "DO ", 3) == 0) {
 				iprintf("%s\r\n", tok[3]+3);
 			} else if (strcmp(tok[3], "DIE") == 0) {
@@ -0,0 +1,226 @@
+/* bench_dispatch.c - benchmark protocol message dispatch (msg.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/util.h>
+
+#include "intdefs.h"
+#include "msg.h"
+
+/* Usage: bench_dispatch [trafficfile]
+ * `trafficfile' holds server-to-client IRC lines as seen in a busy channel
+ * (one per line, like a raw log).  If none is given, a made-up stream with
+ * a typical mix of (mostly) PRIVMSGs, JOINs, PARTs, QUITs etc. is used.
+ *
+ * The lines are dispatched to the same set of handlers a context with
+ * tracking enabled has registered (plus a few user handlers); the handlers
+ * merely count calls, so what we measure is the cost of finding them.  This
+ * is compared to the linear scan over all handler slots that was used before
+ * the dispatch index existed. */
+
+#define DEF_NLINES 4096
+#define MIN_DISPATCHED 4000000u
+
+
+static const char *s_samples[] = {
+	":nick!~user@host.example.org PRIVMSG #channel :hello there",
+	":other!~o@o.example.com PRIVMSG #channel :hi nick",
+	"@time=2024-04-28T12:34:56.789Z;account=someone :someone!~s@gateway/"
+	    "web/x PRIVMSG #channel :a somewhat longer message",
+	":nick!~user@host.example.org PRIVMSG #channel :\001ACTION waves\001",
+	":third!t@t.example.net PRIVMSG #channel :lol",
+	":ChanServ!ChanServ@services. NOTICE #channel :announcement",
+	":other!~o@o.example.com JOIN #channel",
+	":someone!~s@1.2.3.4 PART #channel :bye",
+	":someone!~s@1.2.3.4 QUIT :*.net *.split",
+	":op!~op@op.example.org MODE #channel +o other",
+	":nick!~user@host.example.org NICK :nick_",
+	":nick!~user@host.example.org PRIVMSG #channel :another line",
+	":bot!~bot@bot.example.org PRIVMSG #channel :[url] some title",
+	"PING :irc.example.org",
+	":irc.example.org 352 me #channel ~u h.example irc.example.org u H :0 U",
+	":someone!~s@gateway/web/x AWAY :gone",
+	":other!~o@o.example.com PRIVMSG #channel :one more",
+};
+
+/* the commands handlers are registered for, and by whom */
+static const struct {
+	const char *cmd;
+	const char *module;
+} s_hnds[] = {
+	{ "PING", "core" }, { "432", "core" }, { "433", "core" },
+	{ "436", "core" }, { "437", "core" }, { "464", "core" },
+	{ "NICK", "core" }, { "ERROR", "core" }, { "MODE", "core" },
+	{ "001", "core" }, { "002", "core" }, { "003", "core" },
+	{ "004", "core" }, { "383", "core" }, { "484", "core" },
+	{ "465", "core" }, { "466", "core" }, { "005", "core" },
+	{ "670", "v3" }, { "691", "v3" }, { "903", "v3" }, { "902", "v3" },
+	{ "904", "v3" }, { "905", "v3" }, { "908", "v3" }, { "CAP", "v3" },
+	{ "AUTHENTICATE", "v3" },
+	{ "JOIN", "track" }, { "311", "track" }, { "332", "track" },
+	{ "333", "track" }, { "353", "track" }, { "352", "track" },
+	{ "366", "track" }, { "PART", "track" }, { "QUIT", "track" },
+	{ "NICK", "track" }, { "KICK", "track" }, { "MODE", "track" },
+	{ "PRIVMSG", "track" }, { "NOTICE", "track" }, { "324", "track" },
+	{ "TOPIC", "track" },
+};
+
+static size_t s_ncalls;
+
+
+static uint16_t
+count_hnd(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	s_ncalls++;
+	return 0;
+}
+
+static bool
+count_uhnd(irc *ctx, tokarr *msg, size_t nargs, bool pre)
+{
+	s_ncalls++;
+	return true;
+}
+
+/* the way lsi_msg_handle() used to find handlers */
+static void
+linear_uhnd(irc *ctx, tokarr *msg, size_t ac, bool pre)
+{
+	size_t hcnt = pre ? ctx->uprehnds_cnt : ctx->uposthnds_cnt;
+	struct umsghnd *harr = pre ? ctx->uprehnds : ctx->uposthnds;
+
+	for (size_t i = 0; i < hcnt; i++)
+		if (harr[i].cmd[0] && strcmp((*msg)[1], harr[i].cmd) == 0)
+			harr[i].hndfn(ctx, msg, ac, pre);
+	return;
+}
+
+static void
+linear_handle(irc *ctx, tokarr *msg)
+{
+	size_t ac = 2;
+	while (ac < COUNTOF(*msg) && (*msg)[ac])
+		ac++;
+
+	linear_uhnd(ctx, msg, ac, true);
+	for (size_t i = 0; i < ctx->msghnds_cnt; i++)
+		if (ctx->msghnds[i].cmd[0]
+		    && strcmp((*msg)[1], ctx->msghnds[i].cmd) == 0)
+			ctx->msghnds[i].hndfn(ctx, msg, ac, false);
+	linear_uhnd(ctx, msg, ac, false);
+	return;
+}
+
+/* read (or make up) the traffic and tokenize it; returns number of lines */
+static size_t
+load_traffic(const char *fn, tokarr **msgs)
+{
+	FILE *f = NULL;
+	if (fn && !(f = fopen(fn, "r"))) {
+		fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+		return 0;
+	}
+
+	size_t cap = DEF_NLINES, n = 0;
+	if (!(*msgs = malloc(cap * sizeof **msgs)))
+		return 0;
+
+	char line[1024];
+	size_t nsamp = sizeof s_samples / sizeof *s_samples;
+	for (;;) {
+		if (f) {
+			if (!fgets(line, sizeof line, f))
+				break;
+			line[strcspn(line, "\r\n")] = '\0';
+		} else {
+			if (n == DEF_NLINES)
+				break;
+			/* PRIVMSGs dominate; mix the samples unevenly */
+			strcpy(line, s_samples[(n * 7 + n / 5) % nsamp]);
+		}
+
+		char *buf;
+		if (!line[0] || !(buf = strdup(line)))
+			continue;
+
+		if (n == cap && !(*msgs = realloc(*msgs, (cap *= 2) * sizeof **msgs)))
+			return 0;
+
+		if (!lsi_ut_tokenize(buf, &(*msgs)[n]) || !(*msgs)[n][1]) {
+			free(buf);
+			continue;
+		}
+
+		n++;
+	}
+
+	if (f)
+		fclose(f);
+
+	return n;
+}
+
+int
+main(int argc, char **argv)
+{
+	tokarr *msgs;
+	size_t nmsgs = load_traffic(argc > 1 ? argv[1] : NULL, &msgs);
+	irc *ctx = irc_init();
+	if (!nmsgs || !ctx)
+		return EXIT_FAILURE;
+
+	bool fail = false;
+	for (size_t i = 0; i < sizeof s_hnds / sizeof *s_hnds; i++)
+		fail = fail || !lsi_msg_reghnd(ctx, s_hnds[i].cmd, count_hnd,
+		    s_hnds[i].module);
+	fail = fail || !lsi_msg_reguhnd(ctx, "PRIVMSG", count_uhnd, true);
+	fail = fail || !lsi_msg_reguhnd(ctx, "PING", count_uhnd, true);
+	fail = fail || !lsi_msg_reguhnd(ctx, "JOIN", count_uhnd, false);
+	if (fail)
+		return EXIT_FAILURE;
+
+	size_t reps = MIN_DISPATCHED / nmsgs + 1;
+	printf("%zu %s lines, %zu repetitions\n",
+	    nmsgs, argc > 1 ? "recorded" : "synthetic", reps);
+
+	s_ncalls = 0;
+	for (size_t j = 0; j < nmsgs; j++)
+		linear_handle(ctx, &msgs[j]);
+	size_t ref = s_ncalls;
+
+	s_ncalls = 0;
+	for (size_t j = 0; j < nmsgs; j++)
+		lsi_msg_handle(ctx, &msgs[j], false);
+	if (s_ncalls != ref) {
+		fprintf(stderr, "handler call count mismatch (%zu vs %zu)!\n",
+		    s_ncalls, ref);
+		return EXIT_FAILURE;
+	}
+
+	uint64_t t0 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		for (size_t j = 0; j < nmsgs; j++)
+			linear_handle(ctx, &msgs[j]);
+	uint64_t t1 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		for (size_t j = 0; j < nmsgs; j++)
+			lsi_msg_handle(ctx, &msgs[j], false);
+	uint64_t t2 = lsi_b_tstamp_us();
+
+	printf("%-20s %8.1f ns/msg\n", "linear scan:",
+	    (t1 - t0) * 1000.0 / (reps * nmsgs));
+	printf("%-20s %8.1f ns/msg\n", "dispatch index:",
+	    (t2 - t1) * 1000.0 / (reps * nmsgs));
+
+	printf("(checksum %zu)\n", s_ncalls);
+	irc_dispose(ctx);
+	return EXIT_SUCCESS;
+}
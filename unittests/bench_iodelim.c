@@ -0,0 +1,177 @@
+/* bench_iodelim.c - benchmark line delimiter scanning (io.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include "io.h"
+
+/* Usage: bench_iodelim [trafficfile [chunksize]]
+ * `trafficfile' is a recording of raw server-to-client IRC traffic (i.e. what
+ * you'd get from something like `socat -v` or a packet capture).  If none is
+ * given, some made-up traffic with a realistic mix of line lengths is used. */
+
+#define DEF_TRAFFIC_SZ (8u*1024*1024)
+#define DEF_CHUNK_SZ 64
+#define MIN_BYTES_SCANNED (256u*1024*1024)
+
+
+static const char *s_samples[] = {
+	":nick!~user@host.example.org PRIVMSG #channel :hello there\r\n",
+	":irc.example.org 353 me = #channel :@op +voice nick1 nick2 nick3 "
+	    "nick4 nick5 nick6 nick7 nick8 nick9 nick10 nick11 nick12 nick13 "
+	    "nick14 nick15 nick16 nick17 nick18 nick19 nick20 nick21 nick22 "
+	    "nick23 nick24 nick25 nick26 nick27 nick28 nick29 nick30\r\n",
+	":someone!~s@1.2.3.4 QUIT :*.net *.split\r\n",
+	"@time=2024-04-28T12:34:56.789Z;account=someone;msgid=AbCdEfGhIjKl "
+	    ":someone!~s@gateway/web/x PRIVMSG #channel :a somewhat longer "
+	    "message, as you'd see it with server-time and account-tag "
+	    "enabled; those add quite a few bytes to every line\r\n",
+	"PING :irc.example.org\r\n",
+	":other!~o@o.example.com JOIN #channel\r\n",
+};
+
+
+/* the way find_delim() used to do it */
+static char *
+naive_delim(char *ptr, char *end)
+{
+	for (; ptr < end; ptr++)
+		if (*ptr == '\r' || *ptr == '\n')
+			return ptr;
+	return NULL;
+}
+
+static char *
+load_traffic(const char *fn, size_t *len)
+{
+	char *buf;
+	if (fn) {
+		FILE *f = fopen(fn, "rb");
+		if (!f) {
+			fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+			return NULL;
+		}
+
+		size_t cap = 1024*1024;
+		*len = 0;
+		buf = malloc(cap);
+		size_t n;
+		while (buf && (n = fread(buf + *len, 1, cap - *len, f)) > 0)
+			if ((*len += n) == cap)
+				buf = realloc(buf, cap *= 2);
+		fclose(f);
+		return buf;
+	}
+
+	if (!(buf = malloc(DEF_TRAFFIC_SZ)))
+		return NULL;
+
+	size_t nsamp = sizeof s_samples / sizeof *s_samples;
+	size_t i = 0;
+	*len = 0;
+	for (;;) {
+		const char *s = s_samples[i++ % nsamp];
+		size_t l = strlen(s);
+		if (*len + l > DEF_TRAFFIC_SZ)
+			break;
+		memcpy(buf + *len, s, l);
+		*len += l;
+	}
+
+	return buf;
+}
+
+/* scan through the whole buffer line by line, like the reader does when a
+ * big read() brought in many lines at once.  returns number of lines */
+static size_t
+scan_lines(char *buf, size_t len, char *(*fn)(char *, char *))
+{
+	char *end = buf + len;
+	size_t nl = 0;
+	char *d;
+	while ((d = fn(buf, end))) {
+		buf = d + 1;
+		nl++;
+	}
+	return nl;
+}
+
+/* simulate the data trickling in `chunk' bytes at a time; `remember' tells
+ * whether we rescan from the start of the line after each chunk (the old way)
+ * or continue where we left off.  returns number of lines */
+static size_t
+scan_chunked(char *buf, size_t len, size_t chunk, bool remember,
+    char *(*fn)(char *, char *))
+{
+	char *wptr = buf, *sptr = buf, *eptr = buf, *end = buf + len;
+	size_t nl = 0;
+	while (eptr < end) {
+		eptr = (size_t)(end - eptr) < chunk ? end : eptr + chunk;
+
+		char *d;
+		while ((d = fn(remember ? sptr : wptr, eptr))) {
+			wptr = sptr = d + 1;
+			nl++;
+		}
+		sptr = eptr;
+	}
+	return nl;
+}
+
+static void
+report(const char *what, uint64_t us, size_t bytes)
+{
+	printf("%-34s %8.3f ns/byte  %8.1f MiB/s\n", what,
+	    us * 1000.0 / bytes, bytes / (us / 1000000.0) / (1024*1024));
+	return;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t len;
+	char *buf = load_traffic(argc > 1 ? argv[1] : NULL, &len);
+	size_t chunk = argc > 2 ? strtoul(argv[2], NULL, 10) : DEF_CHUNK_SZ;
+	if (!buf || !len || !chunk)
+		return EXIT_FAILURE;
+
+	size_t reps = MIN_BYTES_SCANNED / len + 1;
+	printf("%zu bytes of %s traffic, %zu repetitions, chunk size %zu\n",
+	    len, argc > 1 ? "recorded" : "synthetic", reps, chunk);
+
+	size_t ref = scan_lines(buf, len, naive_delim);
+	if (scan_lines(buf, len, lsi_io_scan_delim) != ref
+	    || scan_chunked(buf, len, chunk, true, lsi_io_scan_delim) != ref) {
+		fprintf(stderr, "line count mismatch!\n");
+		return EXIT_FAILURE;
+	}
+
+	uint64_t t0 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		ref += scan_lines(buf, len, naive_delim);
+	uint64_t t1 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		ref += scan_lines(buf, len, lsi_io_scan_delim);
+	uint64_t t2 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		ref += scan_chunked(buf, len, chunk, false, naive_delim);
+	uint64_t t3 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		ref += scan_chunked(buf, len, chunk, true, lsi_io_scan_delim);
+	uint64_t t4 = lsi_b_tstamp_us();
+
+	report("bytewise, whole lines:", t1 - t0, len * reps);
+	report("lsi_io_scan_delim, whole lines:", t2 - t1, len * reps);
+	report("bytewise, chunked, rescanning:", t3 - t2, len * reps);
+	report("lsi_io_scan_delim, chunked:", t4 - t3, len * reps);
+
+	printf("(checksum %zu)\n", ref);
+	free(buf);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,198 @@
+/* bench_msgv.c - benchmark eager tokenization against the lazy message view
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include <libsrsirc/irc_msgv.h>
+#include <libsrsirc/util.h>
+
+#include "common.h"
+
+/* Usage: bench_msgv [trafficfile]
+ * `trafficfile' holds server-to-client IRC lines (one per line, like a raw
+ * log); if none is given, a made-up mix is used.
+ *
+ * The consumer we model is a bot that looks at the command of every
+ * message, but only at the arguments of PRIVMSGs addressed to it (which
+ * none of the sample lines are; it checks the target).  With lsi_ut_tokenize()
+ * every line is fully split; with the view, only the target of PRIVMSGs is.
+ * Before timing, the view's tokarr is checked to be identical to what
+ * lsi_ut_tokenize() produces for every line. */
+
+#define DEF_NLINES 4096
+#define MIN_PARSED 4000000u
+
+
+static const char *s_samples[] = {
+	":nick!~user@host.example.org PRIVMSG #channel :hello there",
+	":other!~o@o.example.com PRIVMSG #channel :hi nick",
+	":nick!~user@host.example.org PRIVMSG #channel :\001ACTION waves\001",
+	":ChanServ!ChanServ@services. NOTICE #channel :announcement",
+	":other!~o@o.example.com JOIN #channel",
+	":someone!~s@1.2.3.4 PART #channel :bye",
+	":someone!~s@1.2.3.4 QUIT :*.net *.split",
+	":op!~op@op.example.org MODE #channel +oov other nick third",
+	":irc.example.org 352 me #channel ~u h.example irc.example.org u H :0 U",
+	":irc.example.org 353 me = #channel :@op +voiced nick other someone a b",
+	":irc.example.org 005 me A B C D E F G H I J K L M N O P Q R S :are "
+	    "supported by this server",
+	"PING :irc.example.org",
+	":nick!~user@host.example.org PRIVMSG #channel :  spaced   out  ",
+	"CMD a  b   c",
+};
+
+static size_t s_nhits;
+
+
+static size_t
+load_traffic(const char *fn, char ***lines)
+{
+	FILE *f = NULL;
+	if (fn && !(f = fopen(fn, "r"))) {
+		fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+		return 0;
+	}
+
+	size_t cap = DEF_NLINES, n = 0;
+	if (!(*lines = malloc(cap * sizeof **lines)))
+		return 0;
+
+	char line[1024];
+	size_t nsamp = sizeof s_samples / sizeof *s_samples;
+	for (;;) {
+		if (f) {
+			if (!fgets(line, sizeof line, f))
+				break;
+			line[strcspn(line, "\r\n")] = '\0';
+		} else {
+			if (n == DEF_NLINES)
+				break;
+			strcpy(line, s_samples[(n * 7 + n / 5) % nsamp]);
+		}
+
+		if (!line[0] || line[0] == ' ' || line[0] == '@')
+			continue;
+
+		if (n == cap && !(*lines = realloc(*lines,
+		    (cap *= 2) * sizeof **lines)))
+			return 0;
+
+		if (!((*lines)[n] = strdup(line)))
+			return 0;
+		n++;
+	}
+
+	if (f)
+		fclose(f);
+
+	return n;
+}
+
+static bool
+check(char *const *lines, size_t n)
+{
+	char a[1024], b[1024];
+	for (size_t i = 0; i < n; i++) {
+		strcpy(a, lines[i]);
+		strcpy(b, lines[i]);
+
+		tokarr eager;
+		irc_msgv mv;
+		bool okeager = lsi_ut_tokenize(a, &eager);
+		bool oklazy = irc_msgv_parse(&mv, b);
+		if (okeager != oklazy)
+			goto mismatch;
+		if (!okeager)
+			continue;
+
+		/* split a bit first, so that resuming gets checked too */
+		irc_msgv_arg(&mv, i % 4);
+		tokarr *lazy = irc_msgv_tokarr(&mv);
+		for (size_t j = 0; j < COUNTOF(eager); j++) {
+			if (!eager[j] != !(*lazy)[j])
+				goto mismatch;
+			if (eager[j] && strcmp(eager[j], (*lazy)[j]) != 0)
+				goto mismatch;
+		}
+
+		continue;
+mismatch:
+		fprintf(stderr, "tokenization mismatch for '%s'\n", lines[i]);
+		return false;
+	}
+
+	return true;
+}
+
+static void
+run_eager(char *const *lines, size_t n, char *buf)
+{
+	for (size_t i = 0; i < n; i++) {
+		strcpy(buf, lines[i]);
+		tokarr tok;
+		if (!lsi_ut_tokenize(buf, &tok))
+			continue;
+
+		if (strcmp(tok[1], "PRIVMSG") == 0 && tok[2]
+		    && strcmp(tok[2], "mybot") == 0)
+			s_nhits++;
+	}
+	return;
+}
+
+static void
+run_lazy(char *const *lines, size_t n, char *buf)
+{
+	for (size_t i = 0; i < n; i++) {
+		strcpy(buf, lines[i]);
+		irc_msgv mv;
+		if (!irc_msgv_parse(&mv, buf))
+			continue;
+
+		const char *tgt;
+		if (strcmp(irc_msgv_cmd(&mv), "PRIVMSG") == 0
+		    && (tgt = irc_msgv_arg(&mv, 0)) && strcmp(tgt, "mybot") == 0)
+			s_nhits++;
+	}
+	return;
+}
+
+int
+main(int argc, char **argv)
+{
+	char **lines;
+	size_t nlines = load_traffic(argc > 1 ? argv[1] : NULL, &lines);
+	if (!nlines || !check(lines, nlines))
+		return EXIT_FAILURE;
+
+	size_t reps = MIN_PARSED / nlines + 1;
+	printf("%zu %s lines, %zu repetitions\n",
+	    nlines, argc > 1 ? "recorded" : "synthetic", reps);
+
+	/* both variants copy the line first, as the receive buffer
+	 * is consumed in place, too */
+	char buf[1024];
+	uint64_t t0 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		run_eager(lines, nlines, buf);
+	uint64_t t1 = lsi_b_tstamp_us();
+	for (size_t i = 0; i < reps; i++)
+		run_lazy(lines, nlines, buf);
+	uint64_t t2 = lsi_b_tstamp_us();
+
+	printf("%-20s %8.1f ns/msg\n", "lsi_ut_tokenize:",
+	    (t1 - t0) * 1000.0 / (reps * nlines));
+	printf("%-20s %8.1f ns/msg\n", "irc_msgv:",
+	    (t2 - t1) * 1000.0 / (reps * nlines));
+
+	printf("(checksum %zu)\n", s_nhits);
+	for (size_t i = 0; i < nlines; i++)
+		free(lines[i]);
+	free(lines);
+	return EXIT_SUCCESS;
+}
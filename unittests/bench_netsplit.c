@@ -0,0 +1,253 @@
+/* bench_netsplit.c - benchmark dropping and renaming tracked users (ucbase.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include <libsrsirc/irc.h>
+
+#include "intdefs.h"
+#include "skmap.h"
+#include "ucbase.h"
+
+/* Usage: bench_netsplit [nusers [nchans [chansperuser]]]
+ * Defaults are 10000 users, 2000 channels and 5 channels per user, which is
+ * roughly what a bot idling in a lot of channels on a big network sees.
+ *
+ * The tracking state is set up twice, identically.  On the first copy,
+ * every user gets renamed (like a NICK each) and is then dropped (like
+ * the QUIT each of them sends in a netsplit) the way ucbase used to do
+ * it, i.e. by looking at every channel we know.  On the second copy the
+ * same happens through lsi_ucb_rename_user() and lsi_ucb_drop_user(),
+ * which only visit the user's own channels.  Before timing, a small setup
+ * is put through both and the remaining memberships are compared. */
+
+#define DEF_NUSERS 10000
+#define DEF_NCHANS 2000
+#define DEF_CPU 5
+
+
+static size_t s_nusers = DEF_NUSERS;
+static size_t s_nchans = DEF_NCHANS;
+static size_t s_cpu = DEF_CPU;
+
+
+/* lsi_ucb_rename_user() as it used to be */
+static bool
+old_rename(irc *ctx, const char *nick, const char *newnick)
+{
+	user *u = lsi_ucb_get_user(ctx, nick, true);
+	char *nn;
+	if (!u || !(nn = lsi_arena_strdup(ctx->strs, newnick)))
+		return false;
+
+	if (!lsi_skmap_put(ctx->users, newnick, u))
+		return lsi_arena_strfree(ctx->strs, nn), false;
+
+	lsi_skmap_del(ctx->users, nick);
+
+	void *e;
+	if (lsi_skmap_first(ctx->chans, NULL, &e))
+		do {
+			chan *c = e;
+			memb *m = lsi_skmap_get(c->memb, nick);
+			if (!m)
+				continue;
+
+			if (!lsi_skmap_put(c->memb, newnick, m))
+				return lsi_arena_strfree(ctx->strs, nn), false;
+
+			lsi_skmap_del(c->memb, nick);
+		} while (lsi_skmap_next(ctx->chans, NULL, &e));
+
+	lsi_arena_strfree(ctx->strs, u->nick);
+	u->nick = nn;
+	return true;
+}
+
+/* lsi_ucb_drop_user() as it used to be */
+static bool
+old_drop(irc *ctx, user *u)
+{
+	if (!lsi_skmap_del(ctx->users, u->nick))
+		return false;
+
+	void *e;
+	if (lsi_skmap_first(ctx->chans, NULL, &e))
+		do {
+			lsi_ucb_drop_memb(ctx, e, u, false, false);
+		} while (lsi_skmap_next(ctx->chans, NULL, &e));
+
+	lsi_arena_strfree(ctx->strs, u->nick);
+	lsi_arena_strfree(ctx->strs, u->uname);
+	lsi_arena_strfree(ctx->strs, u->host);
+	lsi_arena_strfree(ctx->strs, u->fname);
+	lsi_pool_put(ctx->upool, u);
+	return true;
+}
+
+static irc *
+setup(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx || !lsi_ucb_init(ctx))
+		return NULL;
+
+	char name[128];
+	for (size_t i = 0; i < s_nchans; i++) {
+		snprintf(name, sizeof name, "#chan%zu", i);
+		if (!lsi_ucb_add_chan(ctx, name))
+			return NULL;
+	}
+
+	uint32_t rnd = 12345;
+	for (size_t i = 0; i < s_nusers; i++) {
+		snprintf(name, sizeof name, "user%zu!~u%zu@host%zu.example.org",
+		    i, i, i % 97);
+		user *u = lsi_ucb_add_user(ctx, name);
+		if (!u)
+			return NULL;
+
+		for (size_t j = 0; j < s_cpu; j++) {
+			rnd = rnd * 1103515245 + 12345;
+			snprintf(name, sizeof name, "#chan%zu",
+			    (size_t)(rnd >> 8) % s_nchans);
+			chan *c = lsi_ucb_get_chan(ctx, name, false);
+			if (!lsi_ucb_get_memb(ctx, c, u->nick, false)
+			    && !lsi_ucb_add_memb(ctx, c, u, j % 4 ? "" : "@"))
+				return NULL;
+		}
+	}
+
+	return ctx;
+}
+
+static void
+teardown(irc *ctx)
+{
+	lsi_ucb_deinit(ctx);
+	irc_dispose(ctx);
+	return;
+}
+
+/* rename all users, then drop every other one */
+static bool
+churn(irc *ctx, bool old)
+{
+	char nick[64], newnick[64];
+	for (size_t i = 0; i < s_nusers; i++) {
+		snprintf(nick, sizeof nick, "user%zu", i);
+		snprintf(newnick, sizeof newnick, "renamed%zu", i);
+		if (!(old ? old_rename(ctx, nick, newnick)
+		    : lsi_ucb_rename_user(ctx, nick, newnick, NULL)))
+			return false;
+	}
+
+	for (size_t i = 0; i < s_nusers; i += 2) {
+		snprintf(nick, sizeof nick, "renamed%zu", i);
+		user *u = lsi_ucb_get_user(ctx, nick, false);
+		if (!u || !(old ? old_drop(ctx, u) : lsi_ucb_drop_user(ctx, u)))
+			return false;
+	}
+
+	return true;
+}
+
+/* both ways are supposed to leave the same memberships behind */
+static bool
+check(void)
+{
+	irc *ctx[2] = { setup(), setup() };
+	if (!ctx[0] || !ctx[1] || !churn(ctx[0], true) || !churn(ctx[1], false))
+		return false;
+
+	if (lsi_ucb_num_users(ctx[0]) != lsi_ucb_num_users(ctx[1]))
+		goto mismatch;
+
+	for (chan *c = lsi_ucb_first_chan(ctx[0]); c;
+	    c = lsi_ucb_next_chan(ctx[0])) {
+		chan *c2 = lsi_ucb_get_chan(ctx[1], c->name, false);
+		if (!c2 || lsi_ucb_num_memb(ctx[0], c)
+		    != lsi_ucb_num_memb(ctx[1], c2))
+			goto mismatch;
+
+		for (memb *m = lsi_ucb_first_memb(ctx[0], c); m;
+		    m = lsi_ucb_next_memb(ctx[0], c)) {
+			memb *m2 = lsi_ucb_get_memb(ctx[1], c2, m->u->nick,
+			    false);
+			if (!m2 || m2->c != c2 || strcmp(m->modepfx, m2->modepfx))
+				goto mismatch;
+		}
+	}
+
+	teardown(ctx[0]);
+	teardown(ctx[1]);
+	return true;
+
+mismatch:
+	fprintf(stderr, "old and new way disagree!\n");
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	if (argc > 1)
+		s_nusers = strtoul(argv[1], NULL, 10);
+	if (argc > 2)
+		s_nchans = strtoul(argv[2], NULL, 10);
+	if (argc > 3)
+		s_cpu = strtoul(argv[3], NULL, 10);
+
+	if (!s_nusers || !s_nchans || !s_cpu)
+		return EXIT_FAILURE;
+
+	size_t nusers = s_nusers, nchans = s_nchans;
+	s_nusers = 500, s_nchans = 100;
+	bool ok = check();
+	s_nusers = nusers, s_nchans = nchans;
+	if (!ok)
+		return EXIT_FAILURE;
+
+	printf("%zu users, %zu channels, up to %zu channels per user\n",
+	    s_nusers, s_nchans, s_cpu);
+
+	double t[2][2];
+	for (size_t i = 0; i < 2; i++) {
+		irc *ctx = setup();
+		if (!ctx)
+			return EXIT_FAILURE;
+
+		char nick[64], newnick[64];
+		uint64_t t0 = lsi_b_tstamp_us();
+		for (size_t j = 0; j < s_nusers; j++) {
+			snprintf(nick, sizeof nick, "user%zu", j);
+			snprintf(newnick, sizeof newnick, "renamed%zu", j);
+			if (!(i == 0 ? old_rename(ctx, nick, newnick)
+			    : lsi_ucb_rename_user(ctx, nick, newnick, NULL)))
+				return EXIT_FAILURE;
+		}
+		uint64_t t1 = lsi_b_tstamp_us();
+		for (size_t j = 0; j < s_nusers; j++) {
+			snprintf(nick, sizeof nick, "renamed%zu", j);
+			user *u = lsi_ucb_get_user(ctx, nick, false);
+			if (!u || !(i == 0 ? old_drop(ctx, u)
+			    : lsi_ucb_drop_user(ctx, u)))
+				return EXIT_FAILURE;
+		}
+		uint64_t t2 = lsi_b_tstamp_us();
+
+		t[i][0] = (t1 - t0) * 1000.0 / s_nusers;
+		t[i][1] = (t2 - t1) * 1000.0 / s_nusers;
+		teardown(ctx);
+	}
+
+	printf("%-12s %14s %14s\n", "ns/user", "all channels", "backlinks");
+	printf("%-12s %14.1f %14.1f\n", "NICK", t[0][0], t[1][0]);
+	printf("%-12s %14.1f %14.1f\n", "QUIT", t[0][1], t[1][1]);
+	return EXIT_SUCCESS;
+}
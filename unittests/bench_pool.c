@@ -0,0 +1,223 @@
+/* bench_pool.c - benchmark the record pools and string arena (pool.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include "pool.h"
+
+/* Usage: bench_pool [nusers [rounds]]
+ * Models what tracking allocates for a netjoin of `nusers' users (default
+ * 20000): per user a record of the size of ucbase's `user', a nick, a
+ * username and a host, and a membership record.  Then half of them quit,
+ * the same number join again, and finally everything goes away the way
+ * it does on disconnect.  This is done `rounds' (default 20) times with
+ * malloc()/strdup()/free(), and with pools plus arena, where disconnect
+ * is a bulk release.  Before timing, the arena is fed a mix of sizes and
+ * checked for overlapping allocations. */
+
+#define DEF_NUSERS 20000
+#define DEF_ROUNDS 20
+
+/* about what ucbase's records take on LP64 */
+#define USER_SZ 72
+#define MEMB_SZ 40
+
+
+struct rec {
+	void *user, *memb;
+	char *nick, *uname, *host;
+};
+
+static char (*s_nicks)[32], (*s_unames)[16], (*s_hosts)[64];
+static size_t s_sum;
+
+
+static void
+mkstrings(size_t n)
+{
+	uint32_t rnd = 4711;
+	for (size_t i = 0; i < n; i++) {
+		rnd = rnd * 1103515245 + 12345;
+		snprintf(s_nicks[i], sizeof *s_nicks, "%.*s%zu",
+		    (int)(rnd >> 16) % 9 + 1, "nicknamesz", i);
+		snprintf(s_unames[i], sizeof *s_unames, "~u%zu", i % 1000);
+		snprintf(s_hosts[i], sizeof *s_hosts, "%zx.%s.example.org",
+		    (size_t)rnd, i % 3 ? "dsl" : "users.irc");
+	}
+	return;
+}
+
+static bool
+join_malloc(struct rec *r, size_t i)
+{
+	r->user = malloc(USER_SZ);
+	r->memb = malloc(MEMB_SZ);
+	r->nick = strdup(s_nicks[i]);
+	r->uname = strdup(s_unames[i]);
+	r->host = strdup(s_hosts[i]);
+	return r->user && r->memb && r->nick && r->uname && r->host;
+}
+
+static void
+quit_malloc(struct rec *r)
+{
+	s_sum += r->nick[0];
+	free(r->user);
+	free(r->memb);
+	free(r->nick);
+	free(r->uname);
+	free(r->host);
+	return;
+}
+
+static bool
+join_pool(pool *up, pool *mp, arena *a, struct rec *r, size_t i)
+{
+	r->user = lsi_pool_get(up);
+	r->memb = lsi_pool_get(mp);
+	r->nick = lsi_arena_strdup(a, s_nicks[i]);
+	r->uname = lsi_arena_strdup(a, s_unames[i]);
+	r->host = lsi_arena_strdup(a, s_hosts[i]);
+	return r->user && r->memb && r->nick && r->uname && r->host;
+}
+
+static void
+quit_pool(pool *up, pool *mp, arena *a, struct rec *r)
+{
+	s_sum += r->nick[0];
+	lsi_pool_put(up, r->user);
+	lsi_pool_put(mp, r->memb);
+	lsi_arena_strfree(a, r->nick);
+	lsi_arena_strfree(a, r->uname);
+	lsi_arena_strfree(a, r->host);
+	return;
+}
+
+/* fill allocations of many sizes with a pattern, free some, allocate
+ * again, and see that no pattern got clobbered */
+static bool
+check(void)
+{
+	enum { NALLOC = 5000 };
+	static unsigned char *p[NALLOC];
+	static size_t sz[NALLOC];
+	arena *a = lsi_arena_init();
+	if (!a)
+		return false;
+
+	uint32_t rnd = 42;
+	for (size_t round = 0; round < 3; round++) {
+		for (size_t i = 0; i < NALLOC; i++) {
+			if (p[i])
+				continue;
+			rnd = rnd * 1103515245 + 12345;
+			sz[i] = (rnd >> 16) % 300 + 1;
+			if (!(p[i] = lsi_arena_alloc(a, sz[i])))
+				return false;
+			if ((uintptr_t)p[i] % sizeof (void *))
+				goto broken;
+			memset(p[i], (int)(i & 0xff), sz[i]);
+		}
+
+		for (size_t i = 0; i < NALLOC; i++) {
+			for (size_t j = 0; j < sz[i]; j++)
+				if (p[i][j] != (i & 0xff))
+					goto broken;
+			if ((i + round) % 3 == 0) {
+				lsi_arena_free(a, p[i]);
+				p[i] = NULL;
+			}
+		}
+	}
+
+	lsi_arena_dispose(a);
+	return true;
+
+broken:
+	fprintf(stderr, "arena handed out overlapping or misaligned memory!\n");
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	size_t n = argc > 1 ? strtoul(argv[1], NULL, 10) : DEF_NUSERS;
+	size_t rounds = argc > 2 ? strtoul(argv[2], NULL, 10) : DEF_ROUNDS;
+	s_nicks = malloc(n * sizeof *s_nicks);
+	s_unames = malloc(n * sizeof *s_unames);
+	s_hosts = malloc(n * sizeof *s_hosts);
+	struct rec *recs = malloc(n * sizeof *recs);
+	pool *up = lsi_pool_init(USER_SZ, 256);
+	pool *mp = lsi_pool_init(MEMB_SZ, 512);
+	arena *a = lsi_arena_init();
+	if (!n || !s_nicks || !s_unames || !s_hosts || !recs || !up || !mp
+	    || !a || !check())
+		return EXIT_FAILURE;
+
+	mkstrings(n);
+	printf("%zu users, %zu rounds\n", n, rounds);
+
+	double t[2][3] = { { 0 } };
+	for (size_t r = 0; r < rounds; r++) {
+		uint64_t t0 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			if (!join_malloc(&recs[i], i))
+				return EXIT_FAILURE;
+		uint64_t t1 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i += 2)
+			quit_malloc(&recs[i]);
+		for (size_t i = 0; i < n; i += 2)
+			if (!join_malloc(&recs[i], n - 1 - i))
+				return EXIT_FAILURE;
+		uint64_t t2 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			quit_malloc(&recs[i]);
+		uint64_t t3 = lsi_b_tstamp_us();
+		t[0][0] += t1 - t0; t[0][1] += t2 - t1; t[0][2] += t3 - t2;
+
+		t0 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			if (!join_pool(up, mp, a, &recs[i], i))
+				return EXIT_FAILURE;
+		t1 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i += 2)
+			quit_pool(up, mp, a, &recs[i]);
+		for (size_t i = 0; i < n; i += 2)
+			if (!join_pool(up, mp, a, &recs[i], n - 1 - i))
+				return EXIT_FAILURE;
+		t2 = lsi_b_tstamp_us();
+		if (r == 0) {
+			size_t nchunks, nlive, nfree, nbytes;
+			lsi_pool_stat(up, &nchunks, &nlive, &nfree, &nbytes);
+			printf("user pool: %zu chunks (%zu bytes), %zu live, "
+			    "%zu free\n", nchunks, nbytes, nlive, nfree);
+		}
+		lsi_pool_clear(up);
+		lsi_pool_clear(mp);
+		lsi_arena_clear(a);
+		t3 = lsi_b_tstamp_us();
+		t[1][0] += t1 - t0; t[1][1] += t2 - t1; t[1][2] += t3 - t2;
+	}
+
+	static const char *what[] = { "netjoin", "churn", "disconnect" };
+	printf("%-12s %12s %12s\n", "ns/user", "malloc", "pool");
+	for (size_t i = 0; i < 3; i++)
+		printf("%-12s %12.1f %12.1f\n", what[i],
+		    t[0][i] * 1000.0 / (rounds * n),
+		    t[1][i] * 1000.0 / (rounds * n));
+
+	printf("(checksum %zu)\n", s_sum);
+	lsi_pool_dispose(up);
+	lsi_pool_dispose(mp);
+	lsi_arena_dispose(a);
+	free(recs);
+	free(s_nicks);
+	free(s_unames);
+	free(s_hosts);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,127 @@
+/* bench_select.c - benchmark lsi_b_select() backends
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <inttypes.h>
+#include <stdint.h>
+
+#include <sys/resource.h>
+#include <sys/select.h>
+#include <unistd.h>
+
+#include <platform/base_net.h>
+#include <platform/base_time.h>
+
+/* Usage: bench_select
+ * For 10, 1000 and 10000 watched descriptors, measure how long it takes
+ * lsi_b_select() to report one (the highest-numbered) of them readable, with
+ * each of the available backends.  All but one of the descriptors are dup()s
+ * of a pipe that never becomes readable, so we don't need twice as many fds */
+
+#define MAX_WATCHED 10000
+#define WAKEUPS_PER_RUN 200000u
+
+
+static const char *s_bename[] = { "select", "poll", "epoll" };
+
+
+static bool
+raise_fd_limit(size_t need)
+{
+	struct rlimit rl;
+	if (getrlimit(RLIMIT_NOFILE, &rl) != 0)
+		return false;
+
+	if (rl.rlim_cur >= need)
+		return true;
+
+	if (rl.rlim_max != RLIM_INFINITY && rl.rlim_max < need)
+		rl.rlim_cur = rl.rlim_max;
+	else
+		rl.rlim_cur = need;
+
+	return setrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur >= need;
+}
+
+int
+main(void)
+{
+	static const size_t counts[] = { 10, 1000, MAX_WATCHED };
+	static int fds[MAX_WATCHED];
+	static int work[MAX_WATCHED];
+	int idle[2], act[2];
+
+	if (!raise_fd_limit(MAX_WATCHED + 16))
+		fprintf(stderr, "Couldn't raise fd limit, expect failures\n");
+
+	if (pipe(idle) != 0 || pipe(act) != 0) {
+		perror("pipe");
+		return EXIT_FAILURE;
+	}
+
+	for (size_t c = 0; c < sizeof counts / sizeof *counts; c++) {
+		size_t n = counts[c];
+		size_t nfds = 0;
+		for (; nfds < n - 1; nfds++)
+			if ((fds[nfds] = dup(idle[0])) == -1)
+				break;
+
+		/* we want the active one to be the highest-numbered fd */
+		int actfd = dup(act[0]);
+		if (nfds < n - 1 || actfd == -1) {
+			fprintf(stderr, "Out of fds at %zu\n", nfds);
+			return EXIT_FAILURE;
+		}
+		fds[nfds++] = actfd;
+
+		size_t iters = WAKEUPS_PER_RUN / n + 10;
+		for (int be = SELB_SELECT; be <= SELB_EPOLL; be++) {
+			if (!lsi_b_set_selbackend(be)) {
+				printf("%6zu fds, %-6s: not available\n",
+				    n, s_bename[be]);
+				continue;
+			}
+
+			if (be == SELB_SELECT && actfd >= FD_SETSIZE) {
+				printf("%6zu fds, %-6s: fd %d >= FD_SETSIZE\n",
+				    n, s_bename[be], actfd);
+				continue;
+			}
+
+			uint64_t tot = 0;
+			bool fail = false;
+			for (size_t i = 0; i < iters && !fail; i++) {
+				char b = 0;
+				if (write(act[1], &b, 1) != 1) {
+					fail = true;
+					break;
+				}
+
+				memcpy(work, fds, nfds * sizeof *fds);
+				uint64_t t0 = lsi_b_tstamp_us();
+				int r = lsi_b_select(work, nfds, false, true, 0);
+				tot += lsi_b_tstamp_us() - t0;
+
+				if (r != 1 || work[nfds-1] != actfd
+				    || work[0] != -1)
+					fail = true;
+
+				if (read(act[0], &b, 1) != 1)
+					fail = true;
+			}
+
+			if (fail)
+				printf("%6zu fds, %-6s: FAILED\n", n, s_bename[be]);
+			else
+				printf("%6zu fds, %-6s: %10.2f us/wakeup\n",
+				    n, s_bename[be], (double)tot / iters);
+		}
+
+		for (size_t i = 0; i < nfds; i++)
+			close(fds[i]);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,318 @@
+/* bench_skmap.c - benchmark the string-keyed hashmap (skmap.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include <libsrsirc/defs.h>
+
+#include "bucklist.h"
+#include "cmap.h"
+#include "skmap.h"
+
+/* Usage: bench_skmap [nicklist]
+ * `nicklist' holds one nickname per line (e.g. extracted from a big NAMES
+ * reply or a WHO dump); if none is given, 50000 made-up ones are used.
+ *
+ * Every nick is put into a map, looked up, looked up again with a suffix
+ * appended (a miss), and finally deleted, with both skmap and the fixed-size
+ * chained map it replaced (4096 buckets of bucklists, 16-bit hash, which is
+ * how the user map used to be set up).  Before timing, both maps are put
+ * through the same sequence of operations and compared. */
+
+#define DEF_NNICKS 50000
+#define OLD_BSZ 4096
+#define MIN_OPS 2000000u
+
+
+/* the map skmap used to be */
+struct oldmap {
+	bucklist *buck[OLD_BSZ];
+	const uint8_t *cmap;
+};
+
+static size_t s_sum;
+
+
+static size_t
+strhash_mid(const char *s, const uint8_t *cmap)
+{
+	uint8_t res[2] = { 0xaa, 0xaa };
+	uint8_t cur;
+	unsigned shift = 0;
+	bool first = true;
+
+	while ((cur = cmap[(uint8_t)*s++]))
+		res[first = !first] ^= cur << (++shift % 3);
+
+	return (res[0] << 8) | res[1];
+}
+
+static bool
+old_put(struct oldmap *m, const char *key, void *val)
+{
+	bucklist **kl = &m->buck[strhash_mid(key, m->cmap) % OLD_BSZ];
+	if (!*kl && !(*kl = lsi_bucklist_init(m->cmap)))
+		return false;
+
+	if (lsi_bucklist_find(*kl, key, NULL))
+		return lsi_bucklist_replace(*kl, key, val);
+
+	char *kd = strdup(key);
+	return kd && lsi_bucklist_insert(*kl, 0, kd, val);
+}
+
+static void *
+old_get(struct oldmap *m, const char *key)
+{
+	bucklist *kl = m->buck[strhash_mid(key, m->cmap) % OLD_BSZ];
+	return kl ? lsi_bucklist_find(kl, key, NULL) : NULL;
+}
+
+static void *
+old_del(struct oldmap *m, const char *key)
+{
+	bucklist *kl = m->buck[strhash_mid(key, m->cmap) % OLD_BSZ];
+	char *okey;
+	void *e;
+	if (!kl || !(e = lsi_bucklist_remove(kl, key, &okey)))
+		return NULL;
+
+	free(okey);
+	return e;
+}
+
+static void
+old_stat(struct oldmap *m, double *avglen, size_t *maxlen)
+{
+	size_t used = 0, sum = 0;
+	*maxlen = 0;
+	for (size_t i = 0; i < OLD_BSZ; i++) {
+		size_t c = m->buck[i] ? lsi_bucklist_count(m->buck[i]) : 0;
+		if (!c)
+			continue;
+		used++;
+		sum += c;
+		if (c > *maxlen)
+			*maxlen = c;
+	}
+
+	*avglen = used ? (double)sum / used : 0;
+	return;
+}
+
+static size_t
+load_nicks(const char *fn, char ***nicks, char ***misses)
+{
+	FILE *f = NULL;
+	if (fn && !(f = fopen(fn, "r"))) {
+		fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+		return 0;
+	}
+
+	size_t cap = DEF_NNICKS, n = 0;
+	if (!(*nicks = malloc(cap * sizeof **nicks)))
+		return 0;
+
+	char line[256];
+	uint32_t rnd = 12345;
+	for (;;) {
+		if (f) {
+			if (!fgets(line, sizeof line, f))
+				break;
+			line[strcspn(line, "\r\n \t")] = '\0';
+		} else {
+			if (n == DEF_NNICKS)
+				break;
+			/* a mix of Guest12345-style and wordy nicks */
+			rnd = rnd * 1103515245 + 12345;
+			if (n % 3 == 0)
+				snprintf(line, sizeof line, "Guest%zu", n);
+			else {
+				size_t len = 4 + (rnd >> 16) % 8;
+				for (size_t i = 0; i < len; i++) {
+					rnd = rnd * 1103515245 + 12345;
+					line[i] = "abcdefghijklmnopqrstuvwxyz"
+					    "_[]{}|`^0123456789"[(rnd >> 16) % 44];
+				}
+				snprintf(line + len, sizeof line - len, "%zu", n);
+			}
+		}
+
+		if (!line[0])
+			continue;
+
+		if (n == cap && !(*nicks = realloc(*nicks,
+		    (cap *= 2) * sizeof **nicks)))
+			return 0;
+
+		if (!((*nicks)[n] = strdup(line)))
+			return 0;
+		n++;
+	}
+
+	if (f)
+		fclose(f);
+
+	if (!(*misses = malloc(n * sizeof **misses)))
+		return 0;
+
+	for (size_t i = 0; i < n; i++) {
+		snprintf(line, sizeof line, "%s~", (*nicks)[i]);
+		if (!((*misses)[i] = strdup(line)))
+			return 0;
+	}
+
+	return n;
+}
+
+/* same operations on both maps, same results expected */
+static bool
+check(char **nicks, size_t n)
+{
+	skmap *m = lsi_skmap_init(16, CMAP_RFC1459);
+	struct oldmap *om = calloc(1, sizeof *om);
+	if (!m || !om)
+		return false;
+	om->cmap = g_cmap[CMAP_RFC1459];
+
+	for (size_t i = 0; i < n; i++)
+		if (!lsi_skmap_put(m, nicks[i], nicks[i])
+		    || !old_put(om, nicks[i], nicks[i]))
+			return false;
+
+	for (size_t i = 0; i < n; i += 2)
+		if (lsi_skmap_del(m, nicks[i]) != old_del(om, nicks[i]))
+			goto mismatch;
+
+	for (size_t i = 0; i < n; i++)
+		if (lsi_skmap_get(m, nicks[i]) != old_get(om, nicks[i]))
+			goto mismatch;
+
+	/* drop every third remaining item while iterating */
+	size_t seen = 0, cnt = lsi_skmap_count(m);
+	char *key;
+	void *val;
+	if (lsi_skmap_first(m, &key, &val))
+		do {
+			if (val != old_get(om, key))
+				goto mismatch;
+			if (seen++ % 3 == 0) {
+				old_del(om, key);
+				lsi_skmap_del_iter(m);
+			}
+		} while (lsi_skmap_next(m, &key, &val));
+
+	if (seen != cnt)
+		goto mismatch;
+
+	for (size_t i = 0; i < n; i++)
+		if (lsi_skmap_get(m, nicks[i]) != old_get(om, nicks[i]))
+			goto mismatch;
+
+	for (size_t i = 0; i < n; i++)
+		old_del(om, nicks[i]);
+	for (size_t i = 0; i < OLD_BSZ; i++)
+		lsi_bucklist_dispose(om->buck[i]);
+	free(om);
+	lsi_skmap_dispose(m);
+	return true;
+
+mismatch:
+	fprintf(stderr, "skmap and reference disagree!\n");
+	return false;
+}
+
+int
+main(int argc, char **argv)
+{
+	char **nicks, **misses;
+	size_t n = load_nicks(argc > 1 ? argv[1] : NULL, &nicks, &misses);
+	if (!n || !check(nicks, n))
+		return EXIT_FAILURE;
+
+	size_t reps = MIN_OPS / n + 1;
+	printf("%zu %s nicks, %zu repetitions\n",
+	    n, argc > 1 ? "listed" : "synthetic", reps);
+
+	double t[2][4] = { { 0 } };
+	for (size_t r = 0; r < reps; r++) {
+		struct oldmap *om = calloc(1, sizeof *om);
+		skmap *m = lsi_skmap_init(1024, CMAP_RFC1459);
+		if (!om || !m)
+			return EXIT_FAILURE;
+		om->cmap = g_cmap[CMAP_RFC1459];
+
+		uint64_t t0 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			old_put(om, nicks[i], nicks[i]);
+		uint64_t t1 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			s_sum += old_get(om, nicks[i]) != NULL;
+		uint64_t t2 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			s_sum += old_get(om, misses[i]) != NULL;
+		uint64_t t3 = lsi_b_tstamp_us();
+		t[0][0] += t1 - t0; t[0][1] += t2 - t1; t[0][2] += t3 - t2;
+
+		size_t maxlen = 0;
+		double avglen = 0;
+		if (r == 0)
+			old_stat(om, &avglen, &maxlen);
+
+		t3 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			old_del(om, nicks[i]);
+		uint64_t t4 = lsi_b_tstamp_us();
+		t[0][3] += t4 - t3;
+
+		t0 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			lsi_skmap_put(m, nicks[i], nicks[i]);
+		t1 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			s_sum += lsi_skmap_get(m, nicks[i]) != NULL;
+		t2 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			s_sum += lsi_skmap_get(m, misses[i]) != NULL;
+		t3 = lsi_b_tstamp_us();
+		t[1][0] += t1 - t0; t[1][1] += t2 - t1; t[1][2] += t3 - t2;
+
+		if (r == 0) {
+			size_t nslots, nused, nitems, maxprobe;
+			double loadfac, avgprobe;
+			printf("chained: %d buckets, avg chain len %.2f, "
+			    "max chain len %zu\n", OLD_BSZ, avglen, maxlen);
+			lsi_skmap_stat(m, &nslots, &nused, &nitems, &loadfac,
+			    &avgprobe, &maxprobe);
+			printf("skmap:   %zu slots, load factor %.2f, "
+			    "avg probe len %.2f, max probe len %zu\n",
+			    nslots, loadfac, avgprobe, maxprobe);
+		}
+
+		t3 = lsi_b_tstamp_us();
+		for (size_t i = 0; i < n; i++)
+			lsi_skmap_del(m, nicks[i]);
+		t4 = lsi_b_tstamp_us();
+		t[1][3] += t4 - t3;
+
+		for (size_t i = 0; i < OLD_BSZ; i++)
+			lsi_bucklist_dispose(om->buck[i]);
+		free(om);
+		lsi_skmap_dispose(m);
+	}
+
+	static const char *what[] = { "put", "get (hit)", "get (miss)", "del" };
+	printf("%-12s %12s %12s\n", "ns/op", "chained", "skmap");
+	for (size_t i = 0; i < 4; i++)
+		printf("%-12s %12.1f %12.1f\n", what[i],
+		    t[0][i] * 1000.0 / (reps * n),
+		    t[1][i] * 1000.0 / (reps * n));
+
+	printf("(checksum %zu)\n", s_sum);
+	return EXIT_SUCCESS;
+}
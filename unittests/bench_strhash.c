@@ -0,0 +1,304 @@
+/* bench_strhash.c - collisions, distribution and speed of skmap's hash
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <platform/base_time.h>
+
+#include <libsrsirc/defs.h>
+
+#include "cmap.h"
+#include "common.h"
+#include "skmap.h"
+
+/* Usage: bench_strhash [nicklist]
+ * `nicklist' holds one nickname per line; real ones (e.g. from a WHO dump
+ * of a big network) are best.  If none is given, 50000 made-up ones are
+ * used.
+ *
+ * Compared are the 16-bit xor fold skmap used when it had 4096 buckets,
+ * the unkeyed 64-bit FNV-1a it used after becoming an open-addressing
+ * table, and the keyed SipHash it uses now (through lsi_skmap_hash()).
+ * For each we count full-width collisions among the nicks, look at how
+ * they spread over a table sized like skmap would size it, and measure
+ * the speed.  Then we craft nicks that all land in the same slot of a
+ * 65536-slot table under the first two (which is easy, as they're fixed
+ * functions), and see how they fare under the keyed one. */
+
+#define DEF_NNICKS 50000
+#define NFLOOD 256
+#define FLOOD_MASK 0xffffu
+
+
+typedef size_t (*hash_fn)(const char *s);
+
+static const uint8_t *s_cmap;
+static skmap *s_map;
+static size_t s_sum;
+
+
+static size_t
+hash_xor16(const char *s)
+{
+	uint8_t res[2] = { 0xaa, 0xaa };
+	uint8_t cur;
+	unsigned shift = 0;
+	bool first = true;
+
+	while ((cur = s_cmap[(uint8_t)*s++]))
+		res[first = !first] ^= cur << (++shift % 3);
+
+	return (res[0] << 8) | res[1];
+}
+
+static size_t
+hash_fnv1a(const char *s)
+{
+	uint64_t res = 0xcbf29ce484222325u;
+	uint8_t cur;
+
+	while ((cur = s_cmap[(uint8_t)*s++]))
+		res = (res ^ cur) * 0x100000001b3u;
+
+	return (size_t)res;
+}
+
+static size_t
+hash_keyed(const char *s)
+{
+	return lsi_skmap_hash(s_map, s);
+}
+
+static const struct {
+	const char *name;
+	hash_fn fn;
+} s_hashes[] = {
+	{ "xor16", hash_xor16 },
+	{ "fnv1a", hash_fnv1a },
+	{ "siphash", hash_keyed },
+};
+
+static bool
+mapeq(const char *n1, const char *n2)
+{
+	uint8_t c1, c2;
+	while ((c1 = s_cmap[(uint8_t)*n1++]) == (c2 = s_cmap[(uint8_t)*n2++]))
+		if (!c1)
+			return true;
+	return false;
+}
+
+static size_t
+load_nicks(const char *fn, char ***nicks)
+{
+	FILE *f = NULL;
+	if (fn && !(f = fopen(fn, "r"))) {
+		fprintf(stderr, "%s: %s\n", fn, strerror(errno));
+		return 0;
+	}
+
+	size_t cap = DEF_NNICKS, n = 0;
+	if (!(*nicks = malloc(cap * sizeof **nicks)))
+		return 0;
+
+	char line[256];
+	uint32_t rnd = 12345;
+	for (;;) {
+		if (f) {
+			if (!fgets(line, sizeof line, f))
+				break;
+			line[strcspn(line, "\r\n \t")] = '\0';
+		} else {
+			if (n == DEF_NNICKS)
+				break;
+			rnd = rnd * 1103515245 + 12345;
+			if (n % 3 == 0)
+				snprintf(line, sizeof line, "Guest%zu", n);
+			else {
+				size_t len = 4 + (rnd >> 16) % 8;
+				for (size_t i = 0; i < len; i++) {
+					rnd = rnd * 1103515245 + 12345;
+					line[i] = "abcdefghijklmnopqrstuvwxyz"
+					    "_[]{}|`^0123456789"[(rnd >> 16) % 44];
+				}
+				snprintf(line + len, sizeof line - len, "%zu", n);
+			}
+		}
+
+		if (!line[0])
+			continue;
+
+		if (n == cap && !(*nicks = realloc(*nicks,
+		    (cap *= 2) * sizeof **nicks)))
+			return 0;
+
+		if (!((*nicks)[n] = strdup(line)))
+			return 0;
+		n++;
+	}
+
+	if (f)
+		fclose(f);
+
+	return n;
+}
+
+struct hent {
+	size_t hash;
+	const char *nick;
+};
+
+static int
+cmp_hent(const void *v1, const void *v2)
+{
+	const struct hent *e1 = v1, *e2 = v2;
+	return e1->hash < e2->hash ? -1 : e1->hash > e2->hash;
+}
+
+/* number of pairs of different nicks with the same (full) hash */
+static size_t
+collisions(hash_fn fn, char **nicks, size_t n, struct hent *tmp)
+{
+	for (size_t i = 0; i < n; i++) {
+		tmp[i].hash = fn(nicks[i]);
+		tmp[i].nick = nicks[i];
+	}
+	qsort(tmp, n, sizeof *tmp, cmp_hent);
+
+	size_t c = 0;
+	for (size_t i = 0; i < n; i++)
+		for (size_t j = i + 1; j < n && tmp[j].hash == tmp[i].hash; j++)
+			c += !mapeq(tmp[i].nick, tmp[j].nick);
+
+	return c;
+}
+
+/* spread over `nb' (a power of 2) buckets; returns the largest bucket */
+static size_t
+spread(hash_fn fn, char **nicks, size_t n, size_t nb, size_t *empty)
+{
+	size_t *cnt = calloc(nb, sizeof *cnt);
+	if (!cnt)
+		return 0;
+
+	size_t max = 0;
+	for (size_t i = 0; i < n; i++) {
+		size_t b = fn(nicks[i]) & (nb - 1);
+		if (++cnt[b] > max)
+			max = cnt[b];
+	}
+
+	*empty = 0;
+	for (size_t i = 0; i < nb; i++)
+		*empty += !cnt[i];
+
+	free(cnt);
+	return max;
+}
+
+/* nicks made of a 6-character block repeated twice cancel out completely
+ * in the xor fold, as characters 6 apart are folded into the same byte
+ * with the same shift */
+static void
+craft_xor16(char flood[][16])
+{
+	for (size_t i = 0; i < NFLOOD; i++) {
+		char blk[7];
+		snprintf(blk, sizeof blk, "fl%04zx", i);
+		snprintf(flood[i], 16, "%s%s", blk, blk);
+	}
+	return;
+}
+
+/* for an unkeyed hash, it only takes trying out names until enough of them
+ * agree in the bits that pick the slot */
+static void
+craft_fnv1a(char flood[][16])
+{
+	size_t n = 0;
+	for (uint32_t i = 0; n < NFLOOD; i++) {
+		char nick[16];
+		snprintf(nick, sizeof nick, "fl%"PRIx32, i);
+		if ((hash_fnv1a(nick) & FLOOD_MASK) == 0x1234)
+			strcpy(flood[n++], nick);
+	}
+	return;
+}
+
+int
+main(int argc, char **argv)
+{
+	char **nicks;
+	size_t n = load_nicks(argc > 1 ? argv[1] : NULL, &nicks);
+	s_cmap = g_cmap[CMAP_RFC1459];
+	s_map = lsi_skmap_init(n, CMAP_RFC1459);
+	struct hent *tmp = malloc(n * sizeof *tmp);
+	if (!n || !s_map || !tmp)
+		return EXIT_FAILURE;
+
+	/* what skmap would grow to for `n' items */
+	size_t nb = 8;
+	while (n * 5 > nb * 4)
+		nb *= 2;
+
+	printf("%zu %s nicks; %zu buckets (load %.2f), expect %.1f%% empty\n",
+	    n, argc > 1 ? "listed" : "synthetic", nb, (double)n / nb,
+	    100.0 * exp(-(double)n / nb));
+
+	printf("%-8s %10s %10s %10s %10s\n",
+	    "hash", "collisions", "empty%", "maxbucket", "ns/hash");
+	for (size_t h = 0; h < COUNTOF(s_hashes); h++) {
+		hash_fn fn = s_hashes[h].fn;
+		size_t empty = 0;
+		size_t coll = collisions(fn, nicks, n, tmp);
+		size_t max = spread(fn, nicks, n, nb, &empty);
+
+		size_t reps = 2000000 / n + 1;
+		uint64_t t0 = lsi_b_tstamp_us();
+		for (size_t r = 0; r < reps; r++)
+			for (size_t i = 0; i < n; i++)
+				s_sum += fn(nicks[i]);
+		uint64_t t1 = lsi_b_tstamp_us();
+
+		printf("%-8s %10zu %10.1f %10zu %10.1f\n", s_hashes[h].name,
+		    coll, 100.0 * empty / nb, max,
+		    (t1 - t0) * 1000.0 / (reps * n));
+	}
+
+	static char flood[NFLOOD][16];
+	static size_t cnt[FLOOD_MASK + 1];
+	static const char *fname[] = { "xor16", "fnv1a" };
+	for (size_t f = 0; f < 2; f++) {
+		if (f == 0)
+			craft_xor16(flood);
+		else
+			craft_fnv1a(flood);
+
+		printf("%d nicks crafted against %s, largest bucket "
+		    "(of %u) under:", NFLOOD, fname[f], FLOOD_MASK + 1);
+		for (size_t h = 0; h < COUNTOF(s_hashes); h++) {
+			size_t max = 0;
+			memset(cnt, 0, sizeof cnt);
+			for (size_t i = 0; i < NFLOOD; i++) {
+				size_t b = s_hashes[h].fn(flood[i]) & FLOOD_MASK;
+				if (++cnt[b] > max)
+					max = cnt[b];
+			}
+			printf(" %s %zu", s_hashes[h].name, max);
+		}
+		putchar('\n');
+	}
+
+	printf("(checksum %zu)\n", s_sum);
+	free(tmp);
+	lsi_skmap_dispose(s_map);
+	for (size_t i = 0; i < n; i++)
+		free(nicks[i]);
+	free(nicks);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,94 @@
+/* fixture.c - a context which believes to be online, for unit tests
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdarg.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/util.h>
+
+#include <platform/base_net.h>
+
+#include "intdefs.h"
+#include "irc_msghnd.h"
+#include "irc_track_int.h"
+#include "msg.h"
+
+#include "fixture.h"
+
+irc *
+fx_online(int *peer, bool hnd, bool track)
+{
+	int sv[2];
+	irc *ctx = irc_init();
+	if (!ctx)
+		return NULL;
+
+	if ((hnd && !lsi_imh_regall(ctx, false))
+	    || (track && !lsi_trk_init(ctx))
+	    || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0) {
+		irc_dispose(ctx);
+		return NULL;
+	}
+
+	/* like a real connection, our end doesn't block */
+	if (!lsi_b_blocking(sv[0], false)) {
+		close(sv[0]);
+		close(sv[1]);
+		irc_dispose(ctx);
+		return NULL;
+	}
+
+	ctx->tracking = ctx->tracking_enab = track;
+	snprintf(ctx->mynick, sizeof ctx->mynick, "me");
+	ctx->con->sh.sck = sv[0];
+	ctx->con->online = true;
+	*peer = sv[1];
+	return ctx;
+}
+
+void
+fx_offline(irc *ctx, int peer)
+{
+	irc_dispose(ctx);
+	close(peer);
+	return;
+}
+
+bool
+fx_feed(irc *ctx, const char *fmt, ...)
+{
+	char line[1024];
+	va_list l;
+	va_start(l, fmt);
+	vsnprintf(line, sizeof line, fmt, l);
+	va_end(l);
+
+	tokarr tok;
+	if (!lsi_ut_tokenize(line, &tok))
+		return false;
+
+	return !(lsi_msg_handle(ctx, &tok, false) & CANT_PROCEED);
+}
+
+long
+fx_drain(irc *ctx, int peer, char *buf, size_t sz)
+{
+	size_t len = 0;
+	ssize_t n;
+
+	if (!irc_flush(ctx))
+		return -1;
+
+	while (len < sz - 1 && (n = recv(peer, buf + len, sz - 1 - len,
+	    MSG_DONTWAIT)) > 0)
+		len += (size_t)n;
+
+	buf[len] = '\0';
+	return (long)len;
+}
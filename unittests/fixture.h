@@ -0,0 +1,31 @@
+/* fixture.h - a context which believes to be online, for unit tests
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_UNITTESTS_FIXTURE_H
+#define LIBSRSIRC_UNITTESTS_FIXTURE_H 1
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libsrsirc/irc.h>
+
+/* a context which believes to be online as `me', talking to the other end
+ * of a socketpair, which is stored in `*peer'.  with `hnd', our protocol
+ * message handlers are registered; with `track', user and channel tracking
+ * is on as well.  NULL on failure */
+irc *fx_online(int *peer, bool hnd, bool track);
+
+/* dispose of a context made by fx_online(), and close `peer' */
+void fx_offline(irc *ctx, int peer);
+
+/* dispatch a line (printf-style) as if we had read it.  false if it didn't
+ * tokenize or a handler said we can't proceed */
+bool fx_feed(irc *ctx, const char *fmt, ...);
+
+/* flush what `ctx' has to send and read everything that arrived at `peer'
+ * into `buf' ('\0'-terminated).  returns the number of bytes read, or -1
+ * if flushing failed */
+long fx_drain(irc *ctx, int peer, char *buf, size_t sz);
+
+#endif /* LIBSRSIRC_UNITTESTS_FIXTURE_H */
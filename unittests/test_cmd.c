@@ -0,0 +1,268 @@
+/* test_cmd.c - convenience functions for common commands (irc_cmd.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdarg.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_cmd.h>
+
+#include "intdefs.h"
+
+#include "fixture.h"
+
+#define MAXLINES 64
+
+/* the other end of the connection */
+static int s_peer = -1;
+
+/* what arrived there, split into lines (without CRLF) */
+static char s_buf[65536];
+static char *s_lines[MAXLINES];
+static size_t s_nlines;
+
+/* a context which believes to be online as `me', talking to `s_peer' */
+static irc *
+setup(bool track)
+{
+	return fx_online(&s_peer, true, track);
+}
+
+static void
+teardown(irc *ctx)
+{
+	fx_offline(ctx, s_peer);
+	s_peer = -1;
+	return;
+}
+
+/* collect what was sent since we last looked into `s_lines'.  false if
+ * there's more than MAXLINES lines, or a line isn't CRLF-terminated or
+ * longer than 512 bytes */
+static bool
+collect(irc *ctx)
+{
+	s_nlines = 0;
+	if (fx_drain(ctx, s_peer, s_buf, sizeof s_buf) < 0)
+		return false;
+
+	char *p = s_buf, *e;
+	while (*p) {
+		if (!(e = strstr(p, "\r\n")) || e - p + 2 > MAX_MSG_LEN
+		    || s_nlines == MAXLINES)
+			return false;
+
+		*e = '\0';
+		s_lines[s_nlines++] = p;
+		p = e + 2;
+	}
+
+	return true;
+}
+
+/* tell whether exactly the given lines were sent, in that order */
+static bool
+sent(irc *ctx, ...)
+{
+	if (!collect(ctx))
+		return false;
+
+	va_list l;
+	va_start(l, ctx);
+	size_t i = 0;
+	const char *exp;
+	while ((exp = va_arg(l, const char *))) {
+		if (i == s_nlines || strcmp(s_lines[i], exp) != 0)
+			break;
+		i++;
+	}
+	va_end(l);
+
+	return !exp && i == s_nlines;
+}
+
+/* split into lines of at most `room' bytes, the text each of the PRIVMSGs
+ * to #one that were sent must add up to `text'.  no cut may be more than
+ * three bytes short of `room' (a UTF-8 sequence is at most 4 bytes), and
+ * none may fall into a sequence */
+static bool
+split_ok(irc *ctx, const char *text, size_t room)
+{
+	if (!collect(ctx) || !s_nlines)
+		return false;
+
+	const char *t = text;
+	for (size_t i = 0; i < s_nlines; i++) {
+		const char *l = s_lines[i];
+		if (strncmp(l, "PRIVMSG #one :", 14) != 0)
+			return false;
+
+		l += 14;
+		size_t n = strlen(l);
+		if (n > room || strncmp(l, t, n) != 0)
+			return false;
+
+		t += n;
+		if (*t && (n + 3 < room || ((unsigned char)*t & 0xc0) == 0x80))
+			return false;
+	}
+
+	return !*t;
+}
+
+const char * /*UNITTEST*/
+test_split(void)
+{
+	irc *ctx = setup(false);
+	if (!ctx)
+		return "setup failed";
+
+	/* 'x' and then 3-byte characters, so that 512 bytes in a line would
+	 * cut in the middle of one */
+	static char text[1602];
+	text[0] = 'x';
+	for (size_t i = 1; i + 3 < sizeof text; i += 3)
+		memcpy(text + i, "\xe2\x82\xac", 3);
+
+	/* what the server relays must fit as well, with the prefix as
+	 * ":me!" plus USERLEN (+1, for a ~) plus "@" plus HOSTLEN plus " ".
+	 * that is 79 bytes by default, so of the 512 bytes, 79 + 12 for
+	 * "PRIVMSG  :" and CRLF + 4 for "#one" leave 417 */
+	if (!irc_privmsg(ctx, "#one", text) || !split_ok(ctx, text, 417))
+		return "text not split correctly (default prefix)";
+
+	if (!fx_feed(ctx, ":srv 005 me USERLEN=12 HOSTLEN=20 :are supported")
+	    || !irc_privmsg(ctx, "#one", text) || !split_ok(ctx, text, 457))
+		return "text not split correctly (005 prefix)";
+
+	/* short text goes out as it is; every line of it separately */
+	if (!irc_privmsg(ctx, "#one", "line1\nline2\r\n\r\nline3")
+	    || !sent(ctx, "PRIVMSG #one :line1", "PRIVMSG #one :line2",
+	    "PRIVMSG #one :line3", NULL))
+		return "multi-line text not sent line by line";
+
+	/* with hosts this long, there's no room for any text */
+	if (!fx_feed(ctx, ":srv 005 me HOSTLEN=500 :are supported")
+	    || irc_privmsg(ctx, "#one", "hi") || !sent(ctx, NULL)
+	    || !irc_online(ctx))
+		return "text sent without room for it";
+
+	teardown(ctx);
+
+	/* when we track ourselves, our actual user name and host count */
+	if (!(ctx = setup(true)))
+		return "setup failed";
+
+	if (!fx_feed(ctx, ":me!~me@h.example JOIN #one")
+	    || !fx_feed(ctx, ":srv 353 me = #one :me")
+	    || !fx_feed(ctx, ":srv 366 me #one :End of /NAMES list.")
+	    || !fx_feed(ctx, ":srv 352 me #one ~me h.example srv me H :0 Me")
+	    || !irc_privmsg(ctx, "#one", text) || !split_ok(ctx, text, 478))
+		return "text not split correctly (tracked prefix)";
+
+	/* pure ASCII is cut at exactly that length */
+	memset(text, 'y', 1000);
+	text[1000] = '\0';
+	if (!irc_privmsg(ctx, "#one", text) || !collect(ctx)
+	    || s_nlines != 3 || strlen(s_lines[0]) != 14 + 478
+	    || strlen(s_lines[2]) != 14 + 1000 - 2 * 478)
+		return "ASCII text not cut at the limit";
+
+	teardown(ctx);
+	return NULL;
+}
+
+static char s_names[12][16];
+static const char *s_targ[12];
+
+static void
+mknames(const char *fmt)
+{
+	for (size_t i = 0; i < 12; i++) {
+		snprintf(s_names[i], sizeof s_names[i], fmt, i);
+		s_targ[i] = s_names[i];
+	}
+	return;
+}
+
+const char * /*UNITTEST*/
+test_batch(void)
+{
+	irc *ctx = setup(false);
+	if (!ctx)
+		return "setup failed";
+
+	/* lacking TARGMAX and MAXTARGETS, one target per PRIVMSG */
+	mknames("t%zu");
+	if (!irc_privmsg_many(ctx, s_targ, 3, "hi")
+	    || !sent(ctx, "PRIVMSG t0 :hi", "PRIVMSG t1 :hi", "PRIVMSG t2 :hi",
+	    NULL))
+		return "more than one target without TARGMAX/MAXTARGETS";
+
+	if (!fx_feed(ctx, ":srv 005 me MAXTARGETS=4 :are supported")
+	    || !irc_notice_many(ctx, s_targ, 10, "hi")
+	    || !sent(ctx, "NOTICE t0,t1,t2,t3 :hi", "NOTICE t4,t5,t6,t7 :hi",
+	    "NOTICE t8,t9 :hi", NULL))
+		return "MAXTARGETS not obeyed";
+
+	/* TARGMAX has precedence; no number means no limit */
+	if (!fx_feed(ctx, ":srv 005 me TARGMAX=PRIVMSG:3,NOTICE:,JOIN:2 "
+	    ":are supported"))
+		return "failed to feed 005";
+
+	if (!irc_privmsg_many(ctx, s_targ, 7, "hi")
+	    || !sent(ctx, "PRIVMSG t0,t1,t2 :hi", "PRIVMSG t3,t4,t5 :hi",
+	    "PRIVMSG t6 :hi", NULL))
+		return "TARGMAX not obeyed";
+
+	/* a bad target is skipped, the others still get it */
+	if (irc_notice(ctx, "a,b,,c,bad target,:d", "hi")
+	    || !sent(ctx, "NOTICE a,b,c :hi", NULL))
+		return "bad target not skipped (correctly)";
+
+	/* channels with a key go first */
+	const char *keys[12] = { NULL };
+	keys[3] = "k3";
+	keys[6] = "";
+	keys[8] = "k8";
+	mknames("#c%zu");
+	if (!irc_join_many(ctx, s_targ, keys, 9)
+	    || !sent(ctx, "JOIN #c3,#c8 k3,k8", "JOIN #c0,#c1", "JOIN #c2,#c4",
+	    "JOIN #c5,#c6", "JOIN #c7", NULL))
+		return "JOIN TARGMAX or key order not obeyed";
+
+	teardown(ctx);
+
+	/* without a limit on the number, the length is what limits */
+	if (!(ctx = setup(false)))
+		return "setup failed";
+
+	static char chans[40][64];
+	static const char *cp[40];
+	for (size_t i = 0; i < 40; i++) {
+		snprintf(chans[i], sizeof chans[i], "#%044zu", i);
+		cp[i] = chans[i];
+	}
+
+	/* "JOIN " plus 11 times 45 bytes plus 10 commas plus CRLF is 512 */
+	if (!irc_join_many(ctx, cp, NULL, 40) || !collect(ctx)
+	    || s_nlines != 4 || strlen(s_lines[0]) != 5 + 11 * 45 + 10
+	    || strlen(s_lines[3]) != 5 + 7 * 45 + 6)
+		return "JOIN lines not filled up to the limit";
+
+	/* the same goes for PRIVMSG, as long as a short text (at most half
+	 * a line) still fits: 5 targets take 229 bytes, "PRIVMSG  :" and
+	 * CRLF 12, and there's 240 bytes of text */
+	static char text[300];
+	memset(text, 'z', 240);
+	if (!fx_feed(ctx, ":srv 005 me TARGMAX=PRIVMSG: :are supported")
+	    || !irc_privmsg_many(ctx, cp, 12, text) || !collect(ctx)
+	    || s_nlines != 3 || strlen(s_lines[0]) != 229 + 10 + 240
+	    || strlen(s_lines[2]) != 91 + 10 + 240)
+		return "PRIVMSG lines not filled up to the limit";
+
+	teardown(ctx);
+	return NULL;
+}
@@ -0,0 +1,154 @@
+/* test_dnscache.c - process-wide cache of resolved server addresses
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <libsrsirc/defs.h>
+
+#include <platform/base_net.h>
+
+#include "dnscache.h"
+
+#define TTL 1000000
+#define STALE 5000000
+
+/* the cache's idea of the current time; we move it by hand */
+static uint64_t s_now;
+
+static uint64_t
+fake_now(void)
+{
+	return s_now;
+}
+
+/* what looking up localhost resolved to the first time */
+static int s_count;
+static char s_addr[64];
+
+static void
+setup(void)
+{
+	lsi_dns_config(TTL, STALE);
+	lsi_dns_flush();
+	lsi_dns_set_clock(fake_now);
+	lsi_dns_stats(NULL, true);
+	s_now = 1000000;
+	s_count = 0;
+	return;
+}
+
+static void
+teardown(void)
+{
+	lsi_dns_set_clock(NULL);
+	lsi_dns_config(DEF_DNSTTL_US, DEF_DNSSTALE_US);
+	lsi_dns_flush();
+	return;
+}
+
+/* look up localhost:`port'.  tell whether we got what we got the first
+ * time (with the port we asked for), and the counters now read `nhit',
+ * `nstale', `nmiss' and `nresolv' */
+static bool
+lookup(uint16_t port, uint64_t nhit, uint64_t nstale, uint64_t nmiss,
+    uint64_t nresolv)
+{
+	struct addrlist *al;
+	int n = lsi_dns_lookup("localhost", port, &al);
+	if (n <= 0)
+		return false;
+
+	if (!s_count) {
+		s_count = n;
+		snprintf(s_addr, sizeof s_addr, "%s", al->addrstr);
+	}
+
+	bool ok = n == s_count && al->port == port
+	    && strcmp(al->addrstr, s_addr) == 0;
+	lsi_b_freeaddrlist(al);
+
+	struct dnsstats st;
+	lsi_dns_stats(&st, false);
+	return ok && st.nhit == nhit && st.nstale == nstale
+	    && st.nmiss == nmiss && st.nresolv == nresolv && !st.nfail;
+}
+
+const char * /*UNITTEST*/
+test_hits(void)
+{
+	setup();
+
+	/* the resolver is asked once; the other nine are answered from
+	 * the cache */
+	for (uint64_t i = 0; i < 10; i++)
+		if (!lookup(6667, i, 0, 1, 1))
+			return "repeated lookup not answered from the cache";
+
+	/* another port is another entry */
+	if (!lookup(6697, 9, 0, 2, 2) || !lookup(6697, 10, 0, 2, 2))
+		return "different port not cached separately";
+
+	/* right up until the TTL runs out, it's fresh */
+	s_now += TTL - 1;
+	if (!lookup(6667, 11, 0, 2, 2) || lsi_dns_pending())
+		return "entry not fresh within its TTL";
+
+	/* a TTL of 0 switches the cache off */
+	lsi_dns_config(0, 0);
+	if (!lookup(6667, 11, 0, 3, 3) || !lookup(6667, 11, 0, 4, 4))
+		return "lookup cached with a TTL of 0";
+
+	teardown();
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_expiry(void)
+{
+	setup();
+
+	if (!lookup(6667, 0, 0, 1, 1))
+		return "lookup failed";
+
+	/* once the TTL ran out, it's still handed out (stale), but marked
+	 * for revalidation; the resolver isn't asked */
+	s_now += TTL;
+	if (!lookup(6667, 0, 1, 1, 1) || !lsi_dns_pending())
+		return "stale entry not served, or not marked";
+
+	/* again; it's marked just once */
+	if (!lookup(6667, 0, 2, 1, 1) || !lsi_dns_revalidate()
+	    || lsi_dns_pending() || lsi_dns_revalidate())
+		return "stale entry marked more than once";
+
+	/* revalidating asked the resolver, and made the entry fresh */
+	if (!lookup(6667, 1, 2, 1, 2))
+		return "revalidated entry not fresh";
+
+	/* past the stale window, it's gone, and we wait for the resolver */
+	s_now += TTL + STALE;
+	if (!lookup(6667, 1, 2, 2, 3) || lsi_dns_pending()
+	    || !lookup(6667, 2, 2, 2, 3))
+		return "expired entry served";
+
+	/* the same goes for an entry that was marked, but never refreshed */
+	s_now += TTL;
+	if (!lookup(6667, 2, 3, 2, 3) || !lsi_dns_pending())
+		return "stale entry not served, or not marked";
+
+	s_now += STALE;
+	if (!lookup(6667, 2, 3, 3, 4) || lsi_dns_pending())
+		return "expired entry served, or still marked";
+
+	/* without a stale window, there's no stale entries */
+	lsi_dns_config(TTL, 0);
+	s_now += TTL;
+	if (!lookup(6667, 2, 3, 4, 5) || lsi_dns_pending())
+		return "stale entry served without a stale window";
+
+	teardown();
+	return NULL;
+}
@@ -0,0 +1,250 @@
+/* test_io.c - reading lines through the receive ring (io.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <sys/socket.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+
+#include "common.h"
+#include "intdefs.h"
+#include "io.h"
+
+#include "fixture.h"
+
+/* the smallest receive buffer there can be */
+#define CAP MAX_LINE_LEN
+
+/* what the peer sends, and the lengths (with CRLF) of the lines in it */
+static char s_in[131072];
+static size_t s_inlen;
+static size_t s_len[128];
+static size_t s_nlines;
+
+/* the text of the `seq'th line, which is `len' bytes long with the
+ * "PRIVMSG #c :" in front of it and the CRLF after it */
+static void
+text(char *dest, size_t seq, size_t len)
+{
+	size_t n = len - 14;
+	int m = snprintf(dest, n + 1, "%zu:", seq);
+	memset(dest + m, 'a' + (int)(seq % 26), n - (size_t)m);
+	dest[n] = '\0';
+	return;
+}
+
+/* add a line of `len' bytes (with CRLF) to what the peer sends */
+static void
+add(size_t len)
+{
+	static char t[3 * CAP];
+	text(t, s_nlines, len);
+	s_inlen += (size_t)snprintf(s_in + s_inlen, sizeof s_in - s_inlen,
+	    "PRIVMSG #c :%s\r\n", t);
+	s_len[s_nlines++] = len;
+	return;
+}
+
+/* have `peer' send `s_in' while we read it with irc_read_batch() if
+ * `batch', else irc_read().  tell whether we got exactly the lines that
+ * aren't too long, in order */
+static bool
+readall(irc *ctx, int peer, bool batch)
+{
+	static char exp[3 * CAP];
+	tokarr toks[16];
+	size_t off = 0, i = 0;
+
+	while (i < s_nlines) {
+		/* don't block on a full socket buffer, we're the reader */
+		ssize_t n = send(peer, s_in + off, s_inlen - off, MSG_DONTWAIT);
+		if (n > 0)
+			off += (size_t)n;
+
+		int r = batch
+		    ? irc_read_batch(ctx, toks, COUNTOF(toks), 1000000)
+		    : irc_read(ctx, toks, 1000000);
+		if (r <= 0)
+			return false;
+
+		for (int j = 0; j < r; j++) {
+			while (i < s_nlines && s_len[i] > MAX_LINE_LEN)
+				i++; /* should have been dropped */
+
+			if (i == s_nlines)
+				return false;
+
+			text(exp, i, s_len[i]);
+			if (strcmp(toks[j][1], "PRIVMSG") != 0
+			    || strcmp(toks[j][2], "#c") != 0
+			    || strcmp(toks[j][3], exp) != 0)
+				return false;
+			i++;
+		}
+	}
+
+	return off == s_inlen && irc_online(ctx);
+}
+
+const char * /*UNITTEST*/
+test_ring(void)
+{
+	int peer;
+	irc *ctx = fx_online(&peer, false, false);
+	if (!ctx)
+		return "setup failed";
+
+	/* the receive buffer can only be resized while offline */
+	ctx->con->online = false;
+	bool ok = !irc_set_rcvbuf_size(ctx, CAP - 1)
+	    && irc_set_rcvbuf_size(ctx, CAP);
+	ctx->con->online = true;
+	if (!ok)
+		return "failed to set the receive buffer size";
+
+	/* as long as the peer is ahead of us, the n-th byte sent lands at
+	 * n % CAP in the ring.  so: a CR at the very end of the ring and
+	 * the LF at the front of it; a line ending right at the end of the
+	 * ring (and thus one starting at the front); a line of the maximum
+	 * length, wrapping around */
+	s_inlen = s_nlines = 0;
+	add(5000);
+	add(CAP + 1 - 5000);
+	add(CAP - 1);
+	add(100);
+	add(MAX_LINE_LEN);
+
+	/* one byte too long, which is dropped, and the line after it must
+	 * come through as it is.  the same for a line so long that we only
+	 * see the end of it after having dropped the start */
+	add(MAX_LINE_LEN + 1);
+	add(50);
+	add(2 * CAP + 7);
+	add(60);
+
+	/* and lots of lines, wrapping around at all sorts of places */
+	for (size_t i = 0; i < 40; i++)
+		add(20 + i * 997 % 2500);
+
+	if (!readall(ctx, peer, false))
+		return "irc_read: lines lost or garbled";
+
+	if (!readall(ctx, peer, true))
+		return "irc_read_batch: lines lost or garbled";
+
+	fx_offline(ctx, peer);
+	return NULL;
+}
+
+static char *
+naive_delim(char *ptr, char *end)
+{
+	for (; ptr < end; ptr++)
+		if (*ptr == '\r' || *ptr == '\n')
+			return ptr;
+	return NULL;
+}
+
+/* bytes that differ from CR or LF by a bit, or are as good as the same to
+ * a signed comparison */
+static const char s_filler[] = "x\x0c\x0e\x09\x8a\x8d\x0b\x00\xff\x2a";
+
+/* in `len' bytes of filler at `off' (followed by a LF), put `c' at `at'
+ * (unless that's past the end), and tell whether lsi_io_scan_delim()
+ * finds the same as the naive loop */
+static bool
+scan_ok(size_t off, size_t len, size_t at, char c)
+{
+	static char buf[256];
+	for (size_t i = 0; i < sizeof buf; i++)
+		buf[i] = s_filler[i % (sizeof s_filler - 1)];
+
+	buf[off + len] = '\n';
+	if (at < len)
+		buf[off + at] = c;
+
+	char *p = buf + off, *e = p + len;
+	return lsi_io_scan_delim(p, e) == naive_delim(p, e);
+}
+
+const char * /*UNITTEST*/
+test_scan_delim(void)
+{
+	static const size_t at[] = { 0, 15, 16, 31, 32, 33, 63, 64, 65, 96 };
+
+	/* all lengths, a few alignments; no delimiter (the one right after
+	 * the range doesn't count), or one of either kind at the interesting
+	 * offsets, and at the very end */
+	for (size_t off = 0; off < 4; off++) {
+		for (size_t len = 0; len <= 130; len++) {
+			if (!scan_ok(off, len, len, 'x'))
+				return "delimiter found where there is none";
+
+			for (size_t i = 0; i < COUNTOF(at); i++)
+				if (!scan_ok(off, len, at[i], '\r')
+				    || !scan_ok(off, len, at[i], '\n'))
+					return "wrong delimiter found";
+
+			if (len && (!scan_ok(off, len, len - 1, '\r')
+			    || !scan_ok(off, len, len - 1, '\n')))
+				return "delimiter at the end not found";
+		}
+	}
+
+	static char buf[128];
+	/* the first of several, wherever the next one is */
+	for (size_t i = 0; i < sizeof buf; i++)
+		buf[i] = 'x';
+	for (size_t a = 0; a < 70; a++) {
+		for (size_t b = a + 1; b < 70; b++) {
+			buf[a] = '\r';
+			buf[b] = '\n';
+			if (lsi_io_scan_delim(buf, buf + 100) != buf + a)
+				return "not the first delimiter found";
+			buf[a] = buf[b] = 'x';
+		}
+	}
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_pieces(void)
+{
+	int peer;
+	irc *ctx = fx_online(&peer, false, false);
+	if (!ctx)
+		return "setup failed";
+
+	/* a line that trickles in, so that the scan carries on from where it
+	 * stopped (across 16 and 32 byte boundaries), and the delimiter comes
+	 * right after that */
+	static const size_t pieces[] = { 1, 14, 1, 15, 1, 16, 17, 31, 33 };
+	static char line[256];
+	size_t len = 0;
+	for (size_t i = 0; i < COUNTOF(pieces); i++) {
+		memset(line + len, 'a' + (int)i, pieces[i]);
+		tokarr tok;
+		if (send(peer, line + len, pieces[i], 0) != (ssize_t)pieces[i]
+		    || irc_read(ctx, &tok, 1000) != 0)
+			return "incomplete line read";
+		len += pieces[i];
+	}
+
+	/* a CR and then the LF on its own; the rest of the line after it */
+	tokarr tok;
+	if (send(peer, "\r", 1, 0) != 1 || irc_read(ctx, &tok, 1000000) != 1
+	    || strlen(tok[1]) != len || strncmp(tok[1], line, len) != 0)
+		return "line not read correctly";
+
+	if (send(peer, "\nPING :x\r", 10, 0) != 10
+	    || irc_read(ctx, &tok, 1000000) != 1
+	    || strcmp(tok[1], "PING") != 0 || strcmp(tok[2], "x") != 0)
+		return "line after the delimiter not read correctly";
+
+	fx_offline(ctx, peer);
+	return NULL;
+}
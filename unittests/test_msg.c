@@ -0,0 +1,414 @@
+/* test_msg.c - protocol message handler dispatch (msg.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <sys/socket.h>
+
+#include <libsrsirc/defs.h>
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/util.h>
+
+#include "common.h"
+#include "intdefs.h"
+#include "msg.h"
+
+#include "fixture.h"
+
+/* which handlers ran, one letter each, in order */
+static char s_log[256];
+
+/* what the handlers are to do about (un)registering others */
+static int s_mode;
+
+static void
+logit(char c)
+{
+	size_t len = strlen(s_log);
+	if (len < sizeof s_log - 1) {
+		s_log[len] = c;
+		s_log[len + 1] = '\0';
+	}
+	return;
+}
+
+/* dispatch a line as if we had read it, and tell whether exactly the
+ * handlers in `exp' ran */
+static bool
+feed(irc *ctx, const char *line, const char *exp)
+{
+	s_log[0] = '\0';
+	fx_feed(ctx, "%s", line);
+	return strcmp(s_log, exp) == 0;
+}
+
+static uint16_t h_b(irc *ctx, tokarr *m, size_t n, bool l);
+static uint16_t h_c(irc *ctx, tokarr *m, size_t n, bool l);
+static uint16_t h_n(irc *ctx, tokarr *m, size_t n, bool l);
+static bool u_post(irc *ctx, tokarr *m, size_t n, bool pre);
+
+static uint16_t
+h_a(irc *ctx, tokarr *m, size_t n, bool l)
+{
+	logit('a');
+	switch (s_mode) {
+	case 1:
+		/* into a slot after ours, and so many others that the
+		 * handler array has to grow */
+		lsi_msg_reghnd(ctx, "PRIVMSG", h_c, "c");
+		for (int i = 0; i < 100; i++)
+			lsi_msg_reghnd(ctx, "NOTICE", h_n, "n");
+		break;
+	case 2:
+		lsi_msg_unregall(ctx, "b");
+		break;
+	case 3:
+		lsi_msg_unregall(ctx, "b");
+		lsi_msg_unregall(ctx, "c");
+		break;
+	case 4:
+		lsi_msg_reguhnd(ctx, "PRIVMSG", u_post, false);
+		break;
+	}
+
+	s_mode = 0;
+	return 0;
+}
+
+static uint16_t
+h_b(irc *ctx, tokarr *m, size_t n, bool l)
+{
+	logit('b');
+	return 0;
+}
+
+static uint16_t
+h_c(irc *ctx, tokarr *m, size_t n, bool l)
+{
+	logit('c');
+	return 0;
+}
+
+static uint16_t
+h_n(irc *ctx, tokarr *m, size_t n, bool l)
+{
+	logit('n');
+	return 0;
+}
+
+/* unregisters and registers itself again, which takes the slot it had */
+static uint16_t
+h_x(irc *ctx, tokarr *m, size_t n, bool l)
+{
+	logit('x');
+	lsi_msg_unregall(ctx, "x");
+	lsi_msg_reghnd(ctx, "PING", h_x, "x");
+	return 0;
+}
+
+/* registers another handler, which takes a slot before its own */
+static uint16_t
+h_y(irc *ctx, tokarr *m, size_t n, bool l)
+{
+	logit('y');
+	if (s_mode == 5)
+		lsi_msg_reghnd(ctx, "PING", h_c, "c");
+	s_mode = 0;
+	return 0;
+}
+
+static bool
+u_post(irc *ctx, tokarr *m, size_t n, bool pre)
+{
+	logit(pre ? '!' : 'P');
+	return true;
+}
+
+static bool
+u_pre2(irc *ctx, tokarr *m, size_t n, bool pre)
+{
+	logit(pre ? '2' : '!');
+	return true;
+}
+
+static bool
+u_pre(irc *ctx, tokarr *m, size_t n, bool pre)
+{
+	logit(pre ? '1' : '!');
+	if (s_mode == 6) {
+		lsi_msg_reguhnd(ctx, "PRIVMSG", u_pre2, true);
+		lsi_msg_reguhnd(ctx, "PRIVMSG", u_post, false);
+	}
+	s_mode = 0;
+	return true;
+}
+
+static bool
+u_deny(irc *ctx, tokarr *m, size_t n, bool pre)
+{
+	logit('D');
+	return false;
+}
+
+const char * /*UNITTEST*/
+test_dispatch(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx)
+		return "irc_init failed";
+
+	if (!lsi_msg_reghnd(ctx, "PRIVMSG", h_a, "a")
+	    || !lsi_msg_reghnd(ctx, "PRIVMSG", h_b, "b")
+	    || !lsi_msg_reghnd(ctx, "001", h_c, "c"))
+		return "lsi_msg_reghnd failed";
+
+	/* by command, in the order of registration; nothing for commands
+	 * that merely look alike */
+	if (!feed(ctx, ":x!y@z PRIVMSG #c :hi", "ab")
+	    || !feed(ctx, ":srv 001 me :welcome", "c")
+	    || !feed(ctx, ":srv 002 me :host", "")
+	    || !feed(ctx, ":x!y@z PRIVMSGX #c :hi", "")
+	    || !feed(ctx, ":x!y@z PRIVMS #c :hi", ""))
+		return "wrong handlers run";
+
+	if (!lsi_msg_needs(ctx, "PRIVMSG") || !lsi_msg_needs(ctx, "001")
+	    || lsi_msg_needs(ctx, "002") || lsi_msg_needs(ctx, "NOTICE"))
+		return "lsi_msg_needs got it wrong";
+
+	/* user handlers come before (pre) and after (post) ours */
+	if (!irc_reg_msghnd(ctx, "PRIVMSG", u_pre, true)
+	    || !feed(ctx, ":x!y@z PRIVMSG #c :hi", "1ab"))
+		return "pre handler not run first";
+
+	/* one that says no stops the whole thing */
+	if (!irc_reg_msghnd(ctx, "PRIVMSG", u_deny, true))
+		return "irc_reg_msghnd failed";
+
+	char buf[] = ":x!y@z PRIVMSG #c :hi";
+	tokarr tok;
+	s_log[0] = '\0';
+	if (!lsi_ut_tokenize(buf, &tok)
+	    || lsi_msg_handle(ctx, &tok, false) != USER_ERR
+	    || strcmp(s_log, "1D") != 0)
+		return "denying pre handler didn't stop dispatch";
+
+	irc_dispose(ctx);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_reentrant(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx)
+		return "irc_init failed";
+
+	if (!lsi_msg_reghnd(ctx, "PRIVMSG", h_a, "a")
+	    || !lsi_msg_reghnd(ctx, "PRIVMSG", h_b, "b"))
+		return "lsi_msg_reghnd failed";
+
+	/* a handler registered while dispatching, to a later slot than the
+	 * one that registers it, runs for the very message that did it,
+	 * even though everything moved meanwhile */
+	s_mode = 1;
+	if (!feed(ctx, ":x!y@z PRIVMSG #c :hi", "abc")
+	    || !feed(ctx, ":x!y@z PRIVMSG #c :hi", "abc"))
+		return "handler registered during dispatch not run (once)";
+
+	char exp[101];
+	memset(exp, 'n', 100);
+	exp[100] = '\0';
+	if (!feed(ctx, "NOTICE x :y", exp))
+		return "handlers registered during dispatch got lost";
+
+	/* one unregistered before it's its turn doesn't run; its slot is
+	 * taken again by the next one registered */
+	s_mode = 2;
+	if (!feed(ctx, ":x!y@z PRIVMSG #c :hi", "ac"))
+		return "handler unregistered during dispatch still run";
+	if (!lsi_msg_reghnd(ctx, "PRIVMSG", h_b, "b")
+	    || !feed(ctx, ":x!y@z PRIVMSG #c :hi", "abc"))
+		return "freed slot not reused";
+
+	/* nor do all the rest, if the command has none left afterwards */
+	s_mode = 3;
+	if (!feed(ctx, ":x!y@z PRIVMSG #c :hi", "a")
+	    || !feed(ctx, ":x!y@z PRIVMSG #c :hi", "a"))
+		return "unregistered handlers still run";
+
+	/* post handlers registered on the way are run, too */
+	s_mode = 4;
+	if (!feed(ctx, ":x!y@z PRIVMSG #c :hi", "aP")
+	    || !feed(ctx, ":x!y@z PRIVMSG #c :hi", "aP"))
+		return "post handler registered during dispatch not run";
+
+	/* the same goes for pre handlers registering pre and post ones */
+	irc_dispose(ctx);
+	if (!(ctx = irc_init()))
+		return "irc_init failed";
+
+	s_mode = 6;
+	if (!irc_reg_msghnd(ctx, "PRIVMSG", u_pre, true)
+	    || !lsi_msg_reghnd(ctx, "PRIVMSG", h_b, "b")
+	    || !feed(ctx, ":x!y@z PRIVMSG #c :hi", "12bP")
+	    || !feed(ctx, ":x!y@z PRIVMSG #c :hi", "12bP"))
+		return "user handlers registered during dispatch not run";
+
+	/* a handler that re-registers itself ends up in its own slot, and
+	 * isn't run again */
+	if (!lsi_msg_reghnd(ctx, "PING", h_x, "x")
+	    || !feed(ctx, "PING :srv", "x") || !feed(ctx, "PING :srv", "x"))
+		return "re-registering handler run more than once";
+
+	/* one registered to a slot before the current one is only run for
+	 * the next message (as it would with a scan over the slots) */
+	lsi_msg_unregall(ctx, "x");
+	if (!lsi_msg_reghnd(ctx, "NOTICE", h_n, "n")
+	    || !lsi_msg_reghnd(ctx, "PING", h_y, "y"))
+		return "lsi_msg_reghnd failed";
+	lsi_msg_unregall(ctx, "n");
+
+	s_mode = 5;
+	if (!feed(ctx, "PING :srv", "y") || !feed(ctx, "PING :srv", "cy"))
+		return "handler registered to an earlier slot run too early";
+
+	irc_dispose(ctx);
+	return NULL;
+}
+
+
+/* ten messages, of which the receive filter is to let through PRIVMSG
+ * and 366 (four of them), and our handlers want PING and NOTICE.  the
+ * other four are to be dropped before they're even tokenized */
+static const char s_input[] =
+    ":a!b@c PRIVMSG #c :0\r\n"
+    ":srv 001 me :welcome\r\n"
+    "@time=2024-01-01T00:00:00.000Z :a!b@c JOIN #c\r\n"
+    "PING :srv\r\n"
+    ":a!b@c NOTICE #c :hi\r\n"
+    "@k=v :a!b@c PRIVMSG #c :1\r\n"
+    ":a!b@c PRIVMSGX #c :no\r\n"
+    "MODE #c +o x\r\n"
+    ":srv 366 me #c :End of /NAMES list.\r\n"
+    ":a!b@c PRIVMSG #c :end\r\n";
+
+static uint16_t
+h_ping(irc *ctx, tokarr *m, size_t n, bool l)
+{
+	logit('p');
+	return 0;
+}
+
+static bool
+u_notice(irc *ctx, tokarr *m, size_t n, bool pre)
+{
+	logit('N');
+	return true;
+}
+
+/* read what's in `s_input' (which `peer' sends) with irc_read_batch() if
+ * `batch', else irc_read().  tell whether it's `ndeliv' messages, plus
+ * the handlers in `exp', and that `nfilt' were dropped unparsed */
+static bool
+readall(irc *ctx, int peer, bool batch, size_t ndeliv, const char *exp,
+    uint64_t nfilt)
+{
+	tokarr toks[16];
+	size_t n = 0;
+	bool end = false;
+
+	s_log[0] = '\0';
+	irc_iostats(NULL, true);
+	if (send(peer, s_input, sizeof s_input - 1, 0)
+	    != (ssize_t)sizeof s_input - 1)
+		return false;
+
+	while (!end) {
+		int r = batch
+		    ? irc_read_batch(ctx, toks, COUNTOF(toks), 1000000)
+		    : irc_read(ctx, toks, 1000000);
+		if (r <= 0)
+			return false;
+
+		for (int i = 0; i < r; i++) {
+			/* everything is a PRIVMSG or a 366 if filtered */
+			if (ndeliv == 4 && strcmp(toks[i][1], "PRIVMSG") != 0
+			    && strcmp(toks[i][1], "366") != 0)
+				return false;
+
+			end = strcmp(toks[i][1], "PRIVMSG") == 0
+			    && strcmp(toks[i][3], "end") == 0;
+			n++;
+		}
+	}
+
+	struct irc_iostats st;
+	irc_iostats(&st, false);
+	return n == ndeliv && strcmp(s_log, exp) == 0
+	    && st.nfiltered == nfilt && st.nmsgs == 10 - nfilt;
+}
+
+const char * /*UNITTEST*/
+test_recv_filter(void)
+{
+	int peer;
+	irc *ctx = fx_online(&peer, false, false);
+	if (!ctx)
+		return "setup failed";
+
+	const char *filt[] = { "PRIVMSG", "366" };
+	if (!lsi_msg_reghnd(ctx, "PING", h_ping, "p")
+	    || !irc_reg_msghnd(ctx, "NOTICE", u_notice, false)
+	    || !irc_set_recv_filter(ctx, filt, COUNTOF(filt)))
+		return "setup failed";
+
+	if (!readall(ctx, peer, false, 4, "pN", 4))
+		return "irc_read: wrong messages filtered, or miscounted";
+	if (!readall(ctx, peer, true, 4, "pN", 4))
+		return "irc_read_batch: wrong messages filtered, or miscounted";
+
+	/* a bad filter leaves the one we had in place */
+	const char *bad[] = { "PRIVMSG", "" };
+	if (irc_set_recv_filter(ctx, bad, COUNTOF(bad))
+	    || !readall(ctx, peer, true, 4, "pN", 4))
+		return "bad filter accepted, or replaced the old one";
+
+	/* without a filter, we get everything */
+	if (!irc_set_recv_filter(ctx, NULL, 0)
+	    || !readall(ctx, peer, false, 10, "pN", 0)
+	    || !readall(ctx, peer, true, 10, "pN", 0))
+		return "messages filtered without a filter";
+
+	fx_offline(ctx, peer);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_batch_bad(void)
+{
+	int peer;
+	irc *ctx = fx_online(&peer, false, false);
+	if (!ctx)
+		return "setup failed";
+
+	/* the good messages before a bad one are handed out; the failure
+	 * comes with the next call */
+	static const char in[] =
+	    "PING :1\r\nPING :2\r\n@just=tags\r\nPING :3\r\n";
+	if (send(peer, in, sizeof in - 1, 0) != (ssize_t)sizeof in - 1)
+		return "send failed";
+
+	tokarr toks[16];
+	if (irc_read_batch(ctx, toks, COUNTOF(toks), 1000000) != 2
+	    || strcmp(toks[0][2], "1") != 0 || strcmp(toks[1][2], "2") != 0)
+		return "messages before a bad line lost";
+
+	if (irc_read_batch(ctx, toks, COUNTOF(toks), 1000000) != -1
+	    || irc_online(ctx))
+		return "bad line not reported";
+
+	fx_offline(ctx, peer);
+	return NULL;
+}
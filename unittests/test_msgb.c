@@ -0,0 +1,279 @@
+/* test_msgb.c - building outgoing messages piece by piece (irc_msgb.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_msgb.h>
+
+#include "common.h"
+#include "conn.h"
+#include "intdefs.h"
+
+#include "fixture.h"
+
+/* the other end of the connection */
+static int s_peer = -1;
+
+/* a context which believes to be online, talking to `s_peer' */
+static irc *
+setup(void)
+{
+	return fx_online(&s_peer, false, false);
+}
+
+static void
+teardown(irc *ctx)
+{
+	fx_offline(ctx, s_peer);
+	s_peer = -1;
+	return;
+}
+
+/* tell whether what arrived at `s_peer' since we last looked is `exp' */
+static bool
+sent(irc *ctx, const char *exp)
+{
+	static char buf[16384];
+	return fx_drain(ctx, s_peer, buf, sizeof buf) >= 0
+	    && strcmp(buf, exp) == 0;
+}
+
+const char * /*UNITTEST*/
+test_build(void)
+{
+	irc *ctx = setup();
+	if (!ctx)
+		return "setup failed";
+
+	irc_msgb *mb = irc_msgb_start(ctx);
+	if (!mb || !irc_msgb_tag(mb, "+example.com/x", "a;b c\\d\r\ne")
+	    || !irc_msgb_tag(mb, "+flag", NULL) || !irc_msgb_tag(mb, "k", "")
+	    || !irc_msgb_cmd(mb, "PRIVMSG") || !irc_msgb_param(mb, "#chan")
+	    || !irc_msgb_trail(mb, "hello: world") || !irc_msgb_send(mb))
+		return "failed to build a message with tags";
+
+	if (!sent(ctx, "@+example.com/x=a\\:b\\sc\\\\d\\r\\ne;+flag;k "
+	    "PRIVMSG #chan :hello: world\r\n"))
+		return "message with tags built wrong";
+
+	/* a numeric; an empty trailing parameter; just the command */
+	mb = irc_msgb_start(ctx);
+	if (!mb || !irc_msgb_cmd(mb, "001") || !irc_msgb_param(mb, "me")
+	    || !irc_msgb_trail(mb, "") || !irc_msgb_send(mb))
+		return "failed to build a numeric";
+
+	mb = irc_msgb_start(ctx);
+	if (!mb || !irc_msgb_cmd(mb, "QUIT") || !irc_msgb_send(mb))
+		return "failed to build a bare command";
+
+	/* only the given length of the trailing parameter */
+	mb = irc_msgb_start(ctx);
+	if (!mb || !irc_msgb_cmd(mb, "AWAY")
+	    || !irc_msgb_trailn(mb, "gone\r\nfishing", 4) || !irc_msgb_send(mb))
+		return "failed to build with irc_msgb_trailn";
+
+	if (!sent(ctx, "001 me :\r\nQUIT\r\nAWAY :gone\r\n"))
+		return "messages built wrong";
+
+	teardown(ctx);
+
+	/* nothing to build while offline */
+	if (!(ctx = irc_init()))
+		return "irc_init failed";
+	if (irc_msgb_start(ctx))
+		return "irc_msgb_start succeeded while offline";
+	irc_dispose(ctx);
+	return NULL;
+}
+
+/* start a PRIVMSG to #c, so that the next part can be tried on it */
+static irc_msgb *
+privmsg(irc *ctx)
+{
+	irc_msgb *mb = irc_msgb_start(ctx);
+	if (mb && (!irc_msgb_cmd(mb, "PRIVMSG") || !irc_msgb_param(mb, "#c")))
+		return NULL;
+
+	return mb;
+}
+
+const char * /*UNITTEST*/
+test_reject(void)
+{
+	irc *ctx = setup();
+	if (!ctx)
+		return "setup failed";
+
+	/* after the first rejected part, everything is refused, and sending
+	 * drops the whole message */
+	irc_msgb *mb = irc_msgb_start(ctx);
+	if (!mb || irc_msgb_tag(mb, "bad_tag", "x")
+	    || irc_msgb_cmd(mb, "PRIVMSG") || irc_msgb_send(mb))
+		return "bad tag name accepted";
+
+	struct {
+		const char *what, *tag, *cmd, *cmd2, *param, *trail, *late;
+	} bad[] = {
+		{ "empty tag name", "+", "PING", NULL, NULL, NULL, NULL },
+		{ "bad command", NULL, "001x", NULL, NULL, NULL, NULL },
+		{ "two-digit numeric", NULL, "01", NULL, NULL, NULL, NULL },
+		{ "command set twice", NULL, "PING", "PONG", NULL, NULL, NULL },
+		{ "no command", "k", NULL, NULL, NULL, NULL, NULL },
+		{ "space in parameter", NULL, "KICK", NULL, "a b", NULL, NULL },
+		{ "colon parameter", NULL, "KICK", NULL, ":a", NULL, NULL },
+		{ "empty parameter", NULL, "KICK", NULL, "", NULL, NULL },
+		{ "CRLF in trailing", NULL, "KICK", NULL, "#c", "a\nb", NULL },
+		{ "param after trailing", NULL, "KICK", NULL, "#c", "x", "y" },
+	};
+
+	for (size_t i = 0; i < COUNTOF(bad); i++) {
+		if (!(mb = irc_msgb_start(ctx)))
+			return "irc_msgb_start failed";
+
+		bool ok = !bad[i].tag || irc_msgb_tag(mb, bad[i].tag, NULL);
+		ok = ok && (!bad[i].cmd || irc_msgb_cmd(mb, bad[i].cmd));
+		ok = ok && (!bad[i].cmd2 || irc_msgb_cmd(mb, bad[i].cmd2));
+		ok = ok && (!bad[i].param || irc_msgb_param(mb, bad[i].param));
+		ok = ok && (!bad[i].trail || irc_msgb_trail(mb, bad[i].trail));
+		ok = ok && (!bad[i].late || irc_msgb_param(mb, bad[i].late));
+		if (irc_msgb_send(mb)) {
+			fprintf(stderr, "accepted: %s\n", bad[i].what);
+			return "bad message sent";
+		}
+	}
+
+	/* a tag after the command; a parameter before it */
+	if (!(mb = privmsg(ctx)) || irc_msgb_tag(mb, "k", "v")
+	    || irc_msgb_send(mb))
+		return "tag after the command accepted";
+	if (!(mb = irc_msgb_start(ctx)) || irc_msgb_param(mb, "#c")
+	    || irc_msgb_send(mb))
+		return "parameter before the command accepted";
+
+	if (!sent(ctx, "") || !irc_online(ctx))
+		return "rejected messages weren't dropped (quietly)";
+
+	teardown(ctx);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_limits(void)
+{
+	irc *ctx = setup();
+	if (!ctx)
+		return "setup failed";
+
+	/* 15 parameters are fine, 16 are not; a trailing one counts */
+	irc_msgb *mb = irc_msgb_start(ctx);
+	if (!mb || !irc_msgb_cmd(mb, "MODE"))
+		return "irc_msgb_start failed";
+	for (int i = 0; i < 14; i++)
+		if (!irc_msgb_param(mb, "p"))
+			return "parameter rejected below the limit";
+	if (!irc_msgb_trail(mb, "t") || !irc_msgb_send(mb))
+		return "15th (trailing) parameter rejected";
+
+	mb = irc_msgb_start(ctx);
+	if (!mb || !irc_msgb_cmd(mb, "MODE"))
+		return "irc_msgb_start failed";
+	for (int i = 0; i < 15; i++)
+		if (!irc_msgb_param(mb, "p"))
+			return "parameter rejected below the limit";
+	if (irc_msgb_param(mb, "p") || irc_msgb_send(mb))
+		return "16th parameter accepted";
+
+	if (!sent(ctx, "MODE p p p p p p p p p p p p p p :t\r\n"))
+		return "parameter limit not enforced (correctly)";
+
+	/* "PRIVMSG #c :" plus text plus CRLF must be within 512 bytes */
+	static char text[4200];
+	memset(text, 'x', sizeof text - 1);
+	if (!(mb = privmsg(ctx)) || !irc_msgb_trailn(mb, text, 498)
+	    || !irc_msgb_send(mb))
+		return "512 byte message rejected";
+	if (!(mb = privmsg(ctx)) || irc_msgb_trailn(mb, text, 499)
+	    || irc_msgb_send(mb))
+		return "513 byte message accepted";
+
+	/* the same goes for middle parameters */
+	text[500] = '\0';
+	if (!(mb = privmsg(ctx)) || irc_msgb_param(mb, text)
+	    || irc_msgb_send(mb))
+		return "overlong parameter accepted";
+	text[500] = 'x';
+
+	/* tags come on top of that, up to 4094 bytes with the '@' and the
+	 * space after them */
+	static char exp[4200 + 2 * 520];
+	text[4090] = '\0';
+	if (!(mb = irc_msgb_start(ctx)) || !irc_msgb_tag(mb, "k", text)
+	    || !irc_msgb_cmd(mb, "PRIVMSG") || !irc_msgb_param(mb, "#c")
+	    || !irc_msgb_trailn(mb, text, 498) || !irc_msgb_send(mb))
+		return "4094 bytes of tags rejected";
+
+	text[4090] = 'x';
+	text[4091] = '\0';
+	if (!(mb = irc_msgb_start(ctx)) || irc_msgb_tag(mb, "k", text)
+	    || irc_msgb_send(mb))
+		return "4095 bytes of tags accepted";
+
+	snprintf(exp, sizeof exp, "PRIVMSG #c :%.498s\r\n@k=%.4090s "
+	    "PRIVMSG #c :%.498s\r\n", text, text, text);
+	if (!sent(ctx, exp))
+		return "length limits not enforced (correctly)";
+
+	teardown(ctx);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_rollback(void)
+{
+	irc *ctx = setup();
+	if (!ctx)
+		return "setup failed";
+
+	/* with output held back, a dropped message must leave what's
+	 * already in the send buffer as it was */
+	lsi_conn_cork(ctx->con);
+	irc_msgb *mb = privmsg(ctx);
+	if (!mb || !irc_msgb_trail(mb, "one") || !irc_msgb_send(mb))
+		return "failed to build a message";
+
+	size_t pend = lsi_conn_pending(ctx->con);
+	if (pend != strlen("PRIVMSG #c :one\r\n"))
+		return "message not in the send buffer";
+
+	if (!(mb = irc_msgb_start(ctx)) || !irc_msgb_tag(mb, "k", "v")
+	    || !irc_msgb_cmd(mb, "PRIVMSG") || !irc_msgb_param(mb, "#c")
+	    || irc_msgb_param(mb, "no good") || irc_msgb_send(mb))
+		return "bad message sent";
+	if (lsi_conn_pending(ctx->con) != pend)
+		return "rejected message not rolled back";
+
+	/* the same for an aborted one, and for one that was left unfinished
+	 * when the next one was started */
+	if (!(mb = privmsg(ctx)))
+		return "failed to build a message";
+	irc_msgb_abort(mb);
+	irc_msgb_abort(mb);
+	if (lsi_conn_pending(ctx->con) != pend)
+		return "aborted message not rolled back";
+
+	if (!(mb = privmsg(ctx)) || !irc_msgb_trail(mb, "unfinished"))
+		return "failed to build a message";
+	if (!(mb = privmsg(ctx)) || lsi_conn_pending(ctx->con) != pend + 10
+	    || !irc_msgb_trail(mb, "two") || !irc_msgb_send(mb))
+		return "unfinished message not dropped";
+
+	if (!lsi_conn_uncork(ctx->con))
+		return "lsi_conn_uncork failed";
+	if (!sent(ctx, "PRIVMSG #c :one\r\nPRIVMSG #c :two\r\n"))
+		return "wrong output after rolling back";
+
+	teardown(ctx);
+	return NULL;
+}
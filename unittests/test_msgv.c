@@ -0,0 +1,208 @@
+/* test_msgv.c - lazily tokenized view of a protocol message (irc_msgv.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <sys/socket.h>
+
+#include <libsrsirc/defs.h>
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_msgv.h>
+#include <libsrsirc/util.h>
+
+#include "common.h"
+
+#include "fixture.h"
+
+static bool
+same(const char *a, const char *b)
+{
+	return a == b || (a && b && strcmp(a, b) == 0);
+}
+
+/* tell whether a view of `line' agrees with what lsi_ut_tokenize() makes
+ * of it, whether the arguments are asked for one by one or all at once */
+static bool
+agrees(const char *line)
+{
+	char b1[1024], b2[1024], b3[1024];
+	snprintf(b1, sizeof b1, "%s", line);
+	snprintf(b2, sizeof b2, "%s", line);
+	snprintf(b3, sizeof b3, "%s", line);
+
+	/* lsi_ut_tokenize() doesn't do tags, lsi_io_read() skips them */
+	char *tags = NULL, *msg = b1;
+	if (*msg == '@') {
+		tags = msg + 1;
+		if ((msg = strchr(msg, ' ')))
+			*msg++ = '\0';
+	}
+
+	tokarr tok;
+	irc_msgv mv, mv2;
+	bool ok = msg && *msg && lsi_ut_tokenize(msg, &tok);
+	if (irc_msgv_parse(&mv, b2) != ok || irc_msgv_parse(&mv2, b3) != ok)
+		return false;
+
+	if (!ok)
+		return true; /* both said no */
+
+	if (!same(irc_msgv_tags(&mv), tags)
+	    || !same(irc_msgv_prefix(&mv), tok[0])
+	    || !same(irc_msgv_cmd(&mv), tok[1]))
+		return false;
+
+	size_t nargs = 0;
+	while (nargs < COUNTOF(tok) - 2 && tok[2 + nargs])
+		nargs++;
+
+	/* one by one, and then again (when they're all split already) */
+	for (size_t i = 0; i < COUNTOF(tok) - 2; i++)
+		if (!same(irc_msgv_arg(&mv, i), tok[2 + i]))
+			return false;
+
+	for (size_t i = 0; i < COUNTOF(tok) - 2; i++)
+		if (!same(irc_msgv_arg(&mv, i), tok[2 + i]))
+			return false;
+
+	if (irc_msgv_nargs(&mv) != nargs)
+		return false;
+
+	/* all at once */
+	tokarr *t = irc_msgv_tokarr(&mv2);
+	for (size_t i = 0; i < COUNTOF(tok); i++)
+		if (!same((*t)[i], tok[i]))
+			return false;
+
+	return irc_msgv_nargs(&mv2) == nargs && !irc_msgv_arg(&mv2, nargs);
+}
+
+const char * /*UNITTEST*/
+test_tokenize(void)
+{
+	static const char *lines[] = {
+		/* with and without a prefix, and a trailing argument */
+		":nick!user@host PRIVMSG #chan :hello there",
+		"PRIVMSG #chan :hello there",
+		":srv 005 me CHANTYPES=# PREFIX=(ov)@+ :are supported",
+		":srv MODE #chan +o nick",
+		"MODE #chan +o nick",
+		"PING",
+		":srv PING",
+		/* an empty trailing argument; a colon within one */
+		":srv 332 me #chan :",
+		"TOPIC #chan :a :b: c",
+		/* extra spaces between and after arguments */
+		":a!b@c  PRIVMSG   #chan  :x  y ",
+		"NICK x  ",
+		/* more arguments than fit; the last one takes the rest */
+		"CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15",
+		"CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16",
+		"CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 17 :18 19",
+		":p CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 :16 17",
+		":p CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 :17 18",
+		/* tags, followed by a command (with or without prefix) */
+		"@time=2024-01-01T00:00:00.000Z;+x=y :a!b@c JOIN #chan",
+		"@k PING :srv",
+		"@a=b;c=d CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 :17",
+		/* no good */
+		":prefixonly",
+		":prefix ",
+		" PRIVMSG #chan :leading space",
+		"@tagsonly",
+		"@tags ",
+		"",
+	};
+
+	for (size_t i = 0; i < COUNTOF(lines); i++) {
+		if (!agrees(lines[i])) {
+			fprintf(stderr, "disagree: '%s'\n", lines[i]);
+			return "view and lsi_ut_tokenize() disagree";
+		}
+	}
+
+	return NULL;
+}
+
+static tokarr s_seen;
+static char s_seenbuf[512];
+
+static bool
+u_privmsg(irc *ctx, tokarr *m, size_t n, bool pre)
+{
+	/* keep what we got, the strings are overwritten by the next read */
+	size_t len = 0;
+	for (size_t i = 0; i < COUNTOF(*m); i++) {
+		s_seen[i] = NULL;
+		if ((*m)[i]) {
+			s_seen[i] = s_seenbuf + len;
+			len += (size_t)snprintf(s_seenbuf + len,
+			    sizeof s_seenbuf - len, "%s", (*m)[i]) + 1;
+		}
+	}
+
+	return true;
+}
+
+/* read `line' (which `peer' sends) with irc_read_msgv(), and tell whether
+ * it was split up front iff `split', and agrees with lsi_ut_tokenize()
+ * either way */
+static bool
+readone(irc *ctx, int peer, const char *line, bool split)
+{
+	char buf[512];
+	snprintf(buf, sizeof buf, "%s\r\n", line);
+	if (send(peer, buf, strlen(buf), 0) != (ssize_t)strlen(buf))
+		return false;
+
+	irc_msgv mv;
+	memset(s_seen, 0, sizeof s_seen);
+	if (irc_read_msgv(ctx, &mv, 1000000) != 1 || mv.done != split)
+		return false;
+
+	snprintf(buf, sizeof buf, "%s", line);
+	tokarr tok;
+	if (!lsi_ut_tokenize(buf, &tok) || !same(irc_msgv_cmd(&mv), tok[1]))
+		return false;
+
+	/* what the handler got (if there was one) is the same, too */
+	for (size_t i = 0; i < COUNTOF(tok); i++)
+		if (split && !same(s_seen[i], tok[i]))
+			return false;
+
+	tokarr *t = irc_msgv_tokarr(&mv);
+	for (size_t i = 0; i < COUNTOF(tok); i++)
+		if (!same((*t)[i], tok[i]))
+			return false;
+
+	return true;
+}
+
+const char * /*UNITTEST*/
+test_read(void)
+{
+	int peer;
+	irc *ctx = fx_online(&peer, false, false);
+	if (!ctx)
+		return "setup failed";
+
+	/* nobody needs anything but the command, so nothing is split */
+	if (!readone(ctx, peer, ":a!b@c PRIVMSG #chan :hi there", false)
+	    || !readone(ctx, peer, "CMD 1 2 3 4 5 6 7 8 9 10 11 12 13 14 15 16 "
+	    "17 :18", false))
+		return "message split without a handler";
+
+	/* with a handler for it, it's split for that; all else isn't */
+	if (!irc_reg_msghnd(ctx, "PRIVMSG", u_privmsg, false))
+		return "irc_reg_msghnd failed";
+
+	if (!readone(ctx, peer, ":a!b@c PRIVMSG #chan :hi there", true)
+	    || !readone(ctx, peer, "PRIVMSG #chan :", true)
+	    || !readone(ctx, peer, ":a!b@c NOTICE #chan :hi there", false))
+		return "message not split for the handler, or split wrong";
+
+	fx_offline(ctx, peer);
+	return NULL;
+}
@@ -0,0 +1,155 @@
+/* test_pool.c - slab pools and the small-object arena (pool.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include "pool.h"
+
+#define NOBJ 1000
+
+static bool
+stat_is(pool *p, size_t nchunks, size_t nlive, size_t nfree)
+{
+	size_t c, l, f, b;
+	lsi_pool_stat(p, &c, &l, &f, &b);
+	return c == nchunks && l == nlive && f == nfree;
+}
+
+const char * /*UNITTEST*/
+test_pool(void)
+{
+	static unsigned char *obj[NOBJ];
+	pool *p = lsi_pool_init(20, 100);
+	if (!p)
+		return "pool alloc failed";
+
+	if (!stat_is(p, 0, 0, 0))
+		return "new pool not empty";
+
+	for (size_t i = 0; i < NOBJ; i++) {
+		if (!(obj[i] = lsi_pool_get(p)))
+			return "lsi_pool_get failed";
+		if ((uintptr_t)obj[i] % sizeof (void *))
+			return "object misaligned";
+		memset(obj[i], (int)(i & 0xff), 20);
+	}
+
+	if (!stat_is(p, NOBJ / 100, NOBJ, 0))
+		return "wrong stats after filling";
+
+	for (size_t i = 0; i < NOBJ; i++)
+		for (size_t j = 0; j < 20; j++)
+			if (obj[i][j] != (i & 0xff))
+				return "objects overlap";
+
+	/* handed back objects are reused, most recently handed back first,
+	 * before any new chunk is allocated */
+	for (size_t i = 0; i < NOBJ; i += 2)
+		lsi_pool_put(p, obj[i]);
+	lsi_pool_put(p, NULL);
+
+	if (!stat_is(p, NOBJ / 100, NOBJ / 2, NOBJ / 2))
+		return "wrong stats after handing back half";
+
+	for (size_t i = NOBJ; i > 0; i -= 2)
+		if (lsi_pool_get(p) != obj[i - 2])
+			return "handed back object not reused";
+
+	if (!stat_is(p, NOBJ / 100, NOBJ, 0))
+		return "wrong stats after reusing";
+
+	if (!lsi_pool_get(p) || !stat_is(p, NOBJ / 100 + 1, NOBJ + 1, 0))
+		return "no new chunk when full";
+
+	lsi_pool_clear(p);
+	if (!stat_is(p, 0, 0, 0))
+		return "pool not empty after clearing";
+
+	if (!lsi_pool_get(p) || !stat_is(p, 1, 1, 0))
+		return "pool unusable after clearing";
+
+	lsi_pool_dispose(p);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_arena(void)
+{
+	enum { N = 3000 };
+	static unsigned char *ptr[N];
+	static size_t sz[N];
+	arena *a = lsi_arena_init();
+	if (!a)
+		return "arena alloc failed";
+
+	/* a bit of everything, small and large, freed and allocated again
+	 * in a jumbled order; nothing may get clobbered */
+	uint32_t rnd = 4711;
+	for (size_t round = 0; round < 4; round++) {
+		for (size_t i = 0; i < N; i++) {
+			if (ptr[i])
+				continue;
+			rnd = rnd * 1103515245 + 12345;
+			sz[i] = (rnd >> 16) % (round % 2 ? 300 : 140) + 1;
+			if (!(ptr[i] = lsi_arena_alloc(a, sz[i])))
+				return "lsi_arena_alloc failed";
+			if ((uintptr_t)ptr[i] % sizeof (void *))
+				return "allocation misaligned";
+			memset(ptr[i], (int)(i & 0xff), sz[i]);
+		}
+
+		for (size_t i = 0; i < N; i++) {
+			for (size_t j = 0; j < sz[i]; j++)
+				if (ptr[i][j] != (i & 0xff))
+					return "allocations overlap";
+			if ((i * 7 + round) % 3 == 0) {
+				lsi_arena_free(a, ptr[i]);
+				ptr[i] = NULL;
+			}
+		}
+	}
+
+	lsi_arena_clear(a);
+	memset(ptr, 0, sizeof ptr);
+
+	/* a freed block goes back to the size class it came from (and is
+	 * the next one handed out from it), whatever its contents are now */
+	char *s = lsi_arena_strdup(a, "a string that takes a 64 byte block");
+	char *t = lsi_arena_strdup(a, "another one of those, to be sure");
+	if (!s || !t || strcmp(s, "a string that takes a 64 byte block") != 0)
+		return "lsi_arena_strdup failed";
+
+	s[3] = '\0'; // 4 bytes, which would be the smallest class
+	lsi_arena_strfree(a, s);
+	void *x = lsi_arena_alloc(a, 4), *y = lsi_arena_alloc(a, 64);
+	if (x == s || y != s)
+		return "freed block went to the wrong size class";
+
+	for (size_t cls = 16; cls <= 128; cls *= 2) {
+		void *p = lsi_arena_alloc(a, cls);
+		lsi_arena_free(a, p);
+		if (!p || lsi_arena_alloc(a, cls / 2 + 1) != p)
+			return "block not reused within its size class";
+	}
+
+	/* large blocks, freed in the middle, at either end, and in bulk */
+	for (size_t i = 0; i < 5; i++)
+		if (!(ptr[i] = lsi_arena_alloc(a, 129 + i * 1000)))
+			return "lsi_arena_alloc failed for a large block";
+	lsi_arena_free(a, ptr[2]);
+	lsi_arena_free(a, ptr[4]);
+	lsi_arena_free(a, ptr[0]);
+	lsi_arena_strfree(a, NULL);
+	lsi_arena_free(a, NULL);
+
+	lsi_arena_clear(a);
+	if (!(s = lsi_arena_strdup(a, "still usable"))
+	    || strcmp(s, "still usable") != 0)
+		return "arena unusable after clearing";
+
+	lsi_arena_dispose(a);
+	return NULL;
+}
@@ -0,0 +1,324 @@
+/* test_sendq.c - flood-controlled send queue (sendq.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <libsrsirc/defs.h>
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+
+#include "sendq.h"
+
+/* the queue's idea of the current time; we move it by hand */
+static uint64_t s_now;
+
+static uint64_t
+fake_now(void)
+{
+	return s_now;
+}
+
+static sendq *
+mksq(void)
+{
+	sendq *sq = lsi_sq_init();
+	if (sq)
+		lsi_sq_set_clock(sq, fake_now);
+	s_now = 1000000;
+	return sq;
+}
+
+/* pop the next line if it's due, and tell whether it's `exp' */
+static bool
+popis(sendq *sq, const char *exp)
+{
+	size_t len;
+	const char *line = lsi_sq_peek(sq, &len);
+	if (!line || len != strlen(exp) || strcmp(line, exp) != 0)
+		return false;
+
+	lsi_sq_pop(sq);
+	return true;
+}
+
+/* line number `n', `len' bytes long, in a way that a mixup shows */
+static void
+mkline(char *dest, size_t n, size_t len)
+{
+	int l = snprintf(dest, len + 1, "PRIVMSG #c :%zu ", n);
+	for (size_t i = l < 0 ? 0 : (size_t)l; i < len; i++)
+		dest[i] = 'a' + (n + i) % 26;
+	dest[len] = '\0';
+	return;
+}
+
+const char * /*UNITTEST*/
+test_lanes(void)
+{
+	sendq *sq = mksq();
+	if (!sq)
+		return "lsi_sq_init failed";
+
+	lsi_sq_config(sq, 1, 0, 1000000);
+	if (!lsi_sq_add(sq, "PRIVMSG #a :bulk1", SENDQ_AUTO)
+	    || !lsi_sq_add(sq, "MODE #a +o x\r\n", SENDQ_AUTO)
+	    || !lsi_sq_add(sq, "PRIVMSG #a :bulk2", SENDQ_BULK)
+	    || !lsi_sq_add(sq, ":me PING :x", SENDQ_AUTO)
+	    || !lsi_sq_add(sq, "JOIN #b", SENDQ_NORMAL)
+	    || !lsi_sq_add(sq, "WHO #a", SENDQ_HIGH))
+		return "lsi_sq_add failed";
+
+	if (lsi_sq_count(sq) != 6 || lsi_sq_bytes(sq) != 17+12+17+11+7+6)
+		return "wrong line or byte count";
+
+	if (!popis(sq, ":me PING :x") || !popis(sq, "WHO #a")
+	    || !popis(sq, "MODE #a +o x") || !popis(sq, "JOIN #b")
+	    || !popis(sq, "PRIVMSG #a :bulk1")
+	    || !popis(sq, "PRIVMSG #a :bulk2"))
+		return "lines not taken by lane priority, in order";
+
+	if (lsi_sq_peek(sq, NULL) || lsi_sq_next(sq) != 0 || lsi_sq_count(sq))
+		return "queue not empty after popping everything";
+
+	if (lsi_sq_classify("@a=b :x!y@z NOTICE #c :hi") != SENDQ_BULK
+	    || lsi_sq_classify("pong :x") != SENDQ_HIGH
+	    || lsi_sq_classify("PINGX") != SENDQ_NORMAL)
+		return "lsi_sq_classify got it wrong";
+
+	lsi_sq_dispose(sq);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_pacing(void)
+{
+	sendq *sq = mksq();
+	if (!sq)
+		return "lsi_sq_init failed";
+
+	/* 1ms a line, 2ms burst: three go out at once (the clock may be up
+	 * to 2ms ahead before each), then one per ms */
+	lsi_sq_config(sq, 1000, 0, 2000);
+	for (int i = 0; i < 8; i++)
+		if (!lsi_sq_add(sq, "NICK x", SENDQ_NORMAL))
+			return "lsi_sq_add failed";
+
+	for (int i = 0; i < 3; i++) {
+		if (lsi_sq_next(sq) != 1 || !popis(sq, "NICK x"))
+			return "burst not granted";
+	}
+
+	if (lsi_sq_peek(sq, NULL))
+		return "line let out beyond the burst";
+	if (lsi_sq_next(sq) != 1000)
+		return "wrong wait time after the burst";
+
+	s_now += 999;
+	if (lsi_sq_peek(sq, NULL) || lsi_sq_next(sq) != 1)
+		return "line let out too early";
+	s_now += 1;
+	if (!popis(sq, "NICK x") || lsi_sq_peek(sq, NULL))
+		return "not exactly one line let out after 1ms";
+
+	/* being idle doesn't save up more than the burst */
+	s_now += 60000000;
+	if (!popis(sq, "NICK x") || !popis(sq, "NICK x")
+	    || !popis(sq, "NICK x"))
+		return "lines held back after idling";
+	if (lsi_sq_peek(sq, NULL))
+		return "idling saved up more than the burst";
+	lsi_sq_clear(sq);
+	lsi_sq_reset(sq);
+
+	/* per-byte cost, CRLF included: 10 + 2 bytes at 100us */
+	lsi_sq_config(sq, 0, 100, 0);
+	if (!lsi_sq_add(sq, "0123456789", SENDQ_NORMAL)
+	    || !lsi_sq_add(sq, "0123456789", SENDQ_NORMAL))
+		return "lsi_sq_add failed";
+	if (!popis(sq, "0123456789") || lsi_sq_next(sq) != 1200)
+		return "byte cost not charged";
+
+	/* a fresh connection gets a fresh clock */
+	lsi_sq_reset(sq);
+	if (!popis(sq, "0123456789"))
+		return "lsi_sq_reset didn't rewind the clock";
+
+	lsi_sq_dispose(sq);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_ring_wrap(void)
+{
+	sendq *sq = mksq();
+	if (!sq)
+		return "lsi_sq_init failed";
+
+	/* a few hundred bytes queued at a time, a few MB through the ring
+	 * all in all; it keeps wrapping around but need not grow */
+	lsi_sq_config(sq, 0, 0, 0);
+	char line[512], exp[512];
+	size_t in = 0, out = 0;
+	for (size_t i = 0; i < 20000; i++) {
+		mkline(line, in, 13 + in * 7 % 450);
+		if (!lsi_sq_add(sq, line, SENDQ_NORMAL))
+			return "lsi_sq_add failed";
+		in++;
+
+		while (lsi_sq_count(sq) > (i % 5)) {
+			mkline(exp, out, 13 + out * 7 % 450);
+			if (!popis(sq, exp))
+				return "line mangled or out of order";
+			out++;
+		}
+	}
+
+	while (out < in) {
+		mkline(exp, out, 13 + out * 7 % 450);
+		if (!popis(sq, exp))
+			return "line mangled or out of order (draining)";
+		out++;
+	}
+
+	if (lsi_sq_count(sq) || lsi_sq_bytes(sq))
+		return "counts not back to zero";
+
+	lsi_sq_dispose(sq);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_ring_grow_wrapped(void)
+{
+	sendq *sq = mksq();
+	if (!sq)
+		return "lsi_sq_init failed";
+
+	/* 400 byte lines take 416 bytes in the 4096 byte ring.  six of them,
+	 * four popped, four more: the last of those goes to the beginning,
+	 * behind a WRAPMARK.  then more than fit are added, so the ring grows
+	 * while it is wrapped */
+	lsi_sq_config(sq, 0, 0, 0);
+	char line[512];
+	size_t in = 0, out = 0;
+	for (; in < 6; in++) {
+		mkline(line, in, 400);
+		if (!lsi_sq_add(sq, line, SENDQ_NORMAL))
+			return "lsi_sq_add failed";
+	}
+
+	for (; out < 4; out++) {
+		mkline(line, out, 400);
+		if (!popis(sq, line))
+			return "line mangled or out of order";
+	}
+
+	for (; in < 40; in++) {
+		mkline(line, in, 400);
+		if (!lsi_sq_add(sq, line, SENDQ_NORMAL))
+			return "lsi_sq_add failed";
+	}
+
+	for (; out < in; out++) {
+		mkline(line, out, 400);
+		if (!popis(sq, line))
+			return "line mangled or out of order after growing";
+	}
+
+	if (lsi_sq_peek(sq, NULL))
+		return "queue not empty";
+
+	lsi_sq_dispose(sq);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_limits(void)
+{
+	sendq *sq = mksq();
+	if (!sq)
+		return "lsi_sq_init failed";
+
+	lsi_sq_config(sq, 0, 0, 0);
+
+	/* the defaults */
+	size_t n = 0;
+	while (lsi_sq_add(sq, "x", SENDQ_BULK))
+		n++;
+	if (n != DEF_SQ_MAXLINES)
+		return "default line limit not enforced";
+
+	lsi_sq_clear(sq);
+	char line[1001];
+	memset(line, 'x', sizeof line - 1);
+	line[sizeof line - 1] = '\0';
+	n = 0;
+	while (lsi_sq_add(sq, line, n % 3))
+		n++;
+	if (n != DEF_SQ_MAXBYTES / 1000 || lsi_sq_bytes(sq) != n * 1000)
+		return "default byte limit not enforced";
+
+	/* set ones; popping makes room again */
+	lsi_sq_clear(sq);
+	lsi_sq_limit(sq, 3, 0);
+	if (!lsi_sq_add(sq, "a", SENDQ_NORMAL)
+	    || !lsi_sq_add(sq, "b", SENDQ_HIGH)
+	    || !lsi_sq_add(sq, "c", SENDQ_BULK))
+		return "lsi_sq_add failed below the limit";
+	if (!lsi_sq_full(sq, 1) || lsi_sq_add(sq, "d", SENDQ_HIGH))
+		return "line limit not enforced";
+	if (!popis(sq, "b") || lsi_sq_full(sq, 1)
+	    || !lsi_sq_add(sq, "d", SENDQ_HIGH))
+		return "no room after popping";
+
+	lsi_sq_clear(sq);
+	lsi_sq_limit(sq, 0, 100);
+	memset(line, 'y', 40);
+	line[40] = '\0';
+	if (!lsi_sq_add(sq, line, SENDQ_NORMAL)
+	    || !lsi_sq_add(sq, line, SENDQ_NORMAL))
+		return "lsi_sq_add failed below the limit";
+	if (lsi_sq_full(sq, 20) || !lsi_sq_full(sq, 21)
+	    || lsi_sq_add(sq, line, SENDQ_NORMAL))
+		return "byte limit not enforced";
+
+	lsi_sq_dispose(sq);
+
+	/* and as seen from the outside; irc_sendq_full() leaves room for
+	 * a line of up to 1024 bytes.  we're not connected, so whatever we
+	 * queue stays there */
+	irc *ctx = irc_init();
+	if (!ctx)
+		return "irc_init failed";
+
+	irc_set_sendq_limits(ctx, 2, 2000);
+	if (irc_sendq_full(ctx) || !irc_sendq(ctx, "NICK a", SENDQ_AUTO))
+		return "irc_sendq failed on an empty queue";
+	if (irc_sendq_full(ctx) || !irc_sendq(ctx, "NICK b", SENDQ_AUTO))
+		return "irc_sendq failed below the limit";
+	if (!irc_sendq_full(ctx) || irc_sendq(ctx, "NICK c", SENDQ_AUTO))
+		return "irc_sendq_full/irc_sendq ignore the line limit";
+
+	irc_sendq_clear(ctx);
+	memset(line, 'z', 990);
+	line[990] = '\0';
+	if (!irc_sendq(ctx, line, SENDQ_AUTO) || !irc_sendq_full(ctx))
+		return "irc_sendq_full ignores the byte limit";
+
+	/* irc_sendq_printf() takes lines of up to 1023 bytes, and doesn't
+	 * queue what it would have to cut */
+	irc_sendq_clear(ctx);
+	irc_set_sendq_limits(ctx, 0, 0);
+	memset(line, 'z', 1000);
+	line[1000] = '\0';
+	if (!irc_sendq_printf(ctx, SENDQ_AUTO, "NICK %s%.18s", line, line)
+	    || irc_sendq_printf(ctx, SENDQ_AUTO, "NICK %s%.19s", line, line)
+	    || irc_sendq_len(ctx) != 1 || irc_sendq_bytes(ctx) != 1023)
+		return "irc_sendq_printf queued a cut line";
+
+	irc_dispose(ctx);
+	return NULL;
+}
@@ -0,0 +1,328 @@
+/* test_skmap.c - hashmap with string keys (skmap.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <libsrsirc/defs.h>
+
+#include "skmap.h"
+
+#define NKEYS 5000
+
+/* the values we store; which one a key maps to is its index */
+static int s_vals[NKEYS];
+
+static const char *
+key(size_t i)
+{
+	static char buf[32];
+	snprintf(buf, sizeof buf, "key%zu", i);
+	return buf;
+}
+
+/* every key below `n' for which `has' says so must map to its value,
+ * every other one must be absent; and there must be no dead slots */
+static bool
+check(skmap *m, size_t n, bool (*has)(size_t i))
+{
+	size_t cnt = 0;
+	for (size_t i = 0; i < n; i++) {
+		void *v = lsi_skmap_get(m, key(i));
+		if (has(i) ? v != &s_vals[i] : v != NULL)
+			return false;
+		cnt += has(i);
+	}
+
+	size_t nslots, nused, nitems, maxprobe;
+	double loadfac, avgprobe;
+	lsi_skmap_stat(m, &nslots, &nused, &nitems, &loadfac, &avgprobe,
+	    &maxprobe);
+	return lsi_skmap_count(m) == cnt && nused == cnt && nitems == cnt;
+}
+
+static bool all(size_t i) { return true; }
+static bool odd(size_t i) { return i % 2; }
+static bool none(size_t i) { return false; }
+
+const char * /*UNITTEST*/
+test_basic(void)
+{
+	skmap *m = lsi_skmap_init(0, CMAP_RFC1459);
+	if (!m)
+		return "skmap alloc failed";
+
+	if (lsi_skmap_count(m) || lsi_skmap_get(m, "foo")
+	    || lsi_skmap_del(m, "foo") || lsi_skmap_first(m, NULL, NULL))
+		return "newly allocated map not empty";
+
+	if (!lsi_skmap_put(m, "foo", &s_vals[0])
+	    || !lsi_skmap_put(m, "bar", &s_vals[1]))
+		return "put failed";
+
+	if (lsi_skmap_get(m, "FOO") != &s_vals[0]
+	    || lsi_skmap_get(m, "bar") != &s_vals[1]
+	    || lsi_skmap_get(m, "baz") || lsi_skmap_count(m) != 2)
+		return "get after put failed";
+
+	if (lsi_skmap_put(m, "baz", NULL) || lsi_skmap_count(m) != 2)
+		return "NULL value was accepted";
+
+	/* same key (casemapped), new value; the count stays */
+	if (!lsi_skmap_put(m, "Foo", &s_vals[2]) || lsi_skmap_count(m) != 2
+	    || lsi_skmap_get(m, "foo") != &s_vals[2])
+		return "overwrite failed";
+
+	if (lsi_skmap_del(m, "fOO") != &s_vals[2] || lsi_skmap_get(m, "foo")
+	    || lsi_skmap_del(m, "foo") || lsi_skmap_count(m) != 1)
+		return "del failed";
+
+	lsi_skmap_clear(m);
+	if (lsi_skmap_count(m) || lsi_skmap_get(m, "bar"))
+		return "map not empty after clear";
+
+	if (!lsi_skmap_put(m, "bar", &s_vals[3])
+	    || lsi_skmap_get(m, "bar") != &s_vals[3])
+		return "put after clear failed";
+
+	lsi_skmap_dispose(m);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_grow(void)
+{
+	skmap *m = lsi_skmap_init(0, CMAP_ASCII);
+	if (!m)
+		return "skmap alloc failed";
+
+	/* the table doubles exactly when the next item would take it
+	 * beyond the maximum load factor of 4/5 */
+	size_t prevslots = 0;
+	for (size_t i = 0; i < NKEYS; i++) {
+		if (!lsi_skmap_put(m, key(i), &s_vals[i]))
+			return "put failed";
+
+		size_t nslots, nused, nitems, maxprobe;
+		double loadfac, avgprobe;
+		lsi_skmap_stat(m, &nslots, &nused, &nitems, &loadfac,
+		    &avgprobe, &maxprobe);
+		if (nitems != i + 1 || nslots & (nslots - 1))
+			return "bad count or table size";
+		if (nitems * 5 > nslots * 4)
+			return "load factor exceeded";
+		if (nslots != prevslots && prevslots && (nslots != 2 * prevslots
+		    || (i + 1) * 5 <= prevslots * 4))
+			return "grew too early, or by too much";
+		prevslots = nslots;
+	}
+
+	if (!check(m, NKEYS, all))
+		return "items lost while growing";
+
+	/* with the right initial size, there's no growing at all */
+	skmap *m2 = lsi_skmap_init(NKEYS, CMAP_ASCII);
+	if (!m2 || !lsi_skmap_put(m2, key(0), &s_vals[0]))
+		return "skmap alloc failed";
+
+	size_t nslots, nused, nitems, maxprobe, nslots2;
+	double loadfac, avgprobe;
+	lsi_skmap_stat(m2, &nslots, &nused, &nitems, &loadfac, &avgprobe,
+	    &maxprobe);
+	for (size_t i = 1; i < NKEYS; i++)
+		if (!lsi_skmap_put(m2, key(i), &s_vals[i]))
+			return "put failed";
+	lsi_skmap_stat(m2, &nslots2, &nused, &nitems, &loadfac, &avgprobe,
+	    &maxprobe);
+	if (nslots != nslots2 || !check(m2, NKEYS, all))
+		return "presized map grew, or lost items";
+
+	lsi_skmap_dispose(m);
+	lsi_skmap_dispose(m2);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_del(void)
+{
+	/* near the maximum load, so that there's plenty of probe sequences
+	 * for deleting to shift back */
+	skmap *m = lsi_skmap_init(NKEYS, CMAP_ASCII);
+	if (!m)
+		return "skmap alloc failed";
+
+	for (size_t i = 0; i < NKEYS; i++)
+		if (!lsi_skmap_put(m, key(i), &s_vals[i]))
+			return "put failed";
+
+	for (size_t i = 0; i < NKEYS; i += 2)
+		if (lsi_skmap_del(m, key(i)) != &s_vals[i])
+			return "del failed";
+
+	if (!check(m, NKEYS, odd))
+		return "wrong items left after deleting every other one";
+
+	/* the freed slots are usable again */
+	for (size_t i = 0; i < NKEYS; i += 2)
+		if (!lsi_skmap_put(m, key(i), &s_vals[i]))
+			return "put failed";
+
+	if (!check(m, NKEYS, all))
+		return "wrong items after putting them back";
+
+	for (size_t i = NKEYS; i-- > 0;)
+		if (lsi_skmap_del(m, key(i)) != &s_vals[i])
+			return "del failed";
+
+	if (!check(m, NKEYS, none))
+		return "items left after deleting all of them";
+
+	lsi_skmap_dispose(m);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_del_iter(void)
+{
+	static unsigned seen[NKEYS];
+	skmap *m = lsi_skmap_init(0, CMAP_ASCII);
+	if (!m)
+		return "skmap alloc failed";
+
+	for (size_t i = 0; i < NKEYS; i++)
+		if (!lsi_skmap_put(m, key(i), &s_vals[i]))
+			return "put failed";
+
+	/* deleting the current item may pull later ones into its slot;
+	 * none of them may be skipped or visited twice */
+	char *k;
+	void *v;
+	if (lsi_skmap_first(m, &k, &v))
+		do {
+			size_t i = (size_t)((int *)v - s_vals);
+			if (strcmp(k, key(i)) != 0)
+				return "key and value don't match";
+			if (seen[i]++)
+				return "item visited twice";
+			if (i % 2 == 0)
+				lsi_skmap_del_iter(m);
+		} while (lsi_skmap_next(m, &k, &v));
+
+	for (size_t i = 0; i < NKEYS; i++)
+		if (seen[i] != 1)
+			return "item not visited";
+
+	if (!check(m, NKEYS, odd))
+		return "wrong items left after deleting while iterating";
+
+	/* deleting everything that way */
+	if (lsi_skmap_first(m, NULL, NULL))
+		do lsi_skmap_del_iter(m); while (lsi_skmap_next(m, NULL, NULL));
+
+	if (!check(m, NKEYS, none))
+		return "items left after deleting all while iterating";
+
+	lsi_skmap_dispose(m);
+	return NULL;
+}
+
+static size_t s_nmerged;
+static void *s_kept[8], *s_dropped[8];
+
+static void
+merge(void *arg, void *kept, void *dropped)
+{
+	if (arg == &s_nmerged && s_nmerged < 8) {
+		s_kept[s_nmerged] = kept;
+		s_dropped[s_nmerged] = dropped;
+	}
+	s_nmerged++;
+	return;
+}
+
+/* whether the values `a' and `b' got merged, whichever way round */
+static bool
+merged(void *a, void *b)
+{
+	for (size_t i = 0; i < s_nmerged && i < 8; i++)
+		if ((s_kept[i] == a && s_dropped[i] == b)
+		    || (s_kept[i] == b && s_dropped[i] == a))
+			return true;
+	return false;
+}
+
+const char * /*UNITTEST*/
+test_rehash(void)
+{
+	skmap *m = lsi_skmap_init(0, CMAP_ASCII);
+	if (!m)
+		return "skmap alloc failed";
+
+	/* distinct under ascii, but not under rfc1459 */
+	if (!lsi_skmap_put(m, "[foo]", &s_vals[0])
+	    || !lsi_skmap_put(m, "{FOO}", &s_vals[1])
+	    || !lsi_skmap_put(m, "a|b", &s_vals[2])
+	    || !lsi_skmap_put(m, "A\\B", &s_vals[3])
+	    || !lsi_skmap_put(m, "x~", &s_vals[4])
+	    || !lsi_skmap_put(m, "plain", &s_vals[5]))
+		return "put failed";
+
+	for (size_t i = 6; i < 100; i++)
+		if (!lsi_skmap_put(m, key(i), &s_vals[i]))
+			return "put failed";
+
+	if (lsi_skmap_count(m) != 100
+	    || lsi_skmap_get(m, "{foo}") != &s_vals[1])
+		return "keys not distinct under ascii";
+
+	s_nmerged = 0;
+	if (!lsi_skmap_rehash(m, CMAP_RFC1459, merge, &s_nmerged))
+		return "rehash failed";
+
+	if (s_nmerged != 2 || !merged(&s_vals[0], &s_vals[1])
+	    || !merged(&s_vals[2], &s_vals[3]) || lsi_skmap_count(m) != 98)
+		return "colliding keys not merged (correctly)";
+
+	void *v = lsi_skmap_get(m, "{foo}");
+	if ((v != &s_vals[0] && v != &s_vals[1])
+	    || lsi_skmap_get(m, "[FOO]") != v)
+		return "merged key not found under either spelling";
+	v = lsi_skmap_get(m, "a\\b");
+	if ((v != &s_vals[2] && v != &s_vals[3])
+	    || lsi_skmap_get(m, "A|B") != v)
+		return "merged key not found under either spelling";
+
+	/* rfc1459 doesn't fold ~ and ^, strict-rfc1459 does, but there's
+	 * no "x^" to merge with */
+	if (lsi_skmap_get(m, "x~") != &s_vals[4] || lsi_skmap_get(m, "x^"))
+		return "unrelated key got mixed up";
+
+	for (size_t i = 6; i < 100; i++)
+		if (lsi_skmap_get(m, key(i)) != &s_vals[i])
+			return "item lost in rehash";
+
+	/* via strict-rfc1459 back to ascii: nothing to merge, and what
+	 * was merged stays merged */
+	s_nmerged = 0;
+	if (!lsi_skmap_rehash(m, CMAP_STRICT_RFC1459, merge, &s_nmerged)
+	    || !lsi_skmap_rehash(m, CMAP_ASCII, merge, &s_nmerged))
+		return "rehash failed";
+
+	if (s_nmerged || lsi_skmap_count(m) != 98
+	    || lsi_skmap_get(m, "x~") != &s_vals[4]
+	    || lsi_skmap_get(m, "plain") != &s_vals[5])
+		return "unexpected merge, or items lost";
+
+	if (lsi_skmap_get(m, "{foo}") && lsi_skmap_get(m, "[foo]"))
+		return "both spellings found under ascii";
+
+	/* without a merge function, the dropped values are just dropped */
+	if (!lsi_skmap_put(m, "[bar]", &s_vals[6])
+	    || !lsi_skmap_put(m, "{bar}", &s_vals[7])
+	    || !lsi_skmap_rehash(m, CMAP_RFC1459, NULL, NULL)
+	    || lsi_skmap_count(m) != 99)
+		return "rehash without merge function failed";
+
+	lsi_skmap_dispose(m);
+	return NULL;
+}
@@ -0,0 +1,286 @@
+/* test_track.c - user and channel tracking (irc_track.c, ucbase.c)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-2024, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <libsrsirc/defs.h>
+#include <libsrsirc/irc.h>
+#include <libsrsirc/util.h>
+
+#include "intdefs.h"
+#include "skmap.h"
+#include "ucbase.h"
+
+#include "fixture.h"
+
+/* the other end of the connection */
+static int s_peer = -1;
+
+/* a context that tracks, as if we had just connected as `me' */
+static irc *
+setup(void)
+{
+	return fx_online(&s_peer, true, true);
+}
+
+static void
+teardown(irc *ctx)
+{
+	fx_offline(ctx, s_peer);
+	s_peer = -1;
+	return;
+}
+
+/* every membership is in its channel's member map under its user's nick
+ * and in its user's list, the other way round, too; and a user's `nchans'
+ * is the length of that list */
+static bool
+consistent(irc *ctx)
+{
+	size_t nmemb = 0;
+	for (chan *c = lsi_ucb_first_chan(ctx); c; c = lsi_ucb_next_chan(ctx)) {
+		for (memb *m = lsi_ucb_first_memb(ctx, c); m;
+		    m = lsi_ucb_next_memb(ctx, c)) {
+			if (m->c != c
+			    || lsi_ucb_get_user(ctx, m->u->nick, false) != m->u)
+				return false;
+
+			memb *o = m->u->memb;
+			while (o && o != m)
+				o = o->unext;
+			if (!o)
+				return false;
+			nmemb++;
+		}
+	}
+
+	size_t nlinked = 0;
+	for (user *u = lsi_ucb_first_user(ctx); u; u = lsi_ucb_next_user(ctx)) {
+		size_t n = 0;
+		for (memb *m = u->memb; m; m = m->unext, n++) {
+			if (m->u != u || (m->unext && m->unext->uprev != m)
+			    || (m == u->memb) != !m->uprev)
+				return false;
+			if (lsi_skmap_get(m->c->memb, u->nick) != m
+			    || lsi_ucb_get_chan(ctx, m->c->name, false) != m->c)
+				return false;
+		}
+
+		/* we only know about people we share a channel with */
+		if (n != u->nchans || !n)
+			return false;
+		nlinked += n;
+	}
+
+	return nmemb == nlinked;
+}
+
+static size_t
+nmemb(irc *ctx, const char *chname)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chname, false);
+	return c ? lsi_ucb_num_memb(ctx, c) : (size_t)-1;
+}
+
+static bool
+ismemb(irc *ctx, const char *chname, const char *nick)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chname, false);
+	return c && lsi_ucb_get_memb(ctx, c, nick, false);
+}
+
+static bool
+streq(const char *s1, const char *s2)
+{
+	return s1 && s2 && strcmp(s1, s2) == 0;
+}
+
+const char * /*UNITTEST*/
+test_casemap(void)
+{
+	irc *ctx = setup();
+	if (!ctx)
+		return "setup failed";
+
+	/* rfc1459, which we assume to begin with: [foo] and {foo} are one
+	 * and the same, as are #[x] and #{x} */
+	if (!fx_feed(ctx, ":me!m@h JOIN #[x]")
+	    || !fx_feed(ctx, ":srv 353 me = #[x] :me [foo] bar")
+	    || !fx_feed(ctx, ":srv 366 me #[x] :End of /NAMES list.")
+	    || !fx_feed(ctx, ":{FOO}!fu@fh PART #{X}")
+	    || !fx_feed(ctx, ":[foo]!fu@fh JOIN #{x}")
+	    || !fx_feed(ctx, ":srv 352 me #[x] fu fh srv {foo} H :0 Foo Bar"))
+		return "dispatch failed";
+
+	if (lsi_ucb_num_chans(ctx) != 1 || lsi_ucb_num_users(ctx) != 3
+	    || nmemb(ctx, "#{x}") != 3 || !ismemb(ctx, "#{X}", "[FOO]")
+	    || !consistent(ctx))
+		return "rfc1459 collisions not treated as the same";
+
+	/* switching to ascii merges nothing, and splits nothing either */
+	if (!fx_feed(ctx, ":srv 005 me CASEMAPPING=ascii :are supported"))
+		return "dispatch failed";
+
+	if (ctx->casemap != CMAP_ASCII || !ctx->tracking_enab
+	    || lsi_ucb_num_chans(ctx) != 1 || lsi_ucb_num_users(ctx) != 3
+	    || nmemb(ctx, "#[X]") != 3 || !consistent(ctx))
+		return "switching to ascii changed what we track";
+
+	/* ...but from now on, those are different.  {foo} joins #[x], and
+	 * we join #{x}, where {foo} is already */
+	if (!fx_feed(ctx, ":{foo}!other@host JOIN #[x]")
+	    || !fx_feed(ctx, ":me!m@h JOIN #{x}")
+	    || !fx_feed(ctx, ":srv 353 me = #{x} :me @{foo} +baz")
+	    || !fx_feed(ctx, ":srv 366 me #{x} :End of /NAMES list."))
+		return "dispatch failed";
+
+	user *uf = lsi_ucb_get_user(ctx, "[foo]", false);
+	user *uc = lsi_ucb_get_user(ctx, "{foo}", false);
+	if (lsi_ucb_num_chans(ctx) != 2 || lsi_ucb_num_users(ctx) != 5
+	    || !uf || !uc || uf == uc || uf->nchans != 1 || uc->nchans != 2
+	    || nmemb(ctx, "#[x]") != 4 || nmemb(ctx, "#{x}") != 3
+	    || !consistent(ctx))
+		return "wrong state under ascii";
+
+	/* back to rfc1459: [foo] and {foo} are the same user again, and #[x]
+	 * and #{x} the same channel, with everyone who was in either */
+	if (!fx_feed(ctx, ":srv 005 me CASEMAPPING=rfc1459 :are supported"))
+		return "dispatch failed";
+
+	if (ctx->casemap != CMAP_RFC1459 || !ctx->tracking_enab)
+		return "casemap not switched back";
+
+	user *u = lsi_ucb_get_user(ctx, "{FOO}", false);
+	if (lsi_ucb_num_chans(ctx) != 1 || lsi_ucb_num_users(ctx) != 4
+	    || !u || lsi_ucb_get_user(ctx, "[foo]", false) != u
+	    || u->nchans != 1 || nmemb(ctx, "#{x}") != 4
+	    || !ismemb(ctx, "#[x]", "baz") || !ismemb(ctx, "#[x]", "bar")
+	    || !consistent(ctx))
+		return "wrong users, channels or members after merging";
+
+	/* the survivor is one of the two and keeps its details; what it
+	 * didn't know itself, it got from the other */
+	if (u == uf) {
+		if (!streq(u->uname, "fu") || !streq(u->host, "fh")
+		    || !streq(u->fname, "Foo Bar"))
+			return "survivor lost its details";
+	} else if (u == uc) {
+		if (!streq(u->uname, "other") || !streq(u->host, "host")
+		    || !streq(u->fname, "Foo Bar"))
+			return "survivor lost or didn't get details";
+	} else
+		return "survivor is neither of the two";
+
+	/* {foo}'s op status in #{x} survives whichever way it was merged */
+	memb *m = lsi_ucb_get_memb(ctx, lsi_ucb_get_chan(ctx, "#[x]", false),
+	    "[foo]", false);
+	if (!m || m->u != u || !streq(m->modepfx, "@"))
+		return "mode prefix lost when merging memberships";
+
+	/* and tracking goes on as usual */
+	if (!fx_feed(ctx, ":{foo}!fu@fh QUIT :bye")
+	    || lsi_ucb_get_user(ctx, "[foo]", false) || nmemb(ctx, "#[x]") != 3
+	    || lsi_ucb_num_users(ctx) != 3 || !consistent(ctx))
+		return "merged user not dropped properly";
+
+	teardown(ctx);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_membership(void)
+{
+	irc *ctx = setup();
+	if (!ctx)
+		return "setup failed";
+
+	if (!fx_feed(ctx, ":me!m@h JOIN #a") || !fx_feed(ctx, ":me!m@h JOIN #b")
+	    || !fx_feed(ctx, ":me!m@h JOIN #c")
+	    || !fx_feed(ctx, ":srv 353 me = #a :me alice bob carol")
+	    || !fx_feed(ctx, ":srv 366 me #a :End of /NAMES list.")
+	    || !fx_feed(ctx, ":srv 353 me = #b :me @alice bob")
+	    || !fx_feed(ctx, ":srv 366 me #b :End of /NAMES list.")
+	    || !fx_feed(ctx, ":srv 353 me = #c :@me alice dave")
+	    || !fx_feed(ctx, ":srv 366 me #c :End of /NAMES list."))
+		return "dispatch failed";
+
+	user *alice = lsi_ucb_get_user(ctx, "alice", false);
+	if (lsi_ucb_num_users(ctx) != 5 || !alice || alice->nchans != 3
+	    || !consistent(ctx))
+		return "wrong state after joining";
+
+	/* a nick change moves all their memberships, and only theirs */
+	if (!fx_feed(ctx, ":alice!a@h NICK alicia"))
+		return "dispatch failed";
+
+	if (lsi_ucb_get_user(ctx, "alice", false)
+	    || lsi_ucb_get_user(ctx, "alicia", false) != alice
+	    || alice->nchans != 3 || ismemb(ctx, "#a", "alice")
+	    || !ismemb(ctx, "#a", "alicia") || !ismemb(ctx, "#b", "alicia")
+	    || !ismemb(ctx, "#c", "alicia") || !ismemb(ctx, "#b", "bob")
+	    || !consistent(ctx))
+		return "NICK left memberships behind";
+
+	if (!fx_feed(ctx, ":alicia!a@h NICK ALICIA")
+	    || lsi_ucb_get_user(ctx, "alicia", false) != alice
+	    || !streq(alice->nick, "ALICIA") || !consistent(ctx))
+		return "case-only NICK went wrong";
+
+	/* leaving a channel drops the membership; leaving the last one we
+	 * share drops the user */
+	user *bob = lsi_ucb_get_user(ctx, "bob", false);
+	if (!fx_feed(ctx, ":bob!b@h PART #a :later")
+	    || ismemb(ctx, "#a", "bob") || !ismemb(ctx, "#b", "bob")
+	    || lsi_ucb_get_user(ctx, "bob", false) != bob || bob->nchans != 1
+	    || !consistent(ctx))
+		return "PART went wrong";
+
+	if (!fx_feed(ctx, ":bob!b@h PART #b")
+	    || lsi_ucb_get_user(ctx, "bob", false)
+	    || nmemb(ctx, "#b") != 2 || !consistent(ctx))
+		return "PART from the last channel didn't drop the user";
+
+	/* same for being kicked */
+	if (!fx_feed(ctx, ":me!m@h KICK #b ALICIA :out")
+	    || ismemb(ctx, "#b", "alicia") || alice->nchans != 2
+	    || !consistent(ctx))
+		return "KICK went wrong";
+
+	if (!fx_feed(ctx, ":me!m@h KICK #c dave :out")
+	    || lsi_ucb_get_user(ctx, "dave", false)
+	    || nmemb(ctx, "#c") != 2 || !consistent(ctx))
+		return "KICK from the last channel didn't drop the user";
+
+	/* quitting takes them out of every channel */
+	if (!fx_feed(ctx, ":ALICIA!a@h QUIT :bye")
+	    || lsi_ucb_get_user(ctx, "alicia", false)
+	    || nmemb(ctx, "#a") != 2 || nmemb(ctx, "#b") != 1
+	    || nmemb(ctx, "#c") != 1 || lsi_ucb_num_users(ctx) != 2
+	    || !consistent(ctx))
+		return "QUIT went wrong";
+
+	/* someone new takes over a nick that was in use before */
+	if (!fx_feed(ctx, ":alice!x@y JOIN #c")
+	    || !(alice = lsi_ucb_get_user(ctx, "alice", false))
+	    || alice->nchans != 1 || !streq(alice->uname, "x")
+	    || !consistent(ctx))
+		return "JOIN after QUIT went wrong";
+
+	/* when we leave or get kicked, the channel goes, and whoever we
+	 * don't see elsewhere goes with it */
+	if (!fx_feed(ctx, ":me!m@h PART #c")
+	    || lsi_ucb_get_chan(ctx, "#c", false)
+	    || lsi_ucb_get_user(ctx, "alice", false) || !consistent(ctx))
+		return "our own PART went wrong";
+
+	if (!fx_feed(ctx, ":carol!c@h KICK #a me :bye")
+	    || lsi_ucb_get_chan(ctx, "#a", false)
+	    || lsi_ucb_get_user(ctx, "carol", false)
+	    || lsi_ucb_num_chans(ctx) != 1 || lsi_ucb_num_users(ctx) != 1
+	    || nmemb(ctx, "#b") != 1 || !consistent(ctx))
+		return "our own KICK went wrong";
+
+	teardown(ctx);
+	return NULL;
+}